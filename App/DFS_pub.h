@@ -19,5 +19,8 @@ void DFS_pwrdn
 void DFS_init
     ( void );
 
+BOOLEAN DFS_is_card_present
+    ( void );
+
 
 #endif /* DFS_PUB_H */
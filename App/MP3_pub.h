@@ -9,6 +9,12 @@
 #include "bsp.h"
 
 #define MP3_PLAYBACK_FILE_NAME_LEN_MAX      ( 32 )
+#define MP3_PLAYLIST_CNT_MAX                ( 32 )
+#define MP3_PLAYBACK_SPEED_MAX              ( 3 )
+#define MP3_TRACK_TEXT_LEN_MAX              ( 31 )
+#define MP3_PLUGIN_FILE_NAME                "PATCHES.PLG"       // Decoder plugin loaded from the root of the SD card at power up
+#define MP3_RECORD_RATE_MIN                 ( 8000 )            // Sample rates a recording can be made at
+#define MP3_RECORD_RATE_MAX                 ( 16000 )
 
 typedef INT8U MP3_playback_sts_type; enum
     {
@@ -22,6 +28,88 @@ typedef INT8U MP3_playback_sts_type; enum
     MP3_PLAYBACK_STS_CNT
     };
 
+// Stream buffering chosen for the playing file
+typedef struct
+    {
+    INT16U  bitrate_kbps;           // Bitrate of the stream, 0 until the decoder has found it
+    INT16U  buf_target_ms;          // Playback time the stream buffer is sized to hold
+    INT32U  buf_target_size;        // Bytes the stream buffer is filled up to
+    INT32U  buf_refill_size;        // Refill the stream buffer once it drops below this
+    } MP3_stream_info_type;
+
+// Stream health counters, since the stream was opened
+typedef struct
+    {
+    INT32U  bytes_total;            // Bytes sent to the decoder
+    INT32U  bytes_per_scnd;         // Bytes sent to the decoder over the last second
+    INT32U  chunk_cnt;              // Writes of data to the decoder
+    INT32U  spi_us_avg;             // SPI time per write
+    INT32U  spi_us_max;
+    INT32U  ring_used_min;          // Stream buffer occupancy as blocks are taken off it
+    INT32U  ring_used_avg;
+    INT32U  ring_used_max;
+    INT32U  dreq_wait_cnt;          // Writes that had to wait for the decoder to ask for data
+    INT32U  dreq_wait_us;           // Total time spent waiting
+    INT32U  dreq_wait_us_max;
+    INT32U  refill_cnt;             // Refills of the stream buffer
+    INT32U  refill_us_avg;          // Time from a refill request to the first block written
+    INT32U  refill_us_max;
+    INT32U  underrun_cnt;           // Times the decoder was starved
+    } MP3_stream_stats_type;
+
+// Time to first audio of the last playback start, in microseconds from
+// the touch that asked for it, or from MP3_playback_start() without one.
+// A time is 0 until it has been reached.
+typedef struct
+    {
+    INT16U  start_cnt;              // Playback starts so far, changes with every start
+    BOOLEAN touched;                // The times are from a touch
+    INT32U  start_us;               // MP3_playback_start() called
+    INT32U  open_us;                // File opened
+    INT32U  first_byte_us;          // First byte sent to the decoder
+    INT32U  format_us;              // Decoder found the stream format, the first sound
+    INT32U  decode_us;              // Decode time first read as non-zero
+    } MP3_ttfa_type;
+
+// Metadata of a playlist track, from the metadata cache on the SD card
+typedef struct
+    {
+    char    title[MP3_TRACK_TEXT_LEN_MAX];  // Empty if not known
+    char    artist[MP3_TRACK_TEXT_LEN_MAX];
+    INT32U  duration_ms;                    // 0 if not known
+    BOOLEAN duration_exact;                 // Duration is from the frame count, not an estimate
+    INT16U  bitrate_kbps;                   // Bitrate of the first frame, 0 if not known
+    } MP3_track_info_type;
+
+// Decoder plugin uploads, the times are of the last one. The plugin
+// is uploaded again at every reset of the decoder, which is at every
+// playback start.
+typedef struct
+    {
+    INT32U  load_cnt;               // Uploads so far, changes with every upload
+    INT32U  image_words;            // Length of the compressed image
+    INT32U  writes;                 // Register writes it expanded to
+    INT32U  verified_words;         // Instruction memory words read back
+    INT32U  verify_errors;          // Words that read back wrong
+    INT32U  upload_us;              // Time taken to upload
+    INT32U  verify_us;              // Time taken to read back
+    } MP3_plugin_stats_type;
+
+// Recording counters, of the recording in progress or the last one.
+// The recording is mono, a sample is one 16 bit word.
+typedef struct
+    {
+    BOOLEAN active;                 // Recording in progress
+    BOOLEAN failed;                 // Recording could not start, or a write to the card failed
+    INT32U  samples;                // Samples kept for the file
+    INT32U  samples_max;            // Samples the file has room for
+    INT32U  dropped_samples;        // Samples drained from the decoder while the buffer was full, lost
+    INT32U  dec_full_cnt;           // Drains that found the decoder's buffer full, it may have lost samples
+    INT32U  blks_written;           // Blocks written to the card
+    INT32U  ring_used_max;          // Most full blocks waiting for the card
+    INT32U  card_busy_ms_max;       // Longest the card was seen busy with a block
+    } MP3_record_stats_type;
+
 void MP3_pwrp
     ( void );
 
@@ -36,16 +124,161 @@ BOOLEAN MP3_playback_start
 BOOLEAN MP3_playback_stop
     ( void );
 
+BOOLEAN MP3_playback_stop_wait
+    (
+    INT16U timeout_ms
+    );
+
 BOOLEAN MP3_playback_pause
     ( void );
 
 BOOLEAN MP3_playback_resume
     ( void );
 
+BOOLEAN MP3_playback_seek
+    (
+    INT16U scnds
+    );
+
+BOOLEAN MP3_playback_set_speed
+    (
+    INT8U speed
+    );
+
+INT8U MP3_playback_get_speed
+    ( void );
+
+BOOLEAN MP3_playback_queue_next
+    (
+    const char* ptr_file_name
+    );
+
+BOOLEAN MP3_playback_is_next_queued
+    ( void );
+
+INT16U MP3_playback_get_track_num
+    ( void );
+
 INT16U MP3_playback_get_time_scnds
     ( void );
 
+INT32U MP3_playback_get_time_ms
+    ( void );
+
+INT16U MP3_playback_get_duration_scnds
+    ( void );
+
 MP3_playback_sts_type MP3_playback_get_status
     ( void );
 
+void MP3_playback_get_stream_info
+    (
+    MP3_stream_info_type* ptr_info
+    );
+
+void MP3_get_stream_stats
+    (
+    MP3_stream_stats_type* ptr_stats
+    );
+
+void MP3_ttfa_mark_touch
+    ( void );
+
+void MP3_get_ttfa
+    (
+    MP3_ttfa_type* ptr_ttfa
+    );
+
+void MP3_plugin_set_image
+    (
+    const INT16U*   ptr_image,
+    INT32U          words
+    );
+
+BOOLEAN MP3_plugin_load
+    (
+    const char* ptr_file_name
+    );
+
+void MP3_plugin_get_stats
+    (
+    MP3_plugin_stats_type* ptr_stats
+    );
+
+BOOLEAN MP3_record_start
+    (
+    const char* ptr_file_name,
+    INT16U      rate,
+    INT16U      scnds,
+    BOOLEAN     line_in
+    );
+
+BOOLEAN MP3_record_stop
+    ( void );
+
+BOOLEAN MP3_record_is_active
+    ( void );
+
+void MP3_record_get_stats
+    (
+    MP3_record_stats_type* ptr_stats
+    );
+
+const char* MP3_playback_get_rom_name
+    (
+    INT8U idx
+    );
+
+INT8U MP3_playlist_load
+    ( void );
+
+INT8U MP3_playlist_get_cnt
+    ( void );
+
+const char* MP3_playlist_get_name
+    (
+    INT8U idx
+    );
+
+BOOLEAN MP3_playlist_get_info
+    (
+    INT8U                   idx,
+    MP3_track_info_type*    ptr_track
+    );
+
+INT8S MP3_playlist_get_cur
+    ( void );
+
+BOOLEAN MP3_playlist_play
+    (
+    INT8U idx
+    );
+
+BOOLEAN MP3_playlist_next
+    ( void );
+
+BOOLEAN MP3_playlist_prev
+    ( void );
+
+void MP3_playlist_stop
+    ( void );
+
+void MP3_playlist_set_repeat
+    (
+    BOOLEAN repeat
+    );
+
+void MP3_playlist_set_shuffle
+    (
+    BOOLEAN shuffle
+    );
+
+void MP3_playlist_update
+    ( void );
+
+#ifdef MP3_BENCH
+void MP3_bench_pwrp
+    ( void );
+#endif
+
 #endif
@@ -24,8 +24,9 @@
 
 typedef struct
     {
-    HANDLE h_SD;
-    HANDLE h_SPI;
+    HANDLE  h_SD;
+    HANDLE  h_SPI;
+    BOOLEAN card_present;           // The SD card was found and mounted
     } dfs_ws_type;
 
 
@@ -49,8 +50,9 @@ void DFS_pwrp
     ( void )
 {
 
-wksp_dfs.h_SD   = 0;
-wksp_dfs.h_SPI  = 0;
+wksp_dfs.h_SD           = 0;
+wksp_dfs.h_SPI          = 0;
+wksp_dfs.card_present   = false;
 
 } /* DFS_pwrp() */
 
@@ -61,7 +63,10 @@ wksp_dfs.h_SPI  = 0;
     file system by enabling the SD driver
 
     NOTE: The control will wait in an infinite
-    while(1) loop if this funciton fails.
+    while(1) loop if the SD driver can not be set
+    up. A missing card is not an error, playback
+    then falls back to the MP3 data built into
+    the flash.
 
     @return None
 */
@@ -92,8 +97,20 @@ if( PJDF_IS_ERROR( pjdfErr ) )
     while(1);
     }
 
-if( !SD.begin( wksp_dfs.h_SD  ) )
-    {
-    while(1);
-    }
+wksp_dfs.card_present = SD.begin( wksp_dfs.h_SD  );
+
 } /* DFS_init() */
+
+/**
+    Is the SD card present
+
+    @return Returns TRUE if the SD card was
+            mounted by DFS_init()
+*/
+BOOLEAN DFS_is_card_present
+    ( void )
+{
+
+return wksp_dfs.card_present;
+
+} /* DFS_is_card_present() */
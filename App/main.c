@@ -46,6 +46,9 @@ Return Value:
 void main() {
 INT8U err;
     Hw_init();
+
+    // Start the cycle counter used to time code paths
+    BspCycleCntInit();
     
     RETAILMSG(1, ("MP3 Player Demo: Built %s %s.\r\n\r\n",
         __DATE__,
@@ -0,0 +1,435 @@
+/**
+    @file        mp3_bench.c
+
+    @author      Vimal Mehta
+
+    @description
+        Streaming benchmark, built in place of the touch
+    screen front end when MP3_BENCH is defined. It runs
+    the real MP3 main, prefetch and streaming threads
+    against the behavioural VS1053 model in bspMp3Model.c,
+    so MP3_VS1053_MODEL must be defined as well. The SD
+    card is the file source, as in normal playback.
+
+        Every track is played under every entry of the
+    configuration table, which sweeps the buffering target
+    of the stream ring, the SPI time per byte of the
+    model and the playback speed. A line per run is
+    printed to the UART with the underruns seen by the
+    model and by the stream, the CPU busy time, the time
+    to first audio, the time taken to stop and the stream
+    health counters.
+
+        The tracks are train_crossing.mp3, copied to the card
+    from its ROM source, and synthetic 256 and 320 kbps
+    streams of silent frames. They are created on the card
+    the first time the benchmark runs. The train crossing
+    is also played straight from the ROM source, which
+    takes the SD card out of the measurement.
+
+        This is not the host benchmark that was asked for.
+    It runs on the board only, as the project has no host
+    build, and the burst size and the task priorities are
+    compile time constants that it does not sweep.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "SD.h"
+#include "TSK_pub.h"
+#include "MP3_pub.h"
+#include "mp3_prv.h"
+
+#ifdef MP3_BENCH
+
+#ifndef MP3_VS1053_MODEL
+    #error MP3_BENCH needs MP3_VS1053_MODEL
+#endif
+
+/**
+    Literal Constants
+*/
+#define BENCH_RUN_MS_MAX            ( 15000 )               // Longest time a track is played for
+#define BENCH_POLL_MS               ( 100 )                 // Playback status and CPU usage polling
+#define BENCH_START_MS_MAX          ( 2000 )                // Time allowed for playback to start or stop
+#define BENCH_SYNTH_SCNDS           ( 20 )                  // Length of the synthetic streams
+#define BENCH_SYNTH_RATE            ( 44100 )               // Sample rate of the synthetic streams
+#define BENCH_WRITE_SIZE            ( 512 )                 // Bytes written to the card at a time
+#define BENCH_PRINT_BUF_SIZE        ( 192 )
+
+/**
+    Types
+*/
+
+// Buffer configuration of a run
+typedef struct
+    {
+    INT16U      target_ms;                  // Buffering target of the stream ring
+    INT32U      spi_ns_per_byte;            // SPI time per byte of the model
+    INT8U       speed;                      // Playback speed, a multiple of normal
+    } bench_cfg_type;
+
+// Track played by the benchmark
+typedef struct
+    {
+    const char* ptr_fname;
+    const char* ptr_copy_fname;             // Source the track is copied from, NULL if none
+    INT16U      synth_kbps;                 // Bitrate of a synthetic stream, 0 if none
+    } bench_trk_type;
+
+/**
+    Static Variables
+*/
+static OS_STK                   bench_stack[APP_CFG_TASK_EQ_STK_SIZE];
+static char                     bench_print_buf[BENCH_PRINT_BUF_SIZE];
+static INT8U                    bench_write_buf[BENCH_WRITE_SIZE];
+
+static const bench_cfg_type     bench_cfg_arr[] =
+    {
+    {  100, MP3_VS1053_MODEL_SPI_NS_DFLT, 1 },
+    {  250, MP3_VS1053_MODEL_SPI_NS_DFLT, 1 },
+    {  500, MP3_VS1053_MODEL_SPI_NS_DFLT, 1 },
+    { 1000, MP3_VS1053_MODEL_SPI_NS_DFLT, 1 },
+    {  250, 16000,                        1 },
+    {  250, 1000,                         1 },
+    {  250, MP3_VS1053_MODEL_SPI_NS_DFLT, 2 },
+    {  250, 16000,                        2 },
+    };
+
+static const bench_trk_type     bench_trk_arr[] =
+    {
+    { "BNCHTRN.MP3",    "rom:train",    0   },
+    { "BNCH256.MP3",    NULL,           256 },
+    { "BNCH320.MP3",    NULL,           320 },
+    { "rom:train",      NULL,           0   },
+    };
+
+/**
+    Static Procedures
+*/
+static void bench_main
+    (
+    void* pdata
+    );
+
+static BOOLEAN create_track
+    (
+    const bench_trk_type* ptr_trk
+    );
+
+static void write_synth_frames
+    (
+    File*   ptr_file,
+    INT16U  kbps
+    );
+
+static void run
+    (
+    const bench_trk_type*   ptr_trk,
+    const bench_cfg_type*   ptr_cfg
+    );
+
+static BOOLEAN wait_for_sts
+    (
+    MP3_playback_sts_type sts
+    );
+
+/**
+    Power up the streaming benchmark
+
+    Called once the MP3 threads are powered up. The
+    statistics task must have been initialised for
+    the CPU usage to be measured.
+
+    @return None
+*/
+void MP3_bench_pwrp
+    ( void )
+{
+
+OSTaskCreate
+    (
+    bench_main,
+    (void*)0,
+    &bench_stack[APP_CFG_TASK_EQ_STK_SIZE-1],
+    APP_TASK_MP3_BENCH_PRIO
+    );
+
+} /* MP3_bench_pwrp() */
+
+/**
+    Benchmark main
+
+    Creates the tracks, then plays each of them
+    under each configuration.
+*/
+static void bench_main
+    (
+    void* pdata
+    )
+{
+INT8U   trk;
+INT8U   cfg;
+
+PrintWithBuf( bench_print_buf, sizeof( bench_print_buf ), "\r\nMP3 streaming benchmark\r\n" );
+
+for( trk = 0; trk < sizeof( bench_trk_arr ) / sizeof( bench_trk_arr[0] ); trk++ )
+    {
+    if( !create_track( &bench_trk_arr[trk] ) )
+        {
+        PrintWithBuf( bench_print_buf, sizeof( bench_print_buf ), "%s: could not be created\r\n", bench_trk_arr[trk].ptr_fname );
+        }
+    }
+
+PrintWithBuf( bench_print_buf, sizeof( bench_print_buf ),
+    "track        tgt_ms spi_ns x | und model/strm starved_ms | cpu%% | ttfa_ms stop_ms | ring min/avg/max | spi_us avg/max dreq_waits refill_us avg/max | kB/s\r\n" );
+
+for( trk = 0; trk < sizeof( bench_trk_arr ) / sizeof( bench_trk_arr[0] ); trk++ )
+    {
+    for( cfg = 0; cfg < sizeof( bench_cfg_arr ) / sizeof( bench_cfg_arr[0] ); cfg++ )
+        {
+        run( &bench_trk_arr[trk], &bench_cfg_arr[cfg] );
+        }
+    }
+
+(void)MP3_playback_set_speed( 1 );
+
+PrintWithBuf( bench_print_buf, sizeof( bench_print_buf ), "Done\r\n" );
+
+OSTaskDel( OS_PRIO_SELF );
+
+} /* bench_main() */
+
+/**
+    Create a track on the card if it is not there yet
+
+    @return Returns TRUE if the track exists
+*/
+static BOOLEAN create_track
+    (
+    const bench_trk_type* ptr_trk
+    )
+{
+File            file;
+mp3_src_type    copy_src;
+const INT8U*    ptr_data;
+INT16U          size;
+BOOLEAN         success;
+
+success = true;
+
+if( ( NULL == ptr_trk->ptr_copy_fname ) && ( 0 == ptr_trk->synth_kbps ) )
+    {
+    // Played from where it is
+    return success;
+    }
+
+mp3_prefetch_lock();
+
+if( !SD.exists( (char*)ptr_trk->ptr_fname ) )
+    {
+    file = SD.open( ptr_trk->ptr_fname, FILE_WRITE );
+    if( !file )
+        {
+        success = false;
+        }
+    else
+        {
+        if( NULL != ptr_trk->ptr_copy_fname )
+            {
+            success = mp3_src_open( &copy_src, ptr_trk->ptr_copy_fname ) && mp3_src_can_map( &copy_src );
+            if( success )
+                {
+                while( 0 != ( size = mp3_src_map( &copy_src, &ptr_data, BENCH_WRITE_SIZE ) ) )
+                    {
+                    file.write( ptr_data, size );
+                    }
+                mp3_src_close( &copy_src );
+                }
+            }
+        else
+            {
+            write_synth_frames( &file, ptr_trk->synth_kbps );
+            }
+        file.close();
+        }
+    }
+
+mp3_prefetch_unlock();
+
+return success;
+
+} /* create_track() */
+
+/**
+    Write a synthetic stream
+
+    MPEG 1 layer III frames at 44.1 kHz with no audio
+    data, padded so the average bitrate is exact.
+*/
+static void write_synth_frames
+    (
+    File*   ptr_file,
+    INT16U  kbps
+    )
+{
+INT32U  frame;
+INT32U  frame_cnt;
+INT32U  frame_len;
+INT32U  pad_rem;
+INT32U  size;
+INT8U   bitrate_idx;
+
+// Layer III bitrate index of 256 and 320 kbps
+bitrate_idx = ( 320 == kbps ) ? 14 : 13;
+
+frame_cnt = ( (INT32U)BENCH_SYNTH_SCNDS * BENCH_SYNTH_RATE ) / 1152;
+pad_rem   = 0;
+
+for( frame = 0; frame < frame_cnt; frame++ )
+    {
+    frame_len = ( 144000UL * kbps ) / BENCH_SYNTH_RATE;
+    pad_rem  += ( 144000UL * kbps ) % BENCH_SYNTH_RATE;
+
+    memset( bench_write_buf, 0, sizeof( bench_write_buf ) );
+    bench_write_buf[0] = 0xFF;
+    bench_write_buf[1] = 0xFB;                          // MPEG 1, layer III, no CRC
+    bench_write_buf[2] = (INT8U)( bitrate_idx << 4 );   // 44.1 kHz
+    if( pad_rem >= BENCH_SYNTH_RATE )
+        {
+        pad_rem -= BENCH_SYNTH_RATE;
+        bench_write_buf[2] |= 0x02;
+        frame_len++;
+        }
+    bench_write_buf[3] = 0x00;                          // Stereo
+
+    while( frame_len > 0 )
+        {
+        size = ( frame_len > BENCH_WRITE_SIZE ) ? BENCH_WRITE_SIZE : frame_len;
+        ptr_file->write( bench_write_buf, size );
+        frame_len -= size;
+        memset( bench_write_buf, 0, 4 );
+        }
+    }
+
+} /* write_synth_frames() */
+
+/**
+    Play a track under a configuration and print
+    the results
+*/
+static void run
+    (
+    const bench_trk_type*   ptr_trk,
+    const bench_cfg_type*   ptr_cfg
+    )
+{
+MP3_stream_stats_type   strm_stats;
+BspMp3ModelStats        model_stats;
+INT32U                  start_cycle;
+INT32U                  start_ms;
+INT32U                  cpu_sum;
+INT32U                  cpu_cnt;
+INT32U                  ttfa_ms;
+INT32U                  stop_cycle;
+INT32U                  stop_ms;
+
+mp3_strm_ctrl_set_dflt_target( ptr_cfg->target_ms );
+(void)MP3_playback_set_speed( ptr_cfg->speed );
+BspMp3ModelSetSpiTiming( ptr_cfg->spi_ns_per_byte );
+BspMp3ModelReset();
+
+memset( &strm_stats, 0, sizeof( strm_stats ) );
+cpu_sum = 0;
+cpu_cnt = 0;
+
+start_cycle = BSP_CYCLE_CNT();
+start_ms    = task_ms_timer;
+
+if( !MP3_playback_start( ptr_trk->ptr_fname ) || !wait_for_sts( MP3_PLAYBACK_STS_IN_PROGRESS ) )
+    {
+    PrintWithBuf( bench_print_buf, sizeof( bench_print_buf ), "%-12s could not be played\r\n", ptr_trk->ptr_fname );
+    return;
+    }
+
+// Play to the end or for the longest run time,
+// the counters are read while the stream is open
+while( MP3_playback_is_plybk_in_prog() && ( ( task_ms_timer - start_ms ) < BENCH_RUN_MS_MAX ) )
+    {
+    OSTimeDly( BENCH_POLL_MS );
+    cpu_sum += OSCPUUsage;
+    cpu_cnt++;
+    if( MP3_playback_is_plybk_in_prog() )
+        {
+        MP3_get_stream_stats( &strm_stats );
+        }
+    }
+
+BspMp3ModelGetStats( &model_stats );
+
+stop_cycle = BSP_CYCLE_CNT();
+(void)MP3_playback_stop_wait( BENCH_START_MS_MAX );
+stop_ms = BSP_CYCLES_TO_US( BSP_CYCLE_CNT() - stop_cycle ) / 1000;
+
+ttfa_ms = 0;
+if( model_stats.playing )
+    {
+    ttfa_ms = BSP_CYCLES_TO_US( model_stats.firstAudioCycle - start_cycle ) / 1000;
+    }
+
+PrintWithBuf( bench_print_buf, sizeof( bench_print_buf ),
+    "%-12s %6u %6u %u | %3u/%3u %10u | %3u%% | %7u %7u | %4u/%4u/%4u | %5u/%5u %10u %6u/%6u | %4u\r\n",
+    ptr_trk->ptr_fname,
+    ptr_cfg->target_ms,
+    ptr_cfg->spi_ns_per_byte,
+    ptr_cfg->speed,
+    model_stats.underruns,
+    strm_stats.underrun_cnt,
+    model_stats.starvedMs,
+    ( 0 != cpu_cnt ) ? ( cpu_sum / cpu_cnt ) : 0,
+    ttfa_ms,
+    stop_ms,
+    strm_stats.ring_used_min,
+    strm_stats.ring_used_avg,
+    strm_stats.ring_used_max,
+    strm_stats.spi_us_avg,
+    strm_stats.spi_us_max,
+    strm_stats.dreq_wait_cnt,
+    strm_stats.refill_us_avg,
+    strm_stats.refill_us_max,
+    strm_stats.bytes_per_scnd / 1000 );
+
+} /* run() */
+
+/**
+    Wait for playback to start
+
+    @return Returns TRUE if playback reached the
+            status in time
+*/
+static BOOLEAN wait_for_sts
+    (
+    MP3_playback_sts_type sts
+    )
+{
+INT32U start_ms;
+
+start_ms = task_ms_timer;
+
+while( sts != MP3_playback_get_status() )
+    {
+    if( ( task_ms_timer - start_ms ) >= BENCH_START_MS_MAX )
+        {
+        return false;
+        }
+    OSTimeDly( 1 );
+    }
+
+return true;
+
+} /* wait_for_sts() */
+
+#endif /* MP3_BENCH */
@@ -0,0 +1,1641 @@
+/**
+    @file        mp3_frame.c
+
+    @author      Vimal Mehta
+
+    @description
+        MPEG audio frame parsing for the playing MP3 file.
+    When a file is opened the first frame header is found,
+    skipping any ID3v2 tag, and a Xing/Info or VBRI header
+    in it gives the number of frames and a table of byte
+    offsets at equal steps of playback time (TOC), from
+    which the duration is known straight away. Trailing
+    ID3v1 and APE tags are left out of the audio, see
+    mp3_frame_find_audio().
+
+        Files without such a header get a sparse index
+    instead, an entry every idx_interval frames, built by a
+    scan of the frame headers that the MP3 prefetch task
+    runs a few frames at a time while it has nothing else
+    to read. Until the scan reaches the end of the file the
+    duration is an estimate from the average frame size
+    seen so far.
+
+        Seeking maps a time to an offset through the TOC,
+    the index or, failing both, the average bitrate, and
+    then moves on to the next frame header. To bound the
+    walk of the FAT cluster chain on long or fragmented
+    files, the scan first records the cluster at every
+    map_step bytes of the file, and a seek starts its walk
+    from the nearest of those.
+
+        What is learnt of a file is kept in the metadata
+    cache, see mp3_meta.c, and a file found there is
+    opened from it without reading its headers again.
+    The cache fills in files that have not been played
+    with mp3_frame_probe(), which leaves the playing file
+    alone.
+
+        A RIFF/WAVE file is taken the same way, with a
+    sample frame, one sample of every channel, standing for
+    a frame. Its header gives the sample rate and the length
+    of the data, so the duration is exact from the start and
+    a time maps straight to an offset. The header is left in
+    the audio that is streamed, as the decoder needs it.
+
+        The scan reads the file through its own handle, and
+    must only be run with the prefetch file semaphore held
+    so that it never uses the card at the same time as the
+    MP3 main thread or the prefetch task.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "SD.h"
+#include "mp3_prv.h"
+
+/**
+    Types
+*/
+
+// Decoded frame header
+typedef struct
+    {
+    INT8U       version;                    // 3 = MPEG 1, 2 = MPEG 2, 0 = MPEG 2.5
+    INT8U       layer;                      // 1, 2 or 3
+    BOOLEAN     mono;
+    INT16U      bitrate_kbps;
+    INT32U      sample_rate;
+    INT16U      samples_per_frame;
+    INT16U      frame_len;                  // Bytes including the header
+    } frame_hdr_type;
+
+// Layout of a RIFF/WAVE file
+typedef struct
+    {
+    INT32U      sample_rate;
+    INT32U      byte_rate;                  // Bytes of audio per second
+    INT16U      block_align;                // Bytes per sample frame
+    INT32U      data_start;                 // Offset of the first sample
+    INT32U      data_end;                   // Offset after the last sample
+    } wav_hdr_type;
+
+// Workspace type
+typedef struct
+    {
+    BOOLEAN     valid;                      // A frame was found in the file
+    INT32U      audio_start;                // Offset of the first frame, or sample of a WAV file
+    INT32U      audio_end;                  // Offset after the last byte of audio
+    INT32U      sample_rate;
+    INT16U      samples_per_frame;
+    INT16U      first_bitrate_kbps;         // Bitrate of the first frame
+    INT16U      block_align;                // Bytes per sample frame of a WAV file, 0 for MPEG audio
+    INT32U      frame_cnt;                  // Number of frames, 0 if not known yet
+    INT32U      duration_ms;                // Duration, an estimate until frame_cnt is known
+    INT8U       toc_cnt;                    // Entries in toc, 0 if none
+    INT32U      toc_step_ms;                // Playback time between toc entries
+    INT32U      toc[MP3_FRAME_TOC_CNT];     // Offsets of the audio at equal steps of time
+
+    BOOLEAN     scan_active;                // Index scan still to reach the end of the file
+    mp3_src_type scan_file;                 // Handle the index scan reads through
+    INT32U      scan_pos;                   // Offset of the next frame header to scan
+    INT32U      scan_frames;                // Frames found by the scan so far
+    INT32U      buf_base;                   // File offset of buf
+    INT16U      buf_len;                    // Valid bytes in buf
+    INT8U       buf[MP3_FRAME_BUF_SIZE];    // Scan buffer
+
+    INT16U      idx_interval;               // Frames between index entries
+    INT16U      idx_cnt;                    // Entries in idx
+    INT32U      idx[MP3_FRAME_IDX_CNT];     // Offset of every idx_interval'th frame
+
+    BOOLEAN     map_done;                   // Cluster map complete, or given up on
+    INT32U      map_step;                   // Bytes of the file between map entries
+    INT16U      map_cnt;                    // Entries in map
+    INT32U      map[MP3_FRAME_MAP_CNT];     // Seek hint at each multiple of map_step, 0 if none
+    } frame_wksp_type;
+
+/**
+    Static Variables
+*/
+static frame_wksp_type          frame_wksp;                         // Workspace
+static INT8U                    frame_probe_buf[MP3_FRAME_PROBE_SIZE];  // First frame read by mp3_frame_probe()
+
+// Bitrates in kbps by bitrate index, for MPEG 1 layers I, II, III
+// and MPEG 2/2.5 layer I then layers II and III
+static const INT16U             frame_kbps_tbl[5][16] =
+    {
+    { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+    { 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+    { 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0 },
+    { 0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+    { 0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160, 0 }
+    };
+
+// Sample rates by sample rate index, for MPEG 1, 2 and 2.5
+static const INT32U             frame_rate_tbl[3][3] =
+    {
+    { 44100, 48000, 32000 },
+    { 22050, 24000, 16000 },
+    { 11025, 12000,  8000 }
+    };
+
+/**
+    Static Procedures
+*/
+
+static BOOLEAN parse_hdr
+    (
+    const INT8U*    ptr_hdr,
+    frame_hdr_type* ptr_frame
+    );
+
+static BOOLEAN parse_wav
+    (
+    mp3_src_type*   ptr_file,
+    wav_hdr_type*   ptr_wav
+    );
+
+static BOOLEAN find_frame
+    (
+    INT16U          len,
+    INT16U*         ptr_offset,
+    frame_hdr_type* ptr_frame
+    );
+
+static void parse_vbr_hdr
+    (
+    mp3_src_type*           ptr_file,
+    INT32U                  frame_pos,
+    const frame_hdr_type*   ptr_frame
+    );
+
+static INT16U read_buf
+    (
+    mp3_src_type* ptr_file
+    );
+
+static BOOLEAN scan_get_byte
+    (
+    INT32U  pos,
+    INT8U*  ptr_byte
+    );
+
+static void scan_add_frame
+    (
+    INT32U  pos
+    );
+
+static void scan_open
+    (
+    const char* fname
+    );
+
+static void scan_map
+    ( void );
+
+static INT32U toc_get_pos
+    (
+    INT32U ms
+    );
+
+static BOOLEAN seek_near
+    (
+    mp3_src_type*   ptr_file,
+    INT32U          pos
+    );
+
+static void set_duration
+    (
+    INT32U frame_cnt
+    );
+
+static INT32U get_be32
+    (
+    const INT8U* ptr
+    );
+
+static INT32U get_le32
+    (
+    const INT8U* ptr
+    );
+
+static INT32U get_audio_end
+    (
+    mp3_src_type* ptr_file
+    );
+
+/**
+    Open the frame parser on a file
+
+    Finds the first frame and any VBR header in it, and
+    starts the scan on a second handle to fname. The scan
+    maps the clusters of the file and, if there is no
+    frame count in the file, indexes the frames. A WAV
+    file has its layout in its header. The file is left
+    at an unknown position.
+
+    @return Returns TRUE if an MPEG audio frame or a
+            WAV header was found
+*/
+BOOLEAN mp3_frame_open
+    (
+    mp3_src_type*   ptr_file,
+    const char*     fname
+    )
+{
+OS_CPU_SR       cpu_sr = 0;
+frame_hdr_type  frame;
+wav_hdr_type    wav;
+INT32U          audio_start;
+INT16U          len;
+INT16U          i;
+
+mp3_frame_close();
+
+if( parse_wav( ptr_file, &wav ) )
+    {
+    OS_ENTER_CRITICAL();
+    frame_wksp.valid                = true;
+    frame_wksp.audio_start          = wav.data_start;
+    frame_wksp.audio_end            = wav.data_end;
+    frame_wksp.sample_rate          = wav.sample_rate;
+    frame_wksp.samples_per_frame    = 1;
+    frame_wksp.first_bitrate_kbps   = (INT16U)( ( wav.byte_rate * 8 ) / 1000 );
+    frame_wksp.block_align          = wav.block_align;
+    frame_wksp.frame_cnt            = ( wav.data_end - wav.data_start ) / wav.block_align;
+    frame_wksp.duration_ms          = (INT32U)( ( (uint64_t)frame_wksp.frame_cnt * 1000 ) / wav.sample_rate );
+    OS_EXIT_CRITICAL();
+
+    // Only maps the clusters, for seeks
+    scan_open( fname );
+
+    return true;
+    }
+
+audio_start = mp3_frame_get_id3v2_size( ptr_file );
+
+len = 0;
+
+if( mp3_src_seek( ptr_file, audio_start ) )
+    {
+    len = read_buf( ptr_file );
+    }
+
+if( !find_frame( len, &i, &frame ) )
+    {
+    return false;
+    }
+
+audio_start += i;
+
+OS_ENTER_CRITICAL();
+frame_wksp.valid                = true;
+frame_wksp.audio_start          = audio_start;
+frame_wksp.audio_end            = mp3_src_size( ptr_file );
+frame_wksp.sample_rate          = frame.sample_rate;
+frame_wksp.samples_per_frame    = frame.samples_per_frame;
+frame_wksp.first_bitrate_kbps   = frame.bitrate_kbps;
+OS_EXIT_CRITICAL();
+
+parse_vbr_hdr( ptr_file, audio_start, &frame );
+
+if( 0 == frame_wksp.frame_cnt )
+    {
+    // No frame count, estimate the duration as if the
+    // bitrate was constant until the scan has counted
+    set_duration( 0 );
+    }
+
+scan_open( fname );
+
+return true;
+
+} /* mp3_frame_open() */
+
+/**
+    Open the frame parser on a file from what is known
+    of it
+
+    Takes the frame layout, duration and seek table of
+    a file from the metadata cache instead of reading
+    them from the file, and starts the scan on a handle
+    to fname. The scan then only maps the clusters of
+    the file, unless the duration is an estimate.
+
+    @return None
+*/
+void mp3_frame_open_info
+    (
+    const char*                 fname,
+    const mp3_frame_info_type*  ptr_info
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT8U       i;
+
+mp3_frame_close();
+
+for( i = 0; ( i < ptr_info->toc_cnt ) && ( i < MP3_FRAME_TOC_CNT ); i++ )
+    {
+    frame_wksp.toc[i] = ptr_info->toc[i];
+    }
+
+OS_ENTER_CRITICAL();
+frame_wksp.valid                = true;
+frame_wksp.audio_start          = ptr_info->audio_start;
+frame_wksp.audio_end            = ptr_info->audio_end;
+frame_wksp.sample_rate          = ptr_info->sample_rate;
+frame_wksp.samples_per_frame    = ptr_info->samples_per_frame;
+frame_wksp.first_bitrate_kbps   = ptr_info->bitrate_kbps;
+frame_wksp.block_align          = ptr_info->block_align;
+frame_wksp.frame_cnt            = ptr_info->frame_cnt;
+frame_wksp.duration_ms          = ptr_info->duration_ms;
+frame_wksp.toc_cnt              = i;
+frame_wksp.toc_step_ms          = ( i > 0 ) ? ( ptr_info->duration_ms / i ) : 0;
+OS_EXIT_CRITICAL();
+
+scan_open( fname );
+
+} /* mp3_frame_open_info() */
+
+/**
+    Get the frame layout of the open file
+
+    The seek table is made from the TOC of the file or,
+    once the scan has indexed the whole file, from the
+    index, with MP3_META_TOC_CNT entries at equal steps
+    of the duration.
+
+    @return Returns TRUE if the duration is exact, FALSE
+            while it is an estimate or if no file is open
+*/
+BOOLEAN mp3_frame_get_info
+    (
+    mp3_frame_info_type* ptr_info
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      step_ms;
+INT32U      frame_idx;
+INT32U      frame_rem;
+INT16U      j;
+INT8U       i;
+
+if( !frame_wksp.valid )
+    {
+    return false;
+    }
+
+OS_ENTER_CRITICAL();
+ptr_info->audio_start       = frame_wksp.audio_start;
+ptr_info->audio_end         = frame_wksp.audio_end;
+ptr_info->sample_rate       = frame_wksp.sample_rate;
+ptr_info->samples_per_frame = frame_wksp.samples_per_frame;
+ptr_info->bitrate_kbps      = frame_wksp.first_bitrate_kbps;
+ptr_info->block_align       = frame_wksp.block_align;
+ptr_info->frame_cnt         = frame_wksp.frame_cnt;
+ptr_info->duration_ms       = frame_wksp.duration_ms;
+OS_EXIT_CRITICAL();
+
+ptr_info->toc_cnt = 0;
+step_ms = ptr_info->duration_ms / MP3_META_TOC_CNT;
+
+if( 0 == step_ms )
+    {
+    // Too short to need a table
+    }
+else if( ( frame_wksp.toc_cnt > 0 ) && ( frame_wksp.toc_step_ms > 0 ) )
+    {
+    for( i = 0; i < MP3_META_TOC_CNT; i++ )
+        {
+        ptr_info->toc[i] = toc_get_pos( i * step_ms );
+        }
+    ptr_info->toc_cnt = MP3_META_TOC_CNT;
+    }
+else if( ( 0 != ptr_info->frame_cnt ) && !frame_wksp.scan_active && ( frame_wksp.idx_cnt > 0 ) )
+    {
+    // Interpolate between the indexed frames either side
+    for( i = 0; i < MP3_META_TOC_CNT; i++ )
+        {
+        frame_idx = (INT32U)( ( (uint64_t)i * step_ms * frame_wksp.sample_rate ) / ( (INT32U)frame_wksp.samples_per_frame * 1000 ) );
+        j         = (INT16U)( frame_idx / frame_wksp.idx_interval );
+        frame_rem = frame_idx % frame_wksp.idx_interval;
+        if( j + 1 < frame_wksp.idx_cnt )
+            {
+            ptr_info->toc[i] = frame_wksp.idx[j] +
+                               ( ( frame_wksp.idx[j + 1] - frame_wksp.idx[j] ) * frame_rem ) / frame_wksp.idx_interval;
+            }
+        else
+            {
+            ptr_info->toc[i] = frame_wksp.idx[frame_wksp.idx_cnt - 1];
+            }
+        }
+    ptr_info->toc_cnt = MP3_META_TOC_CNT;
+    }
+
+return ( 0 != ptr_info->frame_cnt );
+
+} /* mp3_frame_get_info() */
+
+/**
+    Probe the frame layout of a file
+
+    Finds the audio of a file and the duration from the
+    VBR header of its first frame, or as if its bitrate
+    was constant, without disturbing the playing file.
+    The seek table is taken from a Xing/Info TOC only.
+    A WAV file is taken from its header.
+    Only a buffer of its own is used, which only the
+    metadata cache uses, from a single task. The file is
+    left at an unknown position.
+
+    @return Returns TRUE if a frame was found, with
+            ptr_info->frame_cnt 0 if the duration is
+            an estimate
+*/
+BOOLEAN mp3_frame_probe
+    (
+    mp3_src_type*           ptr_file,
+    mp3_frame_info_type*    ptr_info
+    )
+{
+frame_hdr_type  frame;
+wav_hdr_type    wav;
+const INT8U*    ptr;
+INT32U          audio_start;
+INT32U          audio_end;
+INT32U          flags;
+INT32U          bytes;
+INT32U          pct;
+INT32U          val;
+INT16U          offset;
+int             len;
+INT8U           i;
+
+ptr_info->sample_rate = 0;
+ptr_info->block_align = 0;
+ptr_info->frame_cnt   = 0;
+ptr_info->toc_cnt     = 0;
+
+if( parse_wav( ptr_file, &wav ) )
+    {
+    ptr_info->audio_start       = wav.data_start;
+    ptr_info->audio_end         = wav.data_end;
+    ptr_info->sample_rate       = wav.sample_rate;
+    ptr_info->samples_per_frame = 1;
+    ptr_info->bitrate_kbps      = (INT16U)( ( wav.byte_rate * 8 ) / 1000 );
+    ptr_info->block_align       = wav.block_align;
+    ptr_info->frame_cnt         = ( wav.data_end - wav.data_start ) / wav.block_align;
+    ptr_info->duration_ms       = (INT32U)( ( (uint64_t)ptr_info->frame_cnt * 1000 ) / wav.sample_rate );
+    return true;
+    }
+
+if( !mp3_frame_find_audio( ptr_file, &audio_start, &audio_end ) || !mp3_src_seek( ptr_file, audio_start ) )
+    {
+    return false;
+    }
+
+len = mp3_src_read( ptr_file, frame_probe_buf, MP3_FRAME_PROBE_SIZE );
+if( ( len < 4 ) || !parse_hdr( frame_probe_buf, &frame ) )
+    {
+    return false;
+    }
+
+ptr_info->audio_start       = audio_start;
+ptr_info->audio_end         = audio_end;
+ptr_info->sample_rate       = frame.sample_rate;
+ptr_info->samples_per_frame = frame.samples_per_frame;
+ptr_info->bitrate_kbps      = frame.bitrate_kbps;
+
+bytes = audio_end - audio_start;
+
+// The Xing header follows the side information
+if( 3 == frame.version )
+    {
+    offset = frame.mono ? ( 4 + 17 ) : ( 4 + 32 );
+    }
+else
+    {
+    offset = frame.mono ? ( 4 + 9 ) : ( 4 + 17 );
+    }
+
+ptr = &frame_probe_buf[offset];
+
+if( ( offset + 8 <= len ) &&
+    ( ( 0 == memcmp( ptr, "Xing", 4 ) ) || ( 0 == memcmp( ptr, "Info", 4 ) ) ) )
+    {
+    flags = get_be32( &ptr[4] );
+    ptr  += 8;
+
+    if( flags & 0x01 )
+        {
+        ptr_info->frame_cnt = get_be32( ptr );
+        ptr += 4;
+        }
+    if( flags & 0x02 )
+        {
+        bytes = get_be32( ptr );
+        ptr += 4;
+        }
+    if( ( flags & 0x04 ) && ( 0 != ptr_info->frame_cnt ) && ( ptr + 100 <= &frame_probe_buf[len] ) )
+        {
+        // Entry i of the file's TOC is the offset at i percent of
+        // the duration, in 1/256ths of the file, interpolated here
+        for( i = 0; i < MP3_META_TOC_CNT; i++ )
+            {
+            pct = ( (INT32U)i * 100 ) / MP3_META_TOC_CNT;
+            val = (INT32U)ptr[pct] * MP3_META_TOC_CNT;
+            if( ( pct + 1 < 100 ) && ( ptr[pct + 1] > ptr[pct] ) )
+                {
+                val += (INT32U)( ptr[pct + 1] - ptr[pct] ) * ( ( (INT32U)i * 100 ) % MP3_META_TOC_CNT );
+                }
+            ptr_info->toc[i] = audio_start + (INT32U)( ( (uint64_t)val * bytes ) / ( 256 * MP3_META_TOC_CNT ) );
+            }
+        ptr_info->toc_cnt = MP3_META_TOC_CNT;
+        }
+    }
+else if( ( 4 + 32 + 26 <= len ) && ( 0 == memcmp( &frame_probe_buf[4 + 32], "VBRI", 4 ) ) )
+    {
+    // The VBRI header is always 32 bytes after the frame header
+    ptr_info->frame_cnt = get_be32( &frame_probe_buf[4 + 32 + 14] );
+    }
+
+if( 0 != ptr_info->frame_cnt )
+    {
+    ptr_info->duration_ms = (INT32U)( ( (uint64_t)ptr_info->frame_cnt * frame.samples_per_frame * 1000 ) / frame.sample_rate );
+    }
+else
+    {
+    // bytes * 8 / kbit/s gives ms
+    ptr_info->duration_ms = (INT32U)( ( (uint64_t)( audio_end - audio_start ) * 8 ) / frame.bitrate_kbps );
+    }
+
+return true;
+
+} /* mp3_frame_probe() */
+
+/**
+    Close the frame parser
+
+    The prefetch task must have been closed, so that
+    no scan step is in progress.
+
+    @return None
+*/
+void mp3_frame_close
+    ( void )
+{
+OS_CPU_SR cpu_sr = 0;
+
+if( frame_wksp.scan_active )
+    {
+    mp3_src_close( &frame_wksp.scan_file );
+    }
+
+OS_ENTER_CRITICAL();
+frame_wksp.valid        = false;
+frame_wksp.scan_active  = false;
+frame_wksp.scan_frames  = 0;
+frame_wksp.block_align  = 0;
+frame_wksp.frame_cnt    = 0;
+frame_wksp.duration_ms  = 0;
+frame_wksp.toc_cnt      = 0;
+frame_wksp.idx_cnt      = 0;
+frame_wksp.map_cnt      = 0;
+OS_EXIT_CRITICAL();
+
+} /* mp3_frame_close() */
+
+/**
+    Run a step of the index scan
+
+    Maps up to MP3_FRAME_MAP_STEPS clusters until the
+    cluster map is complete, then indexes up to
+    MP3_FRAME_SCAN_FRAMES frames if the frame count is
+    not known. Must be called with the prefetch file
+    semaphore held.
+
+    @return Returns TRUE if there is more to scan
+*/
+BOOLEAN mp3_frame_scan_step
+    ( void )
+{
+INT8U           hdr[4];
+frame_hdr_type  frame;
+INT8U           i;
+INT8U           j;
+BOOLEAN         done;
+
+if( !frame_wksp.scan_active )
+    {
+    return false;
+    }
+
+if( !frame_wksp.map_done )
+    {
+    scan_map();
+    return true;
+    }
+
+// The file gave the frame count
+done = ( 0 != frame_wksp.frame_cnt );
+
+for( i = 0; ( i < MP3_FRAME_SCAN_FRAMES ) && !done; i++ )
+    {
+    for( j = 0; ( j < 4 ) && !done; j++ )
+        {
+        done = !scan_get_byte( frame_wksp.scan_pos + j, &hdr[j] );
+        }
+
+    if( done )
+        {
+        break;
+        }
+
+    if( parse_hdr( hdr, &frame ) )
+        {
+        scan_add_frame( frame_wksp.scan_pos );
+        frame_wksp.scan_pos += frame.frame_len;
+        }
+    else
+        {
+        // Lost sync, or a trailing tag
+        frame_wksp.scan_pos++;
+        }
+    }
+
+if( done )
+    {
+    mp3_src_close( &frame_wksp.scan_file );
+    frame_wksp.scan_active = false;
+    if( 0 == frame_wksp.frame_cnt )
+        {
+        set_duration( frame_wksp.scan_frames );
+        }
+    }
+else if( frame_wksp.scan_pos > frame_wksp.audio_start )
+    {
+    // Estimate the frame count from the average frame size so far
+    set_duration( 0 );
+    }
+
+return !done;
+
+} /* mp3_frame_scan_step() */
+
+/**
+    Get the duration of the file
+
+    @return Returns the duration in milliseconds, an
+            estimate while the index is being built, 0
+            if no file is open
+*/
+INT32U mp3_frame_get_duration_ms
+    ( void )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      duration_ms;
+
+OS_ENTER_CRITICAL();
+duration_ms = frame_wksp.duration_ms;
+OS_EXIT_CRITICAL();
+
+return duration_ms;
+
+} /* mp3_frame_get_duration_ms() */
+
+/**
+    Get the bitrate of an uncompressed file
+
+    The MP3 main thread sets the stream up for the
+    rate of a WAV file, which the decoder can not
+    report the way it does that of MPEG audio.
+
+    @return Returns the bitrate in kbps if the open
+            file is a WAV file, else 0
+*/
+INT16U mp3_frame_get_pcm_kbps
+    ( void )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT16U      kbps;
+
+OS_ENTER_CRITICAL();
+kbps = ( frame_wksp.valid && ( 0 != frame_wksp.block_align ) ) ? frame_wksp.first_bitrate_kbps : 0;
+OS_EXIT_CRITICAL();
+
+return kbps;
+
+} /* mp3_frame_get_pcm_kbps() */
+
+/**
+    Position a file for playback from a time
+
+    The time is mapped to an offset with the TOC, the
+    frame index or the average bitrate, in that order,
+    and the file is positioned at the first frame header
+    from there. A WAV file is positioned at the sample
+    frame of the time. The prefetch task must have been
+    closed.
+
+    @return Returns TRUE if the file was positioned, with
+            *ptr_ms set to the time of the frame where it
+            is known more exactly than requested
+*/
+BOOLEAN mp3_frame_seek
+    (
+    mp3_src_type*   ptr_file,
+    INT32U*         ptr_ms
+    )
+{
+frame_hdr_type  frame;
+INT32U          ms;
+INT32U          pos;
+INT32U          frame_idx;
+INT32U          hint_pos;
+INT32U          hint_cluster;
+INT16U          len;
+INT16U          i;
+
+if( !frame_wksp.valid || ( 0 == frame_wksp.duration_ms ) )
+    {
+    return false;
+    }
+
+ms = *ptr_ms;
+if( ms > frame_wksp.duration_ms )
+    {
+    ms = frame_wksp.duration_ms;
+    }
+
+frame_idx = (INT32U)( ( (uint64_t)ms * frame_wksp.sample_rate ) / ( (INT32U)frame_wksp.samples_per_frame * 1000 ) );
+
+if( 0 != frame_wksp.block_align )
+    {
+    // Any sample frame can be played from
+    if( !seek_near( ptr_file, frame_wksp.audio_start + frame_idx * frame_wksp.block_align ) )
+        {
+        return false;
+        }
+
+    *ptr_ms = ms;
+    return true;
+    }
+
+if( ( frame_wksp.toc_cnt > 0 ) && ( frame_wksp.toc_step_ms > 0 ) )
+    {
+    pos = toc_get_pos( ms );
+    }
+else if( ( frame_wksp.idx_cnt > 0 ) && ( ( frame_idx / frame_wksp.idx_interval ) < frame_wksp.idx_cnt ) )
+    {
+    // Indexed frame at or before the time
+    frame_idx = ( frame_idx / frame_wksp.idx_interval ) * frame_wksp.idx_interval;
+    pos       = frame_wksp.idx[frame_idx / frame_wksp.idx_interval];
+    ms        = (INT32U)( ( (uint64_t)frame_idx * frame_wksp.samples_per_frame * 1000 ) / frame_wksp.sample_rate );
+    }
+else
+    {
+    pos = frame_wksp.audio_start +
+          (INT32U)( ( (uint64_t)ms * ( frame_wksp.audio_end - frame_wksp.audio_start ) ) / frame_wksp.duration_ms );
+    }
+
+if( pos >= frame_wksp.audio_end )
+    {
+    pos = frame_wksp.audio_end;
+    }
+
+// Move on to the next frame header
+if( !seek_near( ptr_file, pos ) )
+    {
+    return false;
+    }
+
+hint_pos     = mp3_src_position( ptr_file );
+hint_cluster = mp3_src_get_hint( ptr_file );
+
+len = read_buf( ptr_file );
+if( find_frame( len, &i, &frame ) )
+    {
+    pos += i;
+    }
+
+// The scan buffer has been overwritten
+frame_wksp.buf_len = 0;
+
+if( !mp3_src_seek_hint( ptr_file, pos, hint_pos, hint_cluster ) )
+    {
+    return false;
+    }
+
+*ptr_ms = ms;
+
+return true;
+
+} /* mp3_frame_seek() */
+
+/**
+    Get the size of the ID3v2 tag at the start of a file
+
+    @return Returns the offset of the first byte after
+            the tag, 0 if there is no tag
+*/
+INT32U mp3_frame_get_id3v2_size
+    (
+    mp3_src_type* ptr_file
+    )
+{
+INT8U   hdr[10];
+INT32U  size;
+
+size = 0;
+
+if( mp3_src_seek( ptr_file, 0 ) && ( sizeof( hdr ) == mp3_src_read( ptr_file, hdr, sizeof( hdr ) ) ) &&
+    ( 'I' == hdr[0] ) && ( 'D' == hdr[1] ) && ( '3' == hdr[2] ) )
+    {
+    // Sync safe size, 7 bits per byte, excludes the header
+    size = ( (INT32U)( hdr[6] & 0x7F ) << 21 ) |
+           ( (INT32U)( hdr[7] & 0x7F ) << 14 ) |
+           ( (INT32U)( hdr[8] & 0x7F ) << 7  ) |
+           ( (INT32U)( hdr[9] & 0x7F ) );
+    size += sizeof( hdr );
+
+    // Footer present
+    if( hdr[5] & 0x10 )
+        {
+        size += sizeof( hdr );
+        }
+    }
+
+return size;
+
+} /* mp3_frame_get_id3v2_size() */
+
+/**
+    Check whether a file is a WAV file
+
+    The file is left at an unknown position.
+
+    @return Returns TRUE if the file has a WAV header
+*/
+BOOLEAN mp3_frame_is_wav
+    (
+    mp3_src_type* ptr_file
+    )
+{
+wav_hdr_type wav;
+
+return parse_wav( ptr_file, &wav );
+
+} /* mp3_frame_is_wav() */
+
+/**
+    Find the audio of a file
+
+    Skips any ID3v2 tag, and anything else up to the
+    first frame header, and leaves out any ID3v1 or APE
+    tag at the end of the file, so that only the audio
+    need be streamed to the decoder. Only a small buffer
+    of its own is used, so that a queued file can be
+    looked at while the playing one is being scanned.
+    The audio of a WAV file runs from the start of the
+    file, as the decoder needs the header, to the end of
+    its data chunk. The file is left at an unknown
+    position.
+
+    @return Returns TRUE if a frame header was found
+            within MP3_FRAME_SYNC_SEARCH_MAX bytes of
+            the start of the audio, or a WAV header
+*/
+BOOLEAN mp3_frame_find_audio
+    (
+    mp3_src_type*   ptr_file,
+    INT32U*         ptr_start,
+    INT32U*         ptr_end
+    )
+{
+INT8U           buf[MP3_FRAME_SYNC_READ_SIZE];
+frame_hdr_type  frame;
+wav_hdr_type    wav;
+INT32U          search_end;
+INT32U          pos;
+int             len;
+int             i;
+
+if( parse_wav( ptr_file, &wav ) )
+    {
+    *ptr_start = 0;
+    *ptr_end   = wav.data_end;
+    return true;
+    }
+
+*ptr_end   = get_audio_end( ptr_file );
+*ptr_start = mp3_frame_get_id3v2_size( ptr_file );
+
+search_end = *ptr_start + MP3_FRAME_SYNC_SEARCH_MAX;
+if( search_end > *ptr_end )
+    {
+    search_end = *ptr_end;
+    }
+
+// Consecutive reads overlap by 3 bytes so that a
+// header across two of them is not missed
+for( pos = *ptr_start; pos + 4 <= search_end; pos += len - 3 )
+    {
+    len = 0;
+    if( mp3_src_seek( ptr_file, pos ) )
+        {
+        len = mp3_src_read( ptr_file, buf, sizeof( buf ) );
+        }
+
+    if( len < 4 )
+        {
+        break;
+        }
+
+    for( i = 0; i + 4 <= len; i++ )
+        {
+        if( parse_hdr( &buf[i], &frame ) )
+            {
+            *ptr_start = pos + i;
+            return true;
+            }
+        }
+    }
+
+return false;
+
+} /* mp3_frame_find_audio() */
+
+/**
+    Read the header of a RIFF/WAVE file
+
+    Walks the chunks after the RIFF header, up to
+    MP3_FRAME_WAV_CHUNK_MAX of them, for the format and
+    then the data. Only the rates and the size of a
+    sample frame are needed, so any format the decoder
+    plays from a WAV file is taken. A data chunk that
+    runs past the end of the file, or has no length as
+    in a file still being written, ends with the file.
+
+    @return Returns TRUE if the file is a WAV file with
+            a format chunk before its data chunk
+*/
+static BOOLEAN parse_wav
+    (
+    mp3_src_type*   ptr_file,
+    wav_hdr_type*   ptr_wav
+    )
+{
+INT8U   hdr[16];
+INT32U  size;
+INT32U  pos;
+INT32U  chunk_len;
+BOOLEAN fmt_found;
+INT8U   i;
+
+size = mp3_src_size( ptr_file );
+
+if( !mp3_src_seek( ptr_file, 0 ) || ( 12 != mp3_src_read( ptr_file, hdr, 12 ) ) ||
+    ( 0 != memcmp( hdr, "RIFF", 4 ) ) || ( 0 != memcmp( &hdr[8], "WAVE", 4 ) ) )
+    {
+    return false;
+    }
+
+fmt_found = false;
+pos       = 12;
+
+for( i = 0; ( i < MP3_FRAME_WAV_CHUNK_MAX ) && ( pos + 8 <= size ); i++ )
+    {
+    if( !mp3_src_seek( ptr_file, pos ) || ( 8 != mp3_src_read( ptr_file, hdr, 8 ) ) )
+        {
+        return false;
+        }
+
+    chunk_len = get_le32( &hdr[4] );
+    pos += 8;
+
+    if( 0 == memcmp( hdr, "data", 4 ) )
+        {
+        if( !fmt_found )
+            {
+            return false;
+            }
+
+        ptr_wav->data_start = pos;
+        ptr_wav->data_end   = ( ( 0 == chunk_len ) || ( chunk_len > size - pos ) ) ? size : ( pos + chunk_len );
+        return true;
+        }
+
+    if( 0 == memcmp( hdr, "fmt ", 4 ) )
+        {
+        if( ( chunk_len < 16 ) || ( 16 != mp3_src_read( ptr_file, hdr, 16 ) ) )
+            {
+            return false;
+            }
+
+        ptr_wav->sample_rate = get_le32( &hdr[4] );
+        ptr_wav->byte_rate   = get_le32( &hdr[8] );
+        ptr_wav->block_align = (INT16U)( hdr[12] | ( hdr[13] << 8 ) );
+        fmt_found = ( 0 != ptr_wav->sample_rate ) && ( 0 != ptr_wav->byte_rate ) && ( 0 != ptr_wav->block_align );
+        }
+
+    if( chunk_len > size - pos )
+        {
+        return false;
+        }
+
+    // Chunks are padded to an even length
+    pos += chunk_len + ( chunk_len & 1 );
+    }
+
+return false;
+
+} /* parse_wav() */
+
+/**
+    Decode a frame header
+
+    @return Returns TRUE if the 4 bytes are a valid
+            frame header
+*/
+static BOOLEAN parse_hdr
+    (
+    const INT8U*    ptr_hdr,
+    frame_hdr_type* ptr_frame
+    )
+{
+INT8U version;
+INT8U layer;
+INT8U kbps_idx;
+INT8U rate_idx;
+INT8U tbl;
+INT8U padding;
+
+if( ( 0xFF != ptr_hdr[0] ) || ( 0xE0 != ( ptr_hdr[1] & 0xE0 ) ) )
+    {
+    return false;
+    }
+
+version  = ( ptr_hdr[1] >> 3 ) & 0x03;
+layer    = 4 - ( ( ptr_hdr[1] >> 1 ) & 0x03 );
+kbps_idx = ( ptr_hdr[2] >> 4 ) & 0x0F;
+rate_idx = ( ptr_hdr[2] >> 2 ) & 0x03;
+padding  = ( ptr_hdr[2] >> 1 ) & 0x01;
+
+// Reserved values, and free format which has no frame length
+if( ( 1 == version ) || ( 4 == layer ) || ( 0 == kbps_idx ) || ( 15 == kbps_idx ) || ( 3 == rate_idx ) )
+    {
+    return false;
+    }
+
+if( 3 == version )
+    {
+    tbl = layer - 1;
+    ptr_frame->sample_rate = frame_rate_tbl[0][rate_idx];
+    }
+else
+    {
+    tbl = ( 1 == layer ) ? 3 : 4;
+    ptr_frame->sample_rate = frame_rate_tbl[( 2 == version ) ? 1 : 2][rate_idx];
+    }
+
+ptr_frame->version      = version;
+ptr_frame->layer        = layer;
+ptr_frame->mono         = ( 0xC0 == ( ptr_hdr[3] & 0xC0 ) );
+ptr_frame->bitrate_kbps = frame_kbps_tbl[tbl][kbps_idx];
+
+if( 1 == layer )
+    {
+    ptr_frame->samples_per_frame = 384;
+    ptr_frame->frame_len = (INT16U)( ( ( 12000UL * ptr_frame->bitrate_kbps ) / ptr_frame->sample_rate + padding ) * 4 );
+    }
+else
+    {
+    ptr_frame->samples_per_frame = ( ( 3 == layer ) && ( 3 != version ) ) ? 576 : 1152;
+    ptr_frame->frame_len = (INT16U)( ( 125UL * ptr_frame->samples_per_frame * ptr_frame->bitrate_kbps ) / ptr_frame->sample_rate + padding );
+    }
+
+return true;
+
+} /* parse_hdr() */
+
+/**
+    Find the first frame header in the buffer
+
+    A header is confirmed by the header of the frame
+    after it, where that is in the buffer.
+
+    @return Returns TRUE if a frame header was found,
+            at *ptr_offset
+*/
+static BOOLEAN find_frame
+    (
+    INT16U          len,
+    INT16U*         ptr_offset,
+    frame_hdr_type* ptr_frame
+    )
+{
+frame_hdr_type  next_frame;
+INT16U          i;
+
+for( i = 0; i + 4 <= len; i++ )
+    {
+    if( parse_hdr( &frame_wksp.buf[i], ptr_frame ) &&
+        ( ( i + ptr_frame->frame_len + 4 > len ) || parse_hdr( &frame_wksp.buf[i + ptr_frame->frame_len], &next_frame ) ) )
+        {
+        *ptr_offset = i;
+        return true;
+        }
+    }
+
+return false;
+
+} /* find_frame() */
+
+/**
+    Read a Xing/Info or VBRI header from the first frame
+
+    Sets the frame count, duration and TOC if found.
+*/
+static void parse_vbr_hdr
+    (
+    mp3_src_type*           ptr_file,
+    INT32U                  frame_pos,
+    const frame_hdr_type*   ptr_frame
+    )
+{
+INT8U*      ptr;
+INT16U      len;
+INT16U      offset;
+INT32U      flags;
+INT32U      frame_cnt;
+INT32U      bytes;
+INT16U      entries;
+INT16U      scale;
+INT16U      entry_size;
+INT16U      entry_frames;
+INT16U      step;
+INT32U      pos;
+INT32U      delta;
+INT16U      i;
+INT16U      j;
+
+if( !mp3_src_seek( ptr_file, frame_pos ) )
+    {
+    return;
+    }
+
+len = read_buf( ptr_file );
+
+// The Xing header follows the side information
+if( 3 == ptr_frame->version )
+    {
+    offset = ptr_frame->mono ? ( 4 + 17 ) : ( 4 + 32 );
+    }
+else
+    {
+    offset = ptr_frame->mono ? ( 4 + 9 ) : ( 4 + 17 );
+    }
+
+ptr = &frame_wksp.buf[offset];
+
+if( ( offset + 8 <= len ) &&
+    ( ( 0 == memcmp( ptr, "Xing", 4 ) ) || ( 0 == memcmp( ptr, "Info", 4 ) ) ) )
+    {
+    flags     = get_be32( &ptr[4] );
+    ptr      += 8;
+    frame_cnt = 0;
+    bytes     = frame_wksp.audio_end - frame_pos;
+
+    if( flags & 0x01 )
+        {
+        frame_cnt = get_be32( ptr );
+        ptr += 4;
+        }
+    if( flags & 0x02 )
+        {
+        bytes = get_be32( ptr );
+        ptr += 4;
+        }
+    if( ( flags & 0x04 ) && ( 0 != frame_cnt ) && ( ptr + 100 <= &frame_wksp.buf[len] ) )
+        {
+        // Entry i is the offset at i percent of the duration, in 1/256ths of the file
+        for( i = 0; i < MP3_FRAME_TOC_CNT; i++ )
+            {
+            frame_wksp.toc[i] = frame_pos + ( ( (INT32U)ptr[i * 100 / MP3_FRAME_TOC_CNT] * bytes ) >> 8 );
+            }
+        frame_wksp.toc_cnt = MP3_FRAME_TOC_CNT;
+        }
+
+    set_duration( frame_cnt );
+    frame_wksp.toc_step_ms = frame_wksp.duration_ms / MP3_FRAME_TOC_CNT;
+    return;
+    }
+
+// The VBRI header is always 32 bytes after the frame header
+ptr = &frame_wksp.buf[4 + 32];
+
+if( ( 4 + 32 + 26 <= len ) && ( 0 == memcmp( ptr, "VBRI", 4 ) ) )
+    {
+    frame_cnt  = get_be32( &ptr[14] );
+    entries    = ( (INT16U)ptr[18] << 8 ) | ptr[19];
+    scale      = ( (INT16U)ptr[20] << 8 ) | ptr[21];
+    entry_size = ( (INT16U)ptr[22] << 8 ) | ptr[23];
+    entry_frames = ( (INT16U)ptr[24] << 8 ) | ptr[25];
+
+    set_duration( frame_cnt );
+
+    if( ( 0 == entries ) || ( 0 == entry_size ) || ( entry_size > 4 ) || ( 0 == entry_frames ) )
+        {
+        return;
+        }
+
+    // Entries hold the size of each step, keep every
+    // step'th sum so the table fits in the TOC
+    step = ( entries + MP3_FRAME_TOC_CNT - 1 ) / MP3_FRAME_TOC_CNT;
+    ptr  = &ptr[26];
+    pos  = frame_pos;
+
+    frame_wksp.toc_step_ms = (INT32U)( ( (uint64_t)step * entry_frames * frame_wksp.samples_per_frame * 1000 ) /
+                                       frame_wksp.sample_rate );
+
+    for( i = 0; ( i < entries ) && ( ( i / step ) < MP3_FRAME_TOC_CNT ); i++ )
+        {
+        if( ptr + entry_size > &frame_wksp.buf[len] )
+            {
+            // Table does not fit in the buffer, do without it
+            frame_wksp.toc_cnt = 0;
+            break;
+            }
+
+        if( 0 == ( i % step ) )
+            {
+            frame_wksp.toc[i / step] = pos;
+            frame_wksp.toc_cnt = (INT8U)( i / step ) + 1;
+            }
+
+        delta = 0;
+        for( j = 0; j < entry_size; j++ )
+            {
+            delta = ( delta << 8 ) | *ptr++;
+            }
+        pos += delta * scale;
+        }
+    }
+
+} /* parse_vbr_hdr() */
+
+/**
+    Read the buffer full from the file position
+
+    @return Returns the number of bytes read, 0 on an
+            error
+*/
+static INT16U read_buf
+    (
+    mp3_src_type* ptr_file
+    )
+{
+int len;
+
+len = mp3_src_read( ptr_file, frame_wksp.buf, MP3_FRAME_BUF_SIZE );
+
+return ( len > 0 ) ? (INT16U)len : 0;
+
+} /* read_buf() */
+
+/**
+    Get a byte of the file for the index scan
+
+    Reads the sector holding pos into the scan buffer
+    if it is not there already.
+
+    @return Returns FALSE past the end of the audio
+*/
+static BOOLEAN scan_get_byte
+    (
+    INT32U  pos,
+    INT8U*  ptr_byte
+    )
+{
+INT32U  base;
+int     len;
+
+if( pos >= frame_wksp.audio_end )
+    {
+    return false;
+    }
+
+if( ( pos < frame_wksp.buf_base ) || ( pos >= frame_wksp.buf_base + frame_wksp.buf_len ) )
+    {
+    base = pos & ~( (INT32U)MP3_FRAME_BUF_SIZE - 1 );
+    len  = 0;
+
+    if( mp3_src_seek( &frame_wksp.scan_file, base ) )
+        {
+        len = mp3_src_read( &frame_wksp.scan_file, frame_wksp.buf, MP3_FRAME_BUF_SIZE );
+        }
+
+    frame_wksp.buf_base = base;
+    frame_wksp.buf_len  = ( len > 0 ) ? (INT16U)len : 0;
+
+    if( pos >= frame_wksp.buf_base + frame_wksp.buf_len )
+        {
+        return false;
+        }
+    }
+
+*ptr_byte = frame_wksp.buf[pos - frame_wksp.buf_base];
+return true;
+
+} /* scan_get_byte() */
+
+/**
+    Count a frame found by the index scan
+
+    The index keeps every idx_interval'th frame. When
+    it is full every other entry is dropped and the
+    interval doubled.
+*/
+static void scan_add_frame
+    (
+    INT32U  pos
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT16U      i;
+
+if( 0 == ( frame_wksp.scan_frames % frame_wksp.idx_interval ) )
+    {
+    if( MP3_FRAME_IDX_CNT == frame_wksp.idx_cnt )
+        {
+        OS_ENTER_CRITICAL();
+        for( i = 0; i < MP3_FRAME_IDX_CNT / 2; i++ )
+            {
+            frame_wksp.idx[i] = frame_wksp.idx[2 * i];
+            }
+        frame_wksp.idx_cnt       = MP3_FRAME_IDX_CNT / 2;
+        frame_wksp.idx_interval *= 2;
+        OS_EXIT_CRITICAL();
+        }
+
+    if( 0 == ( frame_wksp.scan_frames % frame_wksp.idx_interval ) )
+        {
+        frame_wksp.idx[frame_wksp.idx_cnt] = pos;
+        frame_wksp.idx_cnt++;
+        }
+    }
+
+frame_wksp.scan_frames++;
+
+} /* scan_add_frame() */
+
+/**
+    Start the scan on a handle to fname
+
+    Starts with the cluster map, from the start of the
+    audio found by the caller.
+*/
+static void scan_open
+    (
+    const char* fname
+    )
+{
+
+// Entry 0 is the start of the file, which needs no map
+frame_wksp.map_step = ( frame_wksp.audio_end / MP3_FRAME_MAP_CNT ) + 1;
+frame_wksp.map[0]   = 0;
+frame_wksp.map_cnt  = 1;
+
+if( mp3_src_open( &frame_wksp.scan_file, fname ) )
+    {
+    mp3_src_set_range( &frame_wksp.scan_file, frame_wksp.audio_start, frame_wksp.audio_end );
+    mp3_src_set_streaming( &frame_wksp.scan_file );
+    frame_wksp.scan_pos     = frame_wksp.audio_start;
+    frame_wksp.scan_frames  = 0;
+    frame_wksp.buf_base     = 0;
+    frame_wksp.buf_len      = 0;
+    frame_wksp.idx_interval = 1;
+    frame_wksp.idx_cnt      = 0;
+    frame_wksp.map_done     = false;
+    frame_wksp.scan_active  = true;
+    }
+
+} /* scan_open() */
+
+/**
+    Map the next clusters of the file
+
+    Each seek of the scan handle walks the cluster chain
+    on from the previous one, so the whole map costs a
+    single walk of the chain.
+*/
+static void scan_map
+    ( void )
+{
+INT8U i;
+
+for( i = 0; ( i < MP3_FRAME_MAP_STEPS ) && ( frame_wksp.map_cnt < MP3_FRAME_MAP_CNT ); i++ )
+    {
+    if( !mp3_src_seek( &frame_wksp.scan_file, frame_wksp.map_cnt * frame_wksp.map_step ) )
+        {
+        break;
+        }
+
+    frame_wksp.map[frame_wksp.map_cnt] = mp3_src_get_hint( &frame_wksp.scan_file );
+    frame_wksp.map_cnt++;
+    }
+
+// Done, or the map ends where the seek failed
+if( i < MP3_FRAME_MAP_STEPS )
+    {
+    frame_wksp.map_done = true;
+    }
+
+} /* scan_map() */
+
+/**
+    Map a time to an offset with the TOC
+
+    Interpolates between the TOC entries either side.
+
+    @return Returns the offset
+*/
+static INT32U toc_get_pos
+    (
+    INT32U ms
+    )
+{
+INT32U  toc_ms;
+INT32U  pos;
+INT16U  i;
+
+i = (INT16U)( ms / frame_wksp.toc_step_ms );
+if( i >= frame_wksp.toc_cnt )
+    {
+    i = frame_wksp.toc_cnt - 1;
+    }
+
+toc_ms = ms - ( i * frame_wksp.toc_step_ms );
+pos    = frame_wksp.toc[i];
+if( ( i + 1 < frame_wksp.toc_cnt ) && ( toc_ms < frame_wksp.toc_step_ms ) )
+    {
+    pos += (INT32U)( ( (uint64_t)( frame_wksp.toc[i + 1] - frame_wksp.toc[i] ) * toc_ms ) / frame_wksp.toc_step_ms );
+    }
+
+return pos;
+
+} /* toc_get_pos() */
+
+/**
+    Seek a file from the nearest mapped cluster
+
+    @return Returns TRUE if the file was positioned
+*/
+static BOOLEAN seek_near
+    (
+    mp3_src_type*   ptr_file,
+    INT32U          pos
+    )
+{
+INT16U i;
+
+if( 0 == frame_wksp.map_cnt )
+    {
+    return mp3_src_seek( ptr_file, pos );
+    }
+
+i = (INT16U)( pos / frame_wksp.map_step );
+if( i >= frame_wksp.map_cnt )
+    {
+    i = frame_wksp.map_cnt - 1;
+    }
+
+return mp3_src_seek_hint( ptr_file, pos, i * frame_wksp.map_step, frame_wksp.map[i] );
+
+} /* seek_near() */
+
+/**
+    Set the duration from a frame count
+
+    With no frame count the duration is estimated from
+    the average frame size seen by the index scan, or
+    from the bitrate of the first frame before that.
+*/
+static void set_duration
+    (
+    INT32U frame_cnt
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      audio_bytes;
+INT32U      scanned_bytes;
+INT32U      duration_ms;
+
+audio_bytes = frame_wksp.audio_end - frame_wksp.audio_start;
+
+if( 0 != frame_cnt )
+    {
+    duration_ms = (INT32U)( ( (uint64_t)frame_cnt * frame_wksp.samples_per_frame * 1000 ) / frame_wksp.sample_rate );
+    }
+else if( frame_wksp.scan_frames > 0 )
+    {
+    scanned_bytes = frame_wksp.scan_pos - frame_wksp.audio_start;
+    duration_ms   = (INT32U)( ( (uint64_t)frame_wksp.scan_frames * audio_bytes * frame_wksp.samples_per_frame * 1000 ) /
+                              ( (uint64_t)scanned_bytes * frame_wksp.sample_rate ) );
+    }
+else
+    {
+    // bytes * 8 / kbit/s gives ms
+    duration_ms = (INT32U)( ( (uint64_t)audio_bytes * 8 ) / frame_wksp.first_bitrate_kbps );
+    }
+
+OS_ENTER_CRITICAL();
+frame_wksp.frame_cnt   = frame_cnt;
+frame_wksp.duration_ms = duration_ms;
+OS_EXIT_CRITICAL();
+
+} /* set_duration() */
+
+/**
+    Read a big endian 32 bit value
+
+    @return Returns the value
+*/
+static INT32U get_be32
+    (
+    const INT8U* ptr
+    )
+{
+
+return ( (INT32U)ptr[0] << 24 ) | ( (INT32U)ptr[1] << 16 ) | ( (INT32U)ptr[2] << 8 ) | ptr[3];
+
+} /* get_be32() */
+
+/**
+    Read a little endian 32 bit value
+
+    @return Returns the value
+*/
+static INT32U get_le32
+    (
+    const INT8U* ptr
+    )
+{
+
+return ( (INT32U)ptr[3] << 24 ) | ( (INT32U)ptr[2] << 16 ) | ( (INT32U)ptr[1] << 8 ) | ptr[0];
+
+} /* get_le32() */
+
+/**
+    Get the end of the audio of a file
+
+    An ID3v1 tag is the last 128 bytes of a file and
+    starts with TAG. An APEv2 tag ends in a 32 byte
+    footer starting with APETAGEX, which may come before
+    an ID3v1 tag. The footer gives the size of the tag
+    without its header, and flags whether there is one.
+
+    @return Returns the offset after the last byte
+            that is not a trailing tag
+*/
+static INT32U get_audio_end
+    (
+    mp3_src_type* ptr_file
+    )
+{
+INT8U   tag[32];
+INT32U  end;
+INT32U  ape_size;
+
+end = mp3_src_size( ptr_file );
+
+if( ( end >= 128 ) && mp3_src_seek( ptr_file, end - 128 ) &&
+    ( 3 == mp3_src_read( ptr_file, tag, 3 ) ) && ( 0 == memcmp( tag, "TAG", 3 ) ) )
+    {
+    end -= 128;
+    }
+
+if( ( end >= sizeof( tag ) ) && mp3_src_seek( ptr_file, end - sizeof( tag ) ) &&
+    ( sizeof( tag ) == mp3_src_read( ptr_file, tag, sizeof( tag ) ) ) && ( 0 == memcmp( tag, "APETAGEX", 8 ) ) )
+    {
+    ape_size = get_le32( &tag[12] );
+
+    // Header present
+    if( tag[23] & 0x80 )
+        {
+        ape_size += sizeof( tag );
+        }
+
+    if( ape_size <= end )
+        {
+        end -= ape_size;
+        }
+    }
+
+return end;
+
+} /* get_audio_end() */
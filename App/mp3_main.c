@@ -7,8 +7,19 @@
         This is the main task that handles various events
     associated with operation of an MP3 player. This task
     is also responsible for setting up the MP3 stream,
-    reading a buffer of MP3 data from the MP3 file and
-    seding that buffer to the MP3 streaming thread.
+    and for keeping the MP3 stream ring topped up with
+    data read ahead from the MP3 file by the MP3
+    prefetch task.
+
+        Files are named as playback sources, see
+    mp3_src.c, so a file can be on the SD card or an
+    MP3 array in the flash.
+
+        A file queued to play next is opened while the
+    current one plays and read on from its end, so the
+    decoder gets one continuous stream. The playing file
+    only changes over here once the streaming thread
+    reaches the start of the queued one.
 
     Copyright (c) 2016 Vimal Mehta
 */
@@ -34,16 +45,29 @@ enum
     EVNT_PLAY_RESUME        = 0x08,
     EVNT_BUFFER_EMPTY       = 0x10,
     EVNT_RX_MSG             = 0x20,
+    EVNT_PLAY_SEEK          = 0x40,
+    EVNT_QUEUE_NEXT         = 0x80,
+    EVNT_TRACK_START        = 0x100,
 
     EVNT_PLAY_CNT
     };
 
+// Playback status events, set for as long as the status holds
+enum
+    {
+    STS_EVNT_OFF            = 0x01,
+    };
+
 // Workspace type
 typedef struct
     {
     BOOLEAN                 file_hndl_valid;
-    File                    file_hndl;
+    mp3_src_type            file_hndl[MP3_MAIN_FILE_CNT];
+    INT8U                   cur_file;           // Index of the playing file in file_hndl
+    BOOLEAN                 next_file_valid;    // The other file is open and queued
+    INT16U                  track_num;          // Number of queued tracks that have started
     MP3_playback_sts_type   cur_playback_status;
+    INT32U                  seek_ms;            // Time to seek to on EVNT_PLAY_SEEK
     } main_mp3_wksp_type;
 
 // Message type
@@ -57,11 +81,15 @@ typedef struct
 */
 static OS_STK                   main_mp3_stack[APP_CFG_TASK_START_STK_SIZE];        // MP3 main stack
 static char                     cur_mp3_plbk_fname[MP3_PLAYBACK_FILE_NAME_LEN_MAX]; // Name of the playback file name
+static char                     next_mp3_plbk_fname[MP3_PLAYBACK_FILE_NAME_LEN_MAX];// Name of the queued file, empty if none
 static OS_FLAG_GRP              *rx_events_mp3 = 0;                                 // Event flags
+static OS_FLAG_GRP              *sts_events_mp3 = 0;                                // Playback status events
 static OS_EVENT *               intf_smphr_mp3;                                     // Sempahore to protect access to global variables
-static INT8U                    strm_buff[64];                                      // Buffer to copy MP3 data from MP3 file
 static main_mp3_wksp_type       wksp_mp3;                                           // Workspace
 static OS_EVENT *               main_mp3_msg_box;                                   // Message box
+static mp3_frame_info_type      main_frame_info;                                    // Frame layout to or from the metadata cache
+static mp3_src_type             main_plugin_src;                                    // File a plugin is loaded from
+static INT16U                   main_plugin_image[MP3_PLUGIN_WORDS_MAX];            // Plugin loaded from a file
 
 /**
     Static Procedures
@@ -94,9 +122,7 @@ static void set_playback_fname
     );
 
 static BOOLEAN add_data_to_buffer
-    (
-    INT32U* ptr_size
-    );
+    ( void );
 
 static BOOLEAN start_playback
     ( void );
@@ -104,6 +130,35 @@ static BOOLEAN start_playback
 static void stop_playback
     ( void );
 
+static void seek_playback
+    ( void );
+
+static void queue_next_playback
+    ( void );
+
+static void start_next_playback
+    ( void );
+
+static void open_prefetch
+    ( void );
+
+static BOOLEAN open_file
+    (
+    mp3_src_type*   ptr_file,
+    const char*     ptr_file_name
+    );
+
+static void open_frames
+    (
+    mp3_src_type*   ptr_file,
+    const char*     ptr_file_name
+    );
+
+static void save_frames
+    (
+    const char* ptr_file_name
+    );
+
 static BOOLEAN is_file_loaded
     (
     void
@@ -136,9 +191,17 @@ intf_smphr_mp3  = OSSemCreate( 1 );
 // Create the event flags for this thread
 rx_events_mp3 = OSFlagCreate( 0x0, &err );
 
+// Create the status events, playback starts off
+sts_events_mp3 = OSFlagCreate( STS_EVNT_OFF, &err );
+
 // Initalize the global variables
 cur_mp3_plbk_fname[0]           = '\0';
+next_mp3_plbk_fname[0]          = '\0';
 wksp_mp3.file_hndl_valid        = false;
+wksp_mp3.cur_file               = 0;
+wksp_mp3.next_file_valid        = false;
+wksp_mp3.track_num              = 0;
+wksp_mp3.seek_ms                = 0;
 wksp_mp3.cur_playback_status    = MP3_PLAYBACK_STS_OFF;
 
 // Create the MP3 main thread
@@ -153,6 +216,15 @@ OSTaskCreate
 // Power up the MP3 streaming task
 mp3_strm_pwrp();
 
+// Power up the MP3 prefetch task
+mp3_prefetch_pwrp();
+
+// Power up the metadata cache
+mp3_meta_pwrp();
+
+// Power up the recording task
+mp3_record_pwrp();
+
 } /* MP3_pwrp() */
 
 /**
@@ -202,6 +274,13 @@ return get_playback_status();
     The file should be loaded prior to calling
     this function.
 
+    The file name may start with a source prefix,
+    sd: for the SD card, the default, or rom: for
+    an MP3 array in the flash, for example
+    sd:/TRACK.MP3 or rom:test_song. The name uart:
+    plays what a host streams over the UART, see
+    mp3_src.c, and has neither a duration nor seeking.
+
     @return Returns if the playbackw was started
             successfully else returns false.
 */
@@ -213,7 +292,8 @@ BOOLEAN MP3_playback_start
 BOOLEAN     success;
 INT8U       err;
 
-success = ( ptr_file_name != NULL );
+// The decoder and the card are taken while recording
+success = ( ptr_file_name != NULL ) && !MP3_record_is_active();
 
 if( success )
     {
@@ -233,6 +313,7 @@ if( success )
 
     if( success )
         {
+        mp3_strm_stats_ttfa_mark( MP3_TTFA_MARK_START );
         set_playback_status( MP3_PLAYBACK_STS_INIT );
         send_evnt( EVNT_PLAY_START );
         }
@@ -268,6 +349,39 @@ return success;
 
 } /* MP3_playback_stop() */
 
+/**
+    Stop an MP3 playback and wait for it to stop
+
+    This function stops an ongoing playback like
+    MP3_playback_stop() and then blocks until the
+    MP3 main thread has cancelled the decoder and
+    closed the files, or until the timeout.
+
+    @return Returns TRUE if playback is off, else
+            FALSE if it did not stop in time.
+*/
+BOOLEAN MP3_playback_stop_wait
+    (
+    INT16U timeout_ms
+    )
+{
+INT8U   err;
+INT16U  ticks;
+
+(void)MP3_playback_stop();
+
+ticks = (INT16U)( ( (INT32U)timeout_ms * OS_TICKS_PER_SEC + 999 ) / 1000 );
+if( 0 == ticks )
+    {
+    ticks = 1;
+    }
+
+OSFlagPend( sts_events_mp3, STS_EVNT_OFF, OS_FLAG_WAIT_SET_ALL, ticks, &err );
+
+return ( OS_ERR_NONE == err );
+
+} /* MP3_playback_stop_wait() */
+
 /**
     Pause an MP3 playback
 
@@ -328,9 +442,291 @@ if( MP3_PLAYBACK_STS_PAUSE == sts )
 return success;
 } /* MP3_playback_resume() */
 
+/**
+    Seek within an MP3 playback
+
+    This function is used to move an ongoing or
+    paused playback to a time in the file. The
+    playback carries on from the first frame at or
+    after that time, or from the end of the file if
+    the time is past it.
+
+    @return Returns if the seek was requested
+            successfully else returns false.
+*/
+BOOLEAN MP3_playback_seek
+    (
+    INT16U scnds
+    )
+{
+BOOLEAN                 success;
+MP3_playback_sts_type   sts;
+INT8U                   err;
+
+sts = get_playback_status();
+
+success = false;
+
+if( ( MP3_PLAYBACK_STS_INIT         == sts ) ||
+    ( MP3_PLAYBACK_STS_IN_PROGRESS  == sts ) ||
+    ( MP3_PLAYBACK_STS_PAUSE        == sts )
+  )
+    {
+    OSSemPend( intf_smphr_mp3, 0, &err );
+    wksp_mp3.seek_ms = (INT32U)scnds * 1000;
+    OSSemPost( intf_smphr_mp3 );
+
+    send_evnt( EVNT_PLAY_SEEK );
+    success = true;
+    }
+
+return success;
+
+} /* MP3_playback_seek() */
+
+/**
+    Set the playback speed
+
+    This function is used to play faster, for
+    spoken word content. The speed is a whole
+    multiple of normal, up to MP3_PLAYBACK_SPEED_MAX,
+    as that is what the decoder supports. It takes
+    effect at once without restarting the playback,
+    and holds for the playbacks to come.
+
+    @return Returns if the speed was set
+            successfully else returns false.
+*/
+BOOLEAN MP3_playback_set_speed
+    (
+    INT8U speed
+    )
+{
+
+if( ( 0 == speed ) || ( speed > MP3_PLAYBACK_SPEED_MAX ) )
+    {
+    return false;
+    }
+
+mp3_strm_set_speed( speed );
+
+return true;
+
+} /* MP3_playback_set_speed() */
+
+/**
+    Get the playback speed
+
+    @return Returns the speed, a multiple of normal
+*/
+INT8U MP3_playback_get_speed
+    ( void )
+{
+
+return mp3_strm_get_speed();
+
+} /* MP3_playback_get_speed() */
+
+/**
+    Set the decoder plugin
+
+    This function is used to give the decoder a
+    plugin or patch built into the flash, in the
+    compressed format VLSI publishes them in. The
+    image is uploaded at every playback start from
+    the next one on, and must stay put. NULL drops
+    the plugin.
+*/
+void MP3_plugin_set_image
+    (
+    const INT16U*   ptr_image,
+    INT32U          words
+    )
+{
+
+mp3_strm_set_plugin( ptr_image, words );
+
+} /* MP3_plugin_set_image() */
+
+/**
+    Load the decoder plugin from a file
+
+    This function is used to give the decoder a
+    plugin or patch from a file, on the SD card or
+    in the flash, see mp3_src.c. The file holds the
+    compressed image as little endian words, the
+    way the MCU keeps them, so it is read straight
+    into the image buffer. The plugin set before is
+    dropped first, as the buffer may be holding it.
+    The decoder may be reset, and the plugin uploaded
+    from the buffer, at any time during a playback, so
+    the buffer is not touched while one is active.
+
+    @return Returns false if a playback is active, or
+            if the file could not be read or is too
+            long, no plugin is set then.
+*/
+BOOLEAN MP3_plugin_load
+    (
+    const char* ptr_file_name
+    )
+{
+BOOLEAN                 success;
+INT32U                  size;
+MP3_playback_sts_type   sts;
+
+success = false;
+size    = 0;
+
+sts = get_playback_status();
+
+if( ( MP3_PLAYBACK_STS_OFF  == sts ) ||
+    ( MP3_PLAYBACK_STS_DONE == sts ) )
+    {
+    mp3_strm_set_plugin( NULL, 0 );
+
+    mp3_prefetch_lock();
+
+    if( mp3_src_open( &main_plugin_src, ptr_file_name ) )
+        {
+        size = mp3_src_size( &main_plugin_src );
+
+        if( ( 0 != size ) &&
+            ( 0 == ( size % sizeof( INT16U ) ) ) &&
+            ( size <= sizeof( main_plugin_image ) ) &&
+            ( (int)size == mp3_src_read( &main_plugin_src, (INT8U*)main_plugin_image, (INT16U)size ) ) )
+            {
+            success = true;
+            }
+
+        mp3_src_close( &main_plugin_src );
+        }
+
+    mp3_prefetch_unlock();
+
+    if( success )
+        {
+        mp3_strm_set_plugin( main_plugin_image, size / sizeof( INT16U ) );
+        }
+    }
+
+return success;
+
+} /* MP3_plugin_load() */
+
+/**
+    Get the decoder plugin upload counters
+
+    The counters are kept over the playbacks, the
+    times are of the last upload.
+*/
+void MP3_plugin_get_stats
+    (
+    MP3_plugin_stats_type* ptr_stats
+    )
+{
+
+mp3_strm_util_get_plugin_stats( ptr_stats );
+
+} /* MP3_plugin_get_stats() */
+
+/**
+    Queue the MP3 file to play next
+
+    This function is used to give the file that
+    follows on from the current playback with no
+    gap. Only one file can be queued at a time.
+
+    @return Returns if the file was queued
+            successfully else returns false.
+*/
+BOOLEAN MP3_playback_queue_next
+    (
+    const char* ptr_file_name
+    )
+{
+BOOLEAN                 success;
+MP3_playback_sts_type   sts;
+INT8U                   err;
+
+sts = get_playback_status();
+
+success = false;
+
+if( ( NULL != ptr_file_name ) &&
+    ( strlen( ptr_file_name ) < MP3_PLAYBACK_FILE_NAME_LEN_MAX ) &&
+    ( ( MP3_PLAYBACK_STS_INIT         == sts ) ||
+      ( MP3_PLAYBACK_STS_IN_PROGRESS  == sts ) ||
+      ( MP3_PLAYBACK_STS_PAUSE        == sts ) )
+  )
+    {
+    OSSemPend( intf_smphr_mp3, 0, &err );
+    if( '\0' == next_mp3_plbk_fname[0] )
+        {
+        strcpy( next_mp3_plbk_fname, ptr_file_name );
+        success = true;
+        }
+    OSSemPost( intf_smphr_mp3 );
+
+    if( success )
+        {
+        send_evnt( EVNT_QUEUE_NEXT );
+        }
+    }
+
+return success;
+
+} /* MP3_playback_queue_next() */
+
+/**
+    Is an MP3 file queued to play next
+
+    @return Returns TRUE if a file is queued and
+            has not started playing yet
+*/
+BOOLEAN MP3_playback_is_next_queued
+    ( void )
+{
+INT8U   err;
+BOOLEAN queued;
+
+OSSemPend( intf_smphr_mp3, 0, &err );
+queued = ( '\0' != next_mp3_plbk_fname[0] );
+OSSemPost( intf_smphr_mp3 );
+
+return queued;
+
+} /* MP3_playback_is_next_queued() */
+
+/**
+    Get the number of queued tracks that have
+    started playing
+
+    Changes each time playback moves on to a
+    queued file.
+
+    @return Returns the track number
+*/
+INT16U MP3_playback_get_track_num
+    ( void )
+{
+INT8U   err;
+INT16U  track_num;
+
+OSSemPend( intf_smphr_mp3, 0, &err );
+track_num = wksp_mp3.track_num;
+OSSemPost( intf_smphr_mp3 );
+
+return track_num;
+
+} /* MP3_playback_get_track_num() */
+
 /**
     Get the playback time in seconds
 
+    Reads the decode time cached by the streaming
+    thread, so it is cheap to call.
+
     @return Returns the playback time in
             seconds
 */
@@ -349,6 +745,146 @@ else
 
 } /* MP3_playback_get_time_scnds() */
 
+/**
+    Get the playback time in milliseconds
+
+    Interpolated between the reads of the decoder,
+    for a smooth display.
+
+    @return Returns the playback time in
+            milliseconds
+*/
+INT32U MP3_playback_get_time_ms
+    ( void )
+{
+
+if( MP3_PLAYBACK_STS_OFF != get_playback_status() )
+    {
+    return mp3_strm_get_decode_time_ms();
+    }
+else
+    {
+    return 0;
+    }
+
+} /* MP3_playback_get_time_ms() */
+
+/**
+    Get the duration of the playback
+
+    Known once the file is opened if it has a VBR
+    header, otherwise estimated until the file has
+    been indexed in the background.
+
+    @return Returns the duration in seconds, 0 if
+            unknown
+*/
+INT16U MP3_playback_get_duration_scnds
+    ( void )
+{
+
+if( MP3_PLAYBACK_STS_OFF != get_playback_status() )
+    {
+    return (INT16U)( ( mp3_frame_get_duration_ms() + 500 ) / 1000 );
+    }
+else
+    {
+    return 0;
+    }
+
+} /* MP3_playback_get_duration_scnds() */
+
+/**
+    Get the stream buffering
+
+    Reports the bitrate the decoder found in the
+    stream and the buffering chosen for it.
+
+    @return None
+*/
+void MP3_playback_get_stream_info
+    (
+    MP3_stream_info_type* ptr_info
+    )
+{
+
+mp3_strm_ctrl_get_info( ptr_info );
+
+} /* MP3_playback_get_stream_info() */
+
+/**
+    Get the stream health counters
+
+    Reports the throughput, decoder and buffering
+    counters collected since the stream was opened.
+
+    @return None
+*/
+void MP3_get_stream_stats
+    (
+    MP3_stream_stats_type* ptr_stats
+    )
+{
+
+mp3_strm_get_stats( ptr_stats );
+
+} /* MP3_get_stream_stats() */
+
+/**
+    Mark a touch that may start playback
+
+    Called by the front end as it sees a touch, so
+    that the time to first audio of a playback the
+    touch starts is timed from the touch.
+
+    @return None
+*/
+void MP3_ttfa_mark_touch
+    ( void )
+{
+
+mp3_strm_stats_ttfa_mark( MP3_TTFA_MARK_TOUCH );
+
+} /* MP3_ttfa_mark_touch() */
+
+/**
+    Get the time to first audio
+
+    Reports the times from the touch, or the call,
+    that started the last playback to each step
+    towards its first sound.
+
+    @return None
+*/
+void MP3_get_ttfa
+    (
+    MP3_ttfa_type* ptr_ttfa
+    )
+{
+
+mp3_strm_stats_ttfa_get( ptr_ttfa );
+
+} /* MP3_get_ttfa() */
+
+/**
+    Get the name of an MP3 file built into the flash
+
+    The names have the rom: prefix and can be played
+    with no SD card.
+
+    @return Returns the name of file idx, NULL if
+            there are fewer files
+*/
+const char* MP3_playback_get_rom_name
+    (
+    INT8U idx
+    )
+{
+
+return mp3_src_get_rom_name( idx );
+
+} /* MP3_playback_get_rom_name() */
+
 /**
     MP3 main thread
 
@@ -378,13 +914,18 @@ for(;;)
             }
         }
 
-    // Handle play start evnt
+    // Handle play start evnt, filling the ring and
+    // pre-rolling the decoder before the streaming
+    // thread takes over, then topping the ring up
     if( rx_flags & EVNT_PLAY_START )
         {
         if( start_playback() )
             {
             set_playback_status( MP3_PLAYBACK_STS_IN_PROGRESS );
             mp3_strm_open();
+            (void)add_data_to_buffer();
+            (void)mp3_strm_preroll();
+            rx_flags |= EVNT_BUFFER_EMPTY;
             }
         else
             {
@@ -417,18 +958,42 @@ for(;;)
             }
         }
 
-    // Handle a buffer data event
-    if( rx_flags & EVNT_BUFFER_EMPTY )
+    // Handle a seek event, refilling the flushed
+    // stream unless it is paused
+    if( rx_flags & EVNT_PLAY_SEEK )
         {
-        INT32U   size;
-        size = 0;
-        if( add_data_to_buffer( &size ) )
+        seek_playback();
+        if( MP3_PLAYBACK_STS_IN_PROGRESS == get_playback_status() )
             {
-            mp3_strm_write_data( strm_buff, size );
+            rx_flags |= EVNT_BUFFER_EMPTY;
             }
-        else
+        }
+
+    // Handle a queued file, refilling the stream in
+    // case the current file had been read to its end
+    if( rx_flags & EVNT_QUEUE_NEXT )
+        {
+        queue_next_playback();
+        if( MP3_PLAYBACK_STS_IN_PROGRESS == get_playback_status() )
+            {
+            rx_flags |= EVNT_BUFFER_EMPTY;
+            }
+        }
+
+    // Handle the start of a queued file
+    if( rx_flags & EVNT_TRACK_START )
+        {
+        start_next_playback();
+        }
+
+    // Handle a buffer data event
+    if( rx_flags & EVNT_BUFFER_EMPTY )
+        {
+        // Once the end of the file is reached, wait for
+        // the stream to drain before finishing playback
+        if( !add_data_to_buffer() && ( 0 == mp3_strm_get_buffered_size() ) )
             {
-            mp3_strm_close();
+            mp3_strm_close( true );
             set_playback_status( MP3_PLAYBACK_STS_DONE );
             }
         }
@@ -450,14 +1015,34 @@ void mp3_signal_buffer_empty
     void
     )
 {
-//Only if playback is in progress
-if( MP3_PLAYBACK_STS_IN_PROGRESS  == get_playback_status() )
+// Only if playback is in progress. The status is read
+// without the interface semaphore, which the MP3 main
+// thread may hold while it waits for the drain pass
+// this is called from to stop.
+if( MP3_PLAYBACK_STS_IN_PROGRESS  == wksp_mp3.cur_playback_status )
     {
+    mp3_strm_stats_refill_req();
     send_evnt( EVNT_BUFFER_EMPTY );
     }
 
 } /* mp3_signal_buffer_empty() */
 
+/**
+    Signal that a queued file has started
+
+    This function is called by the streaming thread
+    when it reaches the data of the queued file.
+*/
+void mp3_signal_track_start
+    (
+    void
+    )
+{
+
+send_evnt( EVNT_TRACK_START );
+
+} /* mp3_signal_track_start() */
+
 /**
     Send an event to the MP3 main thread
 
@@ -488,11 +1073,11 @@ static OS_FLAGS wait_for_evnt
 INT8U       err;
 OS_FLAGS    flags;
 
-OSFlagPend( rx_events_mp3, 0xFF, OS_FLAG_WAIT_SET_ANY, 0, &err );
+OSFlagPend( rx_events_mp3, 0xFFFF, OS_FLAG_WAIT_SET_ANY, 0, &err );
 
 flags = rx_events_mp3->OSFlagFlags;
 
-OSFlagPost( rx_events_mp3, 0xFF, OS_FLAG_CLR, &err );
+OSFlagPost( rx_events_mp3, flags, OS_FLAG_CLR, &err );
 
 return flags;
 
@@ -565,6 +1150,9 @@ return ret;
 
 /**
     Set the playback status
+
+    The status events are updated along with it,
+    under the same semaphore, so they always agree.
 */
 static void set_playback_status
     (
@@ -577,6 +1165,8 @@ OSSemPend( intf_smphr_mp3, 0, &err );
 
 wksp_mp3.cur_playback_status = sts;
 
+OSFlagPost( sts_events_mp3, STS_EVNT_OFF, ( MP3_PLAYBACK_STS_OFF == sts ) ? OS_FLAG_SET : OS_FLAG_CLR, &err );
+
 OSSemPost( intf_smphr_mp3 );
 } /* set_playback_status() */
 
@@ -584,12 +1174,13 @@ OSSemPost( intf_smphr_mp3 );
     Start playback
 
     This function is used to open the MP3 file
-    on the SD card and seek to its beginning.
+    from its source and seek to its beginning.
 */
 static BOOLEAN start_playback
     ( void )
 {
 BOOLEAN success;
+INT16U  pcm_kbps;
 INT8U err;
 
 OSSemPend( intf_smphr_mp3, 0, &err );
@@ -598,26 +1189,41 @@ success = false;
 
 if( !wksp_mp3.file_hndl_valid )
     {
-    wksp_mp3.file_hndl = SD.open( cur_mp3_plbk_fname, O_READ );
-
-    if( wksp_mp3.file_hndl.size() > 0 )
+    // The playlist may be filling in the metadata cache
+    mp3_prefetch_lock();
+    if( open_file( &wksp_mp3.file_hndl[wksp_mp3.cur_file], cur_mp3_plbk_fname ) )
         {
-        wksp_mp3.file_hndl.seek( 0 );
+        // Learn the duration and set up seeking
+        open_frames( &wksp_mp3.file_hndl[wksp_mp3.cur_file], cur_mp3_plbk_fname );
+        mp3_src_rewind( &wksp_mp3.file_hndl[wksp_mp3.cur_file] );
         wksp_mp3.file_hndl_valid = true;
+
+        // Set the stream and the read ahead up for the rate
+        // of a WAV file, or back for compressed audio
+        pcm_kbps = mp3_frame_get_pcm_kbps();
+        mp3_strm_set_pcm( pcm_kbps );
+        mp3_prefetch_set_pcm( 0 != pcm_kbps );
         success = true;
         }
     else
         {
-        wksp_mp3.file_hndl.close();
         wksp_mp3.file_hndl_valid = false;
         }
+    mp3_prefetch_unlock();
     }
 else
     {
-    wksp_mp3.file_hndl.seek( 0 );
+    mp3_prefetch_close();
+    mp3_src_rewind( &wksp_mp3.file_hndl[wksp_mp3.cur_file] );
     success = true;
     }
 
+if( success )
+    {
+    mp3_strm_stats_ttfa_mark( MP3_TTFA_MARK_OPEN );
+    open_prefetch();
+    }
+
 OSSemPost( intf_smphr_mp3 );
 
 return success;
@@ -634,13 +1240,29 @@ static void stop_playback
 {
 INT8U err;
 
-mp3_strm_close();
+mp3_strm_close( false );
+
+mp3_prefetch_close();
+
+if( is_file_loaded() )
+    {
+    save_frames( cur_mp3_plbk_fname );
+    }
+
+mp3_frame_close();
 
 OSSemPend( intf_smphr_mp3, 0, &err );
 
-wksp_mp3.file_hndl.close();
+mp3_src_close( &wksp_mp3.file_hndl[wksp_mp3.cur_file] );
 wksp_mp3.file_hndl_valid = false;
 
+if( wksp_mp3.next_file_valid )
+    {
+    mp3_src_close( &wksp_mp3.file_hndl[wksp_mp3.cur_file ^ 1] );
+    wksp_mp3.next_file_valid = false;
+    }
+next_mp3_plbk_fname[0] = '\0';
+
 OSSemPost( intf_smphr_mp3 );
 
 set_playback_status( MP3_PLAYBACK_STS_OFF );
@@ -649,28 +1271,328 @@ set_playback_status( MP3_PLAYBACK_STS_OFF );
 } /* stop_playback() */
 
 /**
-    Add data to buffer
+    Seek playback
 
-    This function is used to read data from the MP3 file
-    and copy it to a buffer so that the buffering thread
-    can stream it to MP3 decoder.
+    This function is used to reposition the MP3 file
+    at the requested time and flush the stream, so that
+    the data read ahead and the data the decoder holds
+    from the old position are not played. The file goes
+    back to its start if the time can not be found.
 */
-static BOOLEAN add_data_to_buffer
+static void seek_playback
+    ( void )
+{
+INT8U   err;
+INT32U  ms;
+
+OSSemPend( intf_smphr_mp3, 0, &err );
+
+if( wksp_mp3.file_hndl_valid )
+    {
+    ms = wksp_mp3.seek_ms;
+
+    mp3_prefetch_close();
+
+    if( !mp3_frame_seek( &wksp_mp3.file_hndl[wksp_mp3.cur_file], &ms ) )
+        {
+        mp3_src_rewind( &wksp_mp3.file_hndl[wksp_mp3.cur_file] );
+        ms = 0;
+        }
+
+    mp3_strm_flush( (INT16U)( ms / 1000 ) );
+
+    open_prefetch();
+    }
+
+OSSemPost( intf_smphr_mp3 );
+
+} /* seek_playback() */
+
+/**
+    Queue the next playback
+
+    This function is used to open the file queued
+    by MP3_playback_queue_next() and hand it to the
+    MP3 prefetch task to read on to. A WAV file is
+    not followed on from, nor follows on, and is
+    played once the playing file is done. Neither is
+    a live source, which can only be open once.
+*/
+static void queue_next_playback
+    ( void )
+{
+INT8U           err;
+mp3_src_type*   ptr_next_file;
+
+OSSemPend( intf_smphr_mp3, 0, &err );
+
+if( wksp_mp3.file_hndl_valid && !wksp_mp3.next_file_valid && ( '\0' != next_mp3_plbk_fname[0] ) )
+    {
+    ptr_next_file = &wksp_mp3.file_hndl[wksp_mp3.cur_file ^ 1];
+
+    // The prefetch task may be using the card
+    mp3_prefetch_lock();
+    if( ( 0 == mp3_frame_get_pcm_kbps() ) && !mp3_src_is_live( &wksp_mp3.file_hndl[wksp_mp3.cur_file] ) &&
+        !mp3_src_name_is_live( next_mp3_plbk_fname ) && open_file( ptr_next_file, next_mp3_plbk_fname ) )
+        {
+        // The decoder only reads a WAV header at the start of
+        // a stream, so a WAV file is left to start on its own
+        if( mp3_frame_is_wav( ptr_next_file ) )
+            {
+            mp3_src_close( ptr_next_file );
+            }
+        else
+            {
+            mp3_src_rewind( ptr_next_file );
+            wksp_mp3.next_file_valid = true;
+            }
+        }
+
+    if( !wksp_mp3.next_file_valid )
+        {
+        next_mp3_plbk_fname[0] = '\0';
+        }
+    mp3_prefetch_unlock();
+
+    if( wksp_mp3.next_file_valid )
+        {
+        mp3_prefetch_queue( ptr_next_file );
+        }
+    }
+else if( !wksp_mp3.file_hndl_valid )
+    {
+    // Nothing playing to follow on from
+    next_mp3_plbk_fname[0] = '\0';
+    }
+
+OSSemPost( intf_smphr_mp3 );
+
+} /* queue_next_playback() */
+
+/**
+    Start the next playback
+
+    This function is used to make the queued file
+    the playing one, once its data has reached the
+    decoder. The previous file is closed and the
+    frame parser moved on to the new one.
+*/
+static void start_next_playback
+    ( void )
+{
+INT8U           err;
+mp3_src_type    frame_file;
+
+OSSemPend( intf_smphr_mp3, 0, &err );
+
+if( wksp_mp3.file_hndl_valid && wksp_mp3.next_file_valid )
+    {
+    mp3_prefetch_lock();
+
+    save_frames( cur_mp3_plbk_fname );
+
+    mp3_src_close( &wksp_mp3.file_hndl[wksp_mp3.cur_file] );
+    wksp_mp3.cur_file ^= 1;
+    wksp_mp3.next_file_valid = false;
+    wksp_mp3.track_num++;
+
+    strncpy( cur_mp3_plbk_fname, next_mp3_plbk_fname, MP3_PLAYBACK_FILE_NAME_LEN_MAX );
+    next_mp3_plbk_fname[0] = '\0';
+
+    // The prefetch task is reading the playing file,
+    // so the frame parser gets a handle of its own
+    if( open_file( &frame_file, cur_mp3_plbk_fname ) )
+        {
+        open_frames( &frame_file, cur_mp3_plbk_fname );
+        mp3_src_close( &frame_file );
+        }
+    else
+        {
+        mp3_frame_close();
+        }
+
+    mp3_prefetch_unlock();
+    }
+
+OSSemPost( intf_smphr_mp3 );
+
+} /* start_next_playback() */
+
+/**
+    Open the prefetch
+
+    This function is used to start reading ahead the
+    playing file from its current position, followed
+    by the queued file from its start. The interface
+    semaphore must be held.
+*/
+static void open_prefetch
+    ( void )
+{
+mp3_src_type* ptr_next_file;
+
+mp3_prefetch_open( &wksp_mp3.file_hndl[wksp_mp3.cur_file] );
+
+if( wksp_mp3.next_file_valid )
+    {
+    ptr_next_file = &wksp_mp3.file_hndl[wksp_mp3.cur_file ^ 1];
+    mp3_src_rewind( ptr_next_file );
+    mp3_prefetch_queue( ptr_next_file );
+    }
+
+} /* open_prefetch() */
+
+/**
+    Open a playback file
+
+    This function is used to open a file from its
+    source and narrow it to its audio, so that an
+    ID3v2 tag, which may hold large pictures, and any
+    trailing tags are not streamed to the decoder. The
+    range of a file in the metadata cache is taken from
+    there instead of the file. The file is left at the
+    start of its audio. The card must only be used with
+    the prefetch file semaphore held. A live source is
+    played as it arrives, tags and all.
+
+    @return Returns TRUE if the file was opened
+*/
+static BOOLEAN open_file
     (
-    INT32U* ptr_size
+    mp3_src_type*   ptr_file,
+    const char*     ptr_file_name
     )
 {
-*ptr_size   = 0;
+INT32U audio_start;
+INT32U audio_end;
 
-if( wksp_mp3.file_hndl.available() )
+if( !mp3_src_open( ptr_file, ptr_file_name ) )
     {
-    INT32U len;
-    len         = wksp_mp3.file_hndl.read( strm_buff, 64 );
-    *ptr_size   = len;
+    return false;
     }
 
-return  ( ( *ptr_size > 0 ) ? true : false );
-}
+if( mp3_src_is_live( ptr_file ) )
+    {
+    return true;
+    }
+
+if( mp3_meta_open( ptr_file, ptr_file_name, &audio_start, &audio_end ) ||
+    mp3_frame_find_audio( ptr_file, &audio_start, &audio_end ) )
+    {
+    mp3_src_set_range( ptr_file, audio_start, audio_end );
+    }
+
+mp3_src_rewind( ptr_file );
+
+return true;
+
+} /* open_file() */
+
+/**
+    Open the frame parser on a playback file
+
+    This function is used to learn the duration of a
+    file opened by open_file() and set up seeking in it,
+    from the metadata cache if the file is in it, else
+    from the file itself. A live source has neither a
+    duration nor seeking, and the frame parser, which
+    opens a file of its own, is kept off it.
+*/
+static void open_frames
+    (
+    mp3_src_type*   ptr_file,
+    const char*     ptr_file_name
+    )
+{
+
+if( mp3_src_is_live( ptr_file ) )
+    {
+    mp3_frame_close();
+    }
+else if( mp3_meta_get_info( ptr_file_name, &main_frame_info ) )
+    {
+    mp3_frame_open_info( ptr_file_name, &main_frame_info );
+    }
+else
+    {
+    (void)mp3_frame_open( ptr_file, ptr_file_name );
+    }
+
+} /* open_frames() */
+
+/**
+    Save what the frame parser learnt of a file
+
+    This function is used to put the frame layout of
+    the playing file in the metadata cache, before the
+    frame parser is closed or moved on, once it has an
+    exact duration.
+*/
+static void save_frames
+    (
+    const char* ptr_file_name
+    )
+{
+
+if( mp3_frame_get_info( &main_frame_info ) )
+    {
+    mp3_meta_put_info( ptr_file_name, &main_frame_info );
+    }
+
+} /* save_frames() */
+
+/**
+    Add data to buffer
+
+    This function is used to read data from the MP3 file,
+    through the read ahead window of the MP3 prefetch task,
+    into blocks of the MP3 stream ring, until the ring
+    reaches its high watermark, and hand the blocks over
+    to the streaming thread so that it can stream them to
+    MP3 decoder. Data is not copied: the block points at
+    a sector of the read ahead window, or at the data in
+    place for a file that maps it, such as the ROM, and
+    is only filled by a direct read of the file once the
+    window runs dry.
+
+    @return Returns FALSE once the end of the file
+            has been reached
+*/
+static BOOLEAN add_data_to_buffer
+    ( void )
+{
+mp3_strm_blk_type*  ptr_blk;
+INT16U              len;
+BOOLEAN             more_data;
+
+more_data = true;
+
+while( more_data )
+    {
+    ptr_blk = mp3_strm_alloc_blk();
+
+    if( NULL == ptr_blk )
+        {
+        // Ring is at its high watermark
+        break;
+        }
+
+    len = mp3_prefetch_read( ptr_blk );
+
+    if( len > 0 )
+        {
+        ptr_blk->size = len;
+        mp3_strm_write_data( ptr_blk );
+        }
+    else
+        {
+        mp3_strm_free_blk( ptr_blk );
+        more_data = false;
+        }
+    }
+
+return more_data;
+} /* add_data_to_buffer() */
 
 /**
     Send Message
@@ -0,0 +1,1029 @@
+/**
+    @file        mp3_meta.c
+
+    @author      Vimal Mehta
+
+    @description
+        Metadata cache of the files on the SD card. For each
+    file the cache keeps the title and artist from its tags
+    and its frame layout from the frame parser: the range
+    of its audio, its duration and a coarse seek table, see
+    mp3_frame.c. A file found in the cache is opened and
+    its duration known without reading its tags or headers,
+    and the playlist has the titles and durations of all
+    its files without opening any of them.
+
+        The cache is kept in MP3_META_FILE_NAME in the root
+    of the card, a header and an array of records, and is
+    read in a single sequential read when the playlist is
+    loaded and written back in a single write. A record is
+    keyed by the name of its file, and holds the size and
+    first cluster the file had when the record was made.
+    A file that no longer matches them has been replaced,
+    and its record is made again, so the cache never needs
+    clearing by hand. Records of files that are no longer
+    on the card are dropped when the playlist is loaded.
+
+        Records are filled in as files are played, with
+    the exact duration and seek table once the frame parser
+    has them, and in the background by the playlist while
+    nothing is playing, one file at a time, by probing the
+    tags and the first frame of the files not yet cached.
+    The cache is written back while nothing is playing.
+
+        The card is only used with the prefetch file
+    semaphore held; the records themselves are protected
+    by a semaphore of their own, as the MP3 main thread
+    and the front end both use them.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "SD.h"
+#include "mp3_prv.h"
+
+/**
+    Literal Constants
+*/
+#define META_MAGIC                  ( 0x4154454DUL )        // "META" read as a little endian word
+#define META_VERSION                ( 2 )
+#define META_CNT_MAX                ( MP3_PLAYLIST_CNT_MAX )    // Records in the cache
+#define META_TAG_BUF_SIZE           ( 64 )                  // Bytes of a tag frame read for its text
+#define META_ID3V1_SIZE             ( 128 )
+
+#define META_FLAG_INFO              ( 0x01 )                // Frame layout known, info.sample_rate 0 if there is no audio
+#define META_FLAG_TAGS              ( 0x02 )                // Title and artist looked for
+#define META_FLAG_LIVE              ( 0x80 )                // File is in the playlist, not kept on the card
+
+/**
+    Types
+*/
+
+// Cache file header
+typedef struct
+    {
+    INT32U              magic;
+    INT16U              version;
+    INT16U              rec_size;                   // sizeof( meta_rec_type ), so a change of layout is seen
+    INT16U              cnt;                        // Records that follow
+    } meta_hdr_type;
+
+// Record of a file
+typedef struct
+    {
+    char                name[MP3_META_NAME_LEN];    // Name in the root of the card
+    INT8U               flags;                      // META_FLAG_*
+    INT32U              size;                       // Size and first cluster of the file the record was made for
+    INT32U              ident;
+    char                title[MP3_TRACK_TEXT_LEN_MAX];
+    char                artist[MP3_TRACK_TEXT_LEN_MAX];
+    mp3_frame_info_type info;
+    } meta_rec_type;
+
+// Cache, laid out as it is on the card
+typedef struct
+    {
+    meta_hdr_type       hdr;
+    meta_rec_type       rec[META_CNT_MAX];
+    } meta_file_type;
+
+// Scratch of mp3_meta_build(), kept off the stack of the front end
+typedef struct
+    {
+    mp3_src_type        src;
+    char                title[MP3_TRACK_TEXT_LEN_MAX];
+    char                artist[MP3_TRACK_TEXT_LEN_MAX];
+    mp3_frame_info_type info;
+    INT8U               tag_buf[META_TAG_BUF_SIZE];
+    } meta_build_type;
+
+/**
+    Static Variables
+*/
+static meta_file_type           meta_file;                                  // Cache, records 0 to hdr.cnt - 1 in use
+static BOOLEAN                  meta_dirty;                                 // Cache differs from the file on the card
+static OS_EVENT*                meta_smphr;                                 // Protects meta_file
+static meta_build_type          meta_build;                                 // Scratch of mp3_meta_build()
+
+/**
+    Static Procedures
+*/
+
+static const char* get_key_name
+    (
+    const char* fname
+    );
+
+static meta_rec_type* find_rec
+    (
+    const char* ptr_name
+    );
+
+static meta_rec_type* new_rec
+    (
+    const char* ptr_name,
+    INT32U      size,
+    INT32U      ident
+    );
+
+static void init_rec
+    (
+    meta_rec_type*  ptr_rec,
+    const char*     ptr_name,
+    INT32U          size,
+    INT32U          ident
+    );
+
+static void read_tags
+    (
+    mp3_src_type*   ptr_file,
+    char*           ptr_title,
+    char*           ptr_artist
+    );
+
+static void copy_text
+    (
+    char*           ptr_dst,
+    const INT8U*    ptr_src,
+    INT16U          len,
+    INT8U           enc
+    );
+
+static INT32U get_be32
+    (
+    const INT8U* ptr
+    );
+
+static INT32U get_syncsafe
+    (
+    const INT8U* ptr
+    );
+
+/**
+    Power up the metadata cache
+
+    @return None
+*/
+void mp3_meta_pwrp
+    ( void )
+{
+
+meta_smphr = OSSemCreate( 1 );
+if( NULL == meta_smphr )
+    {
+    while(1);
+    }
+
+meta_file.hdr.cnt = 0;
+meta_dirty        = false;
+
+} /* mp3_meta_pwrp() */
+
+/**
+    Load the cache from the card
+
+    The header and all the records are read in one
+    sequential read. A cache of another version or
+    layout is started again empty. Must be called with
+    the prefetch file semaphore held.
+
+    @return None
+*/
+void mp3_meta_load
+    ( void )
+{
+File    file;
+int     len;
+INT8U   err;
+INT8U   i;
+
+OSSemPend( meta_smphr, 0, &err );
+
+meta_file.hdr.cnt = 0;
+meta_dirty        = false;
+
+file = SD.open( MP3_META_FILE_NAME, O_READ );
+if( file )
+    {
+    len = file.read( &meta_file, sizeof( meta_file ) );
+    file.close();
+
+    if( ( len < (int)sizeof( meta_hdr_type ) )                      ||
+        ( META_MAGIC != meta_file.hdr.magic )                       ||
+        ( META_VERSION != meta_file.hdr.version )                   ||
+        ( sizeof( meta_rec_type ) != meta_file.hdr.rec_size )       ||
+        ( meta_file.hdr.cnt > META_CNT_MAX )                        ||
+        ( len < (int)( sizeof( meta_hdr_type ) + meta_file.hdr.cnt * sizeof( meta_rec_type ) ) )
+      )
+        {
+        meta_file.hdr.cnt = 0;
+        meta_dirty        = true;
+        }
+    }
+
+for( i = 0; i < meta_file.hdr.cnt; i++ )
+    {
+    meta_file.rec[i].flags &= ~META_FLAG_LIVE;
+    }
+
+OSSemPost( meta_smphr );
+
+} /* mp3_meta_load() */
+
+/**
+    Keep the record of a file in the playlist
+
+    A record that no longer matches the size and first
+    cluster of its file is left to mp3_meta_prune().
+
+    @return Returns TRUE if the file has a record
+*/
+BOOLEAN mp3_meta_keep
+    (
+    const char* fname,
+    INT32U      size,
+    INT32U      ident
+    )
+{
+meta_rec_type*  ptr_rec;
+const char*     ptr_name;
+BOOLEAN         kept;
+INT8U           err;
+
+ptr_name = get_key_name( fname );
+if( NULL == ptr_name )
+    {
+    return false;
+    }
+
+kept = false;
+
+OSSemPend( meta_smphr, 0, &err );
+
+ptr_rec = find_rec( ptr_name );
+if( ( NULL != ptr_rec ) && ( size == ptr_rec->size ) && ( ident == ptr_rec->ident ) )
+    {
+    ptr_rec->flags |= META_FLAG_LIVE;
+    kept = true;
+    }
+
+OSSemPost( meta_smphr );
+
+return kept;
+
+} /* mp3_meta_keep() */
+
+/**
+    Drop the records that were not kept
+
+    @return None
+*/
+void mp3_meta_prune
+    ( void )
+{
+INT8U   err;
+INT8U   i;
+INT8U   cnt;
+
+OSSemPend( meta_smphr, 0, &err );
+
+cnt = 0;
+for( i = 0; i < meta_file.hdr.cnt; i++ )
+    {
+    if( meta_file.rec[i].flags & META_FLAG_LIVE )
+        {
+        if( cnt != i )
+            {
+            meta_file.rec[cnt] = meta_file.rec[i];
+            }
+        cnt++;
+        }
+    }
+
+if( cnt != meta_file.hdr.cnt )
+    {
+    meta_file.hdr.cnt = cnt;
+    meta_dirty        = true;
+    }
+
+OSSemPost( meta_smphr );
+
+} /* mp3_meta_prune() */
+
+/**
+    Write the cache back to the card
+
+    The header and the records in use are written in
+    one write, over the previous cache. A cache that
+    could not be written is not tried again until it
+    changes. Must be called with the prefetch file
+    semaphore held.
+
+    @return Returns TRUE if the card was written
+*/
+BOOLEAN mp3_meta_save
+    ( void )
+{
+File    file;
+size_t  len;
+INT8U   err;
+
+if( !meta_dirty )
+    {
+    return false;
+    }
+
+OSSemPend( meta_smphr, 0, &err );
+
+meta_file.hdr.magic    = META_MAGIC;
+meta_file.hdr.version  = META_VERSION;
+meta_file.hdr.rec_size = sizeof( meta_rec_type );
+
+file = SD.open( MP3_META_FILE_NAME, O_WRITE | O_CREAT | O_TRUNC );
+if( file )
+    {
+    len = sizeof( meta_hdr_type ) + meta_file.hdr.cnt * sizeof( meta_rec_type );
+    (void)file.write( (const uint8_t*)&meta_file, len );
+    file.close();
+    }
+
+meta_dirty = false;
+
+OSSemPost( meta_smphr );
+
+return true;
+
+} /* mp3_meta_save() */
+
+/**
+    Fill in the record of a file
+
+    Reads the tags of the file and probes its first
+    frame, whichever the record is missing, making the
+    record if there is none. A file that can not be
+    opened, such as an empty one, gets a complete record
+    with no title and no audio, so it is not tried again.
+    Must be called with the prefetch file semaphore
+    held, by one task only.
+
+    @return Returns TRUE if the card was read, FALSE if
+            the record was complete
+*/
+BOOLEAN mp3_meta_build
+    (
+    const char* fname
+    )
+{
+meta_rec_type*  ptr_rec;
+const char*     ptr_name;
+INT32U          size;
+INT32U          ident;
+INT8U           flags;
+INT8U           err;
+
+ptr_name = get_key_name( fname );
+if( NULL == ptr_name )
+    {
+    return false;
+    }
+
+OSSemPend( meta_smphr, 0, &err );
+ptr_rec = find_rec( ptr_name );
+flags   = ( NULL != ptr_rec ) ? ptr_rec->flags : 0;
+OSSemPost( meta_smphr );
+
+if( ( META_FLAG_INFO | META_FLAG_TAGS ) == ( flags & ( META_FLAG_INFO | META_FLAG_TAGS ) ) )
+    {
+    return false;
+    }
+
+if( !mp3_src_open( &meta_build.src, fname ) )
+    {
+    OSSemPend( meta_smphr, 0, &err );
+
+    ptr_rec = find_rec( ptr_name );
+    if( NULL == ptr_rec )
+        {
+        ptr_rec = new_rec( ptr_name, 0, 0 );
+        }
+
+    if( NULL != ptr_rec )
+        {
+        memset( &ptr_rec->info, 0, sizeof( ptr_rec->info ) );
+        ptr_rec->flags |= META_FLAG_INFO | META_FLAG_TAGS;
+        meta_dirty = true;
+        }
+
+    OSSemPost( meta_smphr );
+
+    return true;
+    }
+
+size  = mp3_src_size( &meta_build.src );
+ident = mp3_src_get_ident( &meta_build.src );
+
+if( !( flags & META_FLAG_TAGS ) )
+    {
+    read_tags( &meta_build.src, meta_build.title, meta_build.artist );
+    }
+
+if( !( flags & META_FLAG_INFO ) )
+    {
+    // Leaves sample_rate 0 if the file has no audio
+    (void)mp3_frame_probe( &meta_build.src, &meta_build.info );
+    }
+
+mp3_src_close( &meta_build.src );
+
+OSSemPend( meta_smphr, 0, &err );
+
+ptr_rec = find_rec( ptr_name );
+if( NULL == ptr_rec )
+    {
+    ptr_rec = new_rec( ptr_name, size, ident );
+    }
+else if( ( size != ptr_rec->size ) || ( ident != ptr_rec->ident ) )
+    {
+    // Replaced since the record was made
+    init_rec( ptr_rec, ptr_name, size, ident );
+    }
+
+if( NULL != ptr_rec )
+    {
+    if( !( flags & META_FLAG_TAGS ) )
+        {
+        strcpy( ptr_rec->title, meta_build.title );
+        strcpy( ptr_rec->artist, meta_build.artist );
+        ptr_rec->flags |= META_FLAG_TAGS;
+        }
+
+    if( !( flags & META_FLAG_INFO ) && !( ptr_rec->flags & META_FLAG_INFO ) )
+        {
+        ptr_rec->info   = meta_build.info;
+        ptr_rec->flags |= META_FLAG_INFO;
+        }
+
+    meta_dirty = true;
+    }
+
+OSSemPost( meta_smphr );
+
+return true;
+
+} /* mp3_meta_build() */
+
+/**
+    Look up a file that has just been opened
+
+    Must be called before the range of the file is set,
+    while its size is that of the whole file. A file
+    without a record, or one that has changed since its
+    record was made, gets a new record to be filled in.
+
+    @return Returns TRUE with the range of the audio of
+            the file if it is cached
+*/
+BOOLEAN mp3_meta_open
+    (
+    mp3_src_type*   ptr_file,
+    const char*     fname,
+    INT32U*         ptr_start,
+    INT32U*         ptr_end
+    )
+{
+meta_rec_type*  ptr_rec;
+const char*     ptr_name;
+INT32U          size;
+INT32U          ident;
+BOOLEAN         cached;
+INT8U           err;
+
+ptr_name = get_key_name( fname );
+if( NULL == ptr_name )
+    {
+    return false;
+    }
+
+size   = mp3_src_size( ptr_file );
+ident  = mp3_src_get_ident( ptr_file );
+cached = false;
+
+OSSemPend( meta_smphr, 0, &err );
+
+ptr_rec = find_rec( ptr_name );
+if( NULL == ptr_rec )
+    {
+    ptr_rec = new_rec( ptr_name, size, ident );
+    }
+else if( ( size != ptr_rec->size ) || ( ident != ptr_rec->ident ) )
+    {
+    init_rec( ptr_rec, ptr_name, size, ident );
+    meta_dirty = true;
+    }
+else if( ( ptr_rec->flags & META_FLAG_INFO ) && ( 0 != ptr_rec->info.sample_rate ) )
+    {
+    // A WAV file is streamed with its header
+    *ptr_start = ( 0 != ptr_rec->info.block_align ) ? 0 : ptr_rec->info.audio_start;
+    *ptr_end   = ptr_rec->info.audio_end;
+    cached     = true;
+    }
+
+OSSemPost( meta_smphr );
+
+return cached;
+
+} /* mp3_meta_open() */
+
+/**
+    Get the frame layout of a file from the cache
+
+    The file must have been looked up with
+    mp3_meta_open().
+
+    @return Returns TRUE if the file is cached
+*/
+BOOLEAN mp3_meta_get_info
+    (
+    const char*             fname,
+    mp3_frame_info_type*    ptr_info
+    )
+{
+meta_rec_type*  ptr_rec;
+const char*     ptr_name;
+BOOLEAN         cached;
+INT8U           err;
+
+ptr_name = get_key_name( fname );
+if( NULL == ptr_name )
+    {
+    return false;
+    }
+
+cached = false;
+
+OSSemPend( meta_smphr, 0, &err );
+
+ptr_rec = find_rec( ptr_name );
+if( ( NULL != ptr_rec ) && ( ptr_rec->flags & META_FLAG_INFO ) && ( 0 != ptr_rec->info.sample_rate ) )
+    {
+    *ptr_info = ptr_rec->info;
+    cached    = true;
+    }
+
+OSSemPost( meta_smphr );
+
+return cached;
+
+} /* mp3_meta_get_info() */
+
+/**
+    Put the frame layout of a played file in the cache
+
+    The file must have been looked up with
+    mp3_meta_open(). The record only takes the layout
+    if it has none yet, or if the layout has an exact
+    duration and a fuller seek table than the record.
+
+    @return None
+*/
+void mp3_meta_put_info
+    (
+    const char*                 fname,
+    const mp3_frame_info_type*  ptr_info
+    )
+{
+meta_rec_type*  ptr_rec;
+const char*     ptr_name;
+INT8U           err;
+
+ptr_name = get_key_name( fname );
+if( NULL == ptr_name )
+    {
+    return;
+    }
+
+OSSemPend( meta_smphr, 0, &err );
+
+ptr_rec = find_rec( ptr_name );
+if( ( NULL != ptr_rec ) &&
+    ( !( ptr_rec->flags & META_FLAG_INFO ) ||
+      ( ( 0 != ptr_info->frame_cnt ) &&
+        ( ( 0 == ptr_rec->info.frame_cnt ) || ( ptr_rec->info.toc_cnt < ptr_info->toc_cnt ) ) ) )
+  )
+    {
+    ptr_rec->info   = *ptr_info;
+    ptr_rec->flags |= META_FLAG_INFO;
+    meta_dirty      = true;
+    }
+
+OSSemPost( meta_smphr );
+
+} /* mp3_meta_put_info() */
+
+/**
+    Get the metadata of a file for the front end
+
+    @return Returns TRUE if the file has a record, with
+            whatever of it is known
+*/
+BOOLEAN mp3_meta_get_track
+    (
+    const char*             fname,
+    MP3_track_info_type*    ptr_track
+    )
+{
+meta_rec_type*  ptr_rec;
+const char*     ptr_name;
+INT8U           err;
+
+ptr_track->title[0]       = '\0';
+ptr_track->artist[0]      = '\0';
+ptr_track->duration_ms    = 0;
+ptr_track->duration_exact = false;
+ptr_track->bitrate_kbps   = 0;
+
+ptr_name = get_key_name( fname );
+if( NULL == ptr_name )
+    {
+    return false;
+    }
+
+OSSemPend( meta_smphr, 0, &err );
+
+ptr_rec = find_rec( ptr_name );
+if( NULL != ptr_rec )
+    {
+    strcpy( ptr_track->title, ptr_rec->title );
+    strcpy( ptr_track->artist, ptr_rec->artist );
+    if( ( ptr_rec->flags & META_FLAG_INFO ) && ( 0 != ptr_rec->info.sample_rate ) )
+        {
+        ptr_track->duration_ms    = ptr_rec->info.duration_ms;
+        ptr_track->duration_exact = ( 0 != ptr_rec->info.frame_cnt );
+        ptr_track->bitrate_kbps   = ptr_rec->info.bitrate_kbps;
+        }
+    }
+
+OSSemPost( meta_smphr );
+
+return ( NULL != ptr_rec );
+
+} /* mp3_meta_get_track() */
+
+/**
+    Get the name a file is cached by
+
+    Only files in the root of the SD card are cached.
+
+    @return Returns the name without any prefix or
+            leading '/', NULL if the file is not cached
+*/
+static const char* get_key_name
+    (
+    const char* fname
+    )
+{
+INT8U len;
+
+len = strlen( MP3_SRC_ROM_PREFIX );
+if( 0 == strncmp( fname, MP3_SRC_ROM_PREFIX, len ) )
+    {
+    return NULL;
+    }
+
+len = strlen( MP3_SRC_SD_PREFIX );
+if( 0 == strncmp( fname, MP3_SRC_SD_PREFIX, len ) )
+    {
+    fname += len;
+    }
+
+if( '/' == fname[0] )
+    {
+    fname++;
+    }
+
+if( ( '\0' == fname[0] ) || ( NULL != strchr( fname, '/' ) ) || ( strlen( fname ) >= MP3_META_NAME_LEN ) )
+    {
+    return NULL;
+    }
+
+return fname;
+
+} /* get_key_name() */
+
+/**
+    Find the record of a file
+
+    The cache semaphore must be held.
+
+    @return Returns the record, NULL if none
+*/
+static meta_rec_type* find_rec
+    (
+    const char* ptr_name
+    )
+{
+INT8U i;
+
+for( i = 0; i < meta_file.hdr.cnt; i++ )
+    {
+    if( 0 == strcmp( ptr_name, meta_file.rec[i].name ) )
+        {
+        return &meta_file.rec[i];
+        }
+    }
+
+return NULL;
+
+} /* find_rec() */
+
+/**
+    Make a record for a file
+
+    Takes a free record or, once the cache is full, the
+    record of a file that is not in the playlist. The
+    cache semaphore must be held.
+
+    @return Returns the record, NULL if the cache is
+            full of files in the playlist
+*/
+static meta_rec_type* new_rec
+    (
+    const char* ptr_name,
+    INT32U      size,
+    INT32U      ident
+    )
+{
+meta_rec_type*  ptr_rec;
+INT8U           i;
+
+ptr_rec = NULL;
+
+if( meta_file.hdr.cnt < META_CNT_MAX )
+    {
+    ptr_rec = &meta_file.rec[meta_file.hdr.cnt];
+    meta_file.hdr.cnt++;
+    }
+else
+    {
+    for( i = 0; ( i < META_CNT_MAX ) && ( NULL == ptr_rec ); i++ )
+        {
+        if( !( meta_file.rec[i].flags & META_FLAG_LIVE ) )
+            {
+            ptr_rec = &meta_file.rec[i];
+            }
+        }
+    }
+
+if( NULL != ptr_rec )
+    {
+    init_rec( ptr_rec, ptr_name, size, ident );
+    meta_dirty = true;
+    }
+
+return ptr_rec;
+
+} /* new_rec() */
+
+/**
+    Start a record again for a file
+
+    @return None
+*/
+static void init_rec
+    (
+    meta_rec_type*  ptr_rec,
+    const char*     ptr_name,
+    INT32U          size,
+    INT32U          ident
+    )
+{
+
+strcpy( ptr_rec->name, ptr_name );
+ptr_rec->flags     = META_FLAG_LIVE;
+ptr_rec->size      = size;
+ptr_rec->ident     = ident;
+ptr_rec->title[0]  = '\0';
+ptr_rec->artist[0] = '\0';
+
+} /* init_rec() */
+
+/**
+    Read the title and artist of a file
+
+    Looks through the frames of an ID3v2 tag at the
+    start of the file, up to MP3_META_TAG_SCAN_MAX bytes
+    of it, then at an ID3v1 tag at the end of the file
+    for whatever is still missing. Must be called before
+    the range of the file is set. The file is left at an
+    unknown position.
+
+    @return None, the text is empty if not found
+*/
+static void read_tags
+    (
+    mp3_src_type*   ptr_file,
+    char*           ptr_title,
+    char*           ptr_artist
+    )
+{
+INT8U*  ptr_buf;
+INT32U  tag_end;
+INT32U  pos;
+INT32U  size;
+INT16U  len;
+INT8U   ver;
+INT8U   hdr_len;
+BOOLEAN is_title;
+BOOLEAN is_artist;
+
+ptr_buf       = meta_build.tag_buf;
+ptr_title[0]  = '\0';
+ptr_artist[0] = '\0';
+
+// Tags that are unsynchronised as a whole are left alone
+if( mp3_src_seek( ptr_file, 0 ) && ( 10 == mp3_src_read( ptr_file, ptr_buf, 10 ) ) &&
+    ( 0 == memcmp( ptr_buf, "ID3", 3 ) ) && ( ptr_buf[3] >= 2 ) && ( ptr_buf[3] <= 4 ) &&
+    !( ptr_buf[5] & 0x80 ) )
+    {
+    ver     = ptr_buf[3];
+    hdr_len = ( 2 == ver ) ? 6 : 10;
+    tag_end = 10 + get_syncsafe( &ptr_buf[6] );
+    if( tag_end > MP3_META_TAG_SCAN_MAX )
+        {
+        tag_end = MP3_META_TAG_SCAN_MAX;
+        }
+
+    pos = 10;
+    if( ( ver > 2 ) && ( ptr_buf[5] & 0x40 ) && ( 4 == mp3_src_read( ptr_file, ptr_buf, 4 ) ) )
+        {
+        // Extended header, its size only counts itself in v2.4
+        pos += ( 4 == ver ) ? get_syncsafe( ptr_buf ) : ( get_be32( ptr_buf ) + 4 );
+        }
+
+    while( ( pos + hdr_len <= tag_end ) && ( ( '\0' == ptr_title[0] ) || ( '\0' == ptr_artist[0] ) ) )
+        {
+        // Stop at the padding
+        if( !mp3_src_seek( ptr_file, pos ) || ( hdr_len != mp3_src_read( ptr_file, ptr_buf, hdr_len ) ) ||
+            ( 0 == ptr_buf[0] ) )
+            {
+            break;
+            }
+
+        if( 2 == ver )
+            {
+            size      = ( (INT32U)ptr_buf[3] << 16 ) | ( (INT32U)ptr_buf[4] << 8 ) | ptr_buf[5];
+            is_title  = ( 0 == memcmp( ptr_buf, "TT2", 3 ) );
+            is_artist = ( 0 == memcmp( ptr_buf, "TP1", 3 ) );
+            }
+        else
+            {
+            size      = ( 4 == ver ) ? get_syncsafe( &ptr_buf[4] ) : get_be32( &ptr_buf[4] );
+            is_title  = ( 0 == memcmp( ptr_buf, "TIT2", 4 ) );
+            is_artist = ( 0 == memcmp( ptr_buf, "TPE1", 4 ) );
+            }
+
+        pos += hdr_len;
+
+        // The text follows its encoding byte
+        if( ( is_title || is_artist ) && ( size > 1 ) )
+            {
+            len = ( size < META_TAG_BUF_SIZE ) ? (INT16U)size : META_TAG_BUF_SIZE;
+            if( len == mp3_src_read( ptr_file, ptr_buf, len ) )
+                {
+                copy_text( is_title ? ptr_title : ptr_artist, &ptr_buf[1], len - 1, ptr_buf[0] );
+                }
+            }
+
+        pos += size;
+        }
+    }
+
+// ID3v1 title at offset 3 and artist at 33, 30 bytes each
+size = mp3_src_size( ptr_file );
+if( ( ( '\0' == ptr_title[0] ) || ( '\0' == ptr_artist[0] ) ) && ( size >= META_ID3V1_SIZE ) &&
+    mp3_src_seek( ptr_file, size - META_ID3V1_SIZE ) && ( 63 == mp3_src_read( ptr_file, ptr_buf, 63 ) ) &&
+    ( 0 == memcmp( ptr_buf, "TAG", 3 ) ) )
+    {
+    if( '\0' == ptr_title[0] )
+        {
+        copy_text( ptr_title, &ptr_buf[3], 30, 0 );
+        }
+    if( '\0' == ptr_artist[0] )
+        {
+        copy_text( ptr_artist, &ptr_buf[33], 30, 0 );
+        }
+    }
+
+} /* read_tags() */
+
+/**
+    Copy the text of a tag
+
+    Text in ISO-8859-1 (enc 0), UTF-16 with a byte
+    order mark (1), UTF-16BE (2) or UTF-8 (3) is kept
+    to ASCII, which is all the LCD font has, with '?'
+    for any other character. Trailing spaces, the
+    padding of ID3v1, are dropped.
+
+    @return None
+*/
+static void copy_text
+    (
+    char*           ptr_dst,
+    const INT8U*    ptr_src,
+    INT16U          len,
+    INT8U           enc
+    )
+{
+INT16U  ch;
+INT16U  i;
+INT8U   n;
+BOOLEAN big_endian;
+
+n = 0;
+
+if( ( 1 == enc ) || ( 2 == enc ) )
+    {
+    big_endian = ( 2 == enc );
+    i          = 0;
+    if( ( len >= 2 ) && ( ( ( 0xFF == ptr_src[0] ) && ( 0xFE == ptr_src[1] ) ) ||
+                          ( ( 0xFE == ptr_src[0] ) && ( 0xFF == ptr_src[1] ) ) ) )
+        {
+        big_endian = ( 0xFE == ptr_src[0] );
+        i          = 2;
+        }
+
+    for( ; ( i + 1 < len ) && ( n < MP3_TRACK_TEXT_LEN_MAX - 1 ); i += 2 )
+        {
+        ch = big_endian ? ( ( (INT16U)ptr_src[i] << 8 ) | ptr_src[i + 1] ) :
+                          ( ( (INT16U)ptr_src[i + 1] << 8 ) | ptr_src[i] );
+        if( 0 == ch )
+            {
+            break;
+            }
+        ptr_dst[n++] = ( ( ch >= 0x20 ) && ( ch < 0x7F ) ) ? (char)ch : '?';
+        }
+    }
+else
+    {
+    for( i = 0; ( i < len ) && ( n < MP3_TRACK_TEXT_LEN_MAX - 1 ); i++ )
+        {
+        ch = ptr_src[i];
+        if( 0 == ch )
+            {
+            break;
+            }
+
+        // One '?' for a whole UTF-8 sequence
+        if( ( 3 == enc ) && ( 0x80 == ( ch & 0xC0 ) ) )
+            {
+            continue;
+            }
+        ptr_dst[n++] = ( ( ch >= 0x20 ) && ( ch < 0x7F ) ) ? (char)ch : '?';
+        }
+    }
+
+while( ( n > 0 ) && ( ' ' == ptr_dst[n - 1] ) )
+    {
+    n--;
+    }
+
+ptr_dst[n] = '\0';
+
+} /* copy_text() */
+
+/**
+    Read a big endian 32 bit value
+
+    @return Returns the value
+*/
+static INT32U get_be32
+    (
+    const INT8U* ptr
+    )
+{
+
+return ( (INT32U)ptr[0] << 24 ) | ( (INT32U)ptr[1] << 16 ) | ( (INT32U)ptr[2] << 8 ) | ptr[3];
+
+} /* get_be32() */
+
+/**
+    Read an ID3v2 sync safe value, 7 bits per byte
+
+    @return Returns the value
+*/
+static INT32U get_syncsafe
+    (
+    const INT8U* ptr
+    )
+{
+
+return ( (INT32U)( ptr[0] & 0x7F ) << 21 ) |
+       ( (INT32U)( ptr[1] & 0x7F ) << 14 ) |
+       ( (INT32U)( ptr[2] & 0x7F ) << 7  ) |
+       ( (INT32U)( ptr[3] & 0x7F ) );
+
+} /* get_syncsafe() */
@@ -0,0 +1,738 @@
+/**
+    @file        mp3_playlist.c
+
+    @author      Vimal Mehta
+
+    @description
+        Playlist of the files in the root of the SD card,
+    or of the MP3 files built into the flash when there is
+    no card. The front end plays, steps through, repeats
+    and shuffles the playlist by its index instead of
+    handing file names to the MP3 main thread.
+
+        The directory is read once, when the playlist is
+    loaded, and each file is kept with its directory entry
+    index, first cluster and size. An SD source opened by
+    the name of one of these files is opened straight from
+    its directory entry, see mp3_src.c, so starting or
+    queueing a track never searches the directory. The
+    first cluster and size tell if the entry no longer
+    holds the file, in which case the file is searched
+    for by name as usual.
+
+        The metadata cache, see mp3_meta.c, is read along
+    with the directory, so the titles and durations of the
+    entries are known from the start. While the playlist
+    is stopped it fills in the entries the cache is
+    missing, one per update.
+
+        The playlist is played in the order of the order
+    array, which is shuffled when shuffle is on. The track
+    after the playing one is kept queued with the MP3 main
+    thread, so that it follows on without a gap.
+
+        All the MP3_playlist_* functions are called from
+    the front end task only.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "SD.h"
+#include "DFS_pub.h"
+#include "MP3_pub.h"
+#include "mp3_prv.h"
+
+/**
+    Literal Constants
+*/
+#define PL_NAME_LEN_MAX             ( 16 )                  // Longest name including the terminator
+#define PL_STOP_MS_MAX              ( 2000 )                // Time allowed for playback to stop
+
+/**
+    Types
+*/
+
+// Playlist entry
+typedef struct
+    {
+    char        name[PL_NAME_LEN_MAX];
+    BOOLEAN     on_card;                    // In the root of the SD card, opened by dir_idx
+    INT16U      dir_idx;                    // Directory entry index in the root
+    INT32U      first_cluster;
+    INT32U      size;
+    } pl_entry_type;
+
+// Workspace type
+typedef struct
+    {
+    INT8U           cnt;                                // Entries in the playlist
+    INT8U           order[MP3_PLAYLIST_CNT_MAX];        // Entry at each position of the play order
+    INT8S           pos;                                // Play order position of the playing entry, -1 if none
+    INT8S           queued_pos;                         // Play order position of the queued entry, -1 if none
+    INT16U          track_num;                          // MP3_playback_get_track_num() when last checked
+    BOOLEAN         repeat;                             // Go back to the start at the end of the playlist
+    BOOLEAN         shuffle;
+    INT32U          seed;                               // Shuffle random number state
+    INT8U           build_idx;                          // Next entry to fill in the metadata cache for
+    BOOLEAN         meta_done;                          // A full pass found no record to fill in
+    } pl_wksp_type;
+
+/**
+    Static Variables
+*/
+static pl_entry_type            pl_entry_arr[MP3_PLAYLIST_CNT_MAX];         // Entries in directory order
+static pl_wksp_type             pl_wksp;                                    // Workspace
+
+/**
+    Static Procedures
+*/
+
+static BOOLEAN add_entry
+    (
+    const char* ptr_name
+    );
+
+static BOOLEAN start_pos
+    (
+    INT8S pos
+    );
+
+static INT8S get_next_pos
+    (
+    INT8S pos
+    );
+
+static void shuffle_after
+    (
+    INT8S pos
+    );
+
+static INT8S find_pos
+    (
+    INT8U idx
+    );
+
+static void build_meta
+    ( void );
+
+/**
+    Load the playlist
+
+    Reads the files in the root of the SD card, or
+    lists the files built into the flash if there is
+    no card. Playback must be stopped.
+
+    @return Returns the number of entries
+*/
+INT8U MP3_playlist_load
+    ( void )
+{
+File    root;
+File    entry;
+INT16U  dir_idx;
+INT8U   i;
+
+pl_wksp.cnt        = 0;
+pl_wksp.pos        = -1;
+pl_wksp.queued_pos = -1;
+pl_wksp.build_idx  = 0;
+pl_wksp.meta_done  = false;
+
+if( DFS_is_card_present() )
+    {
+    mp3_prefetch_lock();
+
+    mp3_meta_load();
+
+    root = SD.open( "/" );
+    while( pl_wksp.cnt < MP3_PLAYLIST_CNT_MAX )
+        {
+        entry = root.openNextFile( O_READ, &dir_idx );
+        if( !entry )
+            {
+            break;
+            }
+
+        if( !entry.isDirectory() &&
+            ( 0 != strcmp( entry.name(), MP3_META_FILE_NAME ) ) &&
+            ( 0 != strcmp( entry.name(), MP3_PLUGIN_FILE_NAME ) ) &&
+            add_entry( entry.name() ) )
+            {
+            pl_entry_arr[pl_wksp.cnt - 1].on_card       = true;
+            pl_entry_arr[pl_wksp.cnt - 1].dir_idx       = dir_idx;
+            pl_entry_arr[pl_wksp.cnt - 1].first_cluster = entry.firstCluster();
+            pl_entry_arr[pl_wksp.cnt - 1].size          = entry.size();
+            (void)mp3_meta_keep( entry.name(), entry.size(), entry.firstCluster() );
+            }
+
+        entry.close();
+        }
+    root.close();
+
+    // Records of files no longer on the card
+    mp3_meta_prune();
+
+    mp3_prefetch_unlock();
+    }
+else
+    {
+    for( i = 0; NULL != mp3_src_get_rom_name( i ); i++ )
+        {
+        (void)add_entry( mp3_src_get_rom_name( i ) );
+        }
+    }
+
+for( i = 0; i < pl_wksp.cnt; i++ )
+    {
+    pl_wksp.order[i] = i;
+    }
+
+if( pl_wksp.shuffle )
+    {
+    pl_wksp.seed ^= OSTimeGet();
+    shuffle_after( -1 );
+    }
+
+return pl_wksp.cnt;
+
+} /* MP3_playlist_load() */
+
+/**
+    Get the number of entries in the playlist
+
+    @return Returns the number of entries
+*/
+INT8U MP3_playlist_get_cnt
+    ( void )
+{
+
+return pl_wksp.cnt;
+
+} /* MP3_playlist_get_cnt() */
+
+/**
+    Get the name of a playlist entry
+
+    @return Returns the name of entry idx, NULL past
+            the end of the playlist
+*/
+const char* MP3_playlist_get_name
+    (
+    INT8U idx
+    )
+{
+
+if( idx >= pl_wksp.cnt )
+    {
+    return NULL;
+    }
+
+return pl_entry_arr[idx].name;
+
+} /* MP3_playlist_get_name() */
+
+/**
+    Get the metadata of a playlist entry
+
+    Comes from the metadata cache, which is filled in
+    as entries are played and while the playlist is
+    stopped.
+
+    @return Returns TRUE if entry idx is in the cache,
+            with whatever of it is known
+*/
+BOOLEAN MP3_playlist_get_info
+    (
+    INT8U                   idx,
+    MP3_track_info_type*    ptr_track
+    )
+{
+
+if( idx >= pl_wksp.cnt )
+    {
+    return false;
+    }
+
+return mp3_meta_get_track( pl_entry_arr[idx].name, ptr_track );
+
+} /* MP3_playlist_get_info() */
+
+/**
+    Get the playing playlist entry
+
+    @return Returns the index of the playing, or
+            paused, entry, -1 if none
+*/
+INT8S MP3_playlist_get_cur
+    ( void )
+{
+
+if( -1 == pl_wksp.pos )
+    {
+    return -1;
+    }
+
+return (INT8S)pl_wksp.order[pl_wksp.pos];
+
+} /* MP3_playlist_get_cur() */
+
+/**
+    Play a playlist entry
+
+    Stops any playback first. The rest of the playlist
+    is played on from the entry.
+
+    @return Returns TRUE if playback was started
+*/
+BOOLEAN MP3_playlist_play
+    (
+    INT8U idx
+    )
+{
+
+if( idx >= pl_wksp.cnt )
+    {
+    return false;
+    }
+
+return start_pos( find_pos( idx ) );
+
+} /* MP3_playlist_play() */
+
+/**
+    Play the next playlist entry
+
+    @return Returns TRUE if playback was started,
+            FALSE at the end of the playlist if it
+            does not repeat
+*/
+BOOLEAN MP3_playlist_next
+    ( void )
+{
+INT8S pos;
+
+pos = get_next_pos( pl_wksp.pos );
+if( -1 == pos )
+    {
+    return false;
+    }
+
+return start_pos( pos );
+
+} /* MP3_playlist_next() */
+
+/**
+    Play the previous playlist entry
+
+    @return Returns TRUE if playback was started,
+            FALSE at the start of the playlist if it
+            does not repeat
+*/
+BOOLEAN MP3_playlist_prev
+    ( void )
+{
+INT8S pos;
+
+if( ( -1 == pl_wksp.pos ) || ( 0 == pl_wksp.cnt ) )
+    {
+    return false;
+    }
+
+if( pl_wksp.pos > 0 )
+    {
+    pos = pl_wksp.pos - 1;
+    }
+else if( pl_wksp.repeat )
+    {
+    pos = pl_wksp.cnt - 1;
+    }
+else
+    {
+    return false;
+    }
+
+return start_pos( pos );
+
+} /* MP3_playlist_prev() */
+
+/**
+    Stop the playlist
+
+    @return None
+*/
+void MP3_playlist_stop
+    ( void )
+{
+
+(void)start_pos( -1 );
+
+} /* MP3_playlist_stop() */
+
+/**
+    Turn repeat of the playlist on or off
+
+    @return None
+*/
+void MP3_playlist_set_repeat
+    (
+    BOOLEAN repeat
+    )
+{
+
+pl_wksp.repeat = repeat;
+
+} /* MP3_playlist_set_repeat() */
+
+/**
+    Turn shuffle of the playlist on or off
+
+    Turning shuffle on shuffles the entries still to
+    be played. Turning it off plays on in directory
+    order from the playing entry, or from the queued
+    one as it can not be taken back.
+
+    @return None
+*/
+void MP3_playlist_set_shuffle
+    (
+    BOOLEAN shuffle
+    )
+{
+INT8U   i;
+INT8S   cur;
+INT8S   queued;
+
+if( shuffle == pl_wksp.shuffle )
+    {
+    return;
+    }
+
+pl_wksp.shuffle = shuffle;
+
+if( shuffle )
+    {
+    pl_wksp.seed ^= OSTimeGet();
+    shuffle_after( ( -1 != pl_wksp.queued_pos ) ? pl_wksp.queued_pos : pl_wksp.pos );
+    }
+else
+    {
+    cur    = ( -1 != pl_wksp.pos ) ? pl_wksp.order[pl_wksp.pos] : -1;
+    queued = ( -1 != pl_wksp.queued_pos ) ? pl_wksp.order[pl_wksp.queued_pos] : -1;
+
+    for( i = 0; i < pl_wksp.cnt; i++ )
+        {
+        pl_wksp.order[i] = i;
+        }
+
+    pl_wksp.pos        = cur;
+    pl_wksp.queued_pos = queued;
+    }
+
+} /* MP3_playlist_set_shuffle() */
+
+/**
+    Keep the playlist going
+
+    Called regularly by the front end. Keeps the entry
+    after the playing one queued with the MP3 main
+    thread, follows playback on to it once it has
+    started, and plays on at the end of playback. An
+    entry is queued only once, so a file that can not
+    be opened is left to the end of playback to skip.
+    While the playlist is stopped the metadata cache is
+    filled in instead, unless a recording holds the
+    card, which would block the front end until it ends.
+    A playback may leave records to fill in, so the
+    cache is looked over again once it has stopped.
+
+    @return None
+*/
+void MP3_playlist_update
+    ( void )
+{
+INT16U  track_num;
+INT8S   pos;
+
+if( -1 == pl_wksp.pos )
+    {
+    if( MP3_PLAYBACK_STS_OFF != MP3_playback_get_status() )
+        {
+        pl_wksp.meta_done = false;
+        }
+    else if( !MP3_record_is_active() )
+        {
+        build_meta();
+        }
+    return;
+    }
+
+pl_wksp.meta_done = false;
+
+// The queued entry has started playing
+track_num = MP3_playback_get_track_num();
+if( track_num != pl_wksp.track_num )
+    {
+    pl_wksp.track_num = track_num;
+    if( -1 != pl_wksp.queued_pos )
+        {
+        pl_wksp.pos        = pl_wksp.queued_pos;
+        pl_wksp.queued_pos = -1;
+        }
+    }
+
+if( MP3_playback_is_plybk_in_prog() )
+    {
+    if( -1 == pl_wksp.queued_pos )
+        {
+        pos = get_next_pos( pl_wksp.pos );
+        if( -1 != pos )
+            {
+            // Remember the entry even if it could not be queued
+            pl_wksp.queued_pos = pos;
+            (void)MP3_playback_queue_next( pl_entry_arr[pl_wksp.order[pos]].name );
+            }
+        }
+    }
+else if( MP3_PLAYBACK_STS_DONE == MP3_playback_get_status() )
+    {
+    pos = get_next_pos( pl_wksp.pos );
+    (void)start_pos( pos );
+    }
+
+} /* MP3_playlist_update() */
+
+/**
+    Open a playlist file on the SD card
+
+    Opens the file from its directory entry if the name
+    is that of a playlist entry on the card, which must
+    still hold the file. The card must not be in use by
+    another task.
+
+    @return Returns TRUE if the file was opened
+*/
+BOOLEAN mp3_playlist_open
+    (
+    const char* ptr_name,
+    File*       ptr_file
+    )
+{
+INT8U i;
+
+if( '/' == ptr_name[0] )
+    {
+    ptr_name++;
+    }
+
+for( i = 0; i < pl_wksp.cnt; i++ )
+    {
+    if( pl_entry_arr[i].on_card && ( 0 == strcmp( ptr_name, pl_entry_arr[i].name ) ) )
+        {
+        *ptr_file = SD.openRootEntry( pl_entry_arr[i].dir_idx, O_READ );
+        if( ( *ptr_file ) &&
+            ( ptr_file->firstCluster() == pl_entry_arr[i].first_cluster ) &&
+            ( ptr_file->size()         == pl_entry_arr[i].size )
+          )
+            {
+            return true;
+            }
+
+        ptr_file->close();
+        return false;
+        }
+    }
+
+return false;
+
+} /* mp3_playlist_open() */
+
+/**
+    Add an entry to the playlist
+
+    @return Returns TRUE if the entry was added
+*/
+static BOOLEAN add_entry
+    (
+    const char* ptr_name
+    )
+{
+pl_entry_type* ptr_entry;
+
+if( ( pl_wksp.cnt >= MP3_PLAYLIST_CNT_MAX ) || ( strlen( ptr_name ) >= PL_NAME_LEN_MAX ) )
+    {
+    return false;
+    }
+
+ptr_entry = &pl_entry_arr[pl_wksp.cnt];
+strcpy( ptr_entry->name, ptr_name );
+ptr_entry->on_card       = false;
+ptr_entry->dir_idx       = 0;
+ptr_entry->first_cluster = 0;
+ptr_entry->size          = 0;
+
+pl_wksp.cnt++;
+
+return true;
+
+} /* add_entry() */
+
+/**
+    Start playback at a play order position
+
+    Stops any playback first and waits for it to have
+    stopped. A position of -1 only stops.
+
+    @return Returns TRUE if playback was started
+*/
+static BOOLEAN start_pos
+    (
+    INT8S pos
+    )
+{
+
+(void)MP3_playback_stop_wait( PL_STOP_MS_MAX );
+
+pl_wksp.pos        = pos;
+pl_wksp.queued_pos = -1;
+pl_wksp.track_num  = MP3_playback_get_track_num();
+
+if( -1 == pos )
+    {
+    return false;
+    }
+
+return MP3_playback_start( pl_entry_arr[pl_wksp.order[pos]].name );
+
+} /* start_pos() */
+
+/**
+    Get the play order position after another
+
+    @return Returns the next position, -1 at the end
+            of the playlist if it does not repeat
+*/
+static INT8S get_next_pos
+    (
+    INT8S pos
+    )
+{
+
+if( ( -1 == pos ) || ( 0 == pl_wksp.cnt ) )
+    {
+    return -1;
+    }
+
+if( pos + 1 < pl_wksp.cnt )
+    {
+    return pos + 1;
+    }
+
+return pl_wksp.repeat ? 0 : -1;
+
+} /* get_next_pos() */
+
+/**
+    Shuffle the play order after a position
+
+    The positions up to and including pos keep their
+    entries, -1 shuffles the whole play order.
+
+    @return None
+*/
+static void shuffle_after
+    (
+    INT8S pos
+    )
+{
+INT8U   i;
+INT8U   j;
+INT8U   first;
+INT8U   tmp;
+
+first = (INT8U)( pos + 1 );
+
+// Fisher-Yates shuffle driven by a linear congruential generator
+for( i = pl_wksp.cnt; i > first + 1; i-- )
+    {
+    pl_wksp.seed = ( pl_wksp.seed * 1103515245UL ) + 12345UL;
+    j = first + (INT8U)( ( pl_wksp.seed >> 16 ) % ( i - first ) );
+
+    tmp                  = pl_wksp.order[i - 1];
+    pl_wksp.order[i - 1] = pl_wksp.order[j];
+    pl_wksp.order[j]     = tmp;
+    }
+
+} /* shuffle_after() */
+
+/**
+    Find the play order position of an entry
+
+    @return Returns the position
+*/
+static INT8S find_pos
+    (
+    INT8U idx
+    )
+{
+INT8U pos;
+
+for( pos = 0; pos < pl_wksp.cnt; pos++ )
+    {
+    if( idx == pl_wksp.order[pos] )
+        {
+        break;
+        }
+    }
+
+return (INT8S)pos;
+
+} /* find_pos() */
+
+/**
+    Fill in the metadata cache
+
+    Fills in the record of the next playlist entry on
+    the card that the cache is missing, and writes the
+    cache back once there are none left to fill in.
+    Nothing more is done until the playlist is loaded
+    again or a playback has run. Playback must be
+    stopped.
+
+    @return None
+*/
+static void build_meta
+    ( void )
+{
+INT8U i;
+INT8U idx;
+
+if( ( 0 == pl_wksp.cnt ) || pl_wksp.meta_done )
+    {
+    return;
+    }
+
+mp3_prefetch_lock();
+
+for( i = 0; i < pl_wksp.cnt; i++ )
+    {
+    idx               = pl_wksp.build_idx;
+    pl_wksp.build_idx = ( idx + 1 ) % pl_wksp.cnt;
+
+    if( pl_entry_arr[idx].on_card && mp3_meta_build( pl_entry_arr[idx].name ) )
+        {
+        break;
+        }
+    }
+
+if( i == pl_wksp.cnt )
+    {
+    (void)mp3_meta_save();
+    pl_wksp.meta_done = true;
+    }
+
+mp3_prefetch_unlock();
+
+} /* build_meta() */
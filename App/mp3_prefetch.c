@@ -0,0 +1,635 @@
+/**
+    @file        mp3_prefetch.c
+
+    @author      Vimal Mehta
+
+    @description
+        Read ahead task for the MP3 file being played. The
+    task runs below all the other application tasks and
+    keeps a window of MP3_PREFETCH_SECTOR_CNT sectors ahead
+    of the playback position in RAM, so that the MP3 main
+    thread refills the stream ring from RAM instead of
+    waiting on the SD card. The card is only read directly
+    when the window has run dry.
+
+        The window is a circular array of sectors. The
+    prefetch task is the only writer of the free sectors
+    from wr_idx. The MP3 main thread hands the sector at
+    rd_idx to a stream block in place, without copying
+    it, and the sector stays lent until the streaming
+    thread releases the block, see mp3_strm_ring.c.
+    Blocks are released in the order they were filled,
+    so the lent sectors are always the ones just before
+    rd_idx. The sectors are contiguous in memory,
+    so the prefetch task fills up to MP3_PREFETCH_READ_MAX
+    free sectors with a single streaming read of the file,
+    which the SD card serves as one multiple block read.
+    Uncompressed audio, which comes several times faster,
+    is read MP3_PREFETCH_READ_MAX_PCM sectors at a time.
+    Access to the file itself is serialized by a semaphore,
+    which also keeps the window and a direct read in file
+    order.
+
+        A source that maps its data, such as the ROM, is
+    not read ahead. Its data is handed out in place by a
+    direct read, see mp3_src.c. Nor is a live source,
+    the UART, whose receive ring already reads it ahead.
+
+        A file queued to play next is read on from the end
+    of the current one, starting in a sector of its own
+    that is flagged as the start of a track, so the MP3
+    main thread can hand the decoder both files without a
+    gap and still tell where one ends.
+
+        Once the window is full the task spends its time
+    building the frame index of the file, see mp3_frame.c,
+    under the same semaphore, which then stands for the
+    whole card.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "SD.h"
+#include "mp3_prv.h"
+
+/**
+    Types
+*/
+
+// Workspace type
+typedef struct
+    {
+    mp3_src_type*       ptr_file;                   // File being read ahead, NULL if none
+    mp3_src_type*       ptr_next_file;              // File to read on to at the end of ptr_file, NULL if none
+    BOOLEAN             eof;                        // End of file has been read
+    BOOLEAN             trk_start;                  // Next data read starts a new track
+    INT8U               rd_idx;                     // Next sector to hand to the consumer
+    INT8U               wr_idx;                     // Next sector to fill
+    volatile INT8U      cnt;                        // Number of filled sectors not yet handed out
+    volatile INT8U      lent;                       // Number of sectors lent to stream blocks
+    INT8U               read_max;                   // Most sectors read at a time
+    } pf_wksp_type;
+
+#if( MP3_STRM_BLK_SIZE < MP3_PREFETCH_SECTOR_SIZE )
+    #error A stream block must hold a whole read ahead sector
+#endif
+
+/**
+    Static Variables
+*/
+static OS_STK                   pf_stack[APP_CFG_TASK_START_STK_SIZE];      // Prefetch task stack
+static INT8U                    pf_window[MP3_PREFETCH_SECTOR_CNT][MP3_PREFETCH_SECTOR_SIZE];   // Read ahead window
+static INT16U                   pf_sector_size[MP3_PREFETCH_SECTOR_CNT];    // Valid bytes in each sector of the window
+static BOOLEAN                  pf_sector_trk_start[MP3_PREFETCH_SECTOR_CNT];   // Sector starts a new track
+static pf_wksp_type             pf_wksp;                                    // Workspace
+static OS_EVENT*                pf_file_smphr;                              // Serializes access to the file
+static OS_EVENT*                pf_wake_smphr;                              // Wakes the prefetch task
+
+/**
+    Static Procedures
+*/
+
+static void mp3_prefetch_main
+    (
+    void* pdata
+    );
+
+static BOOLEAN fill_next_sectors
+    ( void );
+
+static BOOLEAN scan_frames
+    ( void );
+
+static BOOLEAN switch_to_next
+    ( void );
+
+static void reset_window
+    ( void );
+
+/**
+    Power up the MP3 prefetch task
+
+    @return None
+*/
+void mp3_prefetch_pwrp
+    ( void )
+{
+
+pf_file_smphr = OSSemCreate( 1 );
+pf_wake_smphr = OSSemCreate( 0 );
+if( ( NULL == pf_file_smphr ) || ( NULL == pf_wake_smphr ) )
+    {
+    while(1);
+    }
+
+pf_wksp.ptr_file      = NULL;
+pf_wksp.ptr_next_file = NULL;
+pf_wksp.read_max      = MP3_PREFETCH_READ_MAX;
+pf_wksp.rd_idx        = 0;
+pf_wksp.lent          = 0;
+reset_window();
+
+OSTaskCreate
+    (
+    mp3_prefetch_main,
+    (void*)0,
+    &pf_stack[APP_CFG_TASK_START_STK_SIZE-1],
+    APP_TASK_MP3_PREFETCH_PRIO
+    );
+
+} /* mp3_prefetch_pwrp() */
+
+/**
+    Set the prefetch up for compressed or uncompressed
+    audio
+
+    Takes effect from the next read.
+
+    @return None
+*/
+void mp3_prefetch_set_pcm
+    (
+    BOOLEAN pcm
+    )
+{
+
+pf_wksp.read_max = pcm ? MP3_PREFETCH_READ_MAX_PCM : MP3_PREFETCH_READ_MAX;
+
+} /* mp3_prefetch_set_pcm() */
+
+/**
+    Start reading ahead a file
+
+    The file must be positioned where playback will
+    start. Any previous window, and any queued file,
+    is discarded.
+
+    @return None
+*/
+void mp3_prefetch_open
+    (
+    mp3_src_type* ptr_file
+    )
+{
+INT8U err;
+
+OSSemPend( pf_file_smphr, 0, &err );
+
+pf_wksp.ptr_file      = ptr_file;
+pf_wksp.ptr_next_file = NULL;
+mp3_src_set_streaming( pf_wksp.ptr_file );
+reset_window();
+
+OSSemPost( pf_file_smphr );
+
+OSSemPost( pf_wake_smphr );
+
+} /* mp3_prefetch_open() */
+
+/**
+    Queue a file to read on to
+
+    The file must be positioned at its start. It is
+    read ahead as soon as the end of the current file
+    has been read.
+
+    @return None
+*/
+void mp3_prefetch_queue
+    (
+    mp3_src_type* ptr_file
+    )
+{
+INT8U err;
+
+OSSemPend( pf_file_smphr, 0, &err );
+
+if( NULL != pf_wksp.ptr_file )
+    {
+    pf_wksp.ptr_next_file = ptr_file;
+    mp3_src_set_streaming( pf_wksp.ptr_next_file );
+    if( pf_wksp.eof )
+        {
+        switch_to_next();
+        }
+    }
+
+OSSemPost( pf_file_smphr );
+
+OSSemPost( pf_wake_smphr );
+
+} /* mp3_prefetch_queue() */
+
+/**
+    Stop reading ahead
+
+    Waits for any sector read in progress to complete,
+    so that the file can be closed or repositioned once
+    this returns.
+
+    @return None
+*/
+void mp3_prefetch_close
+    ( void )
+{
+INT8U err;
+
+OSSemPend( pf_file_smphr, 0, &err );
+
+pf_wksp.ptr_file      = NULL;
+pf_wksp.ptr_next_file = NULL;
+reset_window();
+
+OSSemPost( pf_file_smphr );
+
+} /* mp3_prefetch_close() */
+
+/**
+    Take the file semaphore
+
+    Used by the MP3 main thread around its own card
+    accesses while the prefetch task is reading.
+
+    @return None
+*/
+void mp3_prefetch_lock
+    ( void )
+{
+INT8U err;
+
+OSSemPend( pf_file_smphr, 0, &err );
+
+} /* mp3_prefetch_lock() */
+
+/**
+    Release the file semaphore
+
+    @return None
+*/
+void mp3_prefetch_unlock
+    ( void )
+{
+
+OSSemPost( pf_file_smphr );
+
+} /* mp3_prefetch_unlock() */
+
+/**
+    Read the next bytes of the file into a stream block
+
+    Only called by the MP3 main thread. The next sector
+    of the read ahead window is lent to the block in
+    place, ptr_blk->ptr_data pointing into the window,
+    and comes back to the window with
+    mp3_prefetch_give_back() once the block is released.
+    The file is read directly into ptr_blk->data only
+    once the window is empty. A read never spans two
+    tracks, and ptr_blk->trk_start is set if it begins
+    a queued one.
+
+        For a file that maps its data ptr_blk->ptr_data
+    is the data in place, which is then never mixed
+    with copied data.
+
+    @return Returns the number of bytes read, 0 once
+            the end of the file has been reached
+*/
+INT16U mp3_prefetch_read
+    (
+    mp3_strm_blk_type* ptr_blk
+    )
+{
+OS_CPU_SR       cpu_sr = 0;
+INT8U           err;
+INT16U          total;
+int             rd_len;
+BOOLEAN         done;
+BOOLEAN         switched;
+
+total    = 0;
+done     = false;
+switched = false;
+
+ptr_blk->ptr_data  = ptr_blk->data;
+ptr_blk->trk_start = false;
+ptr_blk->pf_lent   = false;
+
+while( !done && ( total < MP3_STRM_BLK_SIZE ) )
+    {
+    if( pf_wksp.cnt > 0 )
+        {
+        // Lend the next sector, unless the block has
+        // data of a direct read already
+        if( 0 == total )
+            {
+            ptr_blk->ptr_data  = pf_window[pf_wksp.rd_idx];
+            ptr_blk->trk_start = pf_sector_trk_start[pf_wksp.rd_idx];
+            ptr_blk->pf_lent   = true;
+            total = pf_sector_size[pf_wksp.rd_idx];
+
+            pf_sector_trk_start[pf_wksp.rd_idx] = false;
+            pf_wksp.rd_idx = ( pf_wksp.rd_idx + 1 ) % MP3_PREFETCH_SECTOR_CNT;
+
+            OS_ENTER_CRITICAL();
+            pf_wksp.cnt--;
+            pf_wksp.lent++;
+            OS_EXIT_CRITICAL();
+            }
+        break;
+        }
+
+    // Window exhausted, read the card directly. The
+    // prefetch task may have filled a sector while we
+    // waited for the file, in which case use that.
+    OSSemPend( pf_file_smphr, 0, &err );
+    if( ( 0 == pf_wksp.cnt ) && ( NULL != pf_wksp.ptr_file ) && !pf_wksp.eof )
+        {
+        if( ( pf_wksp.trk_start || mp3_src_can_map( pf_wksp.ptr_file ) ) && ( total > 0 ) )
+            {
+            done = true;
+            }
+        else
+            {
+            if( pf_wksp.trk_start )
+                {
+                pf_wksp.trk_start  = false;
+                ptr_blk->trk_start = true;
+                }
+
+            if( mp3_src_can_map( pf_wksp.ptr_file ) )
+                {
+                rd_len = mp3_src_map( pf_wksp.ptr_file, &ptr_blk->ptr_data, MP3_STRM_BLK_SIZE );
+                }
+            else
+                {
+                rd_len = mp3_src_read( pf_wksp.ptr_file, &ptr_blk->data[total], MP3_STRM_BLK_SIZE - total );
+                }
+
+            if( rd_len > 0 )
+                {
+                total += (INT16U)rd_len;
+                }
+            else if( switch_to_next() )
+                {
+                // Wake the prefetch task to read the new file ahead
+                switched = true;
+                }
+            else
+                {
+                pf_wksp.eof = true;
+                }
+            }
+        }
+    if( ( 0 == pf_wksp.cnt ) && ( ( NULL == pf_wksp.ptr_file ) || pf_wksp.eof ) )
+        {
+        done = true;
+        }
+    OSSemPost( pf_file_smphr );
+    }
+
+if( switched )
+    {
+    OSSemPost( pf_wake_smphr );
+    }
+
+return total;
+
+} /* mp3_prefetch_read() */
+
+/**
+    Give a lent sector back to the window
+
+    Called as a stream block that holds a sector of
+    the window is released, in the order the sectors
+    were lent, by whichever thread releases it.
+
+    @return None
+*/
+void mp3_prefetch_give_back
+    ( void )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+pf_wksp.lent--;
+OS_EXIT_CRITICAL();
+
+OSSemPost( pf_wake_smphr );
+
+} /* mp3_prefetch_give_back() */
+
+/**
+    MP3 prefetch task
+
+    Fills the read ahead window each time the MP3 main
+    thread frees a sector of it or a new file is opened,
+    and indexes the file a step at a time while the window
+    is full. The window is checked again after each step.
+*/
+static void mp3_prefetch_main
+    (
+    void* pdata
+    )
+{
+INT8U err;
+
+for(;;)
+    {
+    OSSemPend( pf_wake_smphr, 0, &err );
+
+    for(;;)
+        {
+        if( fill_next_sectors() )
+            {
+            continue;
+            }
+
+        if( !scan_frames() )
+            {
+            break;
+            }
+        }
+    }
+
+} /* mp3_prefetch_main() */
+
+/**
+    Read the next sectors of the file into the window
+
+    Reads as many free sectors as are contiguous in the
+    window, up to read_max, in one read.
+    At the end of the file it moves on to the queued
+    file, if any.
+
+        The card only serves whole blocks straight into
+    the window, without the volume's block cache, when
+    the read starts on a 512 byte boundary of the file.
+    After a seek, a tag skip or a direct read the file
+    is rarely there, so the first read then only goes
+    up to the next boundary, into a short sector, and
+    the reads after it are whole sectors again.
+
+    @return Returns TRUE if sectors were read and the
+            window has room for more
+*/
+static BOOLEAN fill_next_sectors
+    ( void )
+{
+OS_CPU_SR       cpu_sr = 0;
+INT8U           err;
+INT8U           sector_cnt;
+INT8U           i;
+INT8U           used;
+INT16U          len;
+INT16U          offset;
+int             rd_len;
+BOOLEAN         more;
+
+more = false;
+
+OSSemPend( pf_file_smphr, 0, &err );
+
+// Sectors lent to stream blocks are not free either
+OS_ENTER_CRITICAL();
+used = pf_wksp.cnt + pf_wksp.lent;
+OS_EXIT_CRITICAL();
+
+if( ( NULL != pf_wksp.ptr_file ) && !pf_wksp.eof && !mp3_src_can_map( pf_wksp.ptr_file ) &&
+    !mp3_src_is_live( pf_wksp.ptr_file ) && ( used < MP3_PREFETCH_SECTOR_CNT ) )
+    {
+    sector_cnt = MP3_PREFETCH_SECTOR_CNT - used;
+    if( sector_cnt > ( MP3_PREFETCH_SECTOR_CNT - pf_wksp.wr_idx ) )
+        {
+        sector_cnt = MP3_PREFETCH_SECTOR_CNT - pf_wksp.wr_idx;
+        }
+    if( sector_cnt > pf_wksp.read_max )
+        {
+        sector_cnt = pf_wksp.read_max;
+        }
+
+    len    = sector_cnt * MP3_PREFETCH_SECTOR_SIZE;
+    offset = (INT16U)( mp3_src_position( pf_wksp.ptr_file ) % MP3_PREFETCH_SECTOR_SIZE );
+    if( 0 != offset )
+        {
+        len = MP3_PREFETCH_SECTOR_SIZE - offset;
+        }
+
+    rd_len = mp3_src_read( pf_wksp.ptr_file, pf_window[pf_wksp.wr_idx], len );
+    if( rd_len > 0 )
+        {
+        // Only the last sector read can be short
+        sector_cnt = ( rd_len + MP3_PREFETCH_SECTOR_SIZE - 1 ) / MP3_PREFETCH_SECTOR_SIZE;
+        for( i = 0; i < sector_cnt; i++ )
+            {
+            pf_sector_size[pf_wksp.wr_idx + i]      = MP3_PREFETCH_SECTOR_SIZE;
+            pf_sector_trk_start[pf_wksp.wr_idx + i] = false;
+            }
+        pf_sector_size[pf_wksp.wr_idx + sector_cnt - 1] = rd_len - ( ( sector_cnt - 1 ) * MP3_PREFETCH_SECTOR_SIZE );
+        pf_sector_trk_start[pf_wksp.wr_idx] = pf_wksp.trk_start;
+        pf_wksp.trk_start = false;
+
+        pf_wksp.wr_idx = ( pf_wksp.wr_idx + sector_cnt ) % MP3_PREFETCH_SECTOR_CNT;
+
+        OS_ENTER_CRITICAL();
+        pf_wksp.cnt += sector_cnt;
+        more = ( ( pf_wksp.cnt + pf_wksp.lent ) < MP3_PREFETCH_SECTOR_CNT );
+        OS_EXIT_CRITICAL();
+        }
+    else if( switch_to_next() )
+        {
+        more = true;
+        }
+    else
+        {
+        pf_wksp.eof = true;
+        }
+    }
+
+OSSemPost( pf_file_smphr );
+
+return more;
+
+} /* fill_next_sectors() */
+
+/**
+    Run a step of the frame index scan
+
+    @return Returns TRUE if there is more to scan
+*/
+static BOOLEAN scan_frames
+    ( void )
+{
+INT8U   err;
+BOOLEAN more;
+
+more = false;
+
+OSSemPend( pf_file_smphr, 0, &err );
+
+if( NULL != pf_wksp.ptr_file )
+    {
+    more = mp3_frame_scan_step();
+    }
+
+OSSemPost( pf_file_smphr );
+
+return more;
+
+} /* scan_frames() */
+
+/**
+    Move on to the queued file
+
+    Must be called with the file semaphore held, at the
+    end of the current file.
+
+    @return Returns TRUE if there was a queued file
+*/
+static BOOLEAN switch_to_next
+    ( void )
+{
+
+if( NULL == pf_wksp.ptr_next_file )
+    {
+    return false;
+    }
+
+pf_wksp.ptr_file      = pf_wksp.ptr_next_file;
+pf_wksp.ptr_next_file = NULL;
+pf_wksp.eof           = false;
+pf_wksp.trk_start     = true;
+
+return true;
+
+} /* switch_to_next() */
+
+/**
+    Empty the read ahead window
+
+    Drops the sectors not yet handed out. Sectors lent
+    to stream blocks stay lent until they are given
+    back. Must be called with the file semaphore held.
+*/
+static void reset_window
+    ( void )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT8U       i;
+
+pf_wksp.eof       = false;
+pf_wksp.trk_start = false;
+pf_wksp.wr_idx    = pf_wksp.rd_idx;
+
+OS_ENTER_CRITICAL();
+pf_wksp.cnt       = 0;
+OS_EXIT_CRITICAL();
+
+for( i = 0; i < MP3_PREFETCH_SECTOR_CNT; i++ )
+    {
+    pf_sector_trk_start[i] = false;
+    }
+
+} /* reset_window() */
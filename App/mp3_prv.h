@@ -10,6 +10,185 @@
 #include "MP3_pub.h"
 
 #include "bsp.h"
+#include "SD.h"
+
+/*---------------------------------
+Literal Constants
+---------------------------------*/
+
+#define MP3_STRM_BLK_SIZE           ( 512 )                                     // Size of a stream block, one SD sector
+#define MP3_STRM_BLK_CNT            ( 32 )                                      // Number of stream blocks in the pool, ~90 ms of CD quality WAV
+#define MP3_STRM_RING_SIZE          ( MP3_STRM_BLK_SIZE * MP3_STRM_BLK_CNT )    // Size of the stream ring
+#define MP3_STRM_RING_HIGH_WMARK    ( MP3_STRM_BLK_SIZE * 8 )                   // Default, stop refilling the ring above this
+#define MP3_STRM_RING_LOW_WMARK     ( MP3_STRM_RING_HIGH_WMARK / 2 )            // Default, refill the ring when it drops below this
+#define MP3_STRM_RING_HIGH_WMARK_MIN ( MP3_STRM_BLK_SIZE * 2 )                  // Smallest high watermark the controller sets
+#define MP3_STRM_BURST_SIZE         ( 256 )                                     // Maximum bytes sent to the decoder at a time, at normal speed
+#define MP3_STRM_PREROLL_SIZE       ( 2048 )                                    // Bytes sent at the start of a stream, the decoder's input FIFO
+
+#define MP3_STRM_TARGET_MS_DFLT     ( 250 )                                     // Playback time the ring holds once the bitrate is known
+#define MP3_STRM_TARGET_MS_MAX      ( 2000 )                                    // Limit on growing the target after underruns
+#define MP3_STRM_CTRL_POLL_BLKS     ( 8 )                                       // Blocks streamed between decoder header polls
+#define MP3_STRM_CTRL_STALL_MS      ( 2000 )                                    // Decode time standing still this long is a stall
+#define MP3_STRM_DECODE_POLL_MS     ( 250 )                                     // Shortest time between reads of the decode time
+#define MP3_STRM_TTFA_TOUCH_MS_MAX  ( 1000 )                                    // Oldest touch a playback start is timed from
+
+#define MP3_SRC_SD_PREFIX           "sd:"                                       // Names a file on the SD card, the default
+#define MP3_SRC_ROM_PREFIX          "rom:"                                      // Names an MP3 array built into the flash
+#define MP3_SRC_UART_PREFIX         "uart:"                                     // Names the stream a host sends over the UART
+#define MP3_SRC_UART_START_MS       ( 5000 )                                    // Longest wait for the host to start sending
+#define MP3_SRC_UART_IDLE_MS        ( 1000 )                                    // Host silence this long ends the stream
+#define MP3_SRC_LIVE_SIZE           ( 0xFFFFFFFF )                              // Size of a live source, its end is not known
+
+#define MP3_MAIN_FILE_CNT           ( 2 )                                       // Playing file and the file queued after it
+
+#define MP3_PREFETCH_SECTOR_SIZE    ( 512 )                                     // Size of a read ahead sector
+#define MP3_PREFETCH_SECTOR_CNT     ( 16 )                                      // Sectors read ahead of playback, a multiple
+                                                                                // of the sectors per cluster reads whole clusters
+#define MP3_PREFETCH_READ_MAX       ( 4 )                                       // Maximum sectors read from the card at a time
+#define MP3_PREFETCH_READ_MAX_PCM   ( 8 )                                       // The same for uncompressed audio
+
+#define MP3_FRAME_BUF_SIZE          ( 512 )                                     // Frame parser buffer, a power of 2
+#define MP3_FRAME_TOC_CNT           ( 100 )                                     // Entries of the time to offset table
+#define MP3_FRAME_IDX_CNT           ( 128 )                                     // Entries of the sparse frame index
+#define MP3_FRAME_SCAN_FRAMES       ( 16 )                                      // Frames indexed per scan step
+#define MP3_FRAME_MAP_CNT           ( 128 )                                     // Entries of the cluster map used by seeks
+#define MP3_FRAME_MAP_STEPS         ( 8 )                                       // Clusters mapped per scan step
+#define MP3_FRAME_SYNC_SEARCH_MAX   ( 4096 )                                    // Bytes after an ID3v2 tag searched for the first frame
+#define MP3_FRAME_SYNC_READ_SIZE    ( 64 )                                      // Bytes read at a time by that search
+#define MP3_FRAME_PROBE_SIZE        ( 192 )                                     // Bytes of the first frame read for its VBR header by a probe
+#define MP3_FRAME_WAV_CHUNK_MAX     ( 8 )                                       // Chunks of a WAV file looked through for its data
+
+#define MP3_RECORD_BLK_SIZE         ( 512 )                                     // Size of a recording ring block, one SD sector
+#define MP3_RECORD_BLK_CNT          ( 8 )                                       // Blocks of the recording ring, 128 ms at 16 kHz
+#define MP3_RECORD_DEC_BUF_WORDS    ( 1024 )                                    // Size of the decoder's recording buffer
+#define MP3_RECORD_READ_WORDS       ( 64 )                                      // Most words read from the decoder at a time
+#define MP3_RECORD_POLL_MS          ( 5 )                                       // Idle time between drains of the decoder
+#define MP3_RECORD_WAV_HDR_SIZE     ( 44 )                                      // Header of the WAV file written
+
+#define MP3_META_FILE_NAME          "MP3META.BIN"                               // Metadata cache in the root of the SD card
+#define MP3_META_NAME_LEN           ( 13 )                                      // 8.3 name including the terminator
+#define MP3_META_TOC_CNT            ( 16 )                                      // Entries of the coarse seek table kept per file
+#define MP3_META_TAG_SCAN_MAX       ( 4096 )                                    // Bytes of an ID3v2 tag searched for the title and artist
+
+#define MP3_PLUGIN_WORDS_MAX        ( 4096 )                                    // Longest compressed plugin image loaded from a file
+
+/*---------------------------------
+Types
+---------------------------------*/
+
+// Time to first audio marks, see mp3_strm_stats.c
+typedef INT8U mp3_ttfa_mark_type; enum
+    {
+    MP3_TTFA_MARK_TOUCH,
+    MP3_TTFA_MARK_START,
+    MP3_TTFA_MARK_OPEN,
+    MP3_TTFA_MARK_FIRST_BYTE,
+    MP3_TTFA_MARK_FORMAT,
+    MP3_TTFA_MARK_DECODE,
+
+    MP3_TTFA_MARK_CNT
+    };
+
+// Playback source, see mp3_src.c
+typedef struct
+    {
+    const struct mp3_src_ops_struct*    ptr_ops;    // Backend, NULL while closed
+    File                                file;       // SD card file
+    const INT8U*                        ptr_rom;    // Array of the ROM table
+    INT32U                              rom_size;
+    INT32U                              rom_pos;    // Read position in ptr_rom
+    INT32U                              uart_pos;   // Bytes read from the UART
+    INT32U                              range_start;// Range of the bytes read, see mp3_src_set_range()
+    INT32U                              range_end;
+    } mp3_src_type;
+
+// Frame layout of a file, from the frame parser, kept in the metadata cache
+typedef struct
+    {
+    INT32U          audio_start;                // Offset of the first frame, or sample of a WAV file
+    INT32U          audio_end;                  // Offset after the last byte of audio
+    INT32U          sample_rate;                // 0 if no frame was found
+    INT16U          samples_per_frame;
+    INT16U          bitrate_kbps;               // Bitrate of the first frame
+    INT16U          block_align;                // Bytes per sample frame of a WAV file, 0 for MPEG audio
+    INT32U          frame_cnt;                  // Number of frames, 0 if the duration is an estimate
+    INT32U          duration_ms;
+    INT8U           toc_cnt;                    // Entries in toc, 0 if none
+    INT32U          toc[MP3_META_TOC_CNT];      // Offsets of the audio at equal steps of time
+    } mp3_frame_info_type;
+
+// Block of MP3 data handed from the MP3 main
+// thread to the MP3 streaming thread
+typedef struct
+    {
+    INT16U          size;               // Number of valid bytes at ptr_data
+    BOOLEAN         trk_start;          // Data is the start of a queued track
+    const INT8U*    ptr_data;           // data, or the data in place for a source that maps it or the read ahead window
+    BOOLEAN         pf_lent;            // ptr_data is a sector of the read ahead window, given back on release
+    INT8U           data[MP3_STRM_BLK_SIZE];
+    } mp3_strm_blk_type;
+
+/*---------------------------------
+mp3_frame.c
+---------------------------------*/
+
+BOOLEAN mp3_frame_open
+    (
+    mp3_src_type*   ptr_file,
+    const char*     fname
+    );
+
+void mp3_frame_close
+    ( void );
+
+BOOLEAN mp3_frame_scan_step
+    ( void );
+
+INT32U mp3_frame_get_duration_ms
+    ( void );
+
+INT16U mp3_frame_get_pcm_kbps
+    ( void );
+
+BOOLEAN mp3_frame_seek
+    (
+    mp3_src_type*   ptr_file,
+    INT32U*         ptr_ms
+    );
+
+INT32U mp3_frame_get_id3v2_size
+    (
+    mp3_src_type* ptr_file
+    );
+
+BOOLEAN mp3_frame_is_wav
+    (
+    mp3_src_type* ptr_file
+    );
+
+BOOLEAN mp3_frame_find_audio
+    (
+    mp3_src_type*   ptr_file,
+    INT32U*         ptr_start,
+    INT32U*         ptr_end
+    );
+
+void mp3_frame_open_info
+    (
+    const char*                 fname,
+    const mp3_frame_info_type*  ptr_info
+    );
+
+BOOLEAN mp3_frame_get_info
+    (
+    mp3_frame_info_type* ptr_info
+    );
+
+BOOLEAN mp3_frame_probe
+    (
+    mp3_src_type*           ptr_file,
+    mp3_frame_info_type*    ptr_info
+    );
 
 /*---------------------------------
 mp3_main.c
@@ -23,6 +202,224 @@ void mp3_set_playback_status
 void mp3_signal_buffer_empty
     ( void );
 
+void mp3_signal_track_start
+    ( void );
+
+/*---------------------------------
+mp3_meta.c
+---------------------------------*/
+
+void mp3_meta_pwrp
+    ( void );
+
+void mp3_meta_load
+    ( void );
+
+BOOLEAN mp3_meta_keep
+    (
+    const char* fname,
+    INT32U      size,
+    INT32U      ident
+    );
+
+void mp3_meta_prune
+    ( void );
+
+BOOLEAN mp3_meta_save
+    ( void );
+
+BOOLEAN mp3_meta_build
+    (
+    const char* fname
+    );
+
+BOOLEAN mp3_meta_open
+    (
+    mp3_src_type*   ptr_file,
+    const char*     fname,
+    INT32U*         ptr_start,
+    INT32U*         ptr_end
+    );
+
+BOOLEAN mp3_meta_get_info
+    (
+    const char*             fname,
+    mp3_frame_info_type*    ptr_info
+    );
+
+void mp3_meta_put_info
+    (
+    const char*                 fname,
+    const mp3_frame_info_type*  ptr_info
+    );
+
+BOOLEAN mp3_meta_get_track
+    (
+    const char*             fname,
+    MP3_track_info_type*    ptr_track
+    );
+
+/*---------------------------------
+mp3_playlist.c
+---------------------------------*/
+
+BOOLEAN mp3_playlist_open
+    (
+    const char* ptr_name,
+    File*       ptr_file
+    );
+
+/*---------------------------------
+mp3_prefetch.c
+---------------------------------*/
+
+void mp3_prefetch_pwrp
+    ( void );
+
+void mp3_prefetch_set_pcm
+    (
+    BOOLEAN pcm
+    );
+
+void mp3_prefetch_open
+    (
+    mp3_src_type* ptr_file
+    );
+
+void mp3_prefetch_queue
+    (
+    mp3_src_type* ptr_file
+    );
+
+void mp3_prefetch_close
+    ( void );
+
+void mp3_prefetch_lock
+    ( void );
+
+void mp3_prefetch_unlock
+    ( void );
+
+INT16U mp3_prefetch_read
+    (
+    mp3_strm_blk_type* ptr_blk
+    );
+
+void mp3_prefetch_give_back
+    ( void );
+
+/*---------------------------------
+mp3_record.c
+---------------------------------*/
+
+void mp3_record_pwrp
+    ( void );
+
+/*---------------------------------
+mp3_src.c
+---------------------------------*/
+
+BOOLEAN mp3_src_open
+    (
+    mp3_src_type*   ptr_src,
+    const char*     ptr_name
+    );
+
+void mp3_src_close
+    (
+    mp3_src_type* ptr_src
+    );
+
+BOOLEAN mp3_src_is_open
+    (
+    const mp3_src_type* ptr_src
+    );
+
+int mp3_src_read
+    (
+    mp3_src_type*   ptr_src,
+    INT8U*          ptr_dst,
+    INT16U          len
+    );
+
+BOOLEAN mp3_src_is_live
+    (
+    const mp3_src_type* ptr_src
+    );
+
+BOOLEAN mp3_src_can_map
+    (
+    const mp3_src_type* ptr_src
+    );
+
+INT16U mp3_src_map
+    (
+    mp3_src_type*   ptr_src,
+    const INT8U**   ptr_data,
+    INT16U          len
+    );
+
+BOOLEAN mp3_src_seek
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos
+    );
+
+BOOLEAN mp3_src_seek_hint
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos,
+    INT32U          hint_pos,
+    INT32U          hint
+    );
+
+INT32U mp3_src_get_hint
+    (
+    mp3_src_type* ptr_src
+    );
+
+INT32U mp3_src_position
+    (
+    mp3_src_type* ptr_src
+    );
+
+INT32U mp3_src_size
+    (
+    mp3_src_type* ptr_src
+    );
+
+INT32U mp3_src_get_ident
+    (
+    mp3_src_type* ptr_src
+    );
+
+void mp3_src_set_range
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          range_start,
+    INT32U          range_end
+    );
+
+BOOLEAN mp3_src_rewind
+    (
+    mp3_src_type* ptr_src
+    );
+
+void mp3_src_set_streaming
+    (
+    mp3_src_type* ptr_src
+    );
+
+const char* mp3_src_get_rom_name
+    (
+    INT8U idx
+    );
+
+BOOLEAN mp3_src_name_is_live
+    (
+    const char* ptr_name
+    );
+
 /*---------------------------------
 mp3_strm.c
 ---------------------------------*/
@@ -34,25 +431,197 @@ BOOLEAN mp3_strm_open
     ( void );
 
 BOOLEAN mp3_strm_close
+    (
+    BOOLEAN play_out
+    );
+
+INT32U mp3_strm_preroll
     ( void );
 
+void mp3_strm_set_speed
+    (
+    INT8U speed
+    );
+
+INT8U mp3_strm_get_speed
+    ( void );
+
+void mp3_strm_set_pcm
+    (
+    INT16U kbps
+    );
+
+void mp3_strm_set_plugin
+    (
+    const INT16U*   ptr_image,
+    INT32U          words
+    );
+
+mp3_strm_blk_type* mp3_strm_alloc_blk
+    ( void );
+
+void mp3_strm_free_blk
+    (
+    mp3_strm_blk_type* ptr_blk
+    );
+
 BOOLEAN mp3_strm_write_data
     (
-    const INT8U* ptr_data,
-    INT32U       data_size
+    mp3_strm_blk_type* ptr_blk
     );
 
+INT32U mp3_strm_get_buffered_size
+    ( void );
+
 void mp3_strm_pause
     ( void );
 
 BOOLEAN mp3_strm_resume
     ( void );
 
+void mp3_strm_flush
+    (
+    INT16U decode_time
+    );
+
 INT16U mp3_strm_get_decode_time
     (
     void
     );
 
+INT32U mp3_strm_get_decode_time_ms
+    ( void );
+
+void mp3_strm_get_stats
+    (
+    MP3_stream_stats_type* ptr_stats
+    );
+
+/*---------------------------------
+mp3_strm_ctrl.c
+---------------------------------*/
+
+void mp3_strm_ctrl_reset
+    ( void );
+
+void mp3_strm_ctrl_set_dflt_target
+    (
+    INT16U target_ms
+    );
+
+void mp3_strm_ctrl_set_speed
+    (
+    INT8U speed
+    );
+
+void mp3_strm_ctrl_set_pcm
+    (
+    INT16U kbps
+    );
+
+void mp3_strm_ctrl_restart_clock
+    ( void );
+
+void mp3_strm_ctrl_blk_done
+    (
+    HANDLE hMp3
+    );
+
+void mp3_strm_ctrl_decode_time
+    (
+    INT16U decode_time
+    );
+
+void mp3_strm_ctrl_ring_empty
+    (
+    HANDLE hMp3
+    );
+
+void mp3_strm_ctrl_get_info
+    (
+    MP3_stream_info_type* ptr_info
+    );
+
+/*---------------------------------
+mp3_strm_ring.c
+---------------------------------*/
+
+void mp3_strm_ring_pwrp
+    ( void );
+
+void mp3_strm_ring_reset
+    ( void );
+
+void mp3_strm_ring_set_wmarks
+    (
+    INT32U low_wmark,
+    INT32U high_wmark
+    );
+
+INT32U mp3_strm_ring_get_used
+    ( void );
+
+BOOLEAN mp3_strm_ring_is_below_low_wmark
+    ( void );
+
+mp3_strm_blk_type* mp3_strm_ring_alloc_blk
+    ( void );
+
+void mp3_strm_ring_post_blk
+    (
+    mp3_strm_blk_type* ptr_blk
+    );
+
+mp3_strm_blk_type* mp3_strm_ring_accept_blk
+    ( void );
+
+void mp3_strm_ring_release_blk
+    (
+    mp3_strm_blk_type* ptr_blk
+    );
+
+/*---------------------------------
+mp3_strm_stats.c
+---------------------------------*/
+
+void mp3_strm_stats_reset
+    ( void );
+
+void mp3_strm_stats_blk_start
+    (
+    INT32U ring_used
+    );
+
+void mp3_strm_stats_streamed
+    (
+    INT32U size
+    );
+
+void mp3_strm_stats_underrun
+    ( void );
+
+void mp3_strm_stats_refill_req
+    ( void );
+
+void mp3_strm_stats_refill_done
+    ( void );
+
+void mp3_strm_stats_get
+    (
+    const PjdfMp3Stats*     ptr_drv_stats,
+    MP3_stream_stats_type*  ptr_stats
+    );
+
+void mp3_strm_stats_ttfa_mark
+    (
+    mp3_ttfa_mark_type mark
+    );
+
+void mp3_strm_stats_ttfa_get
+    (
+    MP3_ttfa_type* ptr_ttfa
+    );
+
 /*---------------------------------
 mp3_strm_util.c
 ---------------------------------*/
@@ -67,7 +636,25 @@ void mp3_strm_util_start
 
 void mp3_strm_util_stop
     (
-    HANDLE hMp3
+    HANDLE  hMp3,
+    BOOLEAN play_out
+    );
+
+void mp3_strm_util_set_speed
+    (
+    HANDLE hMp3,
+    INT8U  speed
+    );
+
+void mp3_strm_util_set_plugin
+    (
+    const INT16U*   ptr_image,
+    INT32U          words
+    );
+
+void mp3_strm_util_get_plugin_stats
+    (
+    MP3_plugin_stats_type* ptr_stats
     );
 
 void mp3_strm_util_test
@@ -78,7 +665,7 @@ void mp3_strm_util_test
 void mp3_strm_util_stream_data
     (
     HANDLE hMp3,
-    INT8U *pBuf,
+    const INT8U *pBuf,
     INT32U bufLen
     );
 
@@ -87,4 +674,52 @@ INT16U mp3_strm_util_get_decode_time
     HANDLE hMp3
     );
 
+void mp3_strm_util_get_hdat
+    (
+    HANDLE  hMp3,
+    INT16U* ptr_hdat0,
+    INT16U* ptr_hdat1
+    );
+
+BOOLEAN mp3_strm_util_is_hungry
+    (
+    HANDLE hMp3
+    );
+
+void mp3_strm_util_set_decode_time
+    (
+    HANDLE hMp3,
+    INT16U decode_time
+    );
+
+void mp3_strm_util_resync
+    (
+    HANDLE hMp3,
+    INT16U decode_time
+    );
+
+void mp3_strm_util_record_start
+    (
+    HANDLE  hMp3,
+    INT16U  rate,
+    BOOLEAN line_in
+    );
+
+void mp3_strm_util_record_stop
+    (
+    HANDLE  hMp3
+    );
+
+INT16U mp3_strm_util_record_avail
+    (
+    HANDLE  hMp3
+    );
+
+void mp3_strm_util_record_read
+    (
+    HANDLE  hMp3,
+    INT16U* ptr_words,
+    INT32U  cnt
+    );
+
 #endif // MP3_PRV_H
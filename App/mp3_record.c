@@ -0,0 +1,669 @@
+/**
+    @file        mp3_record.c
+
+    @author      Vimal Mehta
+
+    @description
+        Recording task. The VS1053 encodes the microphone or
+    line input into 16 bit mono PCM, and the task writes it
+    to a WAV file on the SD card.
+
+        The file is created at its full size, made of
+    contiguous clusters, when the recording starts. Its
+    blocks are then written straight to the card as one
+    multiple block write, so the FAT and the directory
+    entry are not touched until the recording stops, when
+    the file is cut to the length recorded and the header
+    is filled in.
+
+        The task drains the words the decoder holds in
+    SCI_HDAT0 into a ring of MP3_RECORD_BLK_CNT blocks and
+    hands the card a full block whenever the card is not
+    busy, so a slow block write is ridden out by the ring
+    rather than by the decoder's own buffer. Words drained
+    while the ring is full are dropped and counted. The
+    task runs above the other application tasks, as the
+    decoder only holds MP3_RECORD_DEC_BUF_WORDS words.
+
+        The card is held, through the prefetch semaphore,
+    from the start of a recording to its end, as no other
+    command may reach it during the multiple block write.
+    Playback cannot start while a recording is made.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "SD.h"
+#include "TSK_pub.h"
+#include "MP3_pub.h"
+#include "mp3_prv.h"
+
+/**
+    Literal Constants
+*/
+#define REC_BLK_WORDS           ( MP3_RECORD_BLK_SIZE / sizeof( INT16U ) )
+
+/**
+    Types
+*/
+
+// Workspace type
+typedef struct
+    {
+    char                fname[MP3_PLAYBACK_FILE_NAME_LEN_MAX];  // File recorded to
+    INT16U              rate;                       // Sample rate
+    INT16U              scnds;                      // Length the file is made for
+    BOOLEAN             line_in;                    // Record the line input instead of the microphone
+    BOOLEAN             start_ok;                   // Recording started, set before the start is acknowledged
+    volatile BOOLEAN    stop_req;                   // Stop asked for
+    HANDLE              hndl_mp3;
+    HANDLE              hndl_spi;
+    File                file;
+    INT8U               rd_idx;                     // Next block to write to the card
+    INT8U               wr_idx;                     // Block being filled
+    INT16U              wr_words;                   // Words of the wr_idx block already filled
+    INT8U               cnt;                        // Number of full blocks waiting for the card
+    BOOLEAN             card_busy;                  // Card was busy at the last write attempt
+    INT32U              card_busy_ms;               // Time the card was first seen busy
+    } rec_wksp_type;
+
+/**
+    Static Variables
+*/
+static OS_STK                   rec_stack[APP_CFG_TASK_START_STK_SIZE];     // Recording task stack
+static INT16U                   rec_ring[MP3_RECORD_BLK_CNT][REC_BLK_WORDS];    // Blocks waiting for the card
+static INT16U                   rec_discard[MP3_RECORD_READ_WORDS];         // Words drained while the ring is full
+static rec_wksp_type            rec_wksp;                                   // Workspace
+static MP3_record_stats_type    rec_stats;                                  // Counters of the recording
+static OS_EVENT*                rec_intf_smphr;                             // Serializes the interface functions
+static OS_EVENT*                rec_start_smphr;                            // Wakes the task to start a recording
+static OS_EVENT*                rec_ack_smphr;                              // Posted once the start has been tried
+
+/**
+    Static Procedures
+*/
+
+static void mp3_record_main
+    (
+    void* pdata
+    );
+
+static BOOLEAN open_recording
+    ( void );
+
+static void close_recording
+    ( void );
+
+static BOOLEAN drain_decoder
+    ( void );
+
+static BOOLEAN write_blk
+    ( void );
+
+static void put_le
+    (
+    INT8U*  ptr_dst,
+    INT32U  value,
+    INT8U   size
+    );
+
+static void fill_wav_hdr
+    (
+    INT8U*  ptr_hdr,
+    INT16U  rate,
+    INT32U  data_len
+    );
+
+/**
+    Power up the MP3 recording task
+
+    @return None
+*/
+void mp3_record_pwrp
+    ( void )
+{
+
+rec_intf_smphr  = OSSemCreate( 1 );
+rec_start_smphr = OSSemCreate( 0 );
+rec_ack_smphr   = OSSemCreate( 0 );
+if( ( NULL == rec_intf_smphr ) || ( NULL == rec_start_smphr ) || ( NULL == rec_ack_smphr ) )
+    {
+    while(1);
+    }
+
+memset( &rec_stats, 0, sizeof( rec_stats ) );
+rec_wksp.hndl_mp3 = -1;
+rec_wksp.hndl_spi = -1;
+
+OSTaskCreate
+    (
+    mp3_record_main,
+    (void*)0,
+    &rec_stack[APP_CFG_TASK_START_STK_SIZE-1],
+    APP_TASK_MP3_RECORD_PRIO
+    );
+
+} /* mp3_record_pwrp() */
+
+/**
+    Start a recording
+
+    Records to a WAV file in the root of the SD card,
+    which is replaced if it exists. The file is made
+    long enough for scnds seconds, and the recording
+    stops by itself once it is full. Only mono 16 bit
+    PCM is recorded, at MP3_RECORD_RATE_MIN to
+    MP3_RECORD_RATE_MAX samples a second. Playback
+    must be off. Waits until the file is made and the
+    decoder is recording.
+
+    @return Returns TRUE if the recording started
+*/
+BOOLEAN MP3_record_start
+    (
+    const char* ptr_file_name,
+    INT16U      rate,
+    INT16U      scnds,
+    BOOLEAN     line_in
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT8U       err;
+BOOLEAN     success;
+
+if( ( NULL == ptr_file_name ) || ( 0 == scnds ) ||
+    ( rate < MP3_RECORD_RATE_MIN ) || ( rate > MP3_RECORD_RATE_MAX ) )
+    {
+    return false;
+    }
+
+OSSemPend( rec_intf_smphr, 0, &err );
+
+success = !rec_stats.active && ( MP3_PLAYBACK_STS_OFF == MP3_playback_get_status() );
+if( success )
+    {
+    strncpy( rec_wksp.fname, ptr_file_name, sizeof( rec_wksp.fname ) - 1 );
+    rec_wksp.fname[sizeof( rec_wksp.fname ) - 1] = '\0';
+    rec_wksp.rate     = rate;
+    rec_wksp.scnds    = scnds;
+    rec_wksp.line_in  = line_in;
+    rec_wksp.stop_req = false;
+
+    OS_ENTER_CRITICAL();
+    memset( &rec_stats, 0, sizeof( rec_stats ) );
+    rec_stats.active = true;
+    OS_EXIT_CRITICAL();
+
+    OSSemPost( rec_start_smphr );
+    OSSemPend( rec_ack_smphr, 0, &err );
+
+    success = rec_wksp.start_ok;
+    }
+
+OSSemPost( rec_intf_smphr );
+
+return success;
+
+} /* MP3_record_start() */
+
+/**
+    Stop a recording
+
+    Waits until the file has been completed and
+    closed.
+
+    @return Returns TRUE if a recording was stopped
+*/
+BOOLEAN MP3_record_stop
+    ( void )
+{
+INT8U   err;
+BOOLEAN success;
+
+OSSemPend( rec_intf_smphr, 0, &err );
+
+success = rec_stats.active;
+if( success )
+    {
+    rec_wksp.stop_req = true;
+    while( rec_stats.active )
+        {
+        OSTimeDly( MP3_RECORD_POLL_MS );
+        }
+    }
+
+OSSemPost( rec_intf_smphr );
+
+return success;
+
+} /* MP3_record_stop() */
+
+/**
+    Is a recording in progress
+
+    @return Returns TRUE from the start of a
+            recording until its file is closed
+*/
+BOOLEAN MP3_record_is_active
+    ( void )
+{
+
+return rec_stats.active;
+
+} /* MP3_record_is_active() */
+
+/**
+    Get the recording counters
+
+    The counters of the last recording are kept
+    until the next one starts.
+
+    @return None
+*/
+void MP3_record_get_stats
+    (
+    MP3_record_stats_type* ptr_stats
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+*ptr_stats = rec_stats;
+OS_EXIT_CRITICAL();
+
+} /* MP3_record_get_stats() */
+
+/**
+    MP3 recording task
+
+    Sleeps until a recording is started, then drains
+    the decoder and writes the card in turn until the
+    recording is stopped, the file is full or a write
+    fails.
+
+    @return None
+*/
+static void mp3_record_main
+    (
+    void* pdata
+    )
+{
+INT8U   err;
+BOOLEAN busy;
+
+for(;;)
+    {
+    OSSemPend( rec_start_smphr, 0, &err );
+
+    rec_wksp.start_ok = open_recording();
+    if( !rec_wksp.start_ok )
+        {
+        rec_stats.failed = true;
+        rec_stats.active   = false;
+        }
+    OSSemPost( rec_ack_smphr );
+
+    if( !rec_wksp.start_ok )
+        {
+        continue;
+        }
+
+    while( !rec_wksp.stop_req && !rec_stats.failed &&
+           ( rec_stats.samples < rec_stats.samples_max ) )
+        {
+        busy  = drain_decoder();
+        busy |= write_blk();
+        if( !busy )
+            {
+            OSTimeDly( MP3_RECORD_POLL_MS );
+            }
+        }
+
+    close_recording();
+
+    rec_stats.active = false;
+    }
+
+} /* mp3_record_main() */
+
+/**
+    Open a recording
+
+    Takes the card, creates the file and starts the
+    multiple block write of it, then starts the
+    decoder's encoder. The first block starts with a
+    header for a full file, which is corrected when
+    the recording is closed.
+
+    @return Returns TRUE if the recording started
+*/
+static BOOLEAN open_recording
+    ( void )
+{
+PjdfErrCode pjdfErr;
+INT32U      length;
+INT32U      size;
+INT32U      bgn_blk;
+INT32U      end_blk;
+
+size = MP3_RECORD_WAV_HDR_SIZE + (INT32U)rec_wksp.scnds * rec_wksp.rate * sizeof( INT16U );
+
+mp3_prefetch_lock();
+
+(void)SD.remove( rec_wksp.fname );
+
+rec_wksp.file = SD.createContiguous( rec_wksp.fname, size );
+if( !rec_wksp.file )
+    {
+    goto exit_unlock;
+    }
+
+if( !rec_wksp.file.contiguousRange( &bgn_blk, &end_blk ) ||
+    !SD.writeBlocksStart( bgn_blk, ( size + MP3_RECORD_BLK_SIZE - 1 ) / MP3_RECORD_BLK_SIZE ) )
+    {
+    goto exit_remove;
+    }
+
+// Open handles to the decoder driver and its SPI
+rec_wksp.hndl_mp3 = Open( PJDF_DEVICE_ID_MP3_VS1053, 0 );
+rec_wksp.hndl_spi = Open( MP3_SPI_DEVICE_ID, 0 );
+if( !PJDF_IS_VALID_HANDLE( rec_wksp.hndl_mp3 ) || !PJDF_IS_VALID_HANDLE( rec_wksp.hndl_spi ) )
+    {
+    goto exit_stop;
+    }
+
+length  = sizeof( HANDLE );
+pjdfErr = Ioctl( rec_wksp.hndl_mp3, PJDF_CTRL_MP3_SET_SPI_HANDLE, &rec_wksp.hndl_spi, &length );
+if( PJDF_IS_ERROR( pjdfErr ) )
+    {
+    goto exit_stop;
+    }
+
+rec_wksp.rd_idx    = 0;
+rec_wksp.wr_idx    = 0;
+rec_wksp.cnt       = 0;
+rec_wksp.card_busy = false;
+fill_wav_hdr( (INT8U*)rec_ring[0], rec_wksp.rate, size - MP3_RECORD_WAV_HDR_SIZE );
+rec_wksp.wr_words  = MP3_RECORD_WAV_HDR_SIZE / sizeof( INT16U );
+
+rec_stats.samples_max = ( size - MP3_RECORD_WAV_HDR_SIZE ) / sizeof( INT16U );
+
+mp3_strm_util_record_start( rec_wksp.hndl_mp3, rec_wksp.rate, rec_wksp.line_in );
+
+return true;
+
+exit_stop:
+
+if( PJDF_IS_VALID_HANDLE( rec_wksp.hndl_mp3 ) )
+    {
+    (void)Close( rec_wksp.hndl_mp3 );
+    }
+if( PJDF_IS_VALID_HANDLE( rec_wksp.hndl_spi ) )
+    {
+    (void)Close( rec_wksp.hndl_spi );
+    }
+rec_wksp.hndl_mp3 = -1;
+rec_wksp.hndl_spi = -1;
+
+(void)SD.writeBlocksStop();
+
+exit_remove:
+
+rec_wksp.file.close();
+(void)SD.remove( rec_wksp.fname );
+
+exit_unlock:
+
+mp3_prefetch_unlock();
+
+return false;
+
+} /* open_recording() */
+
+/**
+    Close a recording
+
+    Takes the decoder out of its encoder, writes out
+    the ring with the last block padded with silence,
+    and ends the multiple block write. The file is
+    then cut to the samples kept and its header filled
+    in, which are the only updates of the FAT and the
+    directory entry. The card is given back.
+
+    @return None
+*/
+static void close_recording
+    ( void )
+{
+INT8U   hdr[MP3_RECORD_WAV_HDR_SIZE];
+INT32U  data_len;
+
+mp3_strm_util_record_stop( rec_wksp.hndl_mp3 );
+
+(void)Close( rec_wksp.hndl_mp3 );
+(void)Close( rec_wksp.hndl_spi );
+rec_wksp.hndl_mp3 = -1;
+rec_wksp.hndl_spi = -1;
+
+if( 0 != rec_wksp.wr_words )
+    {
+    memset( &rec_ring[rec_wksp.wr_idx][rec_wksp.wr_words], 0, ( REC_BLK_WORDS - rec_wksp.wr_words ) * sizeof( INT16U ) );
+    rec_wksp.wr_idx   = ( rec_wksp.wr_idx + 1 ) % MP3_RECORD_BLK_CNT;
+    rec_wksp.wr_words = 0;
+    rec_wksp.cnt++;
+    }
+
+while( ( 0 != rec_wksp.cnt ) && !rec_stats.failed )
+    {
+    if( !write_blk() )
+        {
+        OSTimeDly( 1 );
+        }
+    }
+
+if( !SD.writeBlocksStop() )
+    {
+    rec_stats.failed = true;
+    }
+
+data_len = rec_stats.samples * sizeof( INT16U );
+fill_wav_hdr( hdr, rec_wksp.rate, data_len );
+
+if( !rec_wksp.file.truncate( MP3_RECORD_WAV_HDR_SIZE + data_len ) ||
+    !rec_wksp.file.seek( 0 ) ||
+    ( sizeof( hdr ) != rec_wksp.file.write( hdr, sizeof( hdr ) ) ) )
+    {
+    rec_stats.failed = true;
+    }
+
+rec_wksp.file.close();
+
+mp3_prefetch_unlock();
+
+} /* close_recording() */
+
+/**
+    Drain the decoder into the ring
+
+    Reads all the words the decoder holds, up to
+    the room left in the file. Words that find the
+    ring full are read all the same, to keep the
+    decoder from overflowing, and counted as dropped.
+
+    @return Returns TRUE if any words were read
+*/
+static BOOLEAN drain_decoder
+    ( void )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT16U      avail;
+INT32U      cnt;
+INT32U      room;
+
+avail = mp3_strm_util_record_avail( rec_wksp.hndl_mp3 );
+if( 0 == avail )
+    {
+    return false;
+    }
+
+if( avail >= MP3_RECORD_DEC_BUF_WORDS )
+    {
+    rec_stats.dec_full_cnt++;
+    }
+
+while( avail > 0 )
+    {
+    room = rec_stats.samples_max - rec_stats.samples;
+    if( 0 == room )
+        {
+        break;
+        }
+
+    cnt = ( avail > MP3_RECORD_READ_WORDS ) ? MP3_RECORD_READ_WORDS : avail;
+    if( cnt > room )
+        {
+        cnt = room;
+        }
+
+    if( rec_wksp.cnt >= MP3_RECORD_BLK_CNT )
+        {
+        mp3_strm_util_record_read( rec_wksp.hndl_mp3, rec_discard, cnt );
+        rec_stats.dropped_samples += cnt;
+        }
+    else
+        {
+        if( cnt > REC_BLK_WORDS - rec_wksp.wr_words )
+            {
+            cnt = REC_BLK_WORDS - rec_wksp.wr_words;
+            }
+
+        mp3_strm_util_record_read( rec_wksp.hndl_mp3, &rec_ring[rec_wksp.wr_idx][rec_wksp.wr_words], cnt );
+        rec_wksp.wr_words += cnt;
+
+        OS_ENTER_CRITICAL();
+        rec_stats.samples += cnt;
+        OS_EXIT_CRITICAL();
+
+        if( rec_wksp.wr_words >= REC_BLK_WORDS )
+            {
+            rec_wksp.wr_idx   = ( rec_wksp.wr_idx + 1 ) % MP3_RECORD_BLK_CNT;
+            rec_wksp.wr_words = 0;
+            rec_wksp.cnt++;
+            if( rec_wksp.cnt > rec_stats.ring_used_max )
+                {
+                rec_stats.ring_used_max = rec_wksp.cnt;
+                }
+            }
+        }
+
+    avail -= cnt;
+    }
+
+return true;
+
+} /* drain_decoder() */
+
+/**
+    Write the next full block to the card
+
+    Does not wait for the card to finish the
+    block before.
+
+    @return Returns TRUE if a block was written
+*/
+static BOOLEAN write_blk
+    ( void )
+{
+INT32U busy_ms;
+
+if( 0 == rec_wksp.cnt )
+    {
+    return false;
+    }
+
+if( SD.writeBlocksBusy() )
+    {
+    if( !rec_wksp.card_busy )
+        {
+        rec_wksp.card_busy    = true;
+        rec_wksp.card_busy_ms = task_ms_timer;
+        }
+    return false;
+    }
+
+if( rec_wksp.card_busy )
+    {
+    rec_wksp.card_busy = false;
+    busy_ms = task_ms_timer - rec_wksp.card_busy_ms;
+    if( busy_ms > rec_stats.card_busy_ms_max )
+        {
+        rec_stats.card_busy_ms_max = busy_ms;
+        }
+    }
+
+if( !SD.writeBlocksData( (const uint8_t*)rec_ring[rec_wksp.rd_idx] ) )
+    {
+    rec_stats.failed = true;
+    return false;
+    }
+
+rec_wksp.rd_idx = ( rec_wksp.rd_idx + 1 ) % MP3_RECORD_BLK_CNT;
+rec_wksp.cnt--;
+rec_stats.blks_written++;
+
+return true;
+
+} /* write_blk() */
+
+/**
+    Store a little endian value
+
+    @return None
+*/
+static void put_le
+    (
+    INT8U*  ptr_dst,
+    INT32U  value,
+    INT8U   size
+    )
+{
+
+while( size-- > 0 )
+    {
+    *ptr_dst++ = (INT8U)value;
+    value >>= 8;
+    }
+
+} /* put_le() */
+
+/**
+    Fill in the header of a mono 16 bit PCM
+    WAV file
+
+    @return None
+*/
+static void fill_wav_hdr
+    (
+    INT8U*  ptr_hdr,
+    INT16U  rate,
+    INT32U  data_len
+    )
+{
+
+memcpy( &ptr_hdr[0], "RIFF", 4 );
+put_le( &ptr_hdr[4], MP3_RECORD_WAV_HDR_SIZE - 8 + data_len, 4 );
+memcpy( &ptr_hdr[8], "WAVEfmt ", 8 );
+put_le( &ptr_hdr[16], 16, 4 );                              // Format chunk size
+put_le( &ptr_hdr[20], 1, 2 );                               // PCM
+put_le( &ptr_hdr[22], 1, 2 );                               // Channels
+put_le( &ptr_hdr[24], rate, 4 );
+put_le( &ptr_hdr[28], (INT32U)rate * sizeof( INT16U ), 4 ); // Bytes a second
+put_le( &ptr_hdr[32], sizeof( INT16U ), 2 );                // Block align
+put_le( &ptr_hdr[34], 16, 2 );                              // Bits a sample
+memcpy( &ptr_hdr[36], "data", 4 );
+put_le( &ptr_hdr[40], data_len, 4 );
+
+} /* fill_wav_hdr() */
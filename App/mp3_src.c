@@ -0,0 +1,1200 @@
+/**
+    @file        mp3_src.c
+
+    @author      Vimal Mehta
+
+    @description
+        Playback sources. A source is opened by a name with
+    an optional prefix that picks its backend:
+
+        sd:/TRACK.MP3   a file on the SD card, also when
+                        there is no prefix
+        rom:test_song   an MP3 array built into the flash
+        uart:           MP3 data a host streams over the
+                        UART, the ST-Link virtual COM port
+
+        Each backend is a table of operations, so the MP3
+    main thread, the prefetch task and the frame parser
+    read, seek and size any source the same way.
+
+        The ROM backend also maps its data, handing out
+    pointers into the const array itself, so the MP3 main
+    thread can stream it to the decoder without copying it
+    into the stream ring. It needs neither the SD card nor
+    the prefetch task, which makes it both a fixed baseline
+    for the streaming path and the fallback when there is
+    no card.
+
+        The UART backend is a live source. It can not seek
+    and its size is MP3_SRC_LIVE_SIZE, so the MP3 main
+    thread neither parses its frames nor looks it up in
+    the metadata cache, and the prefetch task leaves it
+    to the DMA ring of the UART, see bspUart.c, which
+    already holds about 90 ms of it. The host is held
+    off with XON/XOFF, since the virtual COM port has
+    no RTS/CTS, for instance on Linux with
+
+        stty -F /dev/ttyACM0 460800 raw -echo ixon
+        cat TRACK.MP3 > /dev/ttyACM0
+
+    started once playback of "uart:" has started. The
+    stream ends once the host has been silent for
+    MP3_SRC_UART_IDLE_MS.
+
+        A source can be narrowed to a range of its bytes,
+    such as the audio between the tags of an MP3 file.
+    Reads and maps then end at the end of the range, and
+    the size is that of the file up to it.
+
+        Access to the card is serialized by the prefetch
+    file semaphore; the ROM and UART backends need no
+    locking.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "SD.h"
+#include "DFS_pub.h"
+#include "mp3_prv.h"
+
+#include "test_song.h"
+#include "train_crossing.h"
+
+/**
+    Literal Constants
+*/
+#define SRC_ROM_CNT                 ( sizeof( src_rom_tbl ) / sizeof( src_rom_tbl[0] ) )   // Entries of the ROM table
+
+/**
+    Types
+*/
+
+// Backend operations
+typedef struct mp3_src_ops_struct
+    {
+    BOOLEAN         (*open)( mp3_src_type* ptr_src, const char* ptr_name );
+    void            (*close)( mp3_src_type* ptr_src );
+    int             (*read)( mp3_src_type* ptr_src, INT8U* ptr_dst, INT16U len );
+    INT16U          (*map)( mp3_src_type* ptr_src, const INT8U** ptr_data, INT16U len );    // NULL if the data must be read
+    BOOLEAN         (*seek)( mp3_src_type* ptr_src, INT32U pos, INT32U hint_pos, INT32U hint );
+    INT32U          (*get_hint)( mp3_src_type* ptr_src );
+    INT32U          (*position)( mp3_src_type* ptr_src );
+    INT32U          (*size)( mp3_src_type* ptr_src );
+    INT32U          (*get_ident)( mp3_src_type* ptr_src );
+    void            (*set_streaming)( mp3_src_type* ptr_src );
+    } src_ops_type;
+
+// Entry of the ROM table
+typedef struct
+    {
+    const char*     ptr_name;                   // Name including MP3_SRC_ROM_PREFIX
+    const INT8U*    ptr_data;
+    INT32U          size;
+    } src_rom_type;
+
+/**
+    Static Procedures
+*/
+
+static INT16U clamp_len
+    (
+    mp3_src_type*   ptr_src,
+    INT16U          len
+    );
+
+static BOOLEAN sd_open
+    (
+    mp3_src_type*   ptr_src,
+    const char*     ptr_name
+    );
+
+static void sd_close
+    (
+    mp3_src_type* ptr_src
+    );
+
+static int sd_read
+    (
+    mp3_src_type*   ptr_src,
+    INT8U*          ptr_dst,
+    INT16U          len
+    );
+
+static BOOLEAN sd_seek
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos,
+    INT32U          hint_pos,
+    INT32U          hint
+    );
+
+static INT32U sd_get_hint
+    (
+    mp3_src_type* ptr_src
+    );
+
+static INT32U sd_position
+    (
+    mp3_src_type* ptr_src
+    );
+
+static INT32U sd_size
+    (
+    mp3_src_type* ptr_src
+    );
+
+static INT32U sd_get_ident
+    (
+    mp3_src_type* ptr_src
+    );
+
+static void sd_set_streaming
+    (
+    mp3_src_type* ptr_src
+    );
+
+static BOOLEAN rom_open
+    (
+    mp3_src_type*   ptr_src,
+    const char*     ptr_name
+    );
+
+static void rom_close
+    (
+    mp3_src_type* ptr_src
+    );
+
+static int rom_read
+    (
+    mp3_src_type*   ptr_src,
+    INT8U*          ptr_dst,
+    INT16U          len
+    );
+
+static INT16U rom_map
+    (
+    mp3_src_type*   ptr_src,
+    const INT8U**   ptr_data,
+    INT16U          len
+    );
+
+static BOOLEAN rom_seek
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos,
+    INT32U          hint_pos,
+    INT32U          hint
+    );
+
+static INT32U rom_get_hint
+    (
+    mp3_src_type* ptr_src
+    );
+
+static INT32U rom_position
+    (
+    mp3_src_type* ptr_src
+    );
+
+static INT32U rom_size
+    (
+    mp3_src_type* ptr_src
+    );
+
+static INT32U rom_get_ident
+    (
+    mp3_src_type* ptr_src
+    );
+
+static void rom_set_streaming
+    (
+    mp3_src_type* ptr_src
+    );
+
+static BOOLEAN uart_open
+    (
+    mp3_src_type*   ptr_src,
+    const char*     ptr_name
+    );
+
+static void uart_close
+    (
+    mp3_src_type* ptr_src
+    );
+
+static int uart_read
+    (
+    mp3_src_type*   ptr_src,
+    INT8U*          ptr_dst,
+    INT16U          len
+    );
+
+static BOOLEAN uart_seek
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos,
+    INT32U          hint_pos,
+    INT32U          hint
+    );
+
+static INT32U uart_position
+    (
+    mp3_src_type* ptr_src
+    );
+
+static INT32U uart_size
+    (
+    mp3_src_type* ptr_src
+    );
+
+/**
+    Static Variables
+*/
+static const src_ops_type       src_sd_ops =
+    {
+    sd_open,
+    sd_close,
+    sd_read,
+    NULL,
+    sd_seek,
+    sd_get_hint,
+    sd_position,
+    sd_size,
+    sd_get_ident,
+    sd_set_streaming
+    };
+
+static const src_ops_type       src_rom_ops =
+    {
+    rom_open,
+    rom_close,
+    rom_read,
+    rom_map,
+    rom_seek,
+    rom_get_hint,
+    rom_position,
+    rom_size,
+    rom_get_ident,
+    rom_set_streaming
+    };
+
+// The UART has no hints, identity or streaming set up
+// either, so it shares those of the ROM
+static const src_ops_type       src_uart_ops =
+    {
+    uart_open,
+    uart_close,
+    uart_read,
+    NULL,
+    uart_seek,
+    rom_get_hint,
+    uart_position,
+    uart_size,
+    rom_get_ident,
+    rom_set_streaming
+    };
+
+static const src_rom_type       src_rom_tbl[] =
+    {
+    { MP3_SRC_ROM_PREFIX "test_song",   Test_Song,      sizeof( Test_Song ) },
+    { MP3_SRC_ROM_PREFIX "train",       Train_Crossing, sizeof( Train_Crossing ) },
+    };
+
+/**
+    Open a source
+
+    The backend is picked by the prefix of the name,
+    the SD card if it has none. The source must not be
+    open already. The SD card must only be accessed
+    with the prefetch file semaphore held.
+
+    @return Returns TRUE if the source was opened and
+            is not empty
+*/
+BOOLEAN mp3_src_open
+    (
+    mp3_src_type*   ptr_src,
+    const char*     ptr_name
+    )
+{
+const src_ops_type* ptr_ops;
+
+ptr_src->ptr_ops = NULL;
+
+if( 0 == strncmp( ptr_name, MP3_SRC_ROM_PREFIX, sizeof( MP3_SRC_ROM_PREFIX ) - 1 ) )
+    {
+    ptr_ops   = &src_rom_ops;
+    ptr_name += sizeof( MP3_SRC_ROM_PREFIX ) - 1;
+    }
+else if( mp3_src_name_is_live( ptr_name ) )
+    {
+    ptr_ops   = &src_uart_ops;
+    ptr_name += sizeof( MP3_SRC_UART_PREFIX ) - 1;
+    }
+else
+    {
+    ptr_ops = &src_sd_ops;
+    if( 0 == strncmp( ptr_name, MP3_SRC_SD_PREFIX, sizeof( MP3_SRC_SD_PREFIX ) - 1 ) )
+        {
+        ptr_name += sizeof( MP3_SRC_SD_PREFIX ) - 1;
+        }
+    }
+
+if( !ptr_ops->open( ptr_src, ptr_name ) )
+    {
+    return false;
+    }
+
+ptr_src->ptr_ops     = ptr_ops;
+ptr_src->range_start = 0;
+ptr_src->range_end   = ptr_ops->size( ptr_src );
+
+if( 0 == mp3_src_size( ptr_src ) )
+    {
+    mp3_src_close( ptr_src );
+    return false;
+    }
+
+return true;
+
+} /* mp3_src_open() */
+
+/**
+    Close a source
+
+    Does nothing if the source is not open.
+
+    @return None
+*/
+void mp3_src_close
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+if( NULL != ptr_src->ptr_ops )
+    {
+    ptr_src->ptr_ops->close( ptr_src );
+    ptr_src->ptr_ops = NULL;
+    }
+
+} /* mp3_src_close() */
+
+/**
+    Is a source open
+
+    @return Returns TRUE if the source is open
+*/
+BOOLEAN mp3_src_is_open
+    (
+    const mp3_src_type* ptr_src
+    )
+{
+
+return ( NULL != ptr_src->ptr_ops );
+
+} /* mp3_src_is_open() */
+
+/**
+    Read the next bytes of a source
+
+    @return Returns the number of bytes read, 0 at
+            the end of the source, -1 on an error
+*/
+int mp3_src_read
+    (
+    mp3_src_type*   ptr_src,
+    INT8U*          ptr_dst,
+    INT16U          len
+    )
+{
+
+len = clamp_len( ptr_src, len );
+if( 0 == len )
+    {
+    return 0;
+    }
+
+return ptr_src->ptr_ops->read( ptr_src, ptr_dst, len );
+
+} /* mp3_src_read() */
+
+/**
+    Is a source live, see mp3_src_name_is_live()
+
+    @return Returns TRUE if the source is read as its
+            data arrives
+*/
+BOOLEAN mp3_src_is_live
+    (
+    const mp3_src_type* ptr_src
+    )
+{
+
+return ( &src_uart_ops == ptr_src->ptr_ops );
+
+} /* mp3_src_is_live() */
+
+/**
+    Can the data of a source be mapped
+
+    @return Returns TRUE if mp3_src_map() hands out
+            the data in place
+*/
+BOOLEAN mp3_src_can_map
+    (
+    const mp3_src_type* ptr_src
+    )
+{
+
+return ( NULL != ptr_src->ptr_ops->map );
+
+} /* mp3_src_can_map() */
+
+/**
+    Map the next bytes of a source
+
+    Like mp3_src_read(), but *ptr_data is pointed at
+    the data in place instead of copying it. The data
+    stays valid for as long as the program runs.
+
+    @return Returns the number of bytes mapped, 0 at
+            the end of the source or if it can not
+            be mapped
+*/
+INT16U mp3_src_map
+    (
+    mp3_src_type*   ptr_src,
+    const INT8U**   ptr_data,
+    INT16U          len
+    )
+{
+
+len = clamp_len( ptr_src, len );
+if( !mp3_src_can_map( ptr_src ) || ( 0 == len ) )
+    {
+    return 0;
+    }
+
+return ptr_src->ptr_ops->map( ptr_src, ptr_data, len );
+
+} /* mp3_src_map() */
+
+/**
+    Move the read position of a source
+
+    @return Returns TRUE if the source was positioned
+*/
+BOOLEAN mp3_src_seek
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos
+    )
+{
+
+return ptr_src->ptr_ops->seek( ptr_src, pos, 0, 0 );
+
+} /* mp3_src_seek() */
+
+/**
+    Move the read position of a source from a hint
+
+    The hint is a value from mp3_src_get_hint() taken
+    at hint_pos, which for the SD card saves walking
+    the cluster chain from the start of the file.
+
+    @return Returns TRUE if the source was positioned
+*/
+BOOLEAN mp3_src_seek_hint
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos,
+    INT32U          hint_pos,
+    INT32U          hint
+    )
+{
+
+return ptr_src->ptr_ops->seek( ptr_src, pos, hint_pos, hint );
+
+} /* mp3_src_seek_hint() */
+
+/**
+    Get a seek hint for the read position
+
+    @return Returns the hint, 0 if none
+*/
+INT32U mp3_src_get_hint
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->ptr_ops->get_hint( ptr_src );
+
+} /* mp3_src_get_hint() */
+
+/**
+    Get the read position of a source
+
+    @return Returns the offset of the next byte read
+*/
+INT32U mp3_src_position
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->ptr_ops->position( ptr_src );
+
+} /* mp3_src_position() */
+
+/**
+    Get the size of a source
+
+    @return Returns the size in bytes, up to the end
+            of its range
+*/
+INT32U mp3_src_size
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->range_end;
+
+} /* mp3_src_size() */
+
+/**
+    Get an identity of the data of a source
+
+    Together with the name and size it tells whether
+    a file has been replaced since it was last seen.
+
+    @return Returns the first cluster of a file on the
+            SD card, 0 for the ROM and the UART
+*/
+INT32U mp3_src_get_ident
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->ptr_ops->get_ident( ptr_src );
+
+} /* mp3_src_get_ident() */
+
+/**
+    Narrow a source to a range of its bytes
+
+    Reads and maps end at range_end, and
+    mp3_src_rewind() goes back to range_start. The
+    range is kept within the source.
+
+    @return None
+*/
+void mp3_src_set_range
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          range_start,
+    INT32U          range_end
+    )
+{
+INT32U size;
+
+size = ptr_src->ptr_ops->size( ptr_src );
+
+if( range_end > size )
+    {
+    range_end = size;
+    }
+
+if( range_start > range_end )
+    {
+    range_start = range_end;
+    }
+
+ptr_src->range_start = range_start;
+ptr_src->range_end   = range_end;
+
+} /* mp3_src_set_range() */
+
+/**
+    Move the read position of a source to the start
+    of its range
+
+    @return Returns TRUE if the source was positioned
+*/
+BOOLEAN mp3_src_rewind
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return mp3_src_seek( ptr_src, ptr_src->range_start );
+
+} /* mp3_src_rewind() */
+
+/**
+    Set a source up for reading straight through
+
+    @return None
+*/
+void mp3_src_set_streaming
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+ptr_src->ptr_ops->set_streaming( ptr_src );
+
+} /* mp3_src_set_streaming() */
+
+/**
+    Get the name of a ROM source
+
+    @return Returns the name, with its prefix, of
+            entry idx of the ROM table, NULL past the
+            end of the table
+*/
+const char* mp3_src_get_rom_name
+    (
+    INT8U idx
+    )
+{
+
+if( idx >= SRC_ROM_CNT )
+    {
+    return NULL;
+    }
+
+return src_rom_tbl[idx].ptr_name;
+
+} /* mp3_src_get_rom_name() */
+
+/**
+    Is a name that of a live source
+
+    A live source, the UART, is read as it arrives. It
+    can not seek, its size is MP3_SRC_LIVE_SIZE and only
+    one handle of it can be open at a time.
+
+    @return Returns TRUE if the name is of a live source
+*/
+BOOLEAN mp3_src_name_is_live
+    (
+    const char* ptr_name
+    )
+{
+
+return ( 0 == strncmp( ptr_name, MP3_SRC_UART_PREFIX, sizeof( MP3_SRC_UART_PREFIX ) - 1 ) );
+
+} /* mp3_src_name_is_live() */
+
+/**
+    Open a file on the SD card
+
+    @return Returns TRUE if the file was opened
+*/
+static BOOLEAN sd_open
+    (
+    mp3_src_type*   ptr_src,
+    const char*     ptr_name
+    )
+{
+
+if( !DFS_is_card_present() )
+    {
+    return false;
+    }
+
+// A playlist file opens without a directory search
+if( mp3_playlist_open( ptr_name, &ptr_src->file ) )
+    {
+    return true;
+    }
+
+ptr_src->file = SD.open( ptr_name, O_READ );
+
+return ( ptr_src->file ? true : false );
+
+} /* sd_open() */
+
+/**
+    Close a file on the SD card
+*/
+static void sd_close
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+ptr_src->file.close();
+
+} /* sd_close() */
+
+/**
+    Read a file on the SD card
+
+    @return Returns the number of bytes read
+*/
+static int sd_read
+    (
+    mp3_src_type*   ptr_src,
+    INT8U*          ptr_dst,
+    INT16U          len
+    )
+{
+
+return ptr_src->file.read( ptr_dst, len );
+
+} /* sd_read() */
+
+/**
+    Seek a file on the SD card
+
+    A hint_pos of 0 walks the cluster chain from the
+    start of the file.
+
+    @return Returns TRUE if the file was positioned
+*/
+static BOOLEAN sd_seek
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos,
+    INT32U          hint_pos,
+    INT32U          hint
+    )
+{
+
+if( 0 == hint_pos )
+    {
+    return ptr_src->file.seek( pos );
+    }
+
+return ptr_src->file.seek( pos, hint_pos, hint );
+
+} /* sd_seek() */
+
+/**
+    Get the cluster of the read position
+
+    @return Returns the cluster
+*/
+static INT32U sd_get_hint
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->file.cluster();
+
+} /* sd_get_hint() */
+
+/**
+    Get the read position of a file on the SD card
+
+    @return Returns the position
+*/
+static INT32U sd_position
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->file.position();
+
+} /* sd_position() */
+
+/**
+    Get the size of a file on the SD card
+
+    @return Returns the size
+*/
+static INT32U sd_size
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->file.size();
+
+} /* sd_size() */
+
+/**
+    Get the first cluster of a file on the SD card
+
+    @return Returns the cluster, 0 for an empty file
+*/
+static INT32U sd_get_ident
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->file.firstCluster();
+
+} /* sd_get_ident() */
+
+/**
+    Read a file on the SD card a block at a time,
+    straight into the caller's buffer
+*/
+static void sd_set_streaming
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+ptr_src->file.setStreamingRead( true );
+
+} /* sd_set_streaming() */
+
+/**
+    Open an array of the ROM table
+
+    @return Returns TRUE if the name is in the table
+*/
+static BOOLEAN rom_open
+    (
+    mp3_src_type*   ptr_src,
+    const char*     ptr_name
+    )
+{
+INT8U i;
+
+for( i = 0; i < SRC_ROM_CNT; i++ )
+    {
+    if( 0 == strcmp( ptr_name, &src_rom_tbl[i].ptr_name[sizeof( MP3_SRC_ROM_PREFIX ) - 1] ) )
+        {
+        ptr_src->ptr_rom  = src_rom_tbl[i].ptr_data;
+        ptr_src->rom_size = src_rom_tbl[i].size;
+        ptr_src->rom_pos  = 0;
+        return true;
+        }
+    }
+
+return false;
+
+} /* rom_open() */
+
+/**
+    Close an array of the ROM table
+*/
+static void rom_close
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+ptr_src->ptr_rom = NULL;
+
+} /* rom_close() */
+
+/**
+    Read an array of the ROM table
+
+    @return Returns the number of bytes read
+*/
+static int rom_read
+    (
+    mp3_src_type*   ptr_src,
+    INT8U*          ptr_dst,
+    INT16U          len
+    )
+{
+const INT8U*    ptr_data;
+
+len = rom_map( ptr_src, &ptr_data, len );
+memcpy( ptr_dst, ptr_data, len );
+
+return len;
+
+} /* rom_read() */
+
+/**
+    Map an array of the ROM table
+
+    @return Returns the number of bytes mapped
+*/
+static INT16U rom_map
+    (
+    mp3_src_type*   ptr_src,
+    const INT8U**   ptr_data,
+    INT16U          len
+    )
+{
+
+if( len > ( ptr_src->rom_size - ptr_src->rom_pos ) )
+    {
+    len = (INT16U)( ptr_src->rom_size - ptr_src->rom_pos );
+    }
+
+*ptr_data = &ptr_src->ptr_rom[ptr_src->rom_pos];
+ptr_src->rom_pos += len;
+
+return len;
+
+} /* rom_map() */
+
+/**
+    Seek an array of the ROM table, hints are not
+    needed
+
+    @return Returns TRUE if the position is within
+            the array
+*/
+static BOOLEAN rom_seek
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos,
+    INT32U          hint_pos,
+    INT32U          hint
+    )
+{
+
+if( pos > ptr_src->rom_size )
+    {
+    return false;
+    }
+
+ptr_src->rom_pos = pos;
+
+return true;
+
+} /* rom_seek() */
+
+/**
+    Get a seek hint, none for the ROM
+
+    @return Returns 0
+*/
+static INT32U rom_get_hint
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return 0;
+
+} /* rom_get_hint() */
+
+/**
+    Get the read position in an array of the ROM
+    table
+
+    @return Returns the position
+*/
+static INT32U rom_position
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->rom_pos;
+
+} /* rom_position() */
+
+/**
+    Get the size of an array of the ROM table
+
+    @return Returns the size
+*/
+static INT32U rom_size
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->rom_size;
+
+} /* rom_size() */
+
+/**
+    The arrays of the ROM table never change
+
+    @return Returns 0
+*/
+static INT32U rom_get_ident
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return 0;
+
+} /* rom_get_ident() */
+
+/**
+    Nothing to set up for reading the ROM straight
+    through
+*/
+static void rom_set_streaming
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+} /* rom_set_streaming() */
+
+/**
+    Start receiving from the UART
+
+    Waits up to MP3_SRC_UART_START_MS for the host to
+    start sending. Any name after the prefix is ignored.
+
+    @return Returns TRUE if data has arrived
+*/
+static BOOLEAN uart_open
+    (
+    mp3_src_type*   ptr_src,
+    const char*     ptr_name
+    )
+{
+INT16U ms;
+
+BspUartRxStart();
+ptr_src->uart_pos = 0;
+
+for( ms = 0; 0 == BspUartRxAvail(); ms++ )
+    {
+    if( ms >= MP3_SRC_UART_START_MS )
+        {
+        BspUartRxStop();
+        return false;
+        }
+    OSTimeDly( 1 );
+    }
+
+return true;
+
+} /* uart_open() */
+
+/**
+    Stop receiving from the UART, holding the host off
+*/
+static void uart_close
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+BspUartRxStop();
+
+} /* uart_close() */
+
+/**
+    Read from the UART
+
+    Returns what has arrived, waiting for at least a
+    byte. The wait, and so the caller, is only held up
+    while the host is silent.
+
+    @return Returns the number of bytes read, 0 once
+            the host has been silent for
+            MP3_SRC_UART_IDLE_MS
+*/
+static int uart_read
+    (
+    mp3_src_type*   ptr_src,
+    INT8U*          ptr_dst,
+    INT16U          len
+    )
+{
+INT32U  rd_len;
+INT16U  ms;
+
+for( ms = 0; ms < MP3_SRC_UART_IDLE_MS; ms++ )
+    {
+    rd_len = BspUartRxRead( ptr_dst, len );
+    if( rd_len > 0 )
+        {
+        ptr_src->uart_pos += rd_len;
+        return (int)rd_len;
+        }
+    OSTimeDly( 1 );
+    }
+
+return 0;
+
+} /* uart_read() */
+
+/**
+    Seek the UART, which can only stay where it is
+
+    @return Returns TRUE if pos is the read position
+*/
+static BOOLEAN uart_seek
+    (
+    mp3_src_type*   ptr_src,
+    INT32U          pos,
+    INT32U          hint_pos,
+    INT32U          hint
+    )
+{
+
+return ( pos == ptr_src->uart_pos );
+
+} /* uart_seek() */
+
+/**
+    Get the number of bytes read from the UART
+
+    @return Returns the position
+*/
+static INT32U uart_position
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return ptr_src->uart_pos;
+
+} /* uart_position() */
+
+/**
+    Get the size of the UART stream, not known
+
+    @return Returns MP3_SRC_LIVE_SIZE
+*/
+static INT32U uart_size
+    (
+    mp3_src_type* ptr_src
+    )
+{
+
+return MP3_SRC_LIVE_SIZE;
+
+} /* uart_size() */
+
+/**
+    Keep a read within the range of a source
+
+    @return Returns len, cut short at the end of
+            the range
+*/
+static INT16U clamp_len
+    (
+    mp3_src_type*   ptr_src,
+    INT16U          len
+    )
+{
+INT32U pos;
+
+pos = mp3_src_position( ptr_src );
+
+if( pos >= ptr_src->range_end )
+    {
+    return 0;
+    }
+
+if( len > ptr_src->range_end - pos )
+    {
+    len = (INT16U)( ptr_src->range_end - pos );
+    }
+
+return len;
+
+} /* clamp_len() */
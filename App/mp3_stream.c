@@ -4,9 +4,41 @@
     @author      Vimal Mehta
 
     @description
-        This thread is responsible for streaming a buffer
-    of data to the MP3 decoder, and sending an new
-    buffer request event back to the MP3 main thread
+        This thread is responsible for draining the blocks
+    queued on the MP3 stream ring into the MP3 decoder,
+    returning each block to the pool once it has been
+    sent, and sending a new buffer request event back to
+    the MP3 main thread whenever the ring drops below its
+    low watermark. The watermarks themselves are set by
+    the adaptive buffer controller in mp3_strm_ctrl.c,
+    which this thread feeds as it streams.
+
+        A newly opened stream is pre-rolled by the MP3
+    main thread, which fills the decoder's input FIFO
+    from the ring in one go so that the first sound is
+    not held up by the burst by burst hand over.
+
+        A queued track follows on in the same stream with
+    no decoder reset. When the first block of it comes up
+    the decode time is restarted and the MP3 main thread
+    is told that the track has started.
+
+        The decode time is read from the decoder between
+    bursts, at most every MP3_STRM_DECODE_POLL_MS, and
+    cached. Readers of the playback time only read the
+    cache, interpolated from the time the cached value
+    last changed, and never touch the SPI.
+
+        The streaming thread drains the ring without a
+    lock. Any other thread that touches the decoder or
+    the stream state, to close, flush, pause or program
+    the stream, first takes the stream with
+    reserve_smphr(). That raises strm_hold, which the
+    drain loop checks between bursts; a drain pass that
+    is under way stops at the next burst boundary and
+    signals strm_idle_smphr. release_smphr() lowers the
+    flag and starts a new drain pass, which picks up
+    the new state.
 
     Copyright (c) 2016 Vimal Mehta
 */
@@ -15,6 +47,7 @@
 #include <stdarg.h>
 #include "ucos_ii.h"
 #include "bsp.h"
+#include "TSK_pub.h"
 #include "MP3_pub.h"
 #include "mp3_prv.h"
 
@@ -34,8 +67,17 @@ enum
 // Workspace type
 typedef struct
     {
-    HANDLE  hndl_mp3;
-    HANDLE  hndl_spi;
+    HANDLE              hndl_mp3;
+    HANDLE              hndl_spi;
+    mp3_strm_blk_type*  ptr_cur_blk;        // Block currently being streamed
+    INT16U              cur_blk_offset;     // Bytes of the current block already streamed
+    INT16U              decode_time;        // Decode time last read from the decoder
+    INT32U              decode_edge_ms;     // task_ms_timer when decode_time was seen to change
+    INT32U              decode_poll_ms;     // task_ms_timer when the decoder was last read
+    INT32U              pause_ms;           // task_ms_timer when the stream was paused
+    INT8U               speed;              // Playback speed, a multiple of normal
+    INT32U              burst_size;         // Bytes sent to the decoder at a time for the speed
+    INT16U              pcm_kbps;           // Bitrate of uncompressed audio, 0 for compressed
     } strm_mp3_wksp_type;
 
 
@@ -43,12 +85,13 @@ typedef struct
     Static Variables
 */
 static OS_STK               strm_mp3_main_stack[APP_CFG_TASK_START_STK_SIZE];
-static OS_EVENT *           strm_mp3_smphr;
+static OS_EVENT *           strm_mp3_smphr;                 // Serializes the threads taking the stream
+static OS_EVENT *           strm_idle_smphr;                // Posted when a drain pass stops for strm_hold
+static volatile BOOLEAN     strm_hold;                      // The stream is taken, drain passes stop
+static volatile BOOLEAN     strm_draining;                  // A drain pass is under way
 static OS_FLAG_GRP         *strm_event_flags= 0;
 static strm_mp3_wksp_type   strm_mp3_wksp;
-static INT32U               strm_mp3_data_size;
 static BOOLEAN              paused;
-static INT8U                strm_mp3_buff[64];
 
 
 /**
@@ -67,6 +110,31 @@ static void strm_send_evnt
 static OS_FLAGS strm_wait_for_evnt
     ( void );
 
+static void strm_drain_ring
+    ( void );
+
+static INT32U strm_send_data
+    (
+    INT32U max_size
+    );
+
+static void strm_release_cur_blk
+    ( void );
+
+static void strm_sample_decode_time
+    ( void );
+
+static void strm_set_decode_time
+    (
+    INT16U decode_time
+    );
+
+static INT32U strm_get_burst_size
+    (
+    INT8U   speed,
+    INT16U  pcm_kbps
+    );
+
 static void reserve_smphr
     ( void );
 
@@ -88,12 +156,22 @@ INT8U err;
 
 mp3_strm_util_pwrp();
 
-strm_mp3_smphr  = OSSemCreate( 1 );
+mp3_strm_ring_pwrp();
 
-strm_mp3_wksp.hndl_mp3  = -1;
-strm_mp3_wksp.hndl_spi  = -1;
-paused                  = false;
-strm_mp3_data_size      = 0;
+strm_mp3_smphr  = OSSemCreate( 1 );
+strm_idle_smphr = OSSemCreate( 0 );
+strm_hold       = false;
+strm_draining   = false;
+
+strm_mp3_wksp.hndl_mp3          = -1;
+strm_mp3_wksp.hndl_spi          = -1;
+strm_mp3_wksp.ptr_cur_blk       = NULL;
+strm_mp3_wksp.cur_blk_offset    = 0;
+strm_mp3_wksp.speed             = 1;
+strm_mp3_wksp.burst_size        = MP3_STRM_BURST_SIZE;
+strm_mp3_wksp.pcm_kbps          = 0;
+paused                          = false;
+strm_set_decode_time( 0 );
 
 // Create the event flags for this thread
 strm_event_flags = OSFlagCreate( 0x0, &err );
@@ -110,10 +188,11 @@ OSTaskCreate
 /**
     MP3 stream main
 
-    This function is waiting to receive a process data
+    This function is waiting to receive a buffer full
     event from the MP3 main thread. On receiving this event,
-    it empties the data in the strm_buff to the MP3 decoder
-    and requests new data from the MP3 main thread.
+    it drains the MP3 stream ring into the MP3 decoder and
+    requests new data from the MP3 main thread whenever the
+    ring drops below its low watermark.
 */
 void mp3_strm_main
     (
@@ -128,34 +207,240 @@ for(;;)
 
     if( rx_flags & STRM_EVNT_BUFFER_FULL )
         {
-        reserve_smphr();
-
-        // If we are not paused
-        if( !paused )
-            {
-
-            // If there is data to be buffered
-            if( strm_mp3_data_size > 0 )
-                {
-                // Write data to the stream
-                mp3_strm_util_stream_data( strm_mp3_wksp.hndl_mp3, strm_mp3_buff, strm_mp3_data_size );
-                strm_mp3_data_size = 0;
-                }
-            release_smphr();
-
-            // Signal to the MP3 thread that the
-            // data has been written to the stream
-            mp3_signal_buffer_empty();
-            }
-        else
-            {
-            release_smphr();
-            }
+        strm_drain_ring();
         }
     }
 
 } /* mp3_strm_main() */
 
+/**
+    Drain the MP3 stream ring
+
+    Takes the queued blocks off the MP3 stream ring and
+    sends them to the MP3 decoder in bursts of up to
+    MP3_STRM_BURST_SIZE bytes, times the playback speed
+    so that a burst holds as much playback time at any
+    speed, or of a block of uncompressed audio, until
+    the ring is empty or another thread takes the
+    stream. Each block goes back to the pool once it
+    has been sent.
+
+        No lock is taken per burst. The decoder handle
+    and the pause state are read once for the pass; no
+    other thread changes them without taking the stream,
+    which ends the pass at the next burst boundary.
+*/
+static void strm_drain_ring
+    ( void )
+{
+OS_CPU_SR           cpu_sr = 0;
+HANDLE              hndl_mp3;
+BOOLEAN             is_paused;
+BOOLEAN             done;
+BOOLEAN             held;
+INT32U              size;
+
+OS_ENTER_CRITICAL();
+held = strm_hold;
+if( !held )
+    {
+    strm_draining = true;
+    }
+hndl_mp3  = strm_mp3_wksp.hndl_mp3;
+is_paused = paused;
+OS_EXIT_CRITICAL();
+
+// Nothing to request while paused or closed, and
+// the pass is started again once the stream is free
+if( held )
+    {
+    return;
+    }
+
+done = ( is_paused || ( -1 == hndl_mp3 ) );
+
+while( !done )
+    {
+    size = strm_send_data( strm_mp3_wksp.burst_size );
+
+    if( 0 == size )
+        {
+        mp3_strm_ctrl_ring_empty( hndl_mp3 );
+        }
+
+    // Ask the MP3 main thread for more data
+    // once the ring drops below its low watermark
+    if( mp3_strm_ring_is_below_low_wmark() )
+        {
+        mp3_signal_buffer_empty();
+        }
+
+    done = ( ( 0 == size ) || strm_hold );
+    }
+
+OS_ENTER_CRITICAL();
+strm_draining = false;
+held = strm_hold;
+OS_EXIT_CRITICAL();
+
+// A thread is waiting to take the stream
+if( held )
+    {
+    OSSemPost( strm_idle_smphr );
+    }
+
+} /* strm_drain_ring() */
+
+/**
+    Send data from the MP3 stream ring to the decoder
+
+    Takes a block off the ring if none is being
+    streamed and sends up to max_size bytes of it. Only
+    called by a drain pass, or with the stream taken.
+
+    @return Returns the number of bytes sent, 0 if the
+            ring is empty
+*/
+static INT32U strm_send_data
+    (
+    INT32U max_size
+    )
+{
+mp3_strm_blk_type*  ptr_blk;
+INT32U              size;
+
+if( NULL == strm_mp3_wksp.ptr_cur_blk )
+    {
+    strm_mp3_wksp.ptr_cur_blk       = mp3_strm_ring_accept_blk();
+    strm_mp3_wksp.cur_blk_offset    = 0;
+
+    if( NULL != strm_mp3_wksp.ptr_cur_blk )
+        {
+        mp3_strm_stats_blk_start( mp3_strm_ring_get_used() );
+        }
+
+    if( ( NULL != strm_mp3_wksp.ptr_cur_blk ) && strm_mp3_wksp.ptr_cur_blk->trk_start )
+        {
+        mp3_strm_util_set_decode_time( strm_mp3_wksp.hndl_mp3, 0 );
+        strm_set_decode_time( 0 );
+        mp3_strm_ctrl_restart_clock();
+        mp3_signal_track_start();
+        }
+    }
+
+ptr_blk = strm_mp3_wksp.ptr_cur_blk;
+
+if( NULL == ptr_blk )
+    {
+    return 0;
+    }
+
+size = ptr_blk->size - strm_mp3_wksp.cur_blk_offset;
+
+if( size > max_size )
+    {
+    size = max_size;
+    }
+
+// Write data to the stream
+mp3_strm_util_stream_data( strm_mp3_wksp.hndl_mp3, &ptr_blk->ptr_data[strm_mp3_wksp.cur_blk_offset], size );
+strm_mp3_wksp.cur_blk_offset += size;
+mp3_strm_stats_streamed( size );
+
+strm_sample_decode_time();
+
+// Give the block back once it has been sent
+if( strm_mp3_wksp.cur_blk_offset >= ptr_blk->size )
+    {
+    strm_release_cur_blk();
+    mp3_strm_ctrl_blk_done( strm_mp3_wksp.hndl_mp3 );
+    }
+
+return size;
+
+} /* strm_send_data() */
+
+/**
+    Release the block currently being streamed
+
+    Only called by a drain pass, or with the stream
+    taken.
+*/
+static void strm_release_cur_blk
+    ( void )
+{
+
+if( NULL != strm_mp3_wksp.ptr_cur_blk )
+    {
+    mp3_strm_ring_release_blk( strm_mp3_wksp.ptr_cur_blk );
+    strm_mp3_wksp.ptr_cur_blk       = NULL;
+    strm_mp3_wksp.cur_blk_offset    = 0;
+    }
+
+} /* strm_release_cur_blk() */
+
+/**
+    Sample the decode time
+
+    Reads the decoder at most every MP3_STRM_DECODE_POLL_MS
+    and updates the cache when the time has moved on.
+    Only called by a drain pass, or with the stream
+    taken.
+*/
+static void strm_sample_decode_time
+    ( void )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT16U      decode_time;
+
+if( ( task_ms_timer - strm_mp3_wksp.decode_poll_ms ) < MP3_STRM_DECODE_POLL_MS )
+    {
+    return;
+    }
+strm_mp3_wksp.decode_poll_ms = task_ms_timer;
+
+decode_time = mp3_strm_util_get_decode_time( strm_mp3_wksp.hndl_mp3 );
+
+if( 0 != decode_time )
+    {
+    mp3_strm_stats_ttfa_mark( MP3_TTFA_MARK_DECODE );
+    }
+
+OS_ENTER_CRITICAL();
+if( decode_time != strm_mp3_wksp.decode_time )
+    {
+    strm_mp3_wksp.decode_time       = decode_time;
+    strm_mp3_wksp.decode_edge_ms    = task_ms_timer;
+    }
+OS_EXIT_CRITICAL();
+
+mp3_strm_ctrl_decode_time( decode_time );
+
+} /* strm_sample_decode_time() */
+
+/**
+    Set the cached decode time
+
+    Called whenever the decoder's time is set or reset.
+    The stream must be taken by the caller, or the
+    thread must not be running yet.
+*/
+static void strm_set_decode_time
+    (
+    INT16U decode_time
+    )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+strm_mp3_wksp.decode_time       = decode_time;
+strm_mp3_wksp.decode_edge_ms    = task_ms_timer;
+strm_mp3_wksp.decode_poll_ms    = task_ms_timer;
+strm_mp3_wksp.pause_ms          = task_ms_timer;
+OS_EXIT_CRITICAL();
+
+} /* strm_set_decode_time() */
+
 /**
     Open the MP3 stream
 
@@ -201,9 +486,17 @@ if( PJDF_IS_ERROR( pjdfErr ) )
 
 mp3_strm_util_start( strm_mp3_wksp.hndl_mp3 );
 
+strm_release_cur_blk();
+mp3_strm_ring_reset();
+mp3_strm_ctrl_reset();
+mp3_strm_stats_reset();
+strm_set_decode_time( 0 );
+
+length = 0;
+(void)Ioctl( strm_mp3_wksp.hndl_mp3, PJDF_CTRL_MP3_RESET_STATS, NULL, &length );
+
 success             = true;
 paused              = false;
-strm_mp3_data_size  = 0;
 
 // Send this event so that the MP3 stream
 // thread can start requesting buffer data
@@ -218,14 +511,59 @@ return success;
 
 } /* mp3_strm_open()*/
 
+/**
+    Pre-roll the MP3 stream
+
+    Called by the MP3 main thread once it has filled
+    the ring of a newly opened stream. Up to
+    MP3_STRM_PREROLL_SIZE bytes, enough to fill the
+    decoder's input FIFO, are sent straight away in
+    whole blocks, rather than burst by burst as the
+    streaming thread gets to run. The decoder raises
+    DREQ after a reset, so this does not wait.
+
+    @return Returns the number of bytes sent
+*/
+
+INT32U mp3_strm_preroll
+    ( void )
+{
+INT32U  sent;
+INT32U  size;
+
+sent = 0;
+
+reserve_smphr();
+
+while( !paused && ( -1 != strm_mp3_wksp.hndl_mp3 ) && ( sent < MP3_STRM_PREROLL_SIZE ) )
+    {
+    size = strm_send_data( MP3_STRM_PREROLL_SIZE - sent );
+    if( 0 == size )
+        {
+        break;
+        }
+    sent += size;
+    }
+
+release_smphr();
+
+return sent;
+
+} /* mp3_strm_preroll() */
+
 /**
     Close the MP3 stream
 
-    This funciton closes the MP3 stream
+    This funciton closes the MP3 stream. The decoder
+    is cancelled at once, or once it has played out
+    what it holds if play_out is set, at the end of
+    a file.
 */
 
 BOOLEAN mp3_strm_close
-    ( void )
+    (
+    BOOLEAN play_out
+    )
 {
 BOOLEAN     success;
 PjdfErrCode pjdfErr;
@@ -240,7 +578,7 @@ if( -1 == strm_mp3_wksp.hndl_mp3 )
     }
 else
     {
-    mp3_strm_util_stop( strm_mp3_wksp.hndl_mp3 );
+    mp3_strm_util_stop( strm_mp3_wksp.hndl_mp3, play_out );
 
     pjdfErr = Close( strm_mp3_wksp.hndl_mp3 );
 
@@ -255,7 +593,9 @@ else
         }
 
     paused              = false;
-    strm_mp3_data_size  = 0;
+    strm_release_cur_blk();
+    mp3_strm_ring_reset();
+    strm_set_decode_time( 0 );
     }
 
 release_smphr();
@@ -268,7 +608,9 @@ return success;
     Get the MP3 decode time
 
     This function is used to get the current
-    MP3 decoder playback time.
+    MP3 decoder playback time. It only reads the
+    cached decode time and may be called as often
+    as needed.
 */
 
 INT16U mp3_strm_get_decode_time
@@ -276,55 +618,241 @@ INT16U mp3_strm_get_decode_time
     void
     )
 {
-INT16U      ret_val;
 
-ret_val = 0;
+return (INT16U)( mp3_strm_get_decode_time_ms() / 1000 );
 
-reserve_smphr();
+} /* mp3_strm_get_decode_time() */
+
+/**
+    Get the MP3 decode time in milliseconds
+
+    The cached decode time, which only has whole
+    seconds, plus the time since it was seen to
+    change, faster at a faster playback speed. The
+    interpolation never runs past the next second, so
+    the time does not go backwards when the decoder is
+    read again, and it stands still while the stream
+    is paused.
+
+    @return Returns the decode time in milliseconds
+*/
+
+INT32U mp3_strm_get_decode_time_ms
+    ( void )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      decode_time;
+INT32U      elapsed_ms;
+
+OS_ENTER_CRITICAL();
+decode_time = strm_mp3_wksp.decode_time;
+elapsed_ms  = ( paused ? strm_mp3_wksp.pause_ms : task_ms_timer ) - strm_mp3_wksp.decode_edge_ms;
+elapsed_ms *= strm_mp3_wksp.speed;
+OS_EXIT_CRITICAL();
 
-if( strm_mp3_wksp.hndl_mp3 != -1 )
+if( elapsed_ms > 999 )
     {
-    ret_val = mp3_strm_util_get_decode_time( strm_mp3_wksp.hndl_mp3 );
+    elapsed_ms = 999;
     }
 
+return ( decode_time * 1000 ) + elapsed_ms;
+
+} /* mp3_strm_get_decode_time_ms() */
+
+/**
+    Set the playback speed
+
+    Programs the decoder, if the stream is open, and
+    scales the ring watermarks and the burst size to
+    the rate the data is used up at. The stream goes
+    on without a restart. The speed is kept for the
+    streams to come.
+*/
+
+void mp3_strm_set_speed
+    (
+    INT8U speed
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      burst_size;
+
+reserve_smphr();
+
+burst_size = strm_get_burst_size( speed, strm_mp3_wksp.pcm_kbps );
+
+mp3_strm_util_set_speed( strm_mp3_wksp.hndl_mp3, speed );
+mp3_strm_ctrl_set_speed( speed );
+
+OS_ENTER_CRITICAL();
+strm_mp3_wksp.speed      = speed;
+strm_mp3_wksp.burst_size = burst_size;
+OS_EXIT_CRITICAL();
+
 release_smphr();
 
-return ret_val;
-}
+} /* mp3_strm_set_speed() */
+
+/**
+    Get the playback speed
+
+    @return Returns the speed, a multiple of normal
+*/
+
+INT8U mp3_strm_get_speed
+    ( void )
+{
+
+return strm_mp3_wksp.speed;
+
+} /* mp3_strm_get_speed() */
+
+/**
+    Set the stream up for uncompressed audio
+
+    A WAV file at CD quality, 1411 kbps, comes several
+    times faster than MP3. Its data is sent a whole block
+    at a time, and the ring is sized for its bitrate from
+    the start, as the decoder does not report it. A seek
+    does not reset the decoder, which plays on from any
+    sample frame. 0 goes back to compressed audio. Takes
+    effect at once, and holds for the streams to come.
+*/
+
+void mp3_strm_set_pcm
+    (
+    INT16U kbps
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      burst_size;
+
+reserve_smphr();
+
+burst_size = strm_get_burst_size( strm_mp3_wksp.speed, kbps );
+mp3_strm_ctrl_set_pcm( kbps );
+
+OS_ENTER_CRITICAL();
+strm_mp3_wksp.pcm_kbps   = kbps;
+strm_mp3_wksp.burst_size = burst_size;
+OS_EXIT_CRITICAL();
+
+release_smphr();
+
+} /* mp3_strm_set_pcm() */
+
+/**
+    Set the decoder plugin
+
+    The plugin is uploaded at the next reset of the
+    decoder, that is the next stream opened or seek.
+    Taking the stream makes sure that no upload is
+    reading the image it replaces.
+*/
+
+void mp3_strm_set_plugin
+    (
+    const INT16U*   ptr_image,
+    INT32U          words
+    )
+{
+
+reserve_smphr();
+
+mp3_strm_util_set_plugin( ptr_image, words );
+
+release_smphr();
+
+} /* mp3_strm_set_plugin() */
+
+/**
+    Allocate an MP3 stream block
+
+    This function gives the MP3 main thread a free
+    block from the MP3 stream ring, so that the MP3
+    file can be read straight into it.
+
+    @return Returns a free block, NULL if the ring
+            is at its high watermark
+*/
+
+mp3_strm_blk_type* mp3_strm_alloc_blk
+    ( void )
+{
+
+return mp3_strm_ring_alloc_blk();
+
+} /* mp3_strm_alloc_blk() */
+
+/**
+    Free an MP3 stream block
+
+    This function returns a block obtained from
+    mp3_strm_alloc_blk() that is not going to be
+    written to the MP3 stream.
+*/
+
+void mp3_strm_free_blk
+    (
+    mp3_strm_blk_type* ptr_blk
+    )
+{
+
+ptr_blk->size = 0;
+mp3_strm_ring_release_blk( ptr_blk );
+
+} /* mp3_strm_free_blk() */
 
 /**
     Write data to the MP3 stream
 
-    This function copies of the incoming
-    MP3 data to a buffer and sends an
-    event to the MP3 stream thread to send
-    that data to the MP3 decoder.
+    This function queues a block filled by the MP3
+    main thread on the MP3 stream ring and sends an
+    event to the MP3 stream thread to send it to the
+    MP3 decoder. Ownership of the block passes to the
+    MP3 stream thread.
 */
 
 BOOLEAN mp3_strm_write_data
     (
-    const INT8U* ptr_data,
-    INT32U       data_size
+    mp3_strm_blk_type* ptr_blk
     )
 {
 BOOLEAN success;
 
 success = false;
 
-reserve_smphr();
-
-if( ( data_size > 0 ) && ( 0 == strm_mp3_data_size ) )
+if( ptr_blk->size > 0 )
     {
-    memcpy( strm_mp3_buff, ptr_data, data_size );
-    strm_mp3_data_size = data_size;
+    mp3_strm_ring_post_blk( ptr_blk );
+    mp3_strm_stats_refill_done();
     strm_send_evnt( STRM_EVNT_BUFFER_FULL );
+    success = true;
+    }
+else
+    {
+    mp3_strm_free_blk( ptr_blk );
     }
-
-release_smphr();
 
 return success;
 } /* mp3_strm_write_data() */
 
+/**
+    Get the amount of buffered MP3 data
+
+    @return Returns the number of bytes in the MP3
+            stream ring that are yet to be sent to
+            the decoder
+*/
+
+INT32U mp3_strm_get_buffered_size
+    ( void )
+{
+
+return mp3_strm_ring_get_used();
+
+} /* mp3_strm_get_buffered_size() */
+
 /**
     Pause the MP3 streaming thread
 */
@@ -334,6 +862,10 @@ void mp3_strm_pause
 {
 
 reserve_smphr();
+if( !paused )
+    {
+    strm_mp3_wksp.pause_ms = task_ms_timer;
+    }
 paused = true;
 release_smphr();
 
@@ -355,9 +887,16 @@ pending_data_in_buffer = false;
 
 reserve_smphr();
 
+// Interpolate on from where the pause left off
+if( paused )
+    {
+    strm_mp3_wksp.decode_edge_ms += task_ms_timer - strm_mp3_wksp.pause_ms;
+    }
+
 paused = false;
+mp3_strm_ctrl_restart_clock();
 
-if( strm_mp3_data_size > 0 )
+if( mp3_strm_ring_get_used() > 0 )
     {
     pending_data_in_buffer = true;
     strm_send_evnt( STRM_EVNT_BUFFER_FULL );
@@ -369,6 +908,78 @@ return pending_data_in_buffer;
 
 } /* mp3_strm_resume() */
 
+/**
+    Flush the MP3 stream
+
+    Drops the data queued on the ring and held by the
+    decoder, so that streaming can restart from another
+    position in the file. The decoder is left the few
+    uncompressed samples it holds rather than reset, as
+    it would then not know their format. Only called by
+    the MP3 main thread, which fills the ring. The stream
+    stays paused if it was.
+*/
+
+void mp3_strm_flush
+    (
+    INT16U decode_time
+    )
+{
+
+reserve_smphr();
+
+if( -1 != strm_mp3_wksp.hndl_mp3 )
+    {
+    strm_release_cur_blk();
+    mp3_strm_ring_reset();
+    if( 0 != strm_mp3_wksp.pcm_kbps )
+        {
+        // Raw samples play on from the new position
+        mp3_strm_util_set_decode_time( strm_mp3_wksp.hndl_mp3, decode_time );
+        }
+    else
+        {
+        mp3_strm_util_resync( strm_mp3_wksp.hndl_mp3, decode_time );
+        }
+    strm_set_decode_time( decode_time );
+    mp3_strm_ctrl_restart_clock();
+    }
+
+release_smphr();
+
+} /* mp3_strm_flush() */
+
+/**
+    Get the stream health counters
+
+    The decoder driver's SPI and DREQ counters are
+    only available while the stream is open.
+*/
+
+void mp3_strm_get_stats
+    (
+    MP3_stream_stats_type* ptr_stats
+    )
+{
+PjdfMp3Stats    drv_stats;
+INT32U          length;
+
+memset( &drv_stats, 0, sizeof( drv_stats ) );
+
+reserve_smphr();
+
+if( -1 != strm_mp3_wksp.hndl_mp3 )
+    {
+    length = sizeof( drv_stats );
+    (void)Ioctl( strm_mp3_wksp.hndl_mp3, PJDF_CTRL_MP3_GET_STATS, &drv_stats, &length );
+    }
+
+release_smphr();
+
+mp3_strm_stats_get( &drv_stats, ptr_stats );
+
+} /* mp3_strm_get_stats() */
+
 
 /**
     Send an event
@@ -406,23 +1017,70 @@ return flags;
 
 
 /**
-    Reserve a sempahore
+    Get the number of bytes sent to the decoder at a time
+
+    A burst holds as much playback time at any speed.
+    Uncompressed audio is sent a whole block at a time.
+
+    @return Returns the burst size in bytes
+*/
+static INT32U strm_get_burst_size
+    (
+    INT8U   speed,
+    INT16U  pcm_kbps
+    )
+{
+INT32U burst_size;
+
+burst_size = (INT32U)MP3_STRM_BURST_SIZE * speed;
+if( ( 0 != pcm_kbps ) || ( burst_size > MP3_STRM_BLK_SIZE ) )
+    {
+    burst_size = MP3_STRM_BLK_SIZE;
+    }
+
+return burst_size;
+
+} /* strm_get_burst_size() */
+
+/**
+    Take the stream
+
+    Serializes the threads that change the stream,
+    then raises strm_hold and waits for a drain pass
+    under way to stop at its next burst boundary.
 */
 
 static void reserve_smphr
     ( void )
 {
-INT8U err;
+OS_CPU_SR   cpu_sr = 0;
+INT8U       err;
+BOOLEAN     draining;
 
 OSSemPend( strm_mp3_smphr, 0, &err );
+
+OS_ENTER_CRITICAL();
+strm_hold = true;
+draining  = strm_draining;
+OS_EXIT_CRITICAL();
+
+if( draining )
+    {
+    OSSemPend( strm_idle_smphr, 0, &err );
+    }
 }
 
 
 /**
-    Release a sempahore
+    Give the stream back
+
+    Starts a new drain pass, which picks up whatever
+    the stream has been changed to.
 */
 static void release_smphr
     ( void )
 {
+strm_hold = false;
 OSSemPost( strm_mp3_smphr );
+strm_send_evnt( STRM_EVNT_BUFFER_FULL );
 }
@@ -0,0 +1,421 @@
+/**
+    @file        mp3_strm_ctrl.c
+
+    @author      Vimal Mehta
+
+    @description
+        Adaptive buffer controller for the MP3 stream ring.
+    Called by the MP3 streaming thread as it drains the
+    ring, it reads the stream header the decoder found
+    (SCI_HDAT0/HDAT1) to learn the bitrate, and sizes the
+    ring watermarks to hold MP3_STRM_TARGET_MS of playback.
+    At a faster playback speed the data is used up faster,
+    so the watermarks are scaled by the speed. The decoder
+    does not report the bitrate of uncompressed audio the
+    same way, so that of a WAV file is given by the MP3
+    main thread, and the decoder is then only polled until
+    it has found the format.
+
+        The target grows by half each time the decoder is
+    found starved, ie asking for data with the ring empty,
+    or the decode time stands still while data is being
+    streamed, up to MP3_STRM_TARGET_MS_MAX. It goes back
+    to its default when a new stream is opened.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "TSK_pub.h"
+#include "MP3_pub.h"
+#include "mp3_prv.h"
+
+/**
+    Types
+*/
+
+// Workspace type
+typedef struct
+    {
+    BOOLEAN     started;                    // A block has been streamed since the reset
+    BOOLEAN     format_found;               // The decoder has found the stream format
+    INT16U      bitrate_kbps;               // Highest bitrate found in the stream, 0 if unknown
+    INT16U      target_ms;                  // Playback time the ring is sized to hold
+    INT32U      low_wmark;                  // Current ring watermarks
+    INT32U      high_wmark;
+    INT8U       blks_since_poll;            // Blocks streamed since the decoder was last polled
+    INT16U      last_decode_time;           // Decode time at the last poll
+    INT32U      last_decode_ms;             // task_ms_timer when the decode time last moved
+    } ctrl_wksp_type;
+
+/**
+    Static Variables
+*/
+static ctrl_wksp_type           ctrl_wksp;                          // Workspace
+static INT16U                   ctrl_dflt_target_ms = MP3_STRM_TARGET_MS_DFLT;  // Target a stream starts with
+static INT8U                    ctrl_speed = 1;                     // Playback speed, a multiple of normal
+static INT16U                   ctrl_pcm_kbps = 0;                  // Bitrate of uncompressed audio, 0 for compressed
+
+// MPEG audio layer III bitrates in kbps, by bitrate index
+static const INT16U             ctrl_mpeg1_l3_kbps[16] =
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+
+static const INT16U             ctrl_mpeg2_l3_kbps[16] =
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 };
+
+/**
+    Static Procedures
+*/
+
+static INT16U parse_bitrate
+    (
+    INT16U hdat0,
+    INT16U hdat1
+    );
+
+static void grow_target
+    ( void );
+
+static void update_wmarks
+    ( void );
+
+/**
+    Reset the controller
+
+    Called when a stream is opened. The ring goes back
+    to its default watermarks until the bitrate is known.
+
+    @return None
+*/
+void mp3_strm_ctrl_reset
+    ( void )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+ctrl_wksp.started           = false;
+ctrl_wksp.format_found      = false;
+ctrl_wksp.bitrate_kbps      = ctrl_pcm_kbps;
+ctrl_wksp.target_ms         = ctrl_dflt_target_ms;
+ctrl_wksp.blks_since_poll   = 0;
+ctrl_wksp.last_decode_time  = 0;
+ctrl_wksp.last_decode_ms    = task_ms_timer;
+OS_EXIT_CRITICAL();
+
+update_wmarks();
+
+} /* mp3_strm_ctrl_reset() */
+
+/**
+    Set the target a stream starts with
+
+    Used by the streaming benchmark to sweep buffer
+    sizes. Takes effect from the next reset.
+
+    @return None
+*/
+void mp3_strm_ctrl_set_dflt_target
+    (
+    INT16U target_ms
+    )
+{
+
+if( target_ms > MP3_STRM_TARGET_MS_MAX )
+    {
+    target_ms = MP3_STRM_TARGET_MS_MAX;
+    }
+
+ctrl_dflt_target_ms = target_ms;
+
+} /* mp3_strm_ctrl_set_dflt_target() */
+
+/**
+    Set the playback speed
+
+    Rescales the watermarks straight away, the speed
+    is kept for the streams to come.
+
+    @return None
+*/
+void mp3_strm_ctrl_set_speed
+    (
+    INT8U speed
+    )
+{
+
+ctrl_speed = speed;
+
+update_wmarks();
+
+} /* mp3_strm_ctrl_set_speed() */
+
+/**
+    Set the bitrate of uncompressed audio
+
+    Sizes the ring for it straight away, 0 goes back
+    to learning the bitrate from the decoder. It is
+    kept for the streams to come.
+
+    @return None
+*/
+void mp3_strm_ctrl_set_pcm
+    (
+    INT16U kbps
+    )
+{
+
+ctrl_pcm_kbps          = kbps;
+ctrl_wksp.bitrate_kbps = kbps;
+
+update_wmarks();
+
+} /* mp3_strm_ctrl_set_pcm() */
+
+/**
+    Restart the stall clock
+
+    Called when streaming resumes after a pause, so the
+    pause is not taken for a stall.
+
+    @return None
+*/
+void mp3_strm_ctrl_restart_clock
+    ( void )
+{
+
+ctrl_wksp.last_decode_ms = task_ms_timer;
+
+} /* mp3_strm_ctrl_restart_clock() */
+
+/**
+    A block has been streamed to the decoder
+
+    Polls the decoder every MP3_STRM_CTRL_POLL_BLKS
+    blocks, and after every block until the bitrate is
+    known, for the stream header. Uncompressed audio is
+    only polled for until the decoder has found it.
+
+    @return None
+*/
+void mp3_strm_ctrl_blk_done
+    (
+    HANDLE hMp3
+    )
+{
+INT16U hdat0;
+INT16U hdat1;
+INT16U bitrate_kbps;
+
+ctrl_wksp.started = true;
+
+if( 0 != ctrl_pcm_kbps )
+    {
+    if( !ctrl_wksp.format_found )
+        {
+        mp3_strm_util_get_hdat( hMp3, &hdat0, &hdat1 );
+        if( 0 != hdat1 )
+            {
+            ctrl_wksp.format_found = true;
+            mp3_strm_stats_ttfa_mark( MP3_TTFA_MARK_FORMAT );
+            }
+        }
+    return;
+    }
+
+ctrl_wksp.blks_since_poll++;
+if( ( 0 != ctrl_wksp.bitrate_kbps ) && ( ctrl_wksp.blks_since_poll < MP3_STRM_CTRL_POLL_BLKS ) )
+    {
+    return;
+    }
+ctrl_wksp.blks_since_poll = 0;
+
+// Size the ring for the highest bitrate seen, so
+// that variable bitrate streams do not run dry
+mp3_strm_util_get_hdat( hMp3, &hdat0, &hdat1 );
+bitrate_kbps = parse_bitrate( hdat0, hdat1 );
+if( bitrate_kbps > ctrl_wksp.bitrate_kbps )
+    {
+    if( !ctrl_wksp.format_found )
+        {
+        ctrl_wksp.format_found = true;
+        mp3_strm_stats_ttfa_mark( MP3_TTFA_MARK_FORMAT );
+        }
+
+    ctrl_wksp.bitrate_kbps = bitrate_kbps;
+    update_wmarks();
+    }
+
+} /* mp3_strm_ctrl_blk_done() */
+
+/**
+    The decode time has been read from the decoder
+
+    Called by the streaming thread as it samples the
+    decode time while streaming. If the data keeps going
+    in but the decoder is not making progress, the
+    target is grown.
+
+    @return None
+*/
+void mp3_strm_ctrl_decode_time
+    (
+    INT16U decode_time
+    )
+{
+
+if( decode_time != ctrl_wksp.last_decode_time )
+    {
+    ctrl_wksp.last_decode_time = decode_time;
+    ctrl_wksp.last_decode_ms   = task_ms_timer;
+    }
+else if( ( task_ms_timer - ctrl_wksp.last_decode_ms ) > MP3_STRM_CTRL_STALL_MS )
+    {
+    ctrl_wksp.last_decode_ms = task_ms_timer;
+    grow_target();
+    }
+
+} /* mp3_strm_ctrl_decode_time() */
+
+/**
+    The streaming thread found the ring empty
+
+    If the decoder is asking for data at the same time
+    it is being starved, so the target is grown.
+
+    @return None
+*/
+void mp3_strm_ctrl_ring_empty
+    (
+    HANDLE hMp3
+    )
+{
+
+if( ctrl_wksp.started && mp3_strm_util_is_hungry( hMp3 ) )
+    {
+    mp3_strm_stats_underrun();
+    grow_target();
+    }
+
+} /* mp3_strm_ctrl_ring_empty() */
+
+/**
+    Get the current stream buffering
+
+    @return None
+*/
+void mp3_strm_ctrl_get_info
+    (
+    MP3_stream_info_type* ptr_info
+    )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+ptr_info->bitrate_kbps      = ctrl_wksp.bitrate_kbps;
+ptr_info->buf_target_ms     = ctrl_wksp.target_ms;
+ptr_info->buf_target_size   = ctrl_wksp.high_wmark;
+ptr_info->buf_refill_size   = ctrl_wksp.low_wmark;
+OS_EXIT_CRITICAL();
+
+} /* mp3_strm_ctrl_get_info() */
+
+/**
+    Get the bitrate from the stream header
+
+    Only MPEG layer III headers are decoded, see the
+    VS1053 datasheet for the SCI_HDAT0/HDAT1 layout.
+
+    @return Returns the bitrate in kbps, 0 if unknown
+*/
+static INT16U parse_bitrate
+    (
+    INT16U hdat0,
+    INT16U hdat1
+    )
+{
+INT8U idx;
+
+// Frame sync and layer III
+if( ( 0xFFE0 != ( hdat1 & 0xFFE0 ) ) || ( 0x0002 != ( hdat1 & 0x0006 ) ) )
+    {
+    return 0;
+    }
+
+idx = (INT8U)( ( hdat0 >> 12 ) & 0x0F );
+
+// ID 3 is MPEG 1, otherwise MPEG 2 or 2.5
+if( 0x0018 == ( hdat1 & 0x0018 ) )
+    {
+    return ctrl_mpeg1_l3_kbps[idx];
+    }
+else
+    {
+    return ctrl_mpeg2_l3_kbps[idx];
+    }
+
+} /* parse_bitrate() */
+
+/**
+    Grow the buffering target after an underrun
+*/
+static void grow_target
+    ( void )
+{
+
+if( ctrl_wksp.target_ms < MP3_STRM_TARGET_MS_MAX )
+    {
+    ctrl_wksp.target_ms += ctrl_wksp.target_ms / 2;
+    if( ctrl_wksp.target_ms > MP3_STRM_TARGET_MS_MAX )
+        {
+        ctrl_wksp.target_ms = MP3_STRM_TARGET_MS_MAX;
+        }
+    update_wmarks();
+    }
+
+} /* grow_target() */
+
+/**
+    Size the ring watermarks for the current bitrate,
+    target and playback speed
+
+    Until the bitrate is known the default watermarks
+    are scaled by the growth of the target.
+*/
+static void update_wmarks
+    ( void )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      high_wmark;
+
+if( 0 != ctrl_wksp.bitrate_kbps )
+    {
+    // kbit/s * ms / 8 gives bytes
+    high_wmark = ( (INT32U)ctrl_wksp.bitrate_kbps * ctrl_wksp.target_ms ) / 8;
+    }
+else
+    {
+    high_wmark = ( (INT32U)MP3_STRM_RING_HIGH_WMARK * ctrl_wksp.target_ms ) / MP3_STRM_TARGET_MS_DFLT;
+    }
+high_wmark *= ctrl_speed;
+
+// Whole blocks, within the ring
+high_wmark = ( ( high_wmark + MP3_STRM_BLK_SIZE - 1 ) / MP3_STRM_BLK_SIZE ) * MP3_STRM_BLK_SIZE;
+if( high_wmark < MP3_STRM_RING_HIGH_WMARK_MIN )
+    {
+    high_wmark = MP3_STRM_RING_HIGH_WMARK_MIN;
+    }
+if( high_wmark > MP3_STRM_RING_SIZE )
+    {
+    high_wmark = MP3_STRM_RING_SIZE;
+    }
+
+OS_ENTER_CRITICAL();
+ctrl_wksp.high_wmark = high_wmark;
+ctrl_wksp.low_wmark  = high_wmark / 2;
+OS_EXIT_CRITICAL();
+
+mp3_strm_ring_set_wmarks( ctrl_wksp.low_wmark, ctrl_wksp.high_wmark );
+
+} /* update_wmarks() */
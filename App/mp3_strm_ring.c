@@ -0,0 +1,269 @@
+/**
+    @file        mp3_strm_ring.c
+
+    @author      Vimal Mehta
+
+    @description
+        Zero copy stream ring that sits between the MP3 main
+    thread, which fills it with data read from the MP3 file,
+    and the MP3 streaming thread, which drains it into the
+    MP3 decoder.
+
+        The ring is built from a uCOS memory partition of
+    fixed size blocks and a uCOS queue. The MP3 main thread
+    gets a free block from the partition, reads the MP3 file
+    straight into it and posts the pointer to the queue. The
+    streaming thread takes the pointer off the queue, sends
+    the block to the decoder and puts it back into the
+    partition. The data itself is never copied. A block may
+    point at data in place instead, mapped from the ROM or
+    lent from the read ahead window of the MP3 prefetch
+    task, in which case the window sector is given back as
+    the block is released.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "mp3_prv.h"
+
+#if( ( MP3_STRM_RING_LOW_WMARK >= MP3_STRM_RING_HIGH_WMARK ) || ( MP3_STRM_RING_HIGH_WMARK > MP3_STRM_RING_SIZE ) || \
+     ( MP3_STRM_RING_HIGH_WMARK_MIN > MP3_STRM_RING_HIGH_WMARK ) )
+    #error Invalid MP3 stream ring watermarks
+#endif
+
+/**
+    Static Variables
+*/
+static mp3_strm_blk_type        ring_blk_arr[MP3_STRM_BLK_CNT];     // Storage for the memory partition
+static OS_MEM*                  ring_blk_pool;                      // Memory partition of free blocks
+static void*                    ring_q_arr[MP3_STRM_BLK_CNT];       // Storage for the queue
+static OS_EVENT*                ring_q;                             // Queue of blocks waiting to be streamed
+static volatile INT32U          ring_used;                          // Number of bytes posted but not yet released
+static INT32U                   ring_low_wmark;                     // Refill the ring when it drops below this
+static INT32U                   ring_high_wmark;                    // Stop refilling the ring above this
+
+/**
+    Power up the MP3 stream ring
+
+    Creates the memory partition of stream blocks
+    and the queue used to hand them over.
+
+    @return None
+*/
+void mp3_strm_ring_pwrp
+    ( void )
+{
+INT8U err;
+
+ring_blk_pool = OSMemCreate( ring_blk_arr, MP3_STRM_BLK_CNT, sizeof( mp3_strm_blk_type ), &err );
+if( OS_ERR_NONE != err )
+    {
+    while(1);
+    }
+
+ring_q = OSQCreate( ring_q_arr, MP3_STRM_BLK_CNT );
+if( NULL == ring_q )
+    {
+    while(1);
+    }
+
+ring_used       = 0;
+ring_low_wmark  = MP3_STRM_RING_LOW_WMARK;
+ring_high_wmark = MP3_STRM_RING_HIGH_WMARK;
+
+} /* mp3_strm_ring_pwrp() */
+
+/**
+    Reset the MP3 stream ring
+
+    Returns all the queued blocks to the memory partition.
+    This must only be called when neither the producer
+    nor the consumer is accessing the ring.
+*/
+void mp3_strm_ring_reset
+    ( void )
+{
+INT8U               err;
+mp3_strm_blk_type*  ptr_blk;
+
+for(;;)
+    {
+    ptr_blk = (mp3_strm_blk_type*)OSQAccept( ring_q, &err );
+    if( NULL == ptr_blk )
+        {
+        break;
+        }
+    mp3_strm_ring_release_blk( ptr_blk );
+    }
+
+} /* mp3_strm_ring_reset() */
+
+/**
+    Set the ring watermarks
+
+    The high watermark is limited to the size of the
+    ring and the low watermark to below the high one.
+    Takes effect from the next allocation.
+*/
+void mp3_strm_ring_set_wmarks
+    (
+    INT32U low_wmark,
+    INT32U high_wmark
+    )
+{
+
+if( high_wmark > MP3_STRM_RING_SIZE )
+    {
+    high_wmark = MP3_STRM_RING_SIZE;
+    }
+
+if( low_wmark >= high_wmark )
+    {
+    low_wmark = high_wmark / 2;
+    }
+
+ring_low_wmark  = low_wmark;
+ring_high_wmark = high_wmark;
+
+} /* mp3_strm_ring_set_wmarks() */
+
+/**
+    Get the number of bytes buffered in the ring
+
+    @return Returns the ring occupancy in bytes
+*/
+INT32U mp3_strm_ring_get_used
+    ( void )
+{
+
+return ring_used;
+
+} /* mp3_strm_ring_get_used() */
+
+/**
+    Is the ring occupancy below the low watermark
+
+    @return Returns TRUE if the producer should
+            start refilling the ring
+*/
+BOOLEAN mp3_strm_ring_is_below_low_wmark
+    ( void )
+{
+
+return ( ring_used < ring_low_wmark );
+
+} /* mp3_strm_ring_is_below_low_wmark() */
+
+/**
+    Allocate a block to fill
+
+    Only called by the producer. No block is handed
+    out once the ring has reached its high watermark.
+
+    @return Returns a free block, NULL if the ring
+            is full
+*/
+mp3_strm_blk_type* mp3_strm_ring_alloc_blk
+    ( void )
+{
+INT8U               err;
+mp3_strm_blk_type*  ptr_blk;
+
+ptr_blk = NULL;
+
+if( ring_used < ring_high_wmark )
+    {
+    ptr_blk = (mp3_strm_blk_type*)OSMemGet( ring_blk_pool, &err );
+    if( OS_ERR_NONE != err )
+        {
+        ptr_blk = NULL;
+        }
+    else
+        {
+        ptr_blk->size      = 0;
+        ptr_blk->trk_start = false;
+        ptr_blk->pf_lent   = false;
+        }
+    }
+
+return ptr_blk;
+
+} /* mp3_strm_ring_alloc_blk() */
+
+/**
+    Post a filled block to the ring
+
+    Only called by the producer. Ownership of the
+    block passes to the consumer.
+*/
+void mp3_strm_ring_post_blk
+    (
+    mp3_strm_blk_type* ptr_blk
+    )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+ring_used += ptr_blk->size;
+OS_EXIT_CRITICAL();
+
+if( OS_ERR_NONE != OSQPost( ring_q, (void*)ptr_blk ) )
+    {
+    // The queue is as deep as the partition
+    while(1);
+    }
+
+} /* mp3_strm_ring_post_blk() */
+
+/**
+    Take the next block off the ring
+
+    Only called by the consumer, does not block.
+
+    @return Returns the next block to stream, NULL
+            if the ring is empty
+*/
+mp3_strm_blk_type* mp3_strm_ring_accept_blk
+    ( void )
+{
+INT8U err;
+
+return (mp3_strm_blk_type*)OSQAccept( ring_q, &err );
+
+} /* mp3_strm_ring_accept_blk() */
+
+/**
+    Return a block to the memory partition
+
+    Called by the consumer once a posted block has
+    been sent to the decoder, or by the producer for
+    a block it allocated but never posted (size 0).
+    A read ahead window sector the block points at is
+    given back to the prefetch task.
+*/
+void mp3_strm_ring_release_blk
+    (
+    mp3_strm_blk_type* ptr_blk
+    )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+ring_used -= ptr_blk->size;
+OS_EXIT_CRITICAL();
+
+if( ptr_blk->pf_lent )
+    {
+    ptr_blk->pf_lent = false;
+    mp3_prefetch_give_back();
+    }
+
+if( OS_ERR_NONE != OSMemPut( ring_blk_pool, (void*)ptr_blk ) )
+    {
+    while(1);
+    }
+
+} /* mp3_strm_ring_release_blk() */
@@ -0,0 +1,324 @@
+/**
+    @file        mp3_strm_stats.c
+
+    @author      Vimal Mehta
+
+    @description
+        Health counters for the MP3 stream, so that a
+    stutter can be put down to the SD card, the decoder
+    or the refilling of the stream ring. The counters are
+    bumped on the streaming hot path with nothing more
+    than additions and a read of the cycle counter, and
+    are read as a snapshot through MP3_get_stream_stats().
+
+        The decoder's SPI and DREQ wait times are counted by
+    the VS1053 driver itself and merged into the snapshot.
+    All counters restart when a stream is opened.
+
+        The time to first audio is followed separately,
+    from the touch or the call that starts playback
+    through the opening of the file and the first byte
+    sent to the decoder to the decoder finding the
+    stream format and its decode time moving. The decode
+    time is only read every MP3_STRM_DECODE_POLL_MS, so
+    that mark can be late by up to that much.
+
+    Copyright (c) 2016 Vimal Mehta
+*/
+
+// Includes
+#include "ucos_ii.h"
+#include "bsp.h"
+#include "TSK_pub.h"
+#include "MP3_pub.h"
+#include "mp3_prv.h"
+
+/**
+    Types
+*/
+
+// Workspace type
+typedef struct
+    {
+    INT32U      bytes_total;                // Bytes sent to the decoder
+    INT32U      bytes_this_scnd;            // Bytes sent since scnd_start_ms
+    INT32U      scnd_start_ms;              // task_ms_timer at the start of the current second
+    INT32U      bytes_per_scnd;             // Throughput over the last full second
+
+    INT32U      ring_samples;               // Ring occupancy samples taken
+    uint64_t    ring_used_sum;
+    INT32U      ring_used_min;
+    INT32U      ring_used_max;
+
+    BOOLEAN     refill_pending;             // A refill has been requested and not yet answered
+    INT32U      refill_start;               // BSP_CYCLE_CNT() at the request
+    INT32U      refill_cnt;
+    uint64_t    refill_cycles;
+    INT32U      refill_max_cycles;
+
+    INT32U      underrun_cnt;               // Decoder found hungry with the ring empty
+    } stats_wksp_type;
+
+// Time to first audio workspace type
+typedef struct
+    {
+    INT16U      start_cnt;                  // Playback starts so far
+    BOOLEAN     touch_pending;              // A touch has been marked since the last start
+    INT32U      touch_cycle;                // BSP_CYCLE_CNT() at the last touch
+    BOOLEAN     touched;                    // The marks are timed from a touch
+    INT32U      origin_cycle;               // BSP_CYCLE_CNT() the marks are timed from
+    INT32U      mark_us[MP3_TTFA_MARK_CNT]; // Time of each mark, 0 until reached
+    } ttfa_wksp_type;
+
+/**
+    Static Variables
+*/
+static stats_wksp_type          stats_wksp;                         // Workspace
+static ttfa_wksp_type           ttfa_wksp;                          // Time to first audio workspace
+
+/**
+    Reset the counters
+
+    Called when a stream is opened.
+
+    @return None
+*/
+void mp3_strm_stats_reset
+    ( void )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+memset( &stats_wksp, 0, sizeof( stats_wksp ) );
+stats_wksp.ring_used_min = MP3_STRM_RING_SIZE;
+stats_wksp.scnd_start_ms = task_ms_timer;
+OS_EXIT_CRITICAL();
+
+} /* mp3_strm_stats_reset() */
+
+/**
+    The streaming thread has taken a block off the ring
+
+    Samples the ring occupancy.
+
+    @return None
+*/
+void mp3_strm_stats_blk_start
+    (
+    INT32U ring_used
+    )
+{
+
+stats_wksp.ring_samples++;
+stats_wksp.ring_used_sum += ring_used;
+
+if( ring_used < stats_wksp.ring_used_min )
+    {
+    stats_wksp.ring_used_min = ring_used;
+    }
+
+if( ring_used > stats_wksp.ring_used_max )
+    {
+    stats_wksp.ring_used_max = ring_used;
+    }
+
+} /* mp3_strm_stats_blk_start() */
+
+/**
+    The streaming thread has sent data to the decoder
+
+    @return None
+*/
+void mp3_strm_stats_streamed
+    (
+    INT32U size
+    )
+{
+INT32U elapsed_ms;
+
+if( ( 0 == stats_wksp.bytes_total ) && ( 0 != size ) )
+    {
+    mp3_strm_stats_ttfa_mark( MP3_TTFA_MARK_FIRST_BYTE );
+    }
+
+stats_wksp.bytes_total     += size;
+stats_wksp.bytes_this_scnd += size;
+
+elapsed_ms = task_ms_timer - stats_wksp.scnd_start_ms;
+if( elapsed_ms >= 1000 )
+    {
+    stats_wksp.bytes_per_scnd  = (INT32U)( ( (uint64_t)stats_wksp.bytes_this_scnd * 1000 ) / elapsed_ms );
+    stats_wksp.bytes_this_scnd = 0;
+    stats_wksp.scnd_start_ms   = task_ms_timer;
+    }
+
+} /* mp3_strm_stats_streamed() */
+
+/**
+    The decoder was found starved
+
+    @return None
+*/
+void mp3_strm_stats_underrun
+    ( void )
+{
+
+stats_wksp.underrun_cnt++;
+
+} /* mp3_strm_stats_underrun() */
+
+/**
+    A refill of the ring has been requested
+
+    Only the first request of a refill is timed.
+
+    @return None
+*/
+void mp3_strm_stats_refill_req
+    ( void )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+if( !stats_wksp.refill_pending )
+    {
+    stats_wksp.refill_pending = true;
+    stats_wksp.refill_start   = BSP_CYCLE_CNT();
+    }
+OS_EXIT_CRITICAL();
+
+} /* mp3_strm_stats_refill_req() */
+
+/**
+    A block has been written to the ring
+
+    Ends the timing of a pending refill request.
+
+    @return None
+*/
+void mp3_strm_stats_refill_done
+    ( void )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      cycles;
+
+OS_ENTER_CRITICAL();
+if( stats_wksp.refill_pending )
+    {
+    cycles = BSP_CYCLE_CNT() - stats_wksp.refill_start;
+    stats_wksp.refill_pending = false;
+    stats_wksp.refill_cnt++;
+    stats_wksp.refill_cycles += cycles;
+    if( cycles > stats_wksp.refill_max_cycles )
+        {
+        stats_wksp.refill_max_cycles = cycles;
+        }
+    }
+OS_EXIT_CRITICAL();
+
+} /* mp3_strm_stats_refill_done() */
+
+/**
+    Get a snapshot of the counters
+
+    Merges in the counters of the decoder driver.
+
+    @return None
+*/
+void mp3_strm_stats_get
+    (
+    const PjdfMp3Stats*     ptr_drv_stats,
+    MP3_stream_stats_type*  ptr_stats
+    )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+ptr_stats->bytes_total      = stats_wksp.bytes_total;
+ptr_stats->bytes_per_scnd   = stats_wksp.bytes_per_scnd;
+ptr_stats->ring_used_min    = ( 0 != stats_wksp.ring_samples ) ? stats_wksp.ring_used_min : 0;
+ptr_stats->ring_used_avg    = ( 0 != stats_wksp.ring_samples ) ? (INT32U)( stats_wksp.ring_used_sum / stats_wksp.ring_samples ) : 0;
+ptr_stats->ring_used_max    = stats_wksp.ring_used_max;
+ptr_stats->refill_cnt       = stats_wksp.refill_cnt;
+ptr_stats->refill_us_avg    = ( 0 != stats_wksp.refill_cnt ) ? BSP_CYCLES_TO_US( (INT32U)( stats_wksp.refill_cycles / stats_wksp.refill_cnt ) ) : 0;
+ptr_stats->refill_us_max    = BSP_CYCLES_TO_US( stats_wksp.refill_max_cycles );
+ptr_stats->underrun_cnt     = stats_wksp.underrun_cnt;
+OS_EXIT_CRITICAL();
+
+ptr_stats->chunk_cnt        = ptr_drv_stats->dataWrites;
+ptr_stats->spi_us_avg       = ( 0 != ptr_drv_stats->dataWrites ) ? BSP_CYCLES_TO_US( ptr_drv_stats->spiCycles / ptr_drv_stats->dataWrites ) : 0;
+ptr_stats->spi_us_max       = BSP_CYCLES_TO_US( ptr_drv_stats->spiMaxCycles );
+ptr_stats->dreq_wait_cnt    = ptr_drv_stats->dreqWaits;
+ptr_stats->dreq_wait_us     = BSP_CYCLES_TO_US( ptr_drv_stats->dreqWaitCycles );
+ptr_stats->dreq_wait_us_max = BSP_CYCLES_TO_US( ptr_drv_stats->dreqWaitMaxCycles );
+
+} /* mp3_strm_stats_get() */
+
+/**
+    Mark a step towards the first audio
+
+    A touch is only remembered, it becomes the origin
+    of the next start if that follows within
+    MP3_STRM_TTFA_TOUCH_MS_MAX. A start clears the
+    other marks, which are then each taken once.
+
+    @return None
+*/
+void mp3_strm_stats_ttfa_mark
+    (
+    mp3_ttfa_mark_type mark
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+INT32U      now;
+
+now = BSP_CYCLE_CNT();
+
+OS_ENTER_CRITICAL();
+if( MP3_TTFA_MARK_TOUCH == mark )
+    {
+    ttfa_wksp.touch_pending = true;
+    ttfa_wksp.touch_cycle   = now;
+    }
+else if( MP3_TTFA_MARK_START == mark )
+    {
+    memset( ttfa_wksp.mark_us, 0, sizeof( ttfa_wksp.mark_us ) );
+    ttfa_wksp.start_cnt++;
+    ttfa_wksp.touched       = ttfa_wksp.touch_pending &&
+                              ( BSP_CYCLES_TO_US( now - ttfa_wksp.touch_cycle ) < ( MP3_STRM_TTFA_TOUCH_MS_MAX * 1000UL ) );
+    ttfa_wksp.touch_pending = false;
+    ttfa_wksp.origin_cycle  = ttfa_wksp.touched ? ttfa_wksp.touch_cycle : now;
+    ttfa_wksp.mark_us[mark] = BSP_CYCLES_TO_US( now - ttfa_wksp.origin_cycle );
+    }
+else if( ( 0 != ttfa_wksp.start_cnt ) && ( mark < MP3_TTFA_MARK_CNT ) && ( 0 == ttfa_wksp.mark_us[mark] ) )
+    {
+    // Never 0 once reached
+    ttfa_wksp.mark_us[mark] = BSP_CYCLES_TO_US( now - ttfa_wksp.origin_cycle ) + 1;
+    }
+OS_EXIT_CRITICAL();
+
+} /* mp3_strm_stats_ttfa_mark() */
+
+/**
+    Get the time to first audio of the last start
+
+    @return None
+*/
+void mp3_strm_stats_ttfa_get
+    (
+    MP3_ttfa_type* ptr_ttfa
+    )
+{
+OS_CPU_SR cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+ptr_ttfa->start_cnt     = ttfa_wksp.start_cnt;
+ptr_ttfa->touched       = ttfa_wksp.touched;
+ptr_ttfa->start_us      = ttfa_wksp.mark_us[MP3_TTFA_MARK_START];
+ptr_ttfa->open_us       = ttfa_wksp.mark_us[MP3_TTFA_MARK_OPEN];
+ptr_ttfa->first_byte_us = ttfa_wksp.mark_us[MP3_TTFA_MARK_FIRST_BYTE];
+ptr_ttfa->format_us     = ttfa_wksp.mark_us[MP3_TTFA_MARK_FORMAT];
+ptr_ttfa->decode_us     = ttfa_wksp.mark_us[MP3_TTFA_MARK_DECODE];
+OS_EXIT_CRITICAL();
+
+} /* mp3_strm_stats_ttfa_get() */
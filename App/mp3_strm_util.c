@@ -14,9 +14,50 @@
 #include "print.h"
 #include "pjdf.h"
 
+/**
+    Literal Constants
+*/
+#define CLOCKF_3_5X         ( 0x9800 )          // SC_MULT 3.5x, SC_ADD 1.0x
+#define VOL_DFLT            ( 0x1010 )          // -8 dB on both channels
+#define CANCEL_CHUNK_LEN    ( 32 )              // Fill bytes sent between checks of SM_CANCEL
+#define CANCEL_LEN_MAX      ( 2048 )            // Fill bytes allowed for SM_CANCEL to clear
+#define END_FILL_LEN        ( 2052 )            // Fill bytes that flush the decoder
+
+/**
+    Static Variables
+*/
+static INT8U                    util_play_speed = 1;        // Playback speed the decoder is set to after a reset
+static const INT16U*            util_plugin_ptr = NULL;     // Plugin image uploaded after a reset, NULL for none
+static INT32U                   util_plugin_words = 0;      // Length of the plugin image in words
+static MP3_plugin_stats_type    util_plugin_stats;          // Counters of the plugin uploads
+
 /**
     Static Procedures
 */
+static void sci_batch
+    (
+    HANDLE          hMp3,
+    PjdfMp3SciOp*   ptr_ops,
+    INT32U          op_cnt
+    );
+
+static INT16U read_sci
+    (
+    HANDLE      hMp3,
+    INT8U       reg
+    );
+
+static void load_plugin
+    (
+    HANDLE      hMp3
+    );
+
+static void send_fill
+    (
+    HANDLE          hMp3,
+    const INT8U*    ptr_fill,
+    INT32U          len
+    );
 
 /**
     Power up the MP3 streaming utility module.
@@ -26,51 +67,226 @@ void mp3_strm_util_pwrp
     ( void )
 {
 
+memset( &util_plugin_stats, 0, sizeof( util_plugin_stats ) );
+
 } /* mp3_strm_util_pwrp() */
 
 /**
     Utility function to start the initialize the
     MP3 driver and set it up for streaming
 
+    A reset puts the playback speed back to normal
+    and drops any plugin, so the plugin is uploaded
+    again once the clock is up and the speed last
+    set is programmed again.
 */
 void mp3_strm_util_start
     (
     HANDLE hMp3
     )
 {
+PjdfMp3SciOp ops[4];
+INT32U       op_cnt;
 
-INT32U length;
+// Reset the device
+ops[0].op    = PJDF_MP3_SCI_WRITE;
+ops[0].reg   = PJDF_MP3_SCI_MODE;
+ops[0].value = PJDF_MP3_SM_SDINEW | PJDF_MP3_SM_RESET;
 
-// Place MP3 driver in command mode (subsequent writes will be sent to the decoder's command interface)
-Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
+ops[1].op    = PJDF_MP3_SCI_WRITE;
+ops[1].reg   = PJDF_MP3_SCI_CLOCKF;
+ops[1].value = CLOCKF_3_5X;
 
-// Reset the device
-length = BspMp3SoftResetLen;
-Write(hMp3, (void*)BspMp3SoftReset, &length);
+sci_batch( hMp3, ops, 2 );
 
-length = BspMp3SetClockFLen;
-Write(hMp3, (void*)BspMp3SetClockF, &length);
+// The faster clock lets the plugin go at the fast SCI rate
+load_plugin( hMp3 );
 
 // Set volume
-length = BspMp3SetVol1010Len;
-Write(hMp3, (void*)BspMp3SetVol1010, &length);
+ops[0].op    = PJDF_MP3_SCI_WRITE;
+ops[0].reg   = PJDF_MP3_SCI_VOL;
+ops[0].value = VOL_DFLT;
 
 // To allow streaming data, set the decoder mode to Play Mode
-length = BspMp3PlayModeLen;
-Write(hMp3, (void*)BspMp3PlayMode, &length);
+ops[1].op    = PJDF_MP3_SCI_WRITE;
+ops[1].reg   = PJDF_MP3_SCI_MODE;
+ops[1].value = PJDF_MP3_SM_SDINEW;
+
+op_cnt = 2;
+
+// Set the playback speed
+if( 1 != util_play_speed )
+    {
+    ops[2].op    = PJDF_MP3_SCI_WRITE;
+    ops[2].reg   = PJDF_MP3_SCI_WRAMADDR;
+    ops[2].value = PJDF_MP3_PARAM_PLAY_SPEED;
+
+    ops[3].op    = PJDF_MP3_SCI_WRITE;
+    ops[3].reg   = PJDF_MP3_SCI_WRAM;
+    ops[3].value = util_play_speed;
+
+    op_cnt = 4;
+    }
+
+// All under one lock of the SPI
+sci_batch( hMp3, ops, op_cnt );
 
 } /* mp3_strm_util_start() */
 
+/**
+    Utility function to set the playback speed
+
+    Programs the decoder's playSpeed parameter, which
+    takes effect at once, and keeps it for the resets
+    to come. The decoder only plays at whole multiples
+    of the normal speed. A handle of -1 only keeps the
+    speed for the next start.
+*/
+void mp3_strm_util_set_speed
+    (
+    HANDLE hMp3,
+    INT8U  speed
+    )
+{
+PjdfMp3SciOp ops[2];
+
+util_play_speed = speed;
+
+if( -1 == hMp3 )
+    {
+    return;
+    }
+
+ops[0].op    = PJDF_MP3_SCI_WRITE;
+ops[0].reg   = PJDF_MP3_SCI_WRAMADDR;
+ops[0].value = PJDF_MP3_PARAM_PLAY_SPEED;
+
+ops[1].op    = PJDF_MP3_SCI_WRITE;
+ops[1].reg   = PJDF_MP3_SCI_WRAM;
+ops[1].value = speed;
+
+sci_batch( hMp3, ops, 2 );
+
+} /* mp3_strm_util_set_speed() */
+
+
+/**
+    Utility function to set the plugin image
+
+    The image, in the compressed format VLSI publishes
+    plugins in, is uploaded after every reset of the
+    decoder from the next one on. It is not copied, so
+    it must stay put until it is replaced. NULL drops
+    the plugin. The image and its length are changed
+    together, so an upload never sees half of each.
+*/
+void mp3_strm_util_set_plugin
+    (
+    const INT16U*   ptr_image,
+    INT32U          words
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+util_plugin_ptr   = ptr_image;
+util_plugin_words = ( NULL != ptr_image ) ? words : 0;
+OS_EXIT_CRITICAL();
+
+} /* mp3_strm_util_set_plugin() */
+
+/**
+    Utility function to get the plugin upload
+    counters
+*/
+void mp3_strm_util_get_plugin_stats
+    (
+    MP3_plugin_stats_type* ptr_stats
+    )
+{
+OS_CPU_SR   cpu_sr = 0;
+
+OS_ENTER_CRITICAL();
+*ptr_stats = util_plugin_stats;
+OS_EXIT_CRITICAL();
+
+} /* mp3_strm_util_get_plugin_stats() */
 
 /**
     Utility function to stop the MP3 driver
+
+    Cancels the stream the way the datasheet asks
+    for, so the decoder goes quiet at once rather
+    than playing out what it holds. SM_CANCEL is set
+    and endFillBytes are sent until the decoder has
+    cleared it, then the decoder is flushed with more
+    of them. If it does not clear SM_CANCEL the decoder
+    is reset instead. Nothing needs doing when the
+    decoder has not found the format of a stream.
+
+    At the end of a file the decoder is first given
+    the endFillBytes that let it play out the data it
+    holds, and the stream is cancelled after them.
 */
 
 void mp3_strm_util_stop
     (
-    HANDLE hMp3
+    HANDLE  hMp3,
+    BOOLEAN play_out
     )
 {
+PjdfMp3SciOp    ops[3];
+INT8U           fill[CANCEL_CHUNK_LEN];
+INT16U          hdat0;
+INT16U          hdat1;
+INT32U          sent;
+
+mp3_strm_util_get_hdat( hMp3, &hdat0, &hdat1 );
+
+if( ( 0 != hdat0 ) || ( 0 != hdat1 ) )
+    {
+    // Read endFillByte
+    ops[0].op    = PJDF_MP3_SCI_WRITE;
+    ops[0].reg   = PJDF_MP3_SCI_WRAMADDR;
+    ops[0].value = PJDF_MP3_PARAM_END_FILL_BYTE;
+
+    ops[1].op    = PJDF_MP3_SCI_READ;
+    ops[1].reg   = PJDF_MP3_SCI_WRAM;
+    ops[1].value = 0;
+
+    sci_batch( hMp3, ops, 2 );
+
+    memset( fill, (INT8U)ops[1].value, sizeof( fill ) );
+
+    if( play_out )
+        {
+        send_fill( hMp3, fill, END_FILL_LEN );
+        }
+
+    // Set SM_CANCEL
+    ops[0].op    = PJDF_MP3_SCI_WRITE;
+    ops[0].reg   = PJDF_MP3_SCI_MODE;
+    ops[0].value = PJDF_MP3_SM_SDINEW | PJDF_MP3_SM_CANCEL;
+
+    sci_batch( hMp3, ops, 1 );
+
+    sent = 0;
+    while( ( read_sci( hMp3, PJDF_MP3_SCI_MODE ) & PJDF_MP3_SM_CANCEL ) &&
+           ( sent < CANCEL_LEN_MAX ) )
+        {
+        mp3_strm_util_stream_data( hMp3, fill, sizeof( fill ) );
+        sent += sizeof( fill );
+        }
+
+    if( read_sci( hMp3, PJDF_MP3_SCI_MODE ) & PJDF_MP3_SM_CANCEL )
+        {
+        mp3_strm_util_start( hMp3 );
+        }
+    else
+        {
+        send_fill( hMp3, fill, END_FILL_LEN );
+        }
+    }
 
 Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
 
@@ -78,41 +294,26 @@ Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
 
 /**
     Utility function to stream data to the MP3 decoder
-    MP3 driver and set it up for streaming
+
+    The driver sends the data in MP3_DECODER_BUF_SIZE
+    bursts for as long as the decoder raises DREQ and
+    blocks on the DREQ interrupt otherwise, so the whole
+    buffer is handed to it in one write. The data
+    is only read, so it may be in flash.
 */
 
 void mp3_strm_util_stream_data
     (
     HANDLE hMp3,
-    INT8U *pBuf,
+    const INT8U *pBuf,
     INT32U bufLen
     )
 {
-INT8U *bufPos = pBuf;
-INT32U iBufPos = 0;
-INT32U chunkLen;
-BOOLEAN done = OS_FALSE;
-
-chunkLen = MP3_DECODER_BUF_SIZE;
 
 // Set MP3 driver to data mode (subsequent writes will be sent to decoder's data interface)
 Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_DATA, 0, 0);
 
-while( !done )
-    {
-    // detect last chunk of pBuf
-    if (bufLen - iBufPos < MP3_DECODER_BUF_SIZE)
-        {
-        chunkLen = bufLen - iBufPos;
-        done = OS_TRUE;
-        }
-
-    Write(hMp3, bufPos, &chunkLen);
-    OSTimeDly(1);
-
-    bufPos += chunkLen;
-    iBufPos += chunkLen;
-    }
+Write(hMp3, (void*)pBuf, &bufLen);
 
 } /* mp3_strm_util_stream_data()*/
 
@@ -121,43 +322,372 @@ while( !done )
     time
 
     @return returns the current decoder time
+*/
+INT16U mp3_strm_util_get_decode_time
+    (
+    HANDLE hMp3
+    )
+{
 
+return read_sci( hMp3, PJDF_MP3_SCI_DECODE_TIME );
+
+} /* mp3_strm_util_get_decode_time()*/
+
+/**
+    Utility function to get the header of the
+    stream being decoded
+
+    Both words are zero until the decoder has
+    found the format of the stream.
 */
+void mp3_strm_util_get_hdat
+    (
+    HANDLE  hMp3,
+    INT16U* ptr_hdat0,
+    INT16U* ptr_hdat1
+    )
+{
+PjdfMp3SciOp ops[2];
 
-INT16U mp3_strm_util_get_decode_time
+ops[0].op    = PJDF_MP3_SCI_READ;
+ops[0].reg   = PJDF_MP3_SCI_HDAT1;
+ops[0].value = 0;
+
+ops[1].op    = PJDF_MP3_SCI_READ;
+ops[1].reg   = PJDF_MP3_SCI_HDAT0;
+ops[1].value = 0;
+
+sci_batch( hMp3, ops, 2 );
+
+*ptr_hdat1 = ops[0].value;
+*ptr_hdat0 = ops[1].value;
+
+} /* mp3_strm_util_get_hdat()*/
+
+/**
+    Utility function to check if the decoder
+    is asking for more data
+
+    @return returns TRUE if the decoder raises DREQ
+*/
+BOOLEAN mp3_strm_util_is_hungry
     (
     HANDLE hMp3
     )
 {
-INT8U       buf[10];
+BOOLEAN     dreq;
 INT32U      len;
-INT16U      decode_time;
 
-decode_time = 0;
+dreq = false;
+len  = sizeof( dreq );
 
-if ( PJDF_IS_VALID_HANDLE( hMp3 ) )
+if( PJDF_ERR_NONE != Ioctl( hMp3, PJDF_CTRL_MP3_GET_DREQ, &dreq, &len ) )
     {
-    Ioctl(hMp3, PJDF_CTRL_MP3_SELECT_COMMAND, 0, 0);
+    while(1);
+    }
 
-    memcpy(buf, BspMp3ReadDecodeTime, BspMp3ReadDecodeTimeLen); // copy command from flash to a ram buffer
+return dreq;
 
-    len  = BspMp3ReadDecodeTimeLen;
+} /* mp3_strm_util_is_hungry()*/
 
-    if( PJDF_ERR_NONE == Read(hMp3, buf, &len) )
-        {
-        decode_time = ( ( (INT16U)buf[2] ) << 8 ) & ( (INT16U)0xFF00 );
-        decode_time = decode_time | ( (INT16U)( (INT16U)buf[3] & (INT16U)0x00FF ) );
-        Ioctl( hMp3, PJDF_CTRL_MP3_SELECT_DATA, 0, 0 );
-        }
-    else
-        {
-        while(1);
-        }
+/**
+    Utility function to set the decoder time
+
+    The datasheet asks for DECODE_TIME to be written
+    twice.
+*/
+void mp3_strm_util_set_decode_time
+    (
+    HANDLE hMp3,
+    INT16U decode_time
+    )
+{
+PjdfMp3SciOp ops[2];
+
+ops[0].op    = PJDF_MP3_SCI_WRITE;
+ops[0].reg   = PJDF_MP3_SCI_DECODE_TIME;
+ops[0].value = decode_time;
+ops[1]       = ops[0];
+
+sci_batch( hMp3, ops, 2 );
+
+} /* mp3_strm_util_set_decode_time()*/
+
+/**
+    Utility function to resynchronise the decoder
+    after a jump in the stream
+
+    The stream is cancelled as for a stop, without
+    playing out, which drops the data the decoder holds
+    from before the jump but keeps its clock, volume,
+    speed and plugin. Only a decoder that does not clear
+    SM_CANCEL is soft reset. The decode time is then set
+    to the time jumped to.
+*/
+void mp3_strm_util_resync
+    (
+    HANDLE hMp3,
+    INT16U decode_time
+    )
+{
+
+mp3_strm_util_stop( hMp3, false );
+
+mp3_strm_util_set_decode_time( hMp3, decode_time );
+
+} /* mp3_strm_util_resync()*/
+
+/**
+    Utility function to start recording
+
+    Resets the decoder into its encoder, which
+    samples the left channel of the microphone, or
+    of the line input, as 16 bit PCM under automatic
+    gain. The reset forgets the clock the driver
+    knows of, so CLOCKF is written again after it
+    to keep the fast SCI rate for draining the
+    samples.
+*/
+void mp3_strm_util_record_start
+    (
+    HANDLE  hMp3,
+    INT16U  rate,
+    BOOLEAN line_in
+    )
+{
+PjdfMp3SciOp ops[8];
+
+ops[0].op    = PJDF_MP3_SCI_WRITE;
+ops[0].reg   = PJDF_MP3_SCI_MODE;
+ops[0].value = PJDF_MP3_SM_SDINEW | PJDF_MP3_SM_RESET;
+
+ops[1].op    = PJDF_MP3_SCI_WRITE;
+ops[1].reg   = PJDF_MP3_SCI_CLOCKF;
+ops[1].value = CLOCKF_3_5X;
+
+ops[2].op    = PJDF_MP3_SCI_WRITE;
+ops[2].reg   = PJDF_MP3_SCI_AICTRL0;
+ops[2].value = rate;
+
+// Automatic gain, up to the most the encoder allows
+ops[3].op    = PJDF_MP3_SCI_WRITE;
+ops[3].reg   = PJDF_MP3_SCI_AICTRL1;
+ops[3].value = 0;
+
+ops[4].op    = PJDF_MP3_SCI_WRITE;
+ops[4].reg   = PJDF_MP3_SCI_AICTRL2;
+ops[4].value = 0;
+
+ops[5].op    = PJDF_MP3_SCI_WRITE;
+ops[5].reg   = PJDF_MP3_SCI_AICTRL3;
+ops[5].value = PJDF_MP3_AICTRL3_LEFT | PJDF_MP3_AICTRL3_PCM;
+
+// The encoder starts with this reset
+ops[6].op    = PJDF_MP3_SCI_WRITE;
+ops[6].reg   = PJDF_MP3_SCI_MODE;
+ops[6].value = PJDF_MP3_SM_SDINEW | PJDF_MP3_SM_ADPCM | PJDF_MP3_SM_RESET;
+if( line_in )
+    {
+    ops[6].value |= PJDF_MP3_SM_LINE1;
     }
-else
+
+ops[7].op    = PJDF_MP3_SCI_WRITE;
+ops[7].reg   = PJDF_MP3_SCI_CLOCKF;
+ops[7].value = CLOCKF_3_5X;
+
+sci_batch( hMp3, ops, 8 );
+
+} /* mp3_strm_util_record_start() */
+
+/**
+    Utility function to stop recording
+
+    A reset takes the decoder out of its encoder.
+*/
+void mp3_strm_util_record_stop
+    (
+    HANDLE  hMp3
+    )
+{
+PjdfMp3SciOp op;
+
+op.op    = PJDF_MP3_SCI_WRITE;
+op.reg   = PJDF_MP3_SCI_MODE;
+op.value = PJDF_MP3_SM_SDINEW | PJDF_MP3_SM_RESET;
+
+sci_batch( hMp3, &op, 1 );
+
+} /* mp3_strm_util_record_stop() */
+
+/**
+    Utility function to get the number of recorded
+    words waiting in the decoder
+
+    @return returns the number of words
+*/
+INT16U mp3_strm_util_record_avail
+    (
+    HANDLE  hMp3
+    )
+{
+
+return read_sci( hMp3, PJDF_MP3_SCI_HDAT1 );
+
+} /* mp3_strm_util_record_avail() */
+
+/**
+    Utility function to read recorded words
+
+    No more words may be read than
+    mp3_strm_util_record_avail() last returned.
+    Each word is a sample, stored in the byte
+    order of the CPU, which is that of a WAV file.
+*/
+void mp3_strm_util_record_read
+    (
+    HANDLE  hMp3,
+    INT16U* ptr_words,
+    INT32U  cnt
+    )
+{
+INT32U len;
+
+len = cnt * sizeof( INT16U );
+if( PJDF_ERR_NONE != Ioctl( hMp3, PJDF_CTRL_MP3_RECORD_READ, ptr_words, &len ) )
     {
     while(1);
     }
 
-return decode_time;
-} /* mp3_strm_util_get_decode_time()*/
\ No newline at end of file
+} /* mp3_strm_util_record_read() */
+
+/**
+    Send endFillBytes to the decoder
+
+    ptr_fill is CANCEL_CHUNK_LEN bytes of endFillByte,
+    sent over and over until len bytes have gone.
+*/
+static void send_fill
+    (
+    HANDLE          hMp3,
+    const INT8U*    ptr_fill,
+    INT32U          len
+    )
+{
+INT32U chunk_len;
+
+while( len > 0 )
+    {
+    chunk_len = ( len > CANCEL_CHUNK_LEN ) ? CANCEL_CHUNK_LEN : len;
+    mp3_strm_util_stream_data( hMp3, ptr_fill, chunk_len );
+    len -= chunk_len;
+    }
+
+} /* send_fill() */
+
+/**
+    Carry out a batch of decoder register accesses
+
+    The driver carries out the whole batch under one
+    lock of the SPI, and serves the registers it
+    shadows without touching the SPI.
+*/
+static void sci_batch
+    (
+    HANDLE          hMp3,
+    PjdfMp3SciOp*   ptr_ops,
+    INT32U          op_cnt
+    )
+{
+INT32U len;
+
+if( !PJDF_IS_VALID_HANDLE( hMp3 ) )
+    {
+    while(1);
+    }
+
+len = op_cnt * sizeof( PjdfMp3SciOp );
+if( PJDF_ERR_NONE != Ioctl( hMp3, PJDF_CTRL_MP3_SCI_BATCH, ptr_ops, &len ) )
+    {
+    while(1);
+    }
+
+} /* sci_batch()*/
+
+/**
+    Upload the plugin image to the decoder
+
+    The driver expands the image as it sends it,
+    under one lock of the SPI, then reads back the
+    instruction memory it wrote. An image the driver
+    turns down is dropped, so it is not tried again
+    at every reset, unless it has been replaced in
+    the meantime.
+*/
+static void load_plugin
+    (
+    HANDLE      hMp3
+    )
+{
+OS_CPU_SR       cpu_sr = 0;
+PjdfMp3Plugin   plugin;
+INT32U          len;
+
+memset( &plugin, 0, sizeof( plugin ) );
+
+OS_ENTER_CRITICAL();
+plugin.pImage = util_plugin_ptr;
+plugin.words  = util_plugin_words;
+OS_EXIT_CRITICAL();
+
+if( NULL == plugin.pImage )
+    {
+    return;
+    }
+
+len = sizeof( plugin );
+if( PJDF_ERR_NONE != Ioctl( hMp3, PJDF_CTRL_MP3_PLUGIN_LOAD, &plugin, &len ) )
+    {
+    OS_ENTER_CRITICAL();
+    if( util_plugin_ptr == plugin.pImage )
+        {
+        util_plugin_ptr   = NULL;
+        util_plugin_words = 0;
+        }
+    OS_EXIT_CRITICAL();
+    return;
+    }
+
+OS_ENTER_CRITICAL();
+util_plugin_stats.load_cnt++;
+util_plugin_stats.image_words    = plugin.words;
+util_plugin_stats.writes         = plugin.writes;
+util_plugin_stats.verified_words = plugin.verifiedWords;
+util_plugin_stats.verify_errors  = plugin.verifyErrors;
+util_plugin_stats.upload_us      = BSP_CYCLES_TO_US( plugin.uploadCycles );
+util_plugin_stats.verify_us      = BSP_CYCLES_TO_US( plugin.verifyCycles );
+OS_EXIT_CRITICAL();
+
+} /* load_plugin() */
+
+/**
+    Read a decoder register
+
+    @return returns the register value
+*/
+static INT16U read_sci
+    (
+    HANDLE      hMp3,
+    INT8U       reg
+    )
+{
+PjdfMp3SciOp op;
+
+op.op    = PJDF_MP3_SCI_READ;
+op.reg   = reg;
+op.value = 0;
+
+sci_batch( hMp3, &op, 1 );
+
+return op.value;
+
+} /* read_sci()*/
@@ -51,6 +51,7 @@ Module Description:
 #define LIST_START_Y            ( 50 )
 
 #define PLAYBACK_FNAME_LEN_MAX  ( 15 )
+#define TTFA_PRINT_BUF_SIZE     ( 96 )
 
 
 /**
@@ -91,9 +92,12 @@ static Adafruit_GFX_Button  button_arr[BTN_TYPE_CNT];
 static OS_STK               lcd_touch_task_stk[APP_CFG_TASK_START_STK_SIZE];
 static HANDLE               hndl_tch_ctrl;
 static INT16U               last_playback_time;
+static INT16U               last_playback_duration;
 static INT32U               prev_touch_time;
 static INT32U               cur_touch_time;
 static INT16S               prev_sel_file_idx;
+static INT16U               last_ttfa_start_cnt;
+static INT32U               last_plugin_load_cnt;
 
 // Useful functions
 void PrintWithBuf(char *buf, int size, char *format, ...);
@@ -141,6 +145,15 @@ static void main_lcd_touch
 static void draw_lcd_contents
     ( void );
 
+static void sync_file_list_selection
+    ( void );
+
+static void report_ttfa
+    ( void );
+
+static void report_plugin
+    ( void );
+
 /************************************************************************************
 
    Allocate the stacks for each task.
@@ -155,10 +168,17 @@ void StartupTask(void* pdata)
     prev_touch_time = 0;
     cur_touch_time = 0;
     prev_sel_file_idx = -1;
+    last_ttfa_start_cnt = 0;
+    last_plugin_load_cnt = 0;
 
     // Start the system tick
     OS_CPU_SysTickInit(OS_TICKS_PER_SEC);
 
+#ifdef MP3_BENCH
+    // Measure the idle CPU before any other task runs
+    OSStatInit();
+#endif
+
     // Power up the devices's file system
     DFS_pwrp();
 
@@ -168,8 +188,13 @@ void StartupTask(void* pdata)
     // Power up the MP3 main thread
     MP3_pwrp();
 
+#ifdef MP3_BENCH
+    // Run the streaming benchmark instead of the front end
+    MP3_bench_pwrp();
+#else
     // Create the LCD and Touch main
     OSTaskCreate( main_lcd_touch, (void*)0, &lcd_touch_task_stk[APP_CFG_TASK_START_STK_SIZE-1], APP_TASK_LCD_TOUCH_PRIO);
+#endif
 
     // Delete the startup task
     OSTaskDel(OS_PRIO_SELF);
@@ -271,6 +296,12 @@ static void main_lcd_touch
     // init the playback list
     file_list.InitList( &lcd_ctrl, LIST_START_X, LIST_START_Y, LIST_BTN_WDT, LIST_BTN_HGT );
 
+    // Give the decoder its plugin if the card has one
+    (void)MP3_plugin_load( MP3_PLUGIN_FILE_NAME );
+
+    // Play the list round and round
+    MP3_playlist_set_repeat( true );
+
     // Draw the MP3 User interface
     draw_lcd_contents();
 
@@ -283,8 +314,10 @@ static void main_lcd_touch
         uint16_t    x;
         uint16_t    y;
         int         len;
-        char        temp_buff[12];
-        char        buf[12];
+        INT16U      playback_time;
+        INT16U      playback_duration;
+        char        temp_buff[16];
+        char        buf[16];
 
         // Is a touch detected
         touched = tch_ctrl_is_touched_detected( hndl_tch_ctrl );
@@ -293,17 +326,31 @@ static void main_lcd_touch
         if( touched )
         {
             cur_touch_time = task_ms_timer;
+            MP3_ttfa_mark_touch();
         }
 
         // If there is change in playback time, update the
         // playback time on the screen
-        if( MP3_playback_get_time_scnds() != last_playback_time )
+        playback_time = MP3_playback_get_time_scnds();
+        playback_duration = MP3_playback_get_duration_scnds();
+        if( ( playback_time != last_playback_time ) ||
+            ( playback_duration != last_playback_duration ) )
         {
-            INT16U mins = MP3_playback_get_time_scnds()/ 60;
+            INT16U mins = playback_time / 60;
 
-            last_playback_time = MP3_playback_get_time_scnds();
+            last_playback_time = playback_time;
+            last_playback_duration = playback_duration;
 
-            len=snprintf( temp_buff, 12, "%02u:%02u", mins, ( MP3_playback_get_time_scnds() % 60 ) );
+            // Show the duration once it is known
+            if( last_playback_duration > 0 )
+            {
+                len=snprintf( temp_buff, 16, "%02u:%02u / %02u:%02u", mins, ( last_playback_time % 60 ),
+                              ( last_playback_duration / 60 ), ( last_playback_duration % 60 ) );
+            }
+            else
+            {
+                len=snprintf( temp_buff, 16, "%02u:%02u", mins, ( last_playback_time % 60 ) );
+            }
 
             lcd_ctrl.fillRect(0, TIME_INFO_Y, ILI9341_TFTWIDTH-10, BOXSIZE, ILI9341_BLACK);
 
@@ -313,23 +360,26 @@ static void main_lcd_touch
                 lcd_ctrl.setCursor( TIME_INFO_X, TIME_INFO_Y + 5 );
                 lcd_ctrl.setTextColor(ILI9341_WHITE);
                 lcd_ctrl.setTextSize(2);
-                PrintToLcdWithBuf(buf, 15, temp_buff);
+                PrintToLcdWithBuf(buf, 16, temp_buff);
             }
 
         }
 
+        // Keep the next item on the playlist queued so that
+        // it follows on without a gap, and go on to the next
+        // item at the end of playback
+        MP3_playlist_update();
+        sync_file_list_selection();
+
+        report_ttfa();
+        report_plugin();
+
         // If plaback is in progress
         if( MP3_playback_is_plybk_in_prog() )
         {
             // Change play button to pause
             button_arr[BTN_TYPE_PLAY].updateText("Pause");
         }
-        else if( MP3_PLAYBACK_STS_DONE == MP3_playback_get_status() )
-        {
-            // Go to the next item on the plaback list and
-            // play it
-            handle_selected_file_list_index( file_list.GetNextIndex() );
-        }
         else
         {
             button_arr[BTN_TYPE_PLAY].updateText("Play");
@@ -421,8 +471,9 @@ static boolean get_pressed_button
 /**
     Function to populate the playback file list
 
-    This function get the names of all the files
-    present in the root the SD card.
+    This function loads the playlist, the files present
+    in the root the SD card or, with no SD card, the MP3
+    files built into the flash, and lists its entries.
 
     Limitations:
         1) All the files exist in the root of the SD card
@@ -435,46 +486,38 @@ static BOOLEAN populate_playback_file_list
     void
     )
 {
-    File    root;
-    File    entry;
-    BOOLEAN files_added;
+    BOOLEAN             files_added;
+    INT8U               i;
+    MP3_track_info_type info;
+    char                label[PLAYBACK_FNAME_LEN_MAX];
 
-    // Open the root of the SD card drive
-    root = SD.open("/");
     files_added = false;
 
-    // Iterate and get the next file
-    while(true)
-    {
-        // Get the next file
-        File entry =  root.openNextFile();
+    // Read the directory and the metadata cache once,
+    // tracks are played by their playlist index from here on
+    MP3_playlist_load();
 
-        if (!entry )
+    for( i = 0; i < MP3_playlist_get_cnt(); i++ )
+    {
+        // Add the title of the file to the list if the cache
+        // has one, else its name
+        if( MP3_playlist_get_info( i, &info ) && ( '\0' != info.title[0] ) )
         {
-            break;
+            strncpy( label, info.title, PLAYBACK_FNAME_LEN_MAX - 1 );
         }
-
-        // If the entry is a file
-        if( !entry.isDirectory() )
+        else
         {
-            // Add the file name to the list
-            if( !file_list.AddItem( entry.name() ) )
-            {
-                entry.close();
-                break;
-            }
-            else
-            {
-                files_added = true;
-            }
+            strncpy( label, MP3_playlist_get_name( i ), PLAYBACK_FNAME_LEN_MAX - 1 );
         }
+        label[PLAYBACK_FNAME_LEN_MAX - 1] = '\0';
 
-        entry.close();
-
+        if( !file_list.AddItem( label ) )
+        {
+            break;
+        }
+        files_added = true;
     }
 
-    root.seek( 0 );
-
     return files_added;
 
 } /* populate_playback_file_list()*/
@@ -486,8 +529,8 @@ static BOOLEAN populate_playback_file_list
     this function will select it and start playing it
     back.
 
-    If playback is already in progress, this function
-    will stop an ongoing playback and start playing back
+    If playback is already in progress, the playlist
+    stops the ongoing playback and starts playing back
     the new selection
 */
 
@@ -499,32 +542,99 @@ static void handle_selected_file_list_index
     // Make sure the index is valid and has really changed
     if( ( -1 !=  index ) && ( prev_sel_file_idx != index ) )
     {
-        // Get the string assocaited with the list item
-        const char* ptr_fname = file_list.GetText( index );
-
-        if( ptr_fname != NULL )
+        // Start playback with the new selection
+        if( !MP3_playlist_play( index ) )
         {
-            // If playback is not OFF, stop existing playback
-            if( MP3_PLAYBACK_STS_OFF != MP3_playback_get_status() )
-            {
-                MP3_playback_stop();
-                OSTimeDly(500);
-            }
-
-            // Update the file list selection
-            file_list.SetSelectedIndex( index );
-            prev_sel_file_idx = index;
-
-            // Start playback with the new selection
-            if( !MP3_playback_start( ptr_fname ) )
-            {
-                while(1);
-            }
+            while(1);
         }
+
+        sync_file_list_selection();
     }
 
 } /* handle_selected_file_list_index() */
 
+/**
+    Function to keep the file list selection on the
+    playing playlist entry
+
+    The playlist moves on by itself to the entry it
+    has queued, and at the end of playback.
+*/
+
+static void sync_file_list_selection
+    ( void )
+{
+    INT8S index;
+
+    index = MP3_playlist_get_cur();
+
+    if( index != prev_sel_file_idx )
+    {
+        file_list.SetSelectedIndex( index );
+        prev_sel_file_idx = index;
+    }
+
+} /* sync_file_list_selection() */
+
+/**
+    Function to report the time to first audio
+
+    Prints the times of the last playback start to
+    the UART once, when its decode time has moved.
+*/
+
+static void report_ttfa
+    ( void )
+{
+    MP3_ttfa_type   ttfa;
+    char            buf[TTFA_PRINT_BUF_SIZE];
+
+    MP3_get_ttfa( &ttfa );
+
+    if( ( ttfa.start_cnt != last_ttfa_start_cnt ) && ( 0 != ttfa.decode_us ) )
+    {
+        last_ttfa_start_cnt = ttfa.start_cnt;
+
+        PrintWithBuf( buf, sizeof( buf ), "TTFA from %s: start %u open %u first byte %u audio %u decode %u ms\r\n",
+                      ttfa.touched ? "touch" : "start",
+                      ttfa.start_us / 1000,
+                      ttfa.open_us / 1000,
+                      ttfa.first_byte_us / 1000,
+                      ttfa.format_us / 1000,
+                      ttfa.decode_us / 1000 );
+    }
+
+} /* report_ttfa() */
+
+/**
+    Report the decoder plugin upload
+
+    Prints the size and times of a plugin upload to the UART
+    once after every upload, which is at every playback start.
+*/
+static void report_plugin
+    ( void )
+{
+    MP3_plugin_stats_type   stats;
+    char                    buf[TTFA_PRINT_BUF_SIZE];
+
+    MP3_plugin_get_stats( &stats );
+
+    if( stats.load_cnt != last_plugin_load_cnt )
+    {
+        last_plugin_load_cnt = stats.load_cnt;
+
+        PrintWithBuf( buf, sizeof( buf ), "Plugin: %u words %u writes upload %u us verify %u us %u/%u bad\r\n",
+                      stats.image_words,
+                      stats.writes,
+                      stats.upload_us,
+                      stats.verify_us,
+                      stats.verify_errors,
+                      stats.verified_words );
+    }
+
+} /* report_plugin() */
+
 /**
     Function to handle playback control button press
 
@@ -563,10 +673,10 @@ static void handle_btn_press
                     // Resume playback
                     MP3_playback_resume();
                 }
-                else
+                else if( -1 != prev_sel_file_idx )
                 {
                     // Start playback
-                    MP3_playback_start( file_list.GetText( prev_sel_file_idx ) );
+                    MP3_playlist_play( prev_sel_file_idx );
                 }
             }
         }
@@ -574,24 +684,24 @@ static void handle_btn_press
         else if( BTN_TYPE_STOP == buttonPressed )
         {
             // Stop ongoing playback
-            MP3_playback_stop();
-            OSTimeDly(500);
+            MP3_playlist_stop();
 
             // Reset the file list selection
-            file_list.SetSelectedIndex(-1);
-            prev_sel_file_idx = -1;
+            sync_file_list_selection();
         }
         // If the next button was pressed
         else if( BTN_TYPE_NEXT == buttonPressed )
         {
-            // Change the file list selection to the next list item
-            handle_selected_file_list_index( file_list.GetNextIndex() );
+            // Play the next playlist item
+            MP3_playlist_next();
+            sync_file_list_selection();
         }
         // If the previous button was pressed
         else if( BTN_TYPE_PREV == buttonPressed )
         {
-            // Change the file list selection to the previous list item
-            handle_selected_file_list_index( file_list.GetPrevIndex() );
+            // Play the previous playlist item
+            MP3_playlist_prev();
+            sync_file_list_selection();
         }
 
         prev_touch_time = cur_touch_time;
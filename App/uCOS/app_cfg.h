@@ -55,10 +55,13 @@
 */
 
 //task priorities
+#define APP_TASK_MP3_RECORD_PRIO            (3)     // above the rest, it drains the decoder's small buffer
 #define APP_TASK_START_PRIO                 4
 #define APP_TASK_MP3_MAIN_PRIO              (5)
 #define APP_TASK_MP3_STREAM_MAIN_PRIO       (6)
 #define APP_TASK_LCD_TOUCH_PRIO             (7)
+#define APP_TASK_MP3_PREFETCH_PRIO          (8)
+#define APP_TASK_MP3_BENCH_PRIO             (9)
 
 #define  OS_TASK_TMR_PRIO                (OS_LOWEST_PRIO - 2u)
 
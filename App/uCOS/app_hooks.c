@@ -262,6 +262,12 @@ void  App_TimeTickHook (void)
 
 task_ms_timer += 1;
 
+BspUartRxTick();
+
+#ifdef MP3_VS1053_MODEL
+BspMp3ModelTick();
+#endif
+
     //HAL_IncTick();                                              /* STM32CubeF4 library function call.                   */
 }
 #endif
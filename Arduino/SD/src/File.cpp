@@ -115,6 +115,16 @@ int File::read(void *buf, uint16_t nbyte) {
   return 0;
 }
 
+// streaming reads go straight from the card into the caller's buffer,
+// whole blocks at a time, without passing through the volume's block cache
+void File::setStreamingRead(boolean enable) {
+  if (! _file) return;
+  if (enable)
+    _file->setUnbufferedRead();
+  else
+    _file->clearUnbufferedRead();
+}
+
 int File::available() {
   if (! _file) return 0;
 
@@ -134,6 +144,36 @@ boolean File::seek(uint32_t pos) {
   return _file->seekSet(pos);
 }
 
+// seek starting the cluster walk from a position and cluster() pair
+// saved earlier, so the seek time does not grow with the file
+boolean File::seek(uint32_t pos, uint32_t hintPos, uint32_t hintCluster) {
+  if (! _file) return false;
+
+  return _file->seekSet(pos, hintPos, hintCluster);
+}
+
+uint32_t File::cluster() {
+  if (! _file) return 0;
+  return _file->curCluster();
+}
+
+uint32_t File::firstCluster() {
+  if (! _file) return 0;
+  return _file->firstCluster();
+}
+
+// first and last card block of a file whose clusters are contiguous,
+// fails if they are not
+boolean File::contiguousRange(uint32_t *bgnBlock, uint32_t *endBlock) {
+  if (! _file) return false;
+  return _file->contiguousRange(bgnBlock, endBlock);
+}
+
+boolean File::truncate(uint32_t length) {
+  if (! _file) return false;
+  return _file->truncate(length);
+}
+
 uint32_t File::position() {
   if (! _file) return -1;
   return _file->curPosition();
@@ -564,8 +564,38 @@ boolean SDClass::remove(char *filepath) {
 }
 
 
-// allows you to recurse into a directory
-File File::openNextFile(uint8_t mode) {
+File SDClass::openRootEntry(uint16_t index, uint8_t mode) {
+  dir_t p;
+  char name[13];
+  SdFile file;
+
+  // readDir() skips unused entries, so make sure it returned this one
+  if (!root.seekSet(32UL * index) || root.readDir(&p) <= 0 ||
+      root.curPosition() != 32UL * (index + 1)) {
+    return File();
+  }
+
+  SdFile::dirName(p, name);
+  if (!file.open(&root, index, mode)) {
+    return File();
+  }
+
+  return File(file, name);
+}
+
+File SDClass::createContiguous(const char *filename, uint32_t size) {
+  SdFile file;
+
+  if (!file.createContiguous(&root, filename, size)) {
+    return File();
+  }
+
+  return File(file, filename);
+}
+
+// allows you to recurse into a directory, the directory entry index of the
+// file is returned in *pIndex for opening it again with openRootEntry()
+File File::openNextFile(uint8_t mode, uint16_t *pIndex) {
   dir_t p;
 
   //Serial.print("\t\treading dir...");
@@ -592,11 +622,14 @@ File File::openNextFile(uint8_t mode) {
     // print file name with possible blank fill
     SdFile f;
     char name[13];
+    uint16_t index = (uint16_t)(_file->curPosition() / 32 - 1);
     _file->dirName(p, name);
     //Serial.print("try to open file ");
     //Serial.println(name);
 
-    if (f.open(_file, name, mode)) {
+    // open by the entry just read rather than searching for the name
+    if (f.open(_file, index, mode)) {
+      if (pIndex) *pIndex = index;
       //Serial.println("OK!");
       return File(f, name);    
     } else {
@@ -38,15 +38,21 @@ public:
   virtual int available();
   virtual void flush();
   int read(void *buf, uint16_t nbyte);
+  void setStreamingRead(boolean enable);
   boolean seek(uint32_t pos);
+  boolean seek(uint32_t pos, uint32_t hintPos, uint32_t hintCluster);
   uint32_t position();
+  uint32_t cluster();
+  uint32_t firstCluster();
+  boolean contiguousRange(uint32_t *bgnBlock, uint32_t *endBlock);
+  boolean truncate(uint32_t length);
   uint32_t size();
   void close();
   operator bool();
   char * name();
 
   boolean isDirectory(void);
-  File openNextFile(uint8_t mode = O_RDONLY);
+  File openNextFile(uint8_t mode = O_RDONLY, uint16_t *pIndex = 0);
   void rewindDirectory(void);
   
   //using Print::write;
@@ -73,6 +79,25 @@ public:
   // Note that currently only one file can be open at a time.
   File open(const char *filename, uint8_t mode = FILE_READ);
 
+  // Open the file at a directory entry index of the root, as returned by
+  // openNextFile(). Only that entry is read, the directory is not searched.
+  File openRootEntry(uint16_t index, uint8_t mode = FILE_READ);
+
+  // Create a file of the given size in the root, made of contiguous
+  // clusters. Fails if the file exists or there is no free run that long.
+  File createContiguous(const char *filename, uint32_t size);
+
+  // Write consecutive blocks straight to the card, bypassing the file and
+  // the FAT, eg the blocks of a file made by createContiguous(). The card
+  // is only selected during each call, so other SPI devices can be used
+  // between the blocks, but nothing else may touch the card until
+  // writeBlocksStop(). writeBlocksBusy() tells, without waiting, whether
+  // the card is still programming the last block.
+  boolean writeBlocksStart(uint32_t block, uint32_t count) { return card.writeStart(block, count); }
+  boolean writeBlocksBusy(void) { return card.writeBusy(); }
+  boolean writeBlocksData(const uint8_t *src) { return card.writeData(src); }
+  boolean writeBlocksStop(void) { return card.writeStop(); }
+
   // Methods to determine if the requested file path exists.
   boolean exists(char *filepath);
 
@@ -19,6 +19,7 @@
  */
 #define USE_SPI_LIB
 #include "Sd2Card.h"
+#include <string.h>
 #include "ucos_ii.h"
 //------------------------------------------------------------------------------
 
@@ -35,6 +36,17 @@ uint8_t Sd2Card::spiRec(void) {
     Read(hSD_, &buf, &len);;
     return buf;
 }
+/** Send a buffer to the card in one transfer */
+void Sd2Card::spiSend(const uint8_t* buf, uint16_t count) {
+    uint32_t len = count;
+    Write(hSD_, (void*)buf, &len);
+}
+/** Receive a buffer from the card in one transfer, clocking out 0XFF */
+void Sd2Card::spiRec(uint8_t* buf, uint16_t count) {
+    uint32_t len = count;
+    memset(buf, 0XFF, count);
+    Read(hSD_, buf, &len);
+}
 //------------------------------------------------------------------------------
 /** nop to tune soft SPI timing */
 #define nop asm volatile ("nop\n\t")
@@ -329,9 +341,7 @@ uint8_t Sd2Card::readData(uint32_t block,
     spiRec();
   }
   // transfer data
-  for (uint16_t i = 0; i < count; i++) {
-    dst[i] = spiRec();
-  }
+  spiRec(dst, count);
 #endif  // OPTIMIZE_HARDWARE_SPI
 
   offset_ += count;
@@ -369,6 +379,82 @@ void Sd2Card::readEnd(void) {
   }
 }
 //------------------------------------------------------------------------------
+/**
+ * Start a read multiple blocks sequence.
+ *
+ * \param[in] blockNumber Address of first block in sequence.
+ *
+ * \note This function is used with readData() and readStop() to read
+ * consecutive blocks straight into the caller's buffers. The SPI bus
+ * stays locked to the card until readStop() is called.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readStart(uint32_t blockNumber) {
+  // use address if not SDHC card
+  if (type()!= SD_CARD_TYPE_SDHC) blockNumber <<= 9;
+  if (cardCommand(CMD18, blockNumber)) {
+    error(SD_CARD_ERROR_CMD18);
+    goto fail;
+  }
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
+/**
+ * Read one block of a read multiple blocks sequence.
+ *
+ * \param[out] dst Pointer to the location that will receive the 512 bytes.
+ *
+ * \note The card is left selected on failure too, so that readStop()
+ * can still end the sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readData(uint8_t* dst) {
+  if (!waitStartBlock()) {
+    // waitStartBlock() deselects the card
+    chipSelectLow();
+    return false;
+  }
+  spiRec(dst, 512);
+  spiRec();  // get first crc byte
+  spiRec();  // get second crc byte
+  return true;
+}
+//------------------------------------------------------------------------------
+/** End a read multiple blocks sequence.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t Sd2Card::readStop(void) {
+  // send the command directly, cardCommand() would wait for the card
+  // to go not busy while it is still streaming data
+  spiSend(CMD12 | 0x40);
+  for (uint8_t i = 0; i < 4; i++) spiSend(0);
+  spiSend(0XFF);
+  spiRec();  // skip stuff byte
+  for (uint8_t i = 0; ((status_ = spiRec()) & 0X80) && i != 0XFF; i++)
+    ;
+  if (status_) {
+    error(SD_CARD_ERROR_CMD12);
+    goto fail;
+  }
+  if (!waitNotBusy(SD_READ_TIMEOUT)) goto fail;
+  chipSelectHigh();
+  return true;
+
+ fail:
+  chipSelectHigh();
+  return false;
+}
+//------------------------------------------------------------------------------
 /** read CID or CSR register */
 uint8_t Sd2Card::readRegister(uint8_t cmd, void* buf) {
   uint8_t* dst = (uint8_t*)(buf);
@@ -506,13 +592,29 @@ uint8_t Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
 //------------------------------------------------------------------------------
 /** Write one data block in a multiple block write sequence */
 uint8_t Sd2Card::writeData(const uint8_t* src) {
+  chipSelectLow();
   // wait for previous write to finish
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) {
     error(SD_CARD_ERROR_WRITE_MULTIPLE);
     chipSelectHigh();
     return false;
   }
-  return writeData(WRITE_MULTIPLE_TOKEN, src);
+  if (!writeData(WRITE_MULTIPLE_TOKEN, src)) return false;
+  chipSelectHigh();
+  return true;
+}
+//------------------------------------------------------------------------------
+/**
+ * Check whether the card is still programming the last block of a write
+ * multiple blocks sequence, without waiting for it.
+ *
+ * \return The value one, true, is returned while the card is busy.
+ */
+uint8_t Sd2Card::writeBusy(void) {
+  chipSelectLow();
+  uint8_t busy = (spiRec() != 0XFF);
+  chipSelectHigh();
+  return busy;
 }
 //------------------------------------------------------------------------------
 // send one block of data for write block or write multiple blocks
@@ -538,9 +640,7 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
 
 #else  // OPTIMIZE_HARDWARE_SPI
   spiSend(token);
-  for (uint16_t i = 0; i < 512; i++) {
-    spiSend(src[i]);
-  }
+  spiSend(src, 512);
 #endif  // OPTIMIZE_HARDWARE_SPI
   spiSend(0xff);  // dummy crc
   spiSend(0xff);  // dummy crc
@@ -560,7 +660,10 @@ uint8_t Sd2Card::writeData(uint8_t token, const uint8_t* src) {
  * \param[in] eraseCount The number of blocks to be pre-erased.
  *
  * \note This function is used with writeData() and writeStop()
- * for optimized multiple block writes.
+ * for optimized multiple block writes. The card is only selected while
+ * each of them runs, so the SPI bus is free for other devices between
+ * the blocks, but no other command may be sent to the card until
+ * writeStop() is called.
  *
  * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
@@ -584,6 +687,7 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
     error(SD_CARD_ERROR_CMD25);
     goto fail;
   }
+  chipSelectHigh();
   return true;
 
  fail:
@@ -597,6 +701,7 @@ uint8_t Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
  * the value zero, false, is returned for failure.
  */
 uint8_t Sd2Card::writeStop(void) {
+  chipSelectLow();
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
   spiSend(STOP_TRAN_TOKEN);
   if (!waitNotBusy(SD_WRITE_TIMEOUT)) goto fail;
@@ -260,10 +260,15 @@ class SdFile {
    */
   uint8_t seekEnd(void) {return seekSet(fileSize_);}
   uint8_t seekSet(uint32_t pos);
+  uint8_t seekSet(uint32_t pos, uint32_t hintPos, uint32_t hintCluster);
   /**
    * Use unbuffered reads to access this file.  Used with Wave
    * Shield ISR.  Used with Sd2Card::partialBlockRead() in WaveRP.
    *
+   * Reads of whole blocks are then done as multiple block reads straight
+   * into the caller's buffer, leaving the block cache to the FAT.  Used
+   * for streaming playback.
+   *
    * Not recommended for normal applications.
    */
   void setUnbufferedRead(void) {
@@ -544,6 +549,7 @@ class SdVolume {
     uint16_t count, uint8_t* dst) {
       return sdCard_->readData(block, offset, count, dst);
   }
+  uint8_t readBlocks(uint32_t block, uint16_t count, uint8_t* dst);
   uint8_t writeBlock(uint32_t block, const uint8_t* dst) {
     return sdCard_->writeBlock(block, dst);
   }
@@ -696,6 +696,24 @@ int16_t SdFile::read(void* buf, uint16_t nbyte) {
     }
     uint16_t n = toRead;
 
+    // unbuffered reads of whole blocks are done as one multiple block
+    // read up to the end of the current cluster
+    if (unbufferedRead() && offset == 0 && n >= 1024 &&
+      type_ != FAT_FILE_TYPE_ROOT16) {
+      uint16_t nBlocks = n >> 9;
+      uint8_t blocksLeft = vol_->blocksPerCluster()
+                           - vol_->blockOfCluster(curPosition_);
+      if (nBlocks > blocksLeft) nBlocks = blocksLeft;
+      if (nBlocks > 1) {
+        if (!vol_->readBlocks(block, nBlocks, dst)) return -1;
+        n = nBlocks << 9;
+        dst += n;
+        curPosition_ += n;
+        toRead -= n;
+        continue;
+      }
+    }
+
     // amount to be read from current block
     if (n > (512 - offset)) n = 512 - offset;
 
@@ -952,6 +970,33 @@ uint8_t SdFile::seekSet(uint32_t pos) {
   return true;
 }
 //------------------------------------------------------------------------------
+/**
+ * Sets a file's position, following the cluster chain from a known
+ * position instead of the first cluster.
+ *
+ * The hint is a position and cluster pair read back with curPosition()
+ * and curCluster() after an earlier seek or read of the same file.
+ * It bounds the FAT reads of a backwards seek, or a long forward one,
+ * in a large or fragmented file.
+ *
+ * \param[in] pos The new position in bytes from the beginning of the file.
+ * \param[in] hintPos A known position at or before \a pos.
+ * \param[in] hintCluster The curCluster() at \a hintPos.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t SdFile::seekSet(uint32_t pos, uint32_t hintPos, uint32_t hintCluster) {
+  // the hint must be usable, and closer than the current position
+  if (isOpen() && type_ != FAT_FILE_TYPE_ROOT16 && pos <= fileSize_ &&
+      hintPos != 0 && hintCluster != 0 && hintPos <= pos &&
+      (curPosition_ < hintPos || curPosition_ > pos)) {
+    curPosition_ = hintPos;
+    curCluster_ = hintCluster;
+  }
+  return seekSet(pos);
+}
+//------------------------------------------------------------------------------
 /**
  * The sync() call causes all modified data and directory fields
  * to be written to the storage device.
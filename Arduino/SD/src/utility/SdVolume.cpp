@@ -136,6 +136,26 @@ uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
   return true;
 }
 //------------------------------------------------------------------------------
+// read consecutive blocks straight into dst, bypassing the block cache
+uint8_t SdVolume::readBlocks(uint32_t block, uint16_t count, uint8_t* dst) {
+  // the card copy of a dirty cached block is stale
+  if (cacheDirty_ && cacheBlockNumber_ >= block &&
+    cacheBlockNumber_ < (block + count)) {
+    if (!cacheFlush()) return false;
+  }
+  if (count == 1) return sdCard_->readBlock(block, dst);
+
+  if (!sdCard_->readStart(block)) return false;
+  for (uint16_t i = 0; i < count; i++, dst += 512) {
+    if (!sdCard_->readData(dst)) {
+      // end the transfer, or the card answers the next command with data
+      sdCard_->readStop();
+      return false;
+    }
+  }
+  return sdCard_->readStop();
+}
+//------------------------------------------------------------------------------
 // return the size in bytes of a cluster chain
 uint8_t SdVolume::chainSize(uint32_t cluster, uint32_t* size) const {
   uint32_t s = 0;
@@ -9,6 +9,8 @@
 
 #include "bsp.h"
 
+INT32U bspCoreClockHz = CLOCK_HSI;
+
 void SetLED(BOOLEAN On)
 {
     if (On) {
@@ -19,3 +21,18 @@ void SetLED(BOOLEAN On)
      }
 }
 
+// BspCycleCntInit
+// Starts the DWT cycle counter read by BSP_CYCLE_CNT() and records the
+// core clock it counts, as set up by SystemInit().
+void BspCycleCntInit(void)
+{
+    RCC_ClocksTypeDef clocks;
+
+    RCC_GetClocksFreq(&clocks);
+    bspCoreClockHz = clocks.HCLK_Frequency;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
@@ -27,6 +27,7 @@
 #include "bspSD.h"
 #include "bspLcd.h"
 #include "bspMp3.h"
+#include "bspMp3Model.h"
 #include "print.h"
 #include "pjdf.h"
 
@@ -35,4 +36,15 @@ PRINT_BUFFER();
 
 void SetLED(BOOLEAN On);
 
+// Free running count of core clock cycles, for timing code paths. The core
+// runs from the PLL, not the HSI, at bspCoreClockHz. The count wraps every
+// 2^32 / bspCoreClockHz seconds, about 71 s at 60 MHz, so only time
+// intervals shorter than that.
+#define BSP_CYCLE_CNT()             ( DWT->CYCCNT )
+#define BSP_CYCLES_TO_US(cycles)    ( (cycles) / ( bspCoreClockHz / 1000000 ) )
+
+extern INT32U bspCoreClockHz;   // Core clock (HCLK), set by BspCycleCntInit()
+
+void BspCycleCntInit(void);
+
 #endif /* __BSP_H */
\ No newline at end of file
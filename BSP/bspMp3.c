@@ -21,6 +21,8 @@ const INT8U BspMp3SetVol1010[] = { 0x02, 0x0B, 0x10, 0x10 };
 const INT8U BspMp3SetVol6060[] = { 0x02, 0x0B, 0x60, 0x60 };
 const INT8U BspMp3ReadVol[]         = { 0x3, 0x0B, 0x00, 0x00 };
 const INT8U BspMp3ReadDecodeTime[]  = { 0x3, 0x04, 0x00, 0x00 };
+const INT8U BspMp3ReadHdat0[]       = { 0x3, 0x08, 0x00, 0x00 };
+const INT8U BspMp3ReadHdat1[]       = { 0x3, 0x09, 0x00, 0x00 };
 
 // Lengths of the above commands
 const INT8U BspMp3SineWaveLen = sizeof(BspMp3SineWave);
@@ -34,7 +36,15 @@ const INT8U BspMp3SetVol6060Len = sizeof(BspMp3SetVol6060);
 const INT8U BspMp3ReadVolLen = sizeof(BspMp3ReadVol);
 
 const INT8U BspMp3ReadDecodeTimeLen = sizeof(BspMp3ReadDecodeTime);
+const INT8U BspMp3ReadHdat0Len = sizeof(BspMp3ReadHdat0);
+const INT8U BspMp3ReadHdat1Len = sizeof(BspMp3ReadHdat1);
 
+// Function called from the DREQ interrupt, registered by the MP3 driver
+static void (*pBspMp3DreqIsr)(void) = 0;
+
+#ifdef MP3_VS1053_SIM_DREQ
+static BOOLEAN bspMp3SimDreq = OS_TRUE;    // Simulated level of the DREQ pin
+#endif
 
 
 // Initializes GPIO pins for the VS1053 MP3 device.
@@ -75,4 +85,78 @@ void BspMp3InitVS1053()
     GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_DOWN;
      
     GPIO_Init(MP3_VS1053_DREQ_GPIO, &GPIO_InitStruct);
-}
\ No newline at end of file
+}
+
+
+// Configures the DREQ pin to raise an interrupt on its rising edge, i.e. each
+// time the VS1053 becomes ready to accept more data. pDreqIsr is called from
+// the interrupt.
+void BspMp3DreqIntInit(void (*pDreqIsr)(void))
+{
+    pBspMp3DreqIsr = pDreqIsr;
+
+#ifndef MP3_VS1053_SIM_DREQ
+    uint32_t reg;
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+
+    // Route PB3 to EXTI line 3
+    reg = SYSCFG->EXTICR[MP3_VS1053_DREQ_EXTI_PIN_SOURCE >> 2];
+    reg &= ~(0x0F << (4 * (MP3_VS1053_DREQ_EXTI_PIN_SOURCE & 0x03)));
+    reg |= MP3_VS1053_DREQ_EXTI_PORT_SOURCE << (4 * (MP3_VS1053_DREQ_EXTI_PIN_SOURCE & 0x03));
+    SYSCFG->EXTICR[MP3_VS1053_DREQ_EXTI_PIN_SOURCE >> 2] = reg;
+
+    // Rising edge only, clear anything pending, then unmask
+    EXTI->RTSR |= MP3_VS1053_DREQ_EXTI_LINE;
+    EXTI->FTSR &= ~MP3_VS1053_DREQ_EXTI_LINE;
+    EXTI->PR = MP3_VS1053_DREQ_EXTI_LINE;
+    EXTI->IMR |= MP3_VS1053_DREQ_EXTI_LINE;
+
+    NVIC_SetPriority(MP3_VS1053_DREQ_IRQn, MP3_VS1053_DREQ_IRQ_PRIO);
+    NVIC_EnableIRQ(MP3_VS1053_DREQ_IRQn);
+#endif
+}
+
+// Returns the current level of the DREQ pin, high when the VS1053 can take
+// at least 32 more bytes.
+BOOLEAN BspMp3DreqIsHigh()
+{
+#ifdef MP3_VS1053_SIM_DREQ
+    return bspMp3SimDreq;
+#else
+    return GPIO_ReadInputDataBit(MP3_VS1053_DREQ_GPIO, MP3_VS1053_DREQ_GPIO_Pin) ? OS_TRUE : OS_FALSE;
+#endif
+}
+
+#ifdef MP3_VS1053_SIM_DREQ
+// Drives the simulated DREQ pin. A rising edge behaves like the EXTI
+// interrupt and calls the registered DREQ function.
+void BspMp3SimSetDreq(BOOLEAN high)
+{
+    BOOLEAN rising = (high && !bspMp3SimDreq);
+
+    bspMp3SimDreq = high;
+    if (rising && pBspMp3DreqIsr) {
+        pBspMp3DreqIsr();
+    }
+}
+#endif
+
+// EXTI line 3 interrupt, raised on the rising edge of DREQ
+void EXTI3IrqHandler(void)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();    // Tell uC/OS-II that we are starting an ISR
+    OSIntNesting++;
+    OS_EXIT_CRITICAL();
+
+#ifndef MP3_VS1053_SIM_DREQ
+    EXTI->PR = MP3_VS1053_DREQ_EXTI_LINE;  // acknowledge the interrupt
+#endif
+    if (pBspMp3DreqIsr) {
+        pBspMp3DreqIsr();
+    }
+
+    OSIntExit();            // Tell uC/OS-II that we are leaving the ISR
+}
@@ -22,6 +22,26 @@
 #define MP3_VS1053_DREQ_GPIO               GPIOB
 #define MP3_VS1053_DREQ_GPIO_Pin           GPIO_Pin_3
 
+#define MP3_VS1053_DREQ_EXTI_PORT_SOURCE   0x01            // EXTICR value selecting port B
+#define MP3_VS1053_DREQ_EXTI_PIN_SOURCE    3               // EXTI line 3 for PB3
+#define MP3_VS1053_DREQ_EXTI_LINE          EXTI_IMR_MR3
+#define MP3_VS1053_DREQ_IRQn               EXTI3_IRQn
+#define MP3_VS1053_DREQ_IRQ_PRIO           0x0C            // NVIC priority of the DREQ interrupt
+
+#define MP3_VS1053_DREQ_TIMEOUT_TICKS      10              // Safety net in case a DREQ edge is ever lost
+
+// Define MP3_VS1053_SIM_DREQ to build without the DREQ pin and EXTI hardware.
+// DREQ is then driven from software with BspMp3SimSetDreq(). The only caller
+// is the decoder model below, which runs on the board; there is no host
+// build or test of the interrupt driven feed path.
+//
+// Define MP3_VS1053_MODEL to run the MP3 driver against the behavioural model
+// of the decoder in bspMp3Model.c instead of the shield. The model drives the
+// simulated DREQ.
+#ifdef MP3_VS1053_MODEL
+#define MP3_VS1053_SIM_DREQ
+#endif
+
 #define MP3_VS1053_MCS_ASSERT()       GPIO_ResetBits(MP3_VS1053_MCS_GPIO, MP3_VS1053_MCS_GPIO_Pin);
 #define MP3_VS1053_MCS_DEASSERT()      GPIO_SetBits(MP3_VS1053_MCS_GPIO, MP3_VS1053_MCS_GPIO_Pin);
 
@@ -35,6 +55,12 @@
 
 #define MP3_SPI_DATARATE  SPI_BaudRatePrescaler_32  // Tune to find optimal value MP3 decoder will work with
 
+// Rates used once CLOCKF has raised the decoder clock, CLKI. The VS1053 takes
+// SCI reads at up to CLKI/7, above 4 MHz with SC_MULT at 2.5x or more, and
+// data writes at up to CLKI/4, above 8 MHz with SC_MULT at 3.0x or more
+#define MP3_SPI_SCI_FAST_DATARATE  SPI_BaudRatePrescaler_4
+#define MP3_SPI_SDI_FAST_DATARATE  SPI_BaudRatePrescaler_2
+
 // some command strings to send to the VS1053 MP3 decoder:
 extern const INT8U BspMp3SineWave[];
 extern const INT8U BspMp3Deact[];
@@ -46,6 +72,8 @@ extern const INT8U BspMp3SetVol1010[];
 extern const INT8U BspMp3SetVol6060[];
 extern const INT8U BspMp3ReadVol[];
 extern const INT8U BspMp3ReadDecodeTime[];
+extern const INT8U BspMp3ReadHdat0[];
+extern const INT8U BspMp3ReadHdat1[];
 
 // Lengths of the above commands
 extern const INT8U BspMp3SineWaveLen;
@@ -58,7 +86,25 @@ extern const INT8U BspMp3SetVol1010Len;
 extern const INT8U BspMp3SetVol6060Len;
 extern const INT8U BspMp3ReadVolLen;
 extern const INT8U BspMp3ReadDecodeTimeLen;
+extern const INT8U BspMp3ReadHdat0Len;
+extern const INT8U BspMp3ReadHdat1Len;
 
 void BspMp3InitVS1053();
+void BspMp3DreqIntInit(void (*pDreqIsr)(void));
+BOOLEAN BspMp3DreqIsHigh();
+
+#ifdef MP3_VS1053_SIM_DREQ
+void BspMp3SimSetDreq(BOOLEAN high);
+#endif
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+void EXTI3IrqHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,356 @@
+/*
+    bspMp3Model.c
+
+    Behavioural model of the VS1053 MP3 decoder, see bspMp3Model.h
+
+    The FIFO is drained lazily: each time the model is touched, from the MP3
+    driver or from the system tick, the time since the last update is turned
+    into bytes played at the current bitrate. Frame headers are found the way
+    the decoder finds them, by skipping from one header to where the next one
+    should be and scanning byte by byte only when that fails. Data is thrown
+    away at once while no header has been found, as the decoder does while it
+    looks for the format of a stream.
+*/
+
+#include "bsp.h"
+
+#ifdef MP3_VS1053_MODEL
+
+#define SCI_WRITE           0x02
+#define SCI_READ            0x03
+#define SCI_REG_CNT         16
+#define SCI_MODE            0x00
+#define SCI_DECODE_TIME     0x04
+#define SCI_WRAM            0x06
+#define SCI_WRAMADDR        0x07
+#define SCI_HDAT0           0x08
+#define SCI_HDAT1           0x09
+#define SM_RESET            0x0004
+#define SM_CANCEL           0x0008
+#define PARAM_PLAY_SPEED    0x1E04
+
+// State of the modelled decoder
+typedef struct _BspMp3Model
+{
+    INT32U fifoLevel;           // Bytes waiting in the FIFO
+    INT32U lastCycle;           // BSP_CYCLE_CNT() at the last update
+    uint64_t bitsPending;       // Bits played but not yet a whole byte, scaled by bspCoreClockHz
+    INT16U kbps;                // Bitrate of the last frame header, 0 until one is found
+    uint64_t playedCycles;      // Time spent playing since DECODE_TIME was set
+    INT16U regs[SCI_REG_CNT];   // SCI registers
+    INT32U header;              // Last bytes of the stream while looking for a frame header
+    INT8U headerLen;            // Number of valid bytes in header
+    INT32U skip;                // Bytes to where the next frame header should be
+    BOOLEAN starved;            // FIFO ran dry while playing
+    INT16U playSpeed;           // playSpeed parameter, 0 or 1 is normal speed
+    INT32U starvedCycle;        // BSP_CYCLE_CNT() when it ran dry
+    BspMp3ModelStats stats;
+} BspMp3Model;
+
+static BspMp3Model bspMp3Model;
+static INT32U bspMp3ModelNsPerByte = MP3_VS1053_MODEL_SPI_NS_DFLT;
+
+// MPEG audio layer III bitrates in kbps and sample rates in Hz, by index
+static const INT16U bspMp3ModelMpeg1Kbps[16] =
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+static const INT16U bspMp3ModelMpeg2Kbps[16] =
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 };
+static const INT32U bspMp3ModelMpeg1Rates[3] = { 44100, 48000, 32000 };
+
+
+// SpiDelay
+// Busy waits for the time the SPI takes to send count bytes.
+static void SpiDelay(INT32U count)
+{
+    INT32U cycles = (INT32U)(((uint64_t)bspMp3ModelNsPerByte * count * (bspCoreClockHz / 1000000)) / 1000);
+    INT32U start = BSP_CYCLE_CNT();
+
+    while ((BSP_CYCLE_CNT() - start) < cycles);
+}
+
+// ParseHeader
+// Returns the length of the layer III frame starting with the given header,
+// or 0 if it is not a valid frame header. Sets *pKbps to its bitrate.
+static INT32U ParseHeader(INT32U header, INT16U *pKbps)
+{
+    INT8U version = (header >> 19) & 0x03;      // 3 MPEG 1, 2 MPEG 2, 0 MPEG 2.5
+    INT8U bitrateIdx = (header >> 12) & 0x0F;
+    INT8U rateIdx = (header >> 10) & 0x03;
+    INT32U rate;
+
+    if ((header & 0xFFE00000) != 0xFFE00000) return 0;     // frame sync
+    if (((header >> 17) & 0x03) != 0x01) return 0;         // layer III
+    if (version == 1 || bitrateIdx == 0 || bitrateIdx == 15 || rateIdx == 3) return 0;
+
+    rate = bspMp3ModelMpeg1Rates[rateIdx];
+    if (version == 3)
+    {
+        *pKbps = bspMp3ModelMpeg1Kbps[bitrateIdx];
+        return (144000UL * *pKbps) / rate + ((header >> 9) & 0x01);
+    }
+
+    rate = (version == 2) ? rate / 2 : rate / 4;
+    *pKbps = bspMp3ModelMpeg2Kbps[bitrateIdx];
+    return (72000UL * *pKbps) / rate + ((header >> 9) & 0x01);
+}
+
+// Update
+// Plays the FIFO for the time since the last update. Interrupts must be
+// disabled.
+static void Update(void)
+{
+    BspMp3Model *pModel = &bspMp3Model;
+    INT32U now = BSP_CYCLE_CNT();
+    INT32U elapsed = now - pModel->lastCycle;
+    INT32U speed = (pModel->playSpeed > 1) ? pModel->playSpeed : 1;
+    INT32U bytes;
+
+    pModel->lastCycle = now;
+    if (pModel->kbps == 0 || pModel->starved) return;
+
+    // Playing faster uses up the data faster, the times are of the stream
+    pModel->bitsPending += (uint64_t)elapsed * speed * pModel->kbps * 1000;
+    bytes = (INT32U)(pModel->bitsPending / (8 * (uint64_t)bspCoreClockHz));
+    pModel->bitsPending -= (uint64_t)bytes * 8 * bspCoreClockHz;
+
+    if (bytes < pModel->fifoLevel)
+    {
+        pModel->fifoLevel -= bytes;
+        pModel->stats.bytesPlayed += bytes;
+        pModel->playedCycles += (uint64_t)elapsed * speed;
+    }
+    else
+    {
+        // Played out what was left, the rest of the time it was starved
+        pModel->stats.bytesPlayed += pModel->fifoLevel;
+        if (bytes > 0) pModel->playedCycles += ((uint64_t)elapsed * speed * pModel->fifoLevel) / bytes;
+        pModel->fifoLevel = 0;
+        pModel->bitsPending = 0;
+        pModel->starved = OS_TRUE;
+        pModel->starvedCycle = now;
+    }
+}
+
+// DreqIsHigh
+// Returns whether the FIFO has room for another burst. Interrupts must be
+// disabled.
+static BOOLEAN DreqIsHigh(void)
+{
+    return (MP3_VS1053_MODEL_FIFO_SIZE - bspMp3Model.fifoLevel) >= MP3_VS1053_MODEL_DREQ_SPACE;
+}
+
+// SoftReset
+// Drops the stream like SM_RESET does. The stats are kept.
+static void SoftReset(void)
+{
+    BspMp3Model *pModel = &bspMp3Model;
+
+    pModel->fifoLevel = 0;
+    pModel->bitsPending = 0;
+    pModel->kbps = 0;
+    pModel->playedCycles = 0;
+    pModel->header = 0;
+    pModel->headerLen = 0;
+    pModel->skip = 0;
+    pModel->starved = OS_FALSE;
+    pModel->playSpeed = 1;
+    pModel->regs[SCI_DECODE_TIME] = 0;
+    pModel->regs[SCI_HDAT0] = 0;
+    pModel->regs[SCI_HDAT1] = 0;
+}
+
+// FindFrames
+// Follows the frame headers through newly streamed data. Interrupts must be
+// disabled.
+static void FindFrames(const INT8U *pData, INT32U count)
+{
+    BspMp3Model *pModel = &bspMp3Model;
+    INT32U frameLen;
+    INT32U n;
+    INT16U kbps;
+
+    while (count > 0)
+    {
+        if (pModel->skip > 0)
+        {
+            n = (pModel->skip < count) ? pModel->skip : count;
+            pModel->skip -= n;
+            pData += n;
+            count -= n;
+            continue;
+        }
+
+        pModel->header = (pModel->header << 8) | *pData++;
+        count--;
+        if (pModel->headerLen < 4) pModel->headerLen++;
+        if (pModel->headerLen < 4) continue;
+
+        frameLen = ParseHeader(pModel->header, &kbps);
+        if (frameLen < 4) continue;
+
+        pModel->kbps = kbps;
+        pModel->regs[SCI_HDAT1] = (INT16U)(pModel->header >> 16);
+        pModel->regs[SCI_HDAT0] = (INT16U)(pModel->header & 0xFFFF);
+        pModel->skip = frameLen - 4;
+        pModel->headerLen = 0;
+
+        if (!pModel->stats.playing)
+        {
+            pModel->stats.playing = OS_TRUE;
+            pModel->stats.firstAudioCycle = BSP_CYCLE_CNT();
+        }
+    }
+}
+
+// BspMp3ModelReset
+// Resets the model and its stats, the SPI timing is kept.
+void BspMp3ModelReset(void)
+{
+    OS_CPU_SR cpu_sr = 0;
+
+    OS_ENTER_CRITICAL();
+    memset(&bspMp3Model, 0, sizeof(bspMp3Model));
+    bspMp3Model.lastCycle = BSP_CYCLE_CNT();
+    OS_EXIT_CRITICAL();
+
+    BspMp3SimSetDreq(OS_TRUE);
+}
+
+// BspMp3ModelSetSpiTiming
+// Sets the time the SPI takes to send a byte to the decoder.
+void BspMp3ModelSetSpiTiming(INT32U nsPerByte)
+{
+    bspMp3ModelNsPerByte = nsPerByte;
+}
+
+// BspMp3ModelSci
+// Carries out SCI commands of 4 bytes each. Like a full duplex SPI transfer
+// the register read by an SCI read is returned in bytes 2 and 3 of it.
+void BspMp3ModelSci(INT8U *pBuffer, INT32U count)
+{
+    OS_CPU_SR cpu_sr = 0;
+    BspMp3Model *pModel = &bspMp3Model;
+    INT8U reg;
+    INT16U value;
+
+    SpiDelay(count);
+
+    OS_ENTER_CRITICAL();
+    Update();
+    for (; count >= 4; count -= 4, pBuffer += 4)
+    {
+        reg = pBuffer[1] & (SCI_REG_CNT - 1);
+        if (pBuffer[0] == SCI_WRITE)
+        {
+            value = (INT16U)((pBuffer[2] << 8) | pBuffer[3]);
+            if (reg == SCI_MODE && (value & SM_RESET))
+            {
+                SoftReset();
+                value &= ~SM_RESET;
+            }
+            else if (reg == SCI_DECODE_TIME)
+            {
+                pModel->playedCycles = 0;
+            }
+            else if (reg == SCI_WRAM)
+            {
+                // Only playSpeed is modelled
+                if (pModel->regs[SCI_WRAMADDR] == PARAM_PLAY_SPEED) pModel->playSpeed = value;
+                pModel->regs[SCI_WRAMADDR]++;
+                continue;
+            }
+            pModel->regs[reg] = value;
+        }
+        else if (pBuffer[0] == SCI_READ)
+        {
+            value = pModel->regs[reg];
+            if (reg == SCI_DECODE_TIME)
+            {
+                value += (INT16U)(pModel->playedCycles / bspCoreClockHz);
+            }
+            else if (reg == SCI_WRAM)
+            {
+                // endFillByte of an MP3 stream is 0, as are the parameters not modelled
+                value = (pModel->regs[SCI_WRAMADDR] == PARAM_PLAY_SPEED) ? pModel->playSpeed : 0;
+                pModel->regs[SCI_WRAMADDR]++;
+            }
+            pBuffer[2] = (INT8U)(value >> 8);
+            pBuffer[3] = (INT8U)(value & 0xFF);
+        }
+    }
+    OS_EXIT_CRITICAL();
+}
+
+// BspMp3ModelWriteData
+// Puts streamed data into the FIFO. Data that does not fit is dropped, as
+// by the decoder.
+void BspMp3ModelWriteData(const INT8U *pData, INT32U count)
+{
+    OS_CPU_SR cpu_sr = 0;
+    BspMp3Model *pModel = &bspMp3Model;
+    INT32U space;
+    BOOLEAN dreq;
+
+    SpiDelay(count);
+
+    OS_ENTER_CRITICAL();
+    Update();
+
+    // SM_CANCEL is seen with the next data, the stream is dropped along
+    // with it and the bit cleared
+    if ((pModel->regs[SCI_MODE] & SM_CANCEL) && count > 0)
+    {
+        SoftReset();
+        pModel->regs[SCI_MODE] &= ~SM_CANCEL;
+        count = 0;
+    }
+
+    if (pModel->starved && count > 0)
+    {
+        pModel->starved = OS_FALSE;
+        pModel->stats.underruns++;
+        pModel->stats.starvedMs += (pModel->lastCycle - pModel->starvedCycle) / (bspCoreClockHz / 1000);
+    }
+
+    space = MP3_VS1053_MODEL_FIFO_SIZE - pModel->fifoLevel;
+    if (count > space) count = space;
+    pModel->fifoLevel += count;
+
+    FindFrames(pData, count);
+    if (pModel->kbps == 0) pModel->fifoLevel = 0;
+
+    dreq = DreqIsHigh();
+    OS_EXIT_CRITICAL();
+
+    BspMp3SimSetDreq(dreq);
+}
+
+// BspMp3ModelTick
+// Called from the system tick to drain the FIFO and raise DREQ as the
+// decoder would.
+void BspMp3ModelTick(void)
+{
+    OS_CPU_SR cpu_sr = 0;
+    BOOLEAN dreq;
+
+    OS_ENTER_CRITICAL();
+    Update();
+    dreq = DreqIsHigh();
+    OS_EXIT_CRITICAL();
+
+    BspMp3SimSetDreq(dreq);
+}
+
+// BspMp3ModelGetStats
+// Returns the counters since the last BspMp3ModelReset().
+void BspMp3ModelGetStats(BspMp3ModelStats *pStats)
+{
+    OS_CPU_SR cpu_sr = 0;
+
+    OS_ENTER_CRITICAL();
+    Update();
+    *pStats = bspMp3Model.stats;
+    OS_EXIT_CRITICAL();
+}
+
+#endif /* MP3_VS1053_MODEL */
@@ -0,0 +1,46 @@
+/*
+    bspMp3Model.h
+
+    Behavioural model of the VS1053 MP3 decoder, for measuring the streaming
+    path without the decoder on the Music Maker shield.
+
+    The model has the VS1053's 2 KB data FIFO and raises the simulated DREQ
+    pin while there is room for at least 32 more bytes. Data is consumed at
+    the bitrate of the MPEG frame headers found in the stream, starting from
+    the first header, and each byte sent costs a configurable SPI time. SCI
+    commands reaching the model update MODE, DECODE_TIME and HDAT0/1 like the
+    real decoder, and SM_CANCEL drops the stream once more data arrives. The
+    playSpeed parameter speeds up the consumption of data.
+
+    Define MP3_VS1053_MODEL to build the MP3 driver against the model.
+*/
+
+#ifndef __BSPMP3MODEL_H
+#define __BSPMP3MODEL_H
+
+#ifdef MP3_VS1053_MODEL
+
+#define MP3_VS1053_MODEL_FIFO_SIZE      2048    // Bytes buffered by the decoder
+#define MP3_VS1053_MODEL_DREQ_SPACE     32      // Free bytes in the FIFO that raise DREQ
+#define MP3_VS1053_MODEL_SPI_NS_DFLT    4267    // SPI time per byte, SPI1 at 60 MHz / 32
+
+// Counters kept by the model, see BspMp3ModelGetStats()
+typedef struct _BspMp3ModelStats
+{
+    INT32U bytesPlayed;         // Bytes consumed by the decoder
+    INT32U underruns;           // Times the FIFO ran dry and was refilled later
+    INT32U starvedMs;           // Time spent with the FIFO dry before a refill
+    BOOLEAN playing;            // A frame header has been found since the last reset
+    INT32U firstAudioCycle;     // BSP_CYCLE_CNT() when the first frame header was found
+} BspMp3ModelStats;
+
+void BspMp3ModelReset(void);
+void BspMp3ModelSetSpiTiming(INT32U nsPerByte);
+void BspMp3ModelSci(INT8U *pBuffer, INT32U count);
+void BspMp3ModelWriteData(const INT8U *pData, INT32U count);
+void BspMp3ModelTick(void);
+void BspMp3ModelGetStats(BspMp3ModelStats *pStats);
+
+#endif /* MP3_VS1053_MODEL */
+
+#endif
@@ -10,6 +10,14 @@
 
 #include "bsp.h"
 
+// Function called when a DMA transfer completes, registered by the SPI driver
+static void (*pSpi1DmaDoneIsr)(BOOLEAN ok) = 0;
+
+// Receive target for transfers whose incoming data is not wanted
+static uint8_t spi1DmaRxDummy;
+
+static void Spi1DmaIrq(void);
+
 // BspSPI1Init
 // Initializes the SPI1 memory mapped register block and enables it for use
 // as a master SPI device.
@@ -82,6 +90,107 @@ void SPI_GetBuffer(SPI_TypeDef *spi, uint8_t *buffer, uint16_t bufLength)
  }
 
 
+// BspSPI1DmaInit
+// Enables the DMA2 streams serving SPI1, the transfer complete interrupt of
+// the receive stream and the transfer error interrupts of both.
+// pDmaDoneIsr is called from the interrupt once a transfer started with
+// SPI_DmaStart() has completed, ok being false if a stream reported a
+// transfer error.
+void BspSPI1DmaInit(void (*pDmaDoneIsr)(BOOLEAN ok))
+{
+    pSpi1DmaDoneIsr = pDmaDoneIsr;
+
+#ifndef SPI_SIM_DMA
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
+
+    SPI1_DMA_RX_STREAM->CR = 0;
+    SPI1_DMA_TX_STREAM->CR = 0;
+    SPI1_DMA_RX_STREAM->PAR = (uint32_t) &SPI1->DR;
+    SPI1_DMA_TX_STREAM->PAR = (uint32_t) &SPI1->DR;
+    DMA2->LIFCR = SPI1_DMA_RX_FLAGS | SPI1_DMA_TX_FLAGS;
+
+    NVIC_SetPriority(SPI1_DMA_RX_IRQn, SPI1_DMA_IRQ_PRIO);
+    NVIC_EnableIRQ(SPI1_DMA_RX_IRQn);
+    NVIC_SetPriority(SPI1_DMA_TX_IRQn, SPI1_DMA_IRQ_PRIO);
+    NVIC_EnableIRQ(SPI1_DMA_TX_IRQn);
+#endif
+}
+
+// SPI_DmaStart
+// Starts a full duplex DMA transfer of the given buffer and returns without
+// waiting for it. Completion is signalled from the receive stream, since
+// the last byte has been clocked out once it has been clocked in. An error
+// on the transmit stream stops the clock, so the receive stream would never
+// complete; that stream interrupts on error to end the transfer instead.
+// keepRx: if true the buffer is OVERWRITTEN with the data output by the
+//    device, otherwise the incoming data is discarded.
+void SPI_DmaStart(SPI_TypeDef *spi, uint8_t *buffer, uint16_t bufLength, BOOLEAN keepRx)
+{
+#ifdef SPI_SIM_DMA
+    // Model of the DMA: the transfer completes immediately, reading back
+    // 0xFF as an idle bus would
+    if (keepRx) {
+        memset(buffer, 0xFF, bufLength);
+    }
+    if (pSpi1DmaDoneIsr) {
+        pSpi1DmaDoneIsr(OS_TRUE);
+    }
+#else
+    // Drop any stale received byte left over from a polled transfer
+    while (SPI_I2S_GetFlagStatus(spi, SPI_I2S_FLAG_RXNE)) {
+        SPI_I2S_ReceiveData(spi);
+    }
+
+    DMA2->LIFCR = SPI1_DMA_RX_FLAGS | SPI1_DMA_TX_FLAGS;
+
+    // Peripheral to memory, interrupt on transfer complete
+    SPI1_DMA_RX_STREAM->NDTR = bufLength;
+    SPI1_DMA_RX_STREAM->M0AR = keepRx ? (uint32_t) buffer : (uint32_t) &spi1DmaRxDummy;
+    SPI1_DMA_RX_STREAM->CR = SPI1_DMA_CHANNEL | DMA_SxCR_PL_1 | DMA_SxCR_TCIE | DMA_SxCR_TEIE |
+                             (keepRx ? DMA_SxCR_MINC : 0);
+
+    // Memory to peripheral, interrupt on transfer error only
+    SPI1_DMA_TX_STREAM->NDTR = bufLength;
+    SPI1_DMA_TX_STREAM->M0AR = (uint32_t) buffer;
+    SPI1_DMA_TX_STREAM->CR = SPI1_DMA_CHANNEL | DMA_SxCR_PL_1 | DMA_SxCR_TEIE | DMA_SxCR_MINC | DMA_SxCR_DIR_0;
+
+    // Enable receive before transmit so that no byte is missed
+    SPI1_DMA_RX_STREAM->CR |= DMA_SxCR_EN;
+    SPI1_DMA_TX_STREAM->CR |= DMA_SxCR_EN;
+    spi->CR2 |= SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+#endif
+}
+
+// DMA2 stream 2 interrupt, raised when the SPI1 receive stream completes
+// or hits a transfer error
+void DMA2Stream2IrqHandler(void)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();    // Tell uC/OS-II that we are starting an ISR
+    OSIntNesting++;
+    OS_EXIT_CRITICAL();
+
+    Spi1DmaIrq();
+
+    OSIntExit();            // Tell uC/OS-II that we are leaving the ISR
+}
+
+// DMA2 stream 3 interrupt, raised when the SPI1 transmit stream hits a
+// transfer error
+void DMA2Stream3IrqHandler(void)
+{
+    OS_CPU_SR cpu_sr;
+
+    OS_ENTER_CRITICAL();    // Tell uC/OS-II that we are starting an ISR
+    OSIntNesting++;
+    OS_EXIT_CRITICAL();
+
+    Spi1DmaIrq();
+
+    OSIntExit();            // Tell uC/OS-II that we are leaving the ISR
+}
+
 // Set a value to control the data rate of the given SPI interface
 void SPI_SetDataRate(SPI_TypeDef *spi, uint16_t value)
 {
@@ -93,3 +202,26 @@ void SPI_SetDataRate(SPI_TypeDef *spi, uint16_t value)
   spi->CR1 = tmpreg;  // write back the register
 }
 
+// Ends the transfer in progress from either stream's interrupt. The
+// transfer failed if either stream reports a transfer error, which disables
+// that stream. Should both streams interrupt for the same transfer, the
+// first acknowledges the flags of both and the second finds nothing to do.
+static void Spi1DmaIrq(void)
+{
+#ifndef SPI_SIM_DMA
+    uint32_t flags = DMA2->LISR;
+
+    if (!(flags & (DMA_LISR_TCIF2 | DMA_LISR_TEIF2 | DMA_LISR_TEIF3))) {
+        return;
+    }
+
+    DMA2->LIFCR = SPI1_DMA_RX_FLAGS | SPI1_DMA_TX_FLAGS;  // acknowledge the interrupt
+    SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    SPI1_DMA_RX_STREAM->CR &= ~DMA_SxCR_EN;
+    SPI1_DMA_TX_STREAM->CR &= ~DMA_SxCR_EN;
+
+    if (pSpi1DmaDoneIsr) {
+        pSpi1DmaDoneIsr((flags & (DMA_LISR_TEIF2 | DMA_LISR_TEIF3)) ? OS_FALSE : OS_TRUE);
+    }
+#endif
+}
@@ -15,11 +15,38 @@
 
 #define PJDF_SPI1 SPI1 // Address of SPI1 memory mapped register block
 
+// SPI1 DMA streams (reference manual table 28, channel 3 on DMA2)
+#define SPI1_DMA_RX_STREAM      DMA2_Stream2
+#define SPI1_DMA_TX_STREAM      DMA2_Stream3
+#define SPI1_DMA_CHANNEL        (3 << 25)       // CHSEL bits of DMA_SxCR
+#define SPI1_DMA_RX_IRQn        DMA2_Stream2_IRQn
+#define SPI1_DMA_TX_IRQn        DMA2_Stream3_IRQn
+#define SPI1_DMA_IRQ_PRIO       0x0C            // NVIC priority of the DMA transfer complete and error interrupts
+#define SPI1_DMA_RX_FLAGS       (DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2 | DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2)
+#define SPI1_DMA_TX_FLAGS       (DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+
+// Define SPI_SIM_DMA to build without the DMA hardware. SPI_DmaStart() then
+// completes the transfer in software and calls the completion function
+// straight away. There is no host build or test that uses it.
+
 // Application interface to hardware
 
 void BspSPI1Init();
+void BspSPI1DmaInit(void (*pDmaDoneIsr)(BOOLEAN ok));
 void SPI_SendBuffer(SPI_TypeDef *spi, uint8_t *buffer, uint16_t bufLength);
 void SPI_GetBuffer(SPI_TypeDef *spi, uint8_t *buffer, uint16_t bufLength);
+void SPI_DmaStart(SPI_TypeDef *spi, uint8_t *buffer, uint16_t bufLength, BOOLEAN keepRx);
 void SPI_SetDataRate(SPI_TypeDef *spi, uint16_t value);
 
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+void DMA2Stream2IrqHandler(void);
+void DMA2Stream3IrqHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* __SPI_H */
\ No newline at end of file
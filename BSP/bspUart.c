@@ -10,6 +10,21 @@
 
 #include "bsp.h"
 
+#define UART_RX_RING_MASK   (UART_RX_RING_SIZE - 1)
+
+// Receive ring. The DMA stream is its only writer and BspUartRxRead() its
+// only reader. Positions are kept as running byte counts, the ring index
+// being the low bits, so a full ring is told apart from an empty one.
+static INT8U uartRxRing[UART_RX_RING_SIZE];
+static volatile INT32U uartRxWrCnt;     // Bytes received, as last counted by BspUartRxTick()
+static volatile INT32U uartRxRdCnt;     // Bytes read or given up as lost
+static INT32U uartRxLastIdx;            // Ring index the DMA stream had reached at the last tick
+static volatile BOOLEAN uartRxOn = OS_FALSE;
+static BspUartRxStats uartRxStats;
+
+static INT32U RxDmaIndex(void);
+static BOOLEAN SendFlowControl(INT8U c);
+
 /**
   * @brief  Print a character on the HyperTerminal
   * @param  c: The character to be printed
@@ -17,6 +32,199 @@
   */
 void PrintByte(char c)
 {
-  USART_SendData(COMM, c);
-  while (USART_GetFlagStatus(COMM, USART_FLAG_TXE) == RESET);
-}
\ No newline at end of file
+  OS_CPU_SR cpu_sr = 0;
+  BOOLEAN sent = OS_FALSE;
+
+  // The tick may send an XON or XOFF between the check of TXE and the write,
+  // which would then overwrite it, so both are done with interrupts off
+  while (!sent) {
+    OS_ENTER_CRITICAL();
+    if (USART_GetFlagStatus(COMM, USART_FLAG_TXE) != RESET) {
+      USART_SendData(COMM, c);
+      sent = OS_TRUE;
+    }
+    OS_EXIT_CRITICAL();
+  }
+}
+
+
+// BspUartRxStart
+// Empties the receive ring and starts the DMA stream filling it from USART2,
+// round and round without further attention. The host is sent XON, in case
+// it was stopped by BspUartRxStop().
+void BspUartRxStart(void)
+{
+    OS_CPU_SR cpu_sr = 0;
+
+    OS_ENTER_CRITICAL();
+    uartRxOn = OS_FALSE;
+    OS_EXIT_CRITICAL();
+
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
+
+    COMM->CR3 &= ~USART_CR3_DMAR;
+    UART_RX_DMA_STREAM->CR = 0;
+    while (UART_RX_DMA_STREAM->CR & DMA_SxCR_EN);
+    DMA1->HIFCR = UART_RX_DMA_FLAGS;
+
+    // Drop a byte left from before and clear any overrun
+    (void) COMM->SR;
+    (void) COMM->DR;
+
+    UART_RX_DMA_STREAM->PAR = (uint32_t) &COMM->DR;
+    UART_RX_DMA_STREAM->M0AR = (uint32_t) uartRxRing;
+    UART_RX_DMA_STREAM->NDTR = UART_RX_RING_SIZE;
+    UART_RX_DMA_STREAM->CR = UART_RX_DMA_CHANNEL | DMA_SxCR_PL_0 | DMA_SxCR_MINC | DMA_SxCR_CIRC;
+    UART_RX_DMA_STREAM->CR |= DMA_SxCR_EN;
+    COMM->CR3 |= USART_CR3_DMAR;
+
+    OS_ENTER_CRITICAL();
+    uartRxWrCnt = 0;
+    uartRxRdCnt = 0;
+    uartRxLastIdx = 0;
+    memset(&uartRxStats, 0, sizeof(uartRxStats));
+    uartRxStats.paused = OS_TRUE;   // the next tick sends XON
+    uartRxOn = OS_TRUE;
+    OS_EXIT_CRITICAL();
+}
+
+// BspUartRxStop
+// Stops the DMA stream and tells the host to stop sending, since nothing
+// reads what it sends any more.
+void BspUartRxStop(void)
+{
+    OS_CPU_SR cpu_sr = 0;
+
+    OS_ENTER_CRITICAL();
+    uartRxOn = OS_FALSE;
+    OS_EXIT_CRITICAL();
+
+    COMM->CR3 &= ~USART_CR3_DMAR;
+    UART_RX_DMA_STREAM->CR &= ~DMA_SxCR_EN;
+    PrintByte(UART_XOFF);
+
+    if (!uartRxStats.paused) {
+        uartRxStats.paused = OS_TRUE;
+        uartRxStats.xoffCnt++;
+    }
+}
+
+// BspUartRxAvail
+// Returns the number of bytes waiting in the receive ring.
+INT32U BspUartRxAvail(void)
+{
+    return uartRxWrCnt - uartRxRdCnt;
+}
+
+// BspUartRxRead
+// Copies up to len bytes waiting in the receive ring to pBuf without waiting
+// for more. Returns the number of bytes copied.
+INT32U BspUartRxRead(INT8U *pBuf, INT32U len)
+{
+    OS_CPU_SR cpu_sr = 0;
+    INT32U rdCnt;
+    INT32U avail;
+    INT32U idx;
+    INT32U chunk;
+    INT32U done;
+
+    OS_ENTER_CRITICAL();
+    rdCnt = uartRxRdCnt;
+    avail = uartRxWrCnt - rdCnt;
+    OS_EXIT_CRITICAL();
+
+    if (len > avail) {
+        len = avail;
+    }
+
+    for (done = 0; done < len; done += chunk) {
+        idx = (rdCnt + done) & UART_RX_RING_MASK;
+        chunk = UART_RX_RING_SIZE - idx;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        memcpy(&pBuf[done], &uartRxRing[idx], chunk);
+    }
+
+    // The tick moves the read count on past lost bytes, so only move it
+    // forward. Bytes lost during the copy may have been copied anyway.
+    OS_ENTER_CRITICAL();
+    if ((INT32S)(rdCnt + len - uartRxRdCnt) > 0) {
+        uartRxRdCnt = rdCnt + len;
+    }
+    OS_EXIT_CRITICAL();
+
+    return len;
+}
+
+// BspUartRxTick
+// Called each OS tick from App_TimeTickHook(). Counts the bytes the DMA
+// stream has written since the last tick, gives up the oldest ones if it has
+// lapped the reader, and sends XOFF or XON as the ring fills or drains. The
+// ring takes about 90 ms at 460800 baud, far longer than a tick.
+void BspUartRxTick(void)
+{
+    INT32U idx;
+    INT32U used;
+
+    if (!uartRxOn) {
+        return;
+    }
+
+    idx = RxDmaIndex();
+    uartRxWrCnt += (idx - uartRxLastIdx) & UART_RX_RING_MASK;
+    uartRxLastIdx = idx;
+
+    used = uartRxWrCnt - uartRxRdCnt;
+    if (used > UART_RX_RING_SIZE) {
+        uartRxStats.lost += used - UART_RX_RING_SIZE;
+        uartRxRdCnt = uartRxWrCnt - UART_RX_RING_SIZE;
+        used = UART_RX_RING_SIZE;
+    }
+
+    uartRxStats.received = uartRxWrCnt;
+    if (used > uartRxStats.usedMax) {
+        uartRxStats.usedMax = used;
+    }
+
+    // Should the transmitter be busy, try again next tick
+    if (!uartRxStats.paused && (used >= UART_RX_XOFF_LEVEL)) {
+        if (SendFlowControl(UART_XOFF)) {
+            uartRxStats.paused = OS_TRUE;
+            uartRxStats.xoffCnt++;
+        }
+    } else if (uartRxStats.paused && (used <= UART_RX_XON_LEVEL)) {
+        if (SendFlowControl(UART_XON)) {
+            uartRxStats.paused = OS_FALSE;
+        }
+    }
+}
+
+// BspUartRxGetStats
+// Copies out the receive statistics.
+void BspUartRxGetStats(BspUartRxStats *pStats)
+{
+    OS_CPU_SR cpu_sr = 0;
+
+    OS_ENTER_CRITICAL();
+    *pStats = uartRxStats;
+    OS_EXIT_CRITICAL();
+}
+
+// Returns the ring index the DMA stream writes next. NDTR counts down from
+// the ring size and reloads it at the end of the ring.
+static INT32U RxDmaIndex(void)
+{
+    return (UART_RX_RING_SIZE - UART_RX_DMA_STREAM->NDTR) & UART_RX_RING_MASK;
+}
+
+// Sends an XON or XOFF if the transmitter is free. Called from the tick,
+// which PrintByte() holds off while it writes.
+static BOOLEAN SendFlowControl(INT8U c)
+{
+    if (USART_GetFlagStatus(COMM, USART_FLAG_TXE) == RESET) {
+        return OS_FALSE;
+    }
+    USART_SendData(COMM, c);
+    return OS_TRUE;
+}
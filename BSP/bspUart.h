@@ -11,9 +11,41 @@
 #ifndef __BSPUART_H
 #define __BSPUART_H
 
+// USART2 receive DMA stream (reference manual table 27, channel 4 on DMA1)
+#define UART_RX_DMA_STREAM      DMA1_Stream5
+#define UART_RX_DMA_CHANNEL     (4 << 25)       // CHSEL bits of DMA_SxCR
+#define UART_RX_DMA_FLAGS       (DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5)
+
+// Receive ring, filled by the DMA stream in circular mode. A power of 2.
+#define UART_RX_RING_SIZE       4096
+
+// Software flow control. The host is sent XOFF once this many bytes wait in
+// the ring and XON once they have drained to UART_RX_XON_LEVEL. The margin
+// above UART_RX_XOFF_LEVEL covers the bytes the host sends before it stops.
+#define UART_RX_XOFF_LEVEL      (UART_RX_RING_SIZE * 3 / 4)
+#define UART_RX_XON_LEVEL       (UART_RX_RING_SIZE / 4)
+#define UART_XON                0x11
+#define UART_XOFF               0x13
+
+// Receive statistics, see BspUartRxGetStats()
+typedef struct
+{
+    INT32U received;        // Bytes received since BspUartRxStart()
+    INT32U lost;            // Bytes overwritten before they were read
+    INT32U xoffCnt;         // Times the host was told to stop
+    INT32U usedMax;         // Most bytes waiting in the ring
+    BOOLEAN paused;         // XOFF sent and not yet followed by XON
+} BspUartRxStats;
+
 // Application interface to hardware
 
 void PrintByte(char c);
 
+void BspUartRxStart(void);
+void BspUartRxStop(void);
+INT32U BspUartRxAvail(void);
+INT32U BspUartRxRead(INT8U *pBuf, INT32U len);
+void BspUartRxTick(void);
+void BspUartRxGetStats(BspUartRxStats *pStats);
 
-#endif /* __BSPUART_H */
\ No newline at end of file
+#endif /* __BSPUART_H */
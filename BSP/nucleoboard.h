@@ -37,8 +37,10 @@ Copyright	: David Allegre
 #define GPIO_PIN_RX             GPIO_Pin_3
 #define GPIO_PORT_USART         GPIOA
 
-// USART 
-#define BAUD_RATE               38400
+// USART, fast enough to stream MP3 at 320 kbps to the uart: source. The
+// USARTDIV of 2 that USART_Init() picks from the 15 MHz APB1 clock runs
+// 1.7% fast, within what the receivers tolerate.
+#define BAUD_RATE               460800
 #define COMM                    USART2
 
 #endif
\ No newline at end of file
@@ -59,6 +59,7 @@ typedef INT8S PjdfErrCode;
 #define PJDF_ERR_UNKNOWN_CTRL_REQUEST -6 // A given Ctrl request was not defined for the driver
 #define PJDF_ERR_CHIP_SELECT -7 // Incorrect chip selection or no chip selected
 #define PJDF_ERR_DEVICE_NOT_OPEN -8 // Attempted operation on device that is not open
+#define PJDF_ERR_TRANSFER -9 // The hardware reported an error during a transfer
 
 // Generic API methods exposed to applications for operating on devices
 HANDLE Open(char *pName, INT8U flags);
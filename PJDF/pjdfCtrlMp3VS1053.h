@@ -19,4 +19,100 @@
 
 #define PJDF_CTRL_MP3_SET_SPI_HANDLE 0x3  // Passes the required SPI handle to the MP3 driver to enable it to talk to the VS1053
 
+#define PJDF_CTRL_MP3_GET_DREQ 0x4  // Returns in a BOOLEAN whether the VS1053 is raising DREQ, ie is ready for more data
+
+#define PJDF_CTRL_MP3_GET_STATS 0x5  // Returns the PjdfMp3Stats counters of the data interface
+#define PJDF_CTRL_MP3_RESET_STATS 0x6  // Zeroes the PjdfMp3Stats counters
+
+#define PJDF_CTRL_MP3_SCI_BATCH 0x7  // Carries out an array of PjdfMp3SciOp register reads and writes under one SPI lock,
+                                     // pSize is the size of the array in bytes
+
+#define PJDF_CTRL_MP3_PLUGIN_LOAD 0x8  // Uploads a PjdfMp3Plugin image to the decoder under one SPI lock and reads it
+                                       // back, pSize is sizeof(PjdfMp3Plugin)
+
+#define PJDF_CTRL_MP3_RECORD_READ 0x9  // Reads recorded words out of SCI_HDAT0 into an INT16U array under one SPI
+                                       // lock, pSize is the size of the array in bytes. SCI_HDAT1 must have shown
+                                       // at least that many words waiting
+
+// SCI operations of PJDF_CTRL_MP3_SCI_BATCH
+#define PJDF_MP3_SCI_WRITE 0x02
+#define PJDF_MP3_SCI_READ 0x03
+
+// VS1053 SCI registers
+#define PJDF_MP3_SCI_MODE 0x00
+#define PJDF_MP3_SCI_BASS 0x02
+#define PJDF_MP3_SCI_CLOCKF 0x03
+#define PJDF_MP3_SCI_DECODE_TIME 0x04
+#define PJDF_MP3_SCI_WRAM 0x06
+#define PJDF_MP3_SCI_WRAMADDR 0x07
+#define PJDF_MP3_SCI_HDAT0 0x08
+#define PJDF_MP3_SCI_HDAT1 0x09
+#define PJDF_MP3_SCI_AIADDR 0x0A
+#define PJDF_MP3_SCI_VOL 0x0B
+#define PJDF_MP3_SCI_AICTRL0 0x0C // recording: sample rate in Hz
+#define PJDF_MP3_SCI_AICTRL1 0x0D // recording: gain, 1024 is 1x, 0 for automatic gain
+#define PJDF_MP3_SCI_AICTRL2 0x0E // recording: most gain the automatic gain may use, 0 for 64x
+#define PJDF_MP3_SCI_AICTRL3 0x0F // recording: channels and format, see below
+
+// Parameters in the decoder's memory, read through WRAMADDR and WRAM
+#define PJDF_MP3_PARAM_PLAY_SPEED 0x1E04 // playback speed, 0 or 1 normal, 2 twice as fast and so on
+#define PJDF_MP3_PARAM_END_FILL_BYTE 0x1E06 // byte to pad the end of a stream with, in the low byte
+
+// MODE register bits
+#define PJDF_MP3_SM_RESET 0x0004
+#define PJDF_MP3_SM_CANCEL 0x0008
+#define PJDF_MP3_SM_SDINEW 0x0800
+#define PJDF_MP3_SM_ADPCM 0x1000 // record from the input instead of decoding, set together with SM_RESET
+#define PJDF_MP3_SM_LINE1 0x4000 // record from the line input instead of the microphone
+
+// AICTRL3 register fields while recording
+#define PJDF_MP3_AICTRL3_LEFT 0x0002 // left channel only, one word per sample
+#define PJDF_MP3_AICTRL3_PCM 0x0004 // linear 16 bit PCM instead of IMA ADPCM
+
+// CLOCKF register fields
+#define PJDF_MP3_SC_MULT_SHIFT 13
+#define PJDF_MP3_SC_MULT_2_5X 2 // lowest multiplier that allows SCI at MP3_SPI_SCI_FAST_DATARATE
+#define PJDF_MP3_SC_MULT_3_0X 3 // lowest multiplier that allows data writes at MP3_SPI_SDI_FAST_DATARATE
+
+// One register access of a PJDF_CTRL_MP3_SCI_BATCH request. MODE, BASS, CLOCKF
+// and VOL are shadowed by the driver: reads of them are served from RAM and
+// writes of the value they already hold are skipped. A MODE write with
+// SM_RESET set is always carried out and forgets the shadowed values. MODE
+// is not shadowed while SM_CANCEL is set, as the decoder clears the bit.
+typedef struct _PjdfMp3SciOp
+{
+    INT8U op;       // PJDF_MP3_SCI_WRITE or PJDF_MP3_SCI_READ
+    INT8U reg;      // SCI register
+    INT16U value;   // value to write, or on return the value read
+} PjdfMp3SciOp;
+
+// Counters kept by the driver as it writes data, times in BSP_CYCLE_CNT() cycles
+typedef struct _PjdfMp3Stats
+{
+    INT32U dataWrites;          // Number of data writes
+    INT32U spiCycles;           // Time spent sending data with the SPI locked
+    INT32U spiMaxCycles;        // Longest time a single data write spent sending
+    INT32U dreqWaits;           // Number of times a data write found DREQ low
+    INT32U dreqWaitCycles;      // Time spent waiting for DREQ to rise
+    INT32U dreqWaitMaxCycles;   // Longest single wait for DREQ
+} PjdfMp3Stats;
+
+// Plugin image of a PJDF_CTRL_MP3_PLUGIN_LOAD request, in the compressed
+// format VLSI publishes plugins and patches in. The image is a run of records,
+// each a register number and a count. If bit 15 of the count is clear, count
+// words to write to the register follow. If it is set, one word follows that
+// is written count & 0x7FFF times. Only the instruction memory written through
+// WRAMADDR and WRAM is read back, the plugin may have changed data memory by
+// the time it is checked.
+typedef struct _PjdfMp3Plugin
+{
+    const INT16U *pImage;       // the compressed image, may be in flash
+    INT32U words;               // length of the image in words
+    INT32U writes;              // on return, the number of register writes made
+    INT32U verifiedWords;       // on return, the number of instruction memory words read back
+    INT32U verifyErrors;        // on return, the number of words that read back wrong
+    INT32U uploadCycles;        // on return, the time taken to upload, in BSP_CYCLE_CNT() cycles
+    INT32U verifyCycles;        // on return, the time taken to read back
+} PjdfMp3Plugin;
+
 #endif
\ No newline at end of file
@@ -12,23 +12,398 @@
 #include "pjdf.h"
 #include "pjdfInternal.h"
 
+#define MP3_SCI_REG_CNT 16
+
+// Registers kept in the shadow copy, see PjdfMp3SciOp
+#define MP3_SCI_SHADOWED ((1 << PJDF_MP3_SCI_MODE) | (1 << PJDF_MP3_SCI_BASS) | \
+                          (1 << PJDF_MP3_SCI_CLOCKF) | (1 << PJDF_MP3_SCI_VOL))
+
+#define MP3_PLUGIN_RUN 0x8000 // count bit of a plugin record holding one word to repeat
+#define MP3_PLUGIN_IMEM_START 0x8000 // instruction memory as seen through WRAMADDR
+#define MP3_PLUGIN_IMEM_END 0xC000
+
 
 // SPI link, etc for VS1053 MP3 decoder hardware
 typedef struct _PjdfContextMp3VS1053
 {
     HANDLE spiHandle; // SPI communication link to VS1053
     INT8U chipSelect; // 0 means command, 1 means data
+    OS_EVENT *dreqSem; // posted from the DREQ interrupt when the VS1053 is ready for data
+    PjdfMp3Stats stats; // data interface counters, see PJDF_CTRL_MP3_GET_STATS
+    INT16U sciShadow[MP3_SCI_REG_CNT]; // last known values of the shadowed registers
+    INT16U sciShadowValid; // bit per register, set while its shadow value is known
+    const INT16U *sciLockRate; // SPI rate the lock held by SciLockedTransfer was taken at
 } PjdfContextMp3VS1053;
 
 static PjdfContextMp3VS1053 mp3VS1053Context = { 0 };
 
 static const INT16U Mp3SpiDataRate = MP3_SPI_DATARATE;
+static const INT16U Mp3SpiSciFastDataRate = MP3_SPI_SCI_FAST_DATARATE;
+static const INT16U Mp3SpiSdiFastDataRate = MP3_SPI_SDI_FAST_DATARATE;
 static const INT32U SizeofMp3SpiDataRate = sizeof(Mp3SpiDataRate);
 
+// Mp3DreqIsr
+// Called from the DREQ rising edge interrupt.
+static void Mp3DreqIsr(void)
+{
+    OSSemPost(mp3VS1053Context.dreqSem);
+}
+
+// WaitForDreq
+// Blocks the calling task until the VS1053 raises DREQ. The caller must not
+// hold the SPI lock, so that the LCD and SD card can use the bus meanwhile.
+static void WaitForDreq(PjdfContextMp3VS1053 *pContext)
+{
+    INT8U osErr;
+    INT32U start;
+    INT32U cycles;
+
+    if (BspMp3DreqIsHigh()) return;
+
+    start = BSP_CYCLE_CNT();
+
+    while (!BspMp3DreqIsHigh())
+    {
+        // Drop edges that were counted while we were not waiting, then look
+        // at the level again so that an edge between the first check and
+        // the pend can not be missed.
+        OSSemSet(pContext->dreqSem, 0, &osErr);
+        if (BspMp3DreqIsHigh()) break;
+        OSSemPend(pContext->dreqSem, MP3_VS1053_DREQ_TIMEOUT_TICKS, &osErr);
+    }
+
+    cycles = BSP_CYCLE_CNT() - start;
+    pContext->stats.dreqWaits++;
+    pContext->stats.dreqWaitCycles += cycles;
+    if (cycles > pContext->stats.dreqWaitMaxCycles) pContext->stats.dreqWaitMaxCycles = cycles;
+}
+
+// LockSpi
+// Waits for exclusive access to the SPI and sets it to the given rate,
+// Mp3SpiDataRate unless the decoder is known to take SCI faster.
+static void LockSpi(HANDLE hSPI, const INT16U *pRate)
+{
+    PjdfErrCode retval;
+
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0);   // wait for exclusive access
+    if (retval != PJDF_ERR_NONE) while(1);
+
+    // adjust SPI transmission rate
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)pRate, (INT32U*)&SizeofMp3SpiDataRate);
+    if (retval != PJDF_ERR_NONE) while(1);
+}
+
+// UnlockSpi
+// Gives up exclusive access to the SPI.
+static void UnlockSpi(HANDLE hSPI)
+{
+    PjdfErrCode retval;
+
+    retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
+    if (retval != PJDF_ERR_NONE) while(1);
+}
+
+// SciTransfer
+// Carries out one SCI register access. The caller holds the SPI lock and has
+// seen DREQ high.
+static void SciTransfer(HANDLE hSPI, PjdfMp3SciOp *pOp)
+{
+    INT8U buf[4];
+    INT32U len = sizeof(buf);
+
+    buf[0] = pOp->op;
+    buf[1] = pOp->reg;
+    buf[2] = (INT8U)(pOp->value >> 8);
+    buf[3] = (INT8U)(pOp->value & 0xFF);
+
+#ifdef MP3_VS1053_MODEL
+    BspMp3ModelSci(buf, len);
+#else
+    PjdfErrCode retval;
+
+    MP3_VS1053_MCS_ASSERT(); // assert command chip-select
+    if (pOp->op == PJDF_MP3_SCI_READ)
+    {
+        retval = Read(hSPI, buf, &len); // full duplex, the register comes back in bytes 2 and 3
+    }
+    else
+    {
+        retval = Write(hSPI, buf, &len);
+    }
+    MP3_VS1053_MCS_DEASSERT(); // de-assert command chip-select
+    if (retval != PJDF_ERR_NONE) while(1);
+#endif
+
+    if (pOp->op == PJDF_MP3_SCI_READ)
+    {
+        pOp->value = (INT16U)((buf[2] << 8) | buf[3]);
+    }
+}
+
+// ScMult
+// Returns the clock multiplier field of CLOCKF, 0 (1.0x) while it is not known.
+static INT16U ScMult(PjdfContextMp3VS1053 *pContext)
+{
+    if (!(pContext->sciShadowValid & (1 << PJDF_MP3_SCI_CLOCKF))) return 0;
+    return pContext->sciShadow[PJDF_MP3_SCI_CLOCKF] >> PJDF_MP3_SC_MULT_SHIFT;
+}
+
+// SciDataRate
+// Picks the SPI rate for SCI accesses. The fast rate is only used while CLOCKF
+// is known to have raised the decoder clock far enough for it.
+static const INT16U *SciDataRate(PjdfContextMp3VS1053 *pContext)
+{
+    return (ScMult(pContext) >= PJDF_MP3_SC_MULT_2_5X) ? &Mp3SpiSciFastDataRate : &Mp3SpiDataRate;
+}
+
+// SdiDataRate
+// Picks the SPI rate for data writes, the same way.
+static const INT16U *SdiDataRate(PjdfContextMp3VS1053 *pContext)
+{
+    return (ScMult(pContext) >= PJDF_MP3_SC_MULT_3_0X) ? &Mp3SpiSdiFastDataRate : &Mp3SpiDataRate;
+}
+
+// SciLockedTransfer
+// Carries out one SCI register access for a caller that keeps the SPI locked
+// from one access to the next. The lock is taken if it is not held, and given
+// up while the decoder needs time, ie drops DREQ. It is also taken again if
+// the access before changed the rate the decoder can take, as a reset or a
+// CLOCKF write does.
+static void SciLockedTransfer(PjdfContextMp3VS1053 *pContext, PjdfMp3SciOp *pOp, BOOLEAN *pLocked)
+{
+    HANDLE hSPI = pContext->spiHandle;
+    const INT16U *pRate = SciDataRate(pContext);
+
+    if (*pLocked && pRate != pContext->sciLockRate)
+    {
+        UnlockSpi(hSPI);
+        *pLocked = OS_FALSE;
+    }
+    if (!BspMp3DreqIsHigh())
+    {
+        if (*pLocked) UnlockSpi(hSPI);
+        *pLocked = OS_FALSE;
+        WaitForDreq(pContext);
+    }
+    if (!*pLocked)
+    {
+        LockSpi(hSPI, pRate);
+        pContext->sciLockRate = pRate;
+        *pLocked = OS_TRUE;
+    }
+
+    SciTransfer(hSPI, pOp);
+}
+
+// SciShadowUpdate
+// Brings the shadow copy up to date after a register access went to the decoder.
+static void SciShadowUpdate(PjdfContextMp3VS1053 *pContext, PjdfMp3SciOp *pOp)
+{
+    INT16U mask = 1 << pOp->reg;
+
+    if (pOp->op == PJDF_MP3_SCI_WRITE && pOp->reg == PJDF_MP3_SCI_MODE && (pOp->value & PJDF_MP3_SM_RESET))
+    {
+        pContext->sciShadowValid = 0; // the decoder may have changed any of them
+    }
+    else if (pOp->reg == PJDF_MP3_SCI_MODE && (pOp->value & PJDF_MP3_SM_CANCEL))
+    {
+        pContext->sciShadowValid &= ~mask; // the decoder clears SM_CANCEL by itself
+    }
+    else if (MP3_SCI_SHADOWED & mask)
+    {
+        pContext->sciShadow[pOp->reg] = pOp->value;
+        pContext->sciShadowValid |= mask;
+    }
+}
+
+// SciBatch
+// Carries out the register accesses of a PJDF_CTRL_MP3_SCI_BATCH request,
+// serving what it can from the shadow copy. The SPI lock is taken once and
+// only given up if the decoder needs time, ie drops DREQ, between accesses.
+static PjdfErrCode SciBatch(PjdfContextMp3VS1053 *pContext, PjdfMp3SciOp *pOps, INT32U count)
+{
+    BOOLEAN locked = OS_FALSE;
+    PjdfMp3SciOp *pOp;
+    INT16U mask;
+    BOOLEAN known;
+    BOOLEAN reset;
+    INT32U i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (pOps[i].reg >= MP3_SCI_REG_CNT) return PJDF_ERR_ARG;
+        if (pOps[i].op != PJDF_MP3_SCI_READ && pOps[i].op != PJDF_MP3_SCI_WRITE) return PJDF_ERR_ARG;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        pOp = &pOps[i];
+        mask = 1 << pOp->reg;
+        known = (pContext->sciShadowValid & mask) ? OS_TRUE : OS_FALSE;
+        reset = (pOp->op == PJDF_MP3_SCI_WRITE && pOp->reg == PJDF_MP3_SCI_MODE && (pOp->value & PJDF_MP3_SM_RESET));
+
+        if (known && pOp->op == PJDF_MP3_SCI_READ)
+        {
+            pOp->value = pContext->sciShadow[pOp->reg];
+            continue;
+        }
+        if (known && !reset && pContext->sciShadow[pOp->reg] == pOp->value)
+        {
+            continue; // redundant write
+        }
+
+        SciLockedTransfer(pContext, pOp, &locked);
+        SciShadowUpdate(pContext, pOp);
+    }
+
+    if (locked) UnlockSpi(pContext->spiHandle);
+    return PJDF_ERR_NONE;
+}
+
+// PluginCheck
+// Returns whether a plugin image is made of whole records that write SCI
+// registers, see PjdfMp3Plugin.
+static BOOLEAN PluginCheck(const INT16U *pImage, INT32U words)
+{
+    INT32U i = 0;
+    INT16U count;
+
+    while (i < words)
+    {
+        if (words - i < 2) return OS_FALSE;
+        if (pImage[i] >= MP3_SCI_REG_CNT) return OS_FALSE;
+        count = pImage[i + 1];
+        i += 2;
+
+        if (count & MP3_PLUGIN_RUN)
+        {
+            if (words - i < 1) return OS_FALSE;
+            i += 1;
+        }
+        else
+        {
+            if (words - i < count) return OS_FALSE;
+            i += count;
+        }
+    }
+    return OS_TRUE;
+}
+
+// PluginWalk
+// Expands the records of a checked plugin image as it goes. On upload every
+// word is written to its register. On verify only the WRAMADDR writes are
+// made again and the words written to instruction memory through WRAM are
+// read back in their place, the address steps the same way on reads. Both
+// go at the fast SCI rate once CLOCKF allows it.
+static void PluginWalk(PjdfContextMp3VS1053 *pContext, PjdfMp3Plugin *pPlugin, BOOLEAN verify)
+{
+    const INT16U *pImage = pPlugin->pImage;
+    BOOLEAN locked = OS_FALSE;
+    BOOLEAN inImem = OS_FALSE;
+    PjdfMp3SciOp op;
+    INT16U count;
+    INT16U value;
+    BOOLEAN run;
+    INT32U i = 0;
+    INT16U n;
+
+    while (i < pPlugin->words)
+    {
+        op.reg = (INT8U)pImage[i];
+        count = pImage[i + 1];
+        i += 2;
+        run = (count & MP3_PLUGIN_RUN) ? OS_TRUE : OS_FALSE;
+        count &= ~MP3_PLUGIN_RUN;
+
+        for (n = 0; n < count; n++)
+        {
+            value = run ? pImage[i] : pImage[i + n];
+
+            if (!verify)
+            {
+                op.op = PJDF_MP3_SCI_WRITE;
+                op.value = value;
+                SciLockedTransfer(pContext, &op, &locked);
+                SciShadowUpdate(pContext, &op);
+                pPlugin->writes++;
+            }
+            else if (op.reg == PJDF_MP3_SCI_WRAMADDR)
+            {
+                op.op = PJDF_MP3_SCI_WRITE;
+                op.value = value;
+                SciLockedTransfer(pContext, &op, &locked);
+                inImem = (value >= MP3_PLUGIN_IMEM_START && value < MP3_PLUGIN_IMEM_END);
+            }
+            else if (op.reg == PJDF_MP3_SCI_WRAM && inImem)
+            {
+                op.op = PJDF_MP3_SCI_READ;
+                op.value = 0;
+                SciLockedTransfer(pContext, &op, &locked);
+                pPlugin->verifiedWords++;
+                if (op.value != value) pPlugin->verifyErrors++;
+            }
+        }
+        i += run ? 1 : count;
+    }
+
+    if (locked) UnlockSpi(pContext->spiHandle);
+}
+
+// PluginLoad
+// Carries out a PJDF_CTRL_MP3_PLUGIN_LOAD request. A broken image is turned
+// down before any of it is sent. The upload and the read back each take the
+// SPI lock once, and are timed apart.
+static PjdfErrCode PluginLoad(PjdfContextMp3VS1053 *pContext, PjdfMp3Plugin *pPlugin)
+{
+    INT32U start;
+
+    if (pPlugin->pImage == NULL) return PJDF_ERR_ARG;
+    if (!PluginCheck(pPlugin->pImage, pPlugin->words)) return PJDF_ERR_ARG;
+
+    pPlugin->writes = 0;
+    pPlugin->verifiedWords = 0;
+    pPlugin->verifyErrors = 0;
+
+    start = BSP_CYCLE_CNT();
+    PluginWalk(pContext, pPlugin, OS_FALSE);
+    pPlugin->uploadCycles = BSP_CYCLE_CNT() - start;
+
+    start = BSP_CYCLE_CNT();
+    PluginWalk(pContext, pPlugin, OS_TRUE);
+    pPlugin->verifyCycles = BSP_CYCLE_CNT() - start;
+
+    return PJDF_ERR_NONE;
+}
+
+// RecordRead
+// Carries out a PJDF_CTRL_MP3_RECORD_READ request. The words are read one SCI
+// access after the other with the SPI locked once, as for a batch.
+static PjdfErrCode RecordRead(PjdfContextMp3VS1053 *pContext, INT16U *pWords, INT32U count)
+{
+    BOOLEAN locked = OS_FALSE;
+    PjdfMp3SciOp op;
+    INT32U i;
+
+    op.op = PJDF_MP3_SCI_READ;
+    op.reg = PJDF_MP3_SCI_HDAT0;
+
+    for (i = 0; i < count; i++)
+    {
+        op.value = 0;
+        SciLockedTransfer(pContext, &op, &locked);
+        pWords[i] = op.value;
+    }
+
+    if (locked) UnlockSpi(pContext->spiHandle);
+    return PJDF_ERR_NONE;
+}
+
 // OpenMP3
-// Nothing to do.
+// Forgets the shadowed registers, the decoder may have been reset meanwhile.
 static PjdfErrCode OpenMP3(DriverInternal *pDriver, INT8U flags)
 {
+    PjdfContextMp3VS1053 *pContext = (PjdfContextMp3VS1053*) pDriver->deviceContext;
+    pContext->sciShadowValid = 0;
     return PJDF_ERR_NONE; 
 }
 
@@ -60,21 +435,20 @@ static PjdfErrCode ReadMP3(DriverInternal *pDriver, void* pBuffer, INT32U* pCoun
     PjdfContextMp3VS1053 *pContext = (PjdfContextMp3VS1053*) pDriver->deviceContext;
     HANDLE hSPI = pContext->spiHandle;
     
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0);   // wait for exclusive access
-    if (retval != PJDF_ERR_NONE) while(1);
-    
-    // adjust SPI transmission rate
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)&Mp3SpiDataRate, (INT32U*)&SizeofMp3SpiDataRate); 
-    if (retval != PJDF_ERR_NONE) while(1);
+    // Wait for device ready without holding the bus
+    WaitForDreq(pContext);
 
-    // Wait for device ready
-    while (!GPIO_ReadInputDataBit(MP3_VS1053_DREQ_GPIO, MP3_VS1053_DREQ_GPIO_Pin));
+    LockSpi(hSPI, &Mp3SpiDataRate);
     
     switch (pContext->chipSelect) {
     case 0: /* send command */
+#ifdef MP3_VS1053_MODEL
+        BspMp3ModelSci((INT8U*)pBuffer, *pCount);
+#else
         MP3_VS1053_MCS_ASSERT(); // assert command chip-select
         retval = Read(hSPI, pBuffer, pCount);
         MP3_VS1053_MCS_DEASSERT(); // de-assert command chip-select
+#endif
         break;
     default:
         while(1); // must be in command mode
@@ -94,43 +468,79 @@ static PjdfErrCode ReadMP3(DriverInternal *pDriver, void* pBuffer, INT32U* pCoun
 //
 // The above selection will persist until changed by another call to Ioctl()
 //
+// Data of any length may be written. It is sent in MP3_DECODER_BUF_SIZE
+// bursts back to back for as long as DREQ stays high, at the fast SDI rate
+// once CLOCKF allows it. While DREQ is low the
+// SPI lock is released and the calling task blocks until the DREQ interrupt.
+//
 // pDriver: pointer to an initialized VS1053 MP3 driver
 // pBuffer: the data to write to the device
 // pCount: the number of bytes to write
-// Returns: PJDF_ERR_NONE if there was no error, otherwise an error code.
+// Returns: PJDF_ERR_NONE if there was no error, otherwise an error code,
+//     PJDF_ERR_TRANSFER if any of the SPI transfers failed.
 static PjdfErrCode WriteMP3(DriverInternal *pDriver, void* pBuffer, INT32U* pCount)
 {
-    PjdfErrCode retval;
+    PjdfErrCode retval = PJDF_ERR_NONE;
+    PjdfErrCode xferErr = PJDF_ERR_NONE;
     PjdfContextMp3VS1053 *pContext = (PjdfContextMp3VS1053*) pDriver->deviceContext;
     HANDLE hSPI = pContext->spiHandle;
-    
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_WAIT_FOR_LOCK, 0, 0); // wait for exclusive access
-    if (retval != PJDF_ERR_NONE) while(1);
-    
-    // adjust SPI transmission rate
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_SET_DATARATE, (void*)&Mp3SpiDataRate, (INT32U*)&SizeofMp3SpiDataRate); 
-    if (retval != PJDF_ERR_NONE) while(1);
-
-    // Wait for device ready
-    while (!GPIO_ReadInputDataBit(MP3_VS1053_DREQ_GPIO, MP3_VS1053_DREQ_GPIO_Pin));
+    INT8U *pData = (INT8U*) pBuffer;
+    INT32U remaining = *pCount;
+    INT32U chunkLen;
+    INT32U start;
+    INT32U spiCycles = 0;
     
     switch (pContext->chipSelect) {
     case 0: /* send command */
+        pContext->sciShadowValid = 0; // raw commands bypass the shadow copy
+        WaitForDreq(pContext);
+        LockSpi(hSPI, &Mp3SpiDataRate);
+#ifdef MP3_VS1053_MODEL
+        BspMp3ModelSci((INT8U*)pBuffer, *pCount);
+#else
         MP3_VS1053_MCS_ASSERT(); // assert command chip-select
-        retval = Write(hSPI, pBuffer, pCount);
+        xferErr = Write(hSPI, pBuffer, pCount);
         MP3_VS1053_MCS_DEASSERT(); // de-assert command chip-select
+#endif
+        retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
+        if (retval != PJDF_ERR_NONE) while(1);
         break;
     case 1:  /* send data */
-        MP3_VS1053_DCS_ASSERT(); // assert data chip-select
-        retval = Write(hSPI, pBuffer, pCount);
-        MP3_VS1053_DCS_DEASSERT(); // de-assert data chip-select
+        while (remaining > 0)
+        {
+            // Block without holding the bus until the decoder wants data
+            WaitForDreq(pContext);
+
+            LockSpi(hSPI, SdiDataRate(pContext));
+            MP3_VS1053_DCS_ASSERT(); // assert data chip-select
+            start = BSP_CYCLE_CNT();
+
+            // DREQ high guarantees room for at least one burst
+            do {
+                chunkLen = (remaining < MP3_DECODER_BUF_SIZE) ? remaining : MP3_DECODER_BUF_SIZE;
+#ifdef MP3_VS1053_MODEL
+                BspMp3ModelWriteData(pData, chunkLen);
+#else
+                retval = Write(hSPI, pData, &chunkLen);
+                if (retval != PJDF_ERR_NONE) xferErr = retval;
+#endif
+                pData += chunkLen;
+                remaining -= chunkLen;
+            } while (remaining > 0 && BspMp3DreqIsHigh());
+
+            spiCycles += BSP_CYCLE_CNT() - start;
+            MP3_VS1053_DCS_DEASSERT(); // de-assert data chip-select
+            retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
+            if (retval != PJDF_ERR_NONE) while(1);
+        }
+        pContext->stats.dataWrites++;
+        pContext->stats.spiCycles += spiCycles;
+        if (spiCycles > pContext->stats.spiMaxCycles) pContext->stats.spiMaxCycles = spiCycles;
         break;
     default:
         while(1);
     }
-    retval = Ioctl(hSPI, PJDF_CTRL_SPI_RELEASE_LOCK, 0, 0);
-    if (retval != PJDF_ERR_NONE) while(1);
-    return retval;
+    return xferErr;
 }
 
 // IoctlMP3
@@ -164,6 +574,46 @@ static PjdfErrCode IoctlMP3(DriverInternal *pDriver, INT8U request, void* pArgs,
         }
         pContext->spiHandle = handle;
         break;
+    case PJDF_CTRL_MP3_GET_DREQ:
+        if (*pSize < sizeof(BOOLEAN))
+        {
+            return PJDF_ERR_ARG;
+        }
+        *((BOOLEAN*)pArgs) = BspMp3DreqIsHigh();
+        *pSize = sizeof(BOOLEAN);
+        break;
+    case PJDF_CTRL_MP3_GET_STATS:
+        if (*pSize < sizeof(PjdfMp3Stats))
+        {
+            return PJDF_ERR_ARG;
+        }
+        *((PjdfMp3Stats*)pArgs) = pContext->stats;
+        *pSize = sizeof(PjdfMp3Stats);
+        break;
+    case PJDF_CTRL_MP3_RESET_STATS:
+        memset(&pContext->stats, 0, sizeof(pContext->stats));
+        break;
+    case PJDF_CTRL_MP3_SCI_BATCH:
+        if (*pSize % sizeof(PjdfMp3SciOp) != 0)
+        {
+            return PJDF_ERR_ARG;
+        }
+        retval = SciBatch(pContext, (PjdfMp3SciOp*)pArgs, *pSize / sizeof(PjdfMp3SciOp));
+        break;
+    case PJDF_CTRL_MP3_PLUGIN_LOAD:
+        if (*pSize < sizeof(PjdfMp3Plugin))
+        {
+            return PJDF_ERR_ARG;
+        }
+        retval = PluginLoad(pContext, (PjdfMp3Plugin*)pArgs);
+        break;
+    case PJDF_CTRL_MP3_RECORD_READ:
+        if (*pSize % sizeof(INT16U) != 0)
+        {
+            return PJDF_ERR_ARG;
+        }
+        retval = RecordRead(pContext, (INT16U*)pArgs, *pSize / sizeof(INT16U));
+        break;
     default:
         retval = PJDF_ERR_UNKNOWN_CTRL_REQUEST;
         break;
@@ -184,7 +634,12 @@ PjdfErrCode InitMp3VS1053(DriverInternal *pDriver, char *pName)
     pDriver->maxRefCount = 1; // only one open handle allowed
     pDriver->deviceContext = &mp3VS1053Context;
     
+    // Counts DREQ rising edges, the streaming task blocks on it while DREQ is low
+    mp3VS1053Context.dreqSem = OSSemCreate(0);
+    if (mp3VS1053Context.dreqSem == NULL) while (1);  // not enough semaphores available
+
     BspMp3InitVS1053(); // Initialize related GPIO
+    BspMp3DreqIntInit(Mp3DreqIsr); // Interrupt on DREQ rising edge
   
     // Assign implemented functions to the interface pointers
     pDriver->Open = OpenMP3;
@@ -12,14 +12,52 @@
 #include "pjdf.h"
 #include "pjdfInternal.h"
 
+// Transfers of at least this many bytes are done by DMA, the calling task
+// blocking until the transfer completes. Shorter transfers are polled since
+// the cost of setting up the DMA and switching tasks outweighs the gain.
+#define PJDF_SPI_DMA_MIN_LEN 32
+
 // Control registers etc for SPI hardware
 typedef struct _PjdfContextSpi
 {
     SPI_TypeDef *spiMemMap; // Memory mapped register block for a SPI interface
+    OS_EVENT *dmaDoneSem;   // Posted by the DMA interrupt when a transfer completes
+    BOOLEAN dmaOk;          // Set by the DMA interrupt, false if the transfer failed
 } PjdfContextSpi;
 
-static PjdfContextSpi spi1Context = { PJDF_SPI1 };
+static PjdfContextSpi spi1Context = { PJDF_SPI1, NULL, OS_TRUE };
+
 
+// Spi1DmaDoneIsr
+// Called by the BSP from the DMA interrupt when a SPI1 transfer completes
+// or fails
+static void Spi1DmaDoneIsr(BOOLEAN ok)
+{
+    spi1Context.dmaOk = ok;
+    OSSemPost(spi1Context.dmaDoneSem);
+}
+
+// TransferSPI
+// Transfers the buffer by DMA if it is large enough and the OS is running,
+// otherwise by polling. The SPI lock is held by the caller so only one
+// transfer is ever in flight on the interface.
+// Returns: PJDF_ERR_TRANSFER if the DMA reported a transfer error.
+static PjdfErrCode TransferSPI(PjdfContextSpi *pContext, INT8U *pBuffer, INT32U count, BOOLEAN keepRx)
+{
+    INT8U osErr;
+    
+    if (count < PJDF_SPI_DMA_MIN_LEN || count > 0xFFFF || !OSRunning || OSIntNesting > 0)
+    {
+        if (keepRx) SPI_GetBuffer(pContext->spiMemMap, pBuffer, count);
+        else SPI_SendBuffer(pContext->spiMemMap, pBuffer, count);
+        return PJDF_ERR_NONE;
+    }
+    
+    SPI_DmaStart(pContext->spiMemMap, pBuffer, count, keepRx);
+    OSSemPend(pContext->dmaDoneSem, 0, &osErr);
+    if (osErr != OS_ERR_NONE) while(1);
+    return pContext->dmaOk ? PJDF_ERR_NONE : PJDF_ERR_TRANSFER;
+}
 
 
 // OpenSPI
@@ -52,8 +90,7 @@ static PjdfErrCode ReadSPI(DriverInternal *pDriver, void* pBuffer, INT32U* pCoun
 {
     PjdfContextSpi *pContext = (PjdfContextSpi*) pDriver->deviceContext;
     if (pContext == NULL) while(1);
-    SPI_GetBuffer(pContext->spiMemMap, (INT8U*) pBuffer, *pCount);
-    return PJDF_ERR_NONE;
+    return TransferSPI(pContext, (INT8U*) pBuffer, *pCount, OS_TRUE);
 }
 
 
@@ -69,8 +106,7 @@ static PjdfErrCode WriteSPI(DriverInternal *pDriver, void* pBuffer, INT32U* pCou
 {
     PjdfContextSpi *pContext = (PjdfContextSpi*) pDriver->deviceContext;
     if (pContext == NULL) while(1);
-    SPI_SendBuffer(pContext->spiMemMap, (INT8U*) pBuffer, *pCount);
-    return PJDF_ERR_NONE;
+    return TransferSPI(pContext, (INT8U*) pBuffer, *pCount, OS_FALSE);
 }
 
 // IoctlSPI
@@ -118,6 +154,11 @@ PjdfErrCode InitSPI(DriverInternal *pDriver, char *pName)
         pDriver->maxRefCount = 10; // Maximum refcount allowed for the device
         pDriver->deviceContext = (void*) &spi1Context;
         BspSPI1Init(); // init SPI1 hardware
+        
+        // Semaphore the task pends on while a DMA transfer is in progress
+        spi1Context.dmaDoneSem = OSSemCreate(0);
+        if (spi1Context.dmaDoneSem == NULL) while (1);  // not enough semaphores available
+        BspSPI1DmaInit(Spi1DmaDoneIsr);
     }
   
     // Assign implemented functions to the interface pointers